@@ -0,0 +1,199 @@
+/**
+ * batchbench.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Batch call benchmark. Scores the given number of records with a script
+ * function and reports records per second for a loop over
+ * gunderscript_function(), a loop over gunderscript_call(), one
+ * gunderscript_call_batch(), and one vmpool_call_batch() on the given number
+ * of threads. gunderscript_function() can't pass arguments, so its loop runs
+ * a copy of the function that reads them from constants.
+ * usage: batchbench [records] [threads]
+ * defaults to 1000000 records and 4 threads.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gunderscript.h"
+
+/* number of fields in each record */
+#define BATCHBENCH_FIELDS       3
+
+/* the scoring function, and a copy for gunderscript_function() */
+static char * script =
+  "function exported score(a, b, c) {\n"
+  "  var s;\n"
+  "  s = a * 3 + b * 2 - c;\n"
+  "  if(s < 0) {\n"
+  "    s = 0 - s;\n"
+  "  }\n"
+  "  return (s % 97);\n"
+  "}\n"
+  "function exported score_fixed() {\n"
+  "  var a;\n"
+  "  var b;\n"
+  "  var c;\n"
+  "  var s;\n"
+  "  a = 7;\n"
+  "  b = 11;\n"
+  "  c = 5;\n"
+  "  s = a * 3 + b * 2 - c;\n"
+  "  if(s < 0) {\n"
+  "    s = 0 - s;\n"
+  "  }\n"
+  "  return (s % 97);\n"
+  "}\n";
+
+/**
+ * Gets the wall clock time.
+ * returns: the time in seconds.
+ */
+static double now() {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Prints the throughput of one way of scoring the records.
+ * name: the way.
+ * records: the number of records scored.
+ * seconds: the time taken.
+ */
+static void report(char * name, int records, double seconds) {
+  printf("%-26s %8.4f s  %12.0f records/s\n", name, seconds,
+	 seconds > 0 ? records / seconds : 0.0);
+}
+
+int main(int argc, char * argv[]) {
+  int records = argc > 1 ? atoi(argv[1]) : 1000000;
+  int threads = argc > 2 ? atoi(argv[2]) : 4;
+  Gunderscript ginst;
+  GunderscriptFunc score;
+  Program * program;
+  VMPool * pool;
+  VMArg * args;
+  VMArg * results;
+  VMArg result;
+  char name[48];
+  double start;
+  double callSum = 0;
+  double batchSum = 0;
+  double poolSum = 0;
+  int i;
+
+  if(records < 1 || threads < 1) {
+    printf("usage: batchbench [records] [threads]\n");
+    return 1;
+  }
+
+  if(!gunderscript_new(&ginst, 100000, 55, NULL, VMMEM_REFCOUNT)) {
+    printf("Unable to allocate Gunderscript instance.\n");
+    return 1;
+  }
+  if(!gunderscript_build(&ginst, script, strlen(script))
+     || !gunderscript_lookup(&ginst, "score", 5, &score)) {
+    printf("Build failed: %s\n", gunderscript_err_message(&ginst));
+    gunderscript_free(&ginst);
+    return 1;
+  }
+
+  /* make the records */
+  args = malloc((size_t)records * BATCHBENCH_FIELDS * sizeof(VMArg));
+  results = malloc((size_t)records * sizeof(VMArg));
+  if(args == NULL || results == NULL) {
+    printf("Unable to allocate records.\n");
+    return 1;
+  }
+  for(i = 0; i < records; i++) {
+    args[i * BATCHBENCH_FIELDS] = vmarg_make_number(i % 1000);
+    args[i * BATCHBENCH_FIELDS + 1] = vmarg_make_number(i % 37);
+    args[i * BATCHBENCH_FIELDS + 2] = vmarg_make_number(i % 501);
+  }
+
+  start = now();
+  for(i = 0; i < records; i++) {
+    if(!gunderscript_function(&ginst, "score_fixed", 11)) {
+      printf("Run failed: %s\n", gunderscript_err_message(&ginst));
+      return 1;
+    }
+  }
+  report("gunderscript_function", records, now() - start);
+
+  start = now();
+  for(i = 0; i < records; i++) {
+    if(!gunderscript_call(&score, args + (i * BATCHBENCH_FIELDS),
+			  BATCHBENCH_FIELDS, &result)) {
+      printf("Call failed: %s\n", gunderscript_err_message(&ginst));
+      return 1;
+    }
+    callSum += vmarg_number(result, NULL);
+  }
+  report("gunderscript_call", records, now() - start);
+
+  start = now();
+  if(gunderscript_call_batch(&score, args, BATCHBENCH_FIELDS,
+			     results, records) != records) {
+    printf("Batch failed: %s\n", gunderscript_err_message(&ginst));
+    return 1;
+  }
+  report("gunderscript_call_batch", records, now() - start);
+
+  for(i = 0; i < records; i++) {
+    batchSum += vmarg_number(results[i], NULL);
+  }
+
+  program = gunderscript_program(&ginst);
+  pool = program != NULL ? vmpool_new(program, threads, 100000, NULL,
+				      VMMEM_REFCOUNT) : NULL;
+  if(pool == NULL) {
+    printf("Unable to allocate pool.\n");
+    return 1;
+  }
+
+  start = now();
+  if(vmpool_call_batch(pool, program_function(program, "score", 5), args,
+		       BATCHBENCH_FIELDS, results, records,
+		       threads, NULL) != records) {
+    printf("Pool batch failed.\n");
+    return 1;
+  }
+  sprintf(name, "vmpool_call_batch, %i thr", threads);
+  report(name, records, now() - start);
+
+  /* every way should get the same scores */
+  for(i = 0; i < records; i++) {
+    poolSum += vmarg_number(results[i], NULL);
+  }
+  if(batchSum != callSum || poolSum != callSum) {
+    printf("Results differ: %.0f %.0f %.0f\n", callSum, batchSum, poolSum);
+    return 1;
+  }
+
+  vmpool_free(pool);
+  program_release(program);
+  gunderscript_free(&ginst);
+  free(args);
+  free(results);
+  return 0;
+}
@@ -0,0 +1,372 @@
+/**
+ * chanbench.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Channel benchmark. Runs producer scripts and consumer scripts, each on its
+ * own thread and ExecContext, over one channel, and reports the messages per
+ * second for numbers, for strings that are moved to the consumer, for the
+ * same strings when they have to be copied because the producer keeps a
+ * reference to them in a variable, and for one frozen string that every
+ * message shares. Then runs a script that does nothing but copy a string
+ * between variables on as many threads as there are stages, first with a
+ * string of each thread's own, then with one frozen string that all of the
+ * threads share, to compare the plain and the atomic reference counts.
+ * usage: chanbench [producers] [consumers] [messages] [capacity]
+ * defaults to 2 producers, 2 consumers, 1000000 messages in all, and a
+ * channel of 1024 messages.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "gunderscript.h"
+#include "libchan.h"
+#include "libstr.h"
+
+/* producers of each kind of message, and a consumer for all of them. each
+ * string producer but frozen makes a new string per message, so they differ
+ * only in whether the channel can move it. churn changes the reference count
+ * of its string twice per loop
+ */
+static char * script =
+  "function exported numbers(c, n) {\n"
+  "  var i;\n"
+  "  i = 0;\n"
+  "  while(i < n) {\n"
+  "    chan_send(c, i);\n"
+  "    i = i + 1;\n"
+  "  }\n"
+  "  return (n);\n"
+  "}\n"
+  "function exported moved(c, n) {\n"
+  "  var i;\n"
+  "  i = 0;\n"
+  "  while(i < n) {\n"
+  "    chan_send(c, \"a message of \" + \"some length\");\n"
+  "    i = i + 1;\n"
+  "  }\n"
+  "  return (n);\n"
+  "}\n"
+  "function exported copied(c, n) {\n"
+  "  var i;\n"
+  "  var s;\n"
+  "  i = 0;\n"
+  "  while(i < n) {\n"
+  "    s = \"a message of \" + \"some length\";\n"
+  "    chan_send(c, s);\n"
+  "    i = i + 1;\n"
+  "  }\n"
+  "  return (n);\n"
+  "}\n"
+  "function exported frozen(c, n) {\n"
+  "  var i;\n"
+  "  var s;\n"
+  "  i = 0;\n"
+  "  s = freeze(\"a message of \" + \"some length\");\n"
+  "  while(i < n) {\n"
+  "    chan_send(c, s);\n"
+  "    i = i + 1;\n"
+  "  }\n"
+  "  return (n);\n"
+  "}\n"
+  "function exported consume(c, n) {\n"
+  "  var i;\n"
+  "  var m;\n"
+  "  i = 0;\n"
+  "  while(i < n) {\n"
+  "    m = chan_recv(c);\n"
+  "    i = i + 1;\n"
+  "  }\n"
+  "  return (n);\n"
+  "}\n"
+  "function exported churn(s, n) {\n"
+  "  var i;\n"
+  "  var t;\n"
+  "  i = 0;\n"
+  "  while(i < n) {\n"
+  "    t = s;\n"
+  "    i = i + 1;\n"
+  "  }\n"
+  "  return (n);\n"
+  "}\n"
+  "function exported churnlocal(n) {\n"
+  "  return (churn(\"a message of \" + \"some length\", n));\n"
+  "}\n";
+
+/* one script stage on its own thread */
+typedef struct Stage {
+  ExecContext * context;
+  CompilerFunc * function;
+  Channel * channel;
+  VMLibData * string;             /* string to churn, or NULL */
+  int count;                      /* messages to send or receive */
+  bool success;
+  pthread_t thread;
+} Stage;
+
+/**
+ * Gets the wall clock time.
+ * returns: the time in seconds.
+ */
+static double now() {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Stage thread: calls the stage's function with the channel and count.
+ * arg: the Stage.
+ * returns: NULL.
+ */
+static void * stage_main(void * arg) {
+  Stage * stage = arg;
+  VMLibData * handle;
+  VMArg args[2];
+  VMArg result;
+
+  handle = libchan_handle(execcontext_vm(stage->context), stage->channel);
+  if(handle == NULL) {
+    stage->success = false;
+    return NULL;
+  }
+
+  /* the call takes over the handle */
+  args[0] = vmarg_make_libdata(handle);
+  args[1] = vmarg_make_number(stage->count);
+  stage->success = execcontext_call(stage->context, stage->function,
+				    args, 2, &result);
+  return NULL;
+}
+
+/**
+ * Churn thread: calls the stage's function with the stage's string, if any,
+ * and the count.
+ * arg: the Stage.
+ * returns: NULL.
+ */
+static void * churn_main(void * arg) {
+  Stage * stage = arg;
+  VMArg args[2];
+  VMArg result;
+  int argc = 0;
+
+  /* the host's reference keeps a shared string alive through the call */
+  if(stage->string != NULL) {
+    args[argc++] = vmarg_make_libdata(stage->string);
+  }
+  args[argc++] = vmarg_make_number(stage->count);
+  stage->success = execcontext_call(stage->context, stage->function,
+				    args, argc, &result);
+  return NULL;
+}
+
+/**
+ * Runs the churn script on every stage's thread at once, and prints the
+ * time per reference count change.
+ * program: the benchmark program.
+ * name: the name of the function to run.
+ * string: the string to pass to each call, or NULL.
+ * stages: the stages.
+ * numStages: the number of stages.
+ * loops: the number of loops on each thread.
+ * returns: true if every stage succeeded.
+ */
+static bool churn(Program * program, char * name, VMLibData * string,
+		  Stage * stages, int numStages, int loops) {
+  double start;
+  double seconds;
+  bool success = true;
+  int i;
+
+  for(i = 0; i < numStages; i++) {
+    stages[i].function = program_function(program, name, strlen(name));
+    stages[i].string = string;
+    stages[i].count = loops;
+  }
+
+  start = now();
+  for(i = 0; i < numStages; i++) {
+    pthread_create(&stages[i].thread, NULL, churn_main, &stages[i]);
+  }
+  for(i = 0; i < numStages; i++) {
+    pthread_join(stages[i].thread, NULL);
+    success = success && stages[i].success;
+  }
+  seconds = now() - start;
+
+  /* two reference count changes per loop */
+  printf("%-16s %8.4f s  %12.0f loops/s  %8.1f ns each\n", name,
+	 seconds, loops * (double)numStages / seconds,
+	 seconds * 1e9 / ((double)loops * numStages));
+  return success;
+}
+
+/**
+ * Runs the producers and consumers of one kind of message, and prints the
+ * throughput.
+ * program: the benchmark program.
+ * producer: the name of the producer function.
+ * stages: numProducers producer stages, then numConsumers consumer stages.
+ * numProducers: the number of producers.
+ * numConsumers: the number of consumers.
+ * messages: the number of messages in all.
+ * capacity: the channel capacity.
+ * returns: true if every stage succeeded.
+ */
+static bool run(Program * program, char * producer, Stage * stages,
+		int numProducers, int numConsumers, int messages,
+		int capacity) {
+  Channel * channel = channel_new(capacity, NULL);
+  int numStages = numProducers + numConsumers;
+  double start;
+  double seconds;
+  bool success = true;
+  int i;
+
+  if(channel == NULL) {
+    printf("Unable to allocate channel.\n");
+    return false;
+  }
+
+  /* split the messages, the last stage of each side takes the remainder */
+  for(i = 0; i < numStages; i++) {
+    bool isProducer = i < numProducers;
+    int count = messages / (isProducer ? numProducers : numConsumers);
+
+    if(i == numProducers - 1 || i == numStages - 1) {
+      count = messages - count * ((isProducer ? numProducers
+				   : numConsumers) - 1);
+    }
+
+    stages[i].function = program_function(program,
+					   isProducer ? producer : "consume",
+					   strlen(isProducer ? producer
+						  : "consume"));
+    stages[i].channel = channel;
+    stages[i].count = count;
+  }
+
+  start = now();
+  for(i = 0; i < numStages; i++) {
+    pthread_create(&stages[i].thread, NULL, stage_main, &stages[i]);
+  }
+  for(i = 0; i < numStages; i++) {
+    pthread_join(stages[i].thread, NULL);
+    success = success && stages[i].success;
+  }
+  seconds = now() - start;
+
+  printf("%-16s %8.4f s  %12.0f msgs/s  %8.1f ns each\n", producer,
+	 seconds, messages / seconds, seconds * 1e9 / messages);
+
+  channel_release(channel);
+  return success;
+}
+
+int main(int argc, char * argv[]) {
+  int numProducers = argc > 1 ? atoi(argv[1]) : 2;
+  int numConsumers = argc > 2 ? atoi(argv[2]) : 2;
+  int messages = argc > 3 ? atoi(argv[3]) : 1000000;
+  int capacity = argc > 4 ? atoi(argv[4]) : 1024;
+  Gunderscript ginst;
+  Program * program;
+  Stage * stages;
+  VMLibData * shared;
+  bool success = true;
+  int i;
+
+  if(numProducers < 1 || numConsumers < 1 || capacity < 1
+     || messages < numProducers || messages < numConsumers) {
+    printf("usage: chanbench [producers] [consumers] [messages] "
+	   "[capacity]\n");
+    return 1;
+  }
+
+  if(!gunderscript_new(&ginst, 100000, 55, NULL, VMMEM_REFCOUNT)) {
+    printf("Unable to allocate Gunderscript instance.\n");
+    return 1;
+  }
+  if(!gunderscript_build(&ginst, script, strlen(script))) {
+    printf("Build failed: %s\n", gunderscript_err_message(&ginst));
+    gunderscript_free(&ginst);
+    return 1;
+  }
+
+  program = gunderscript_program(&ginst);
+  stages = calloc(numProducers + numConsumers, sizeof(Stage));
+  if(program == NULL || stages == NULL) {
+    printf("Unable to allocate stages.\n");
+    return 1;
+  }
+
+  for(i = 0; i < numProducers + numConsumers; i++) {
+    stages[i].context = execcontext_new(program, 100000, NULL,
+					VMMEM_REFCOUNT);
+    if(stages[i].context == NULL) {
+      printf("Unable to allocate context.\n");
+      return 1;
+    }
+  }
+
+  printf("%d producers, %d consumers, %d messages, capacity %d\n",
+	 numProducers, numConsumers, messages, capacity);
+  success = run(program, "numbers", stages, numProducers, numConsumers,
+		messages, capacity)
+    && run(program, "moved", stages, numProducers, numConsumers,
+	   messages, capacity)
+    && run(program, "copied", stages, numProducers, numConsumers,
+	   messages, capacity)
+    && run(program, "frozen", stages, numProducers, numConsumers,
+	   messages, capacity);
+
+  /* one string made by the host, frozen, and held until the end */
+  shared = vmarg_new_string(gunderscript_vm(&ginst), "a message of some length",
+			    24);
+  if(shared == NULL) {
+    printf("Unable to allocate string.\n");
+    return 1;
+  }
+  vmlibdata_inc_refcount(shared);
+  libstr_string_freeze(gunderscript_vm(&ginst), shared);
+
+  printf("%d threads, %d loops each\n", numProducers + numConsumers,
+	 messages);
+  success = success
+    && churn(program, "churnlocal", NULL, stages,
+	     numProducers + numConsumers, messages)
+    && churn(program, "churn", shared, stages,
+	     numProducers + numConsumers, messages);
+  vmlibdata_release(gunderscript_vm(&ginst), shared);
+  if(!success) {
+    printf("A stage failed.\n");
+  }
+
+  for(i = 0; i < numProducers + numConsumers; i++) {
+    execcontext_free(stages[i].context);
+  }
+  free(stages);
+  program_release(program);
+  gunderscript_free(&ginst);
+  return success ? 0 : 1;
+}
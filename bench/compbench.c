@@ -0,0 +1,295 @@
+/**
+ * compbench.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Compiler benchmark. Generates a script with the given number of lines of
+ * functions, expressions, calls, and control flow, compiles it several times,
+ * and reports the best compile time, the number of allocations made while
+ * compiling, and the peak memory allocated while compiling. The script can be
+ * split into several files, which are built with gunderscript_build_files().
+ * With lazy set to 1, functions are only scanned, and then the first one is
+ * called, which compiles it and nothing else.
+ * usage: compbench [lines] [runs] [files] [threads] [lazy]
+ * defaults to 100000 lines, 5 runs, 1 file, 1 thread and lazy off.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "gunderscript.h"
+
+/* lines in each generated function */
+#define COMPBENCH_FUNC_LINES    12
+/* longest generated line */
+#define COMPBENCH_MAX_LINE      128
+
+/* counters kept by the benchmark's allocator */
+typedef struct CompbenchCounts {
+  long allocs;                    /* number of allocations */
+  size_t used;                    /* bytes currently allocated */
+  size_t peak;                    /* most bytes allocated at once */
+  size_t compilerPeak;            /* peak reported by the compiler */
+  size_t arenaSize;               /* size of the compiler's arena */
+  pthread_mutex_t lock;           /* files may be built on several threads */
+} CompbenchCounts;
+
+/**
+ * Counting allocator alloc function.
+ */
+static void * counting_alloc(void * context, size_t size) {
+  CompbenchCounts * counts = context;
+
+  pthread_mutex_lock(&counts->lock);
+  counts->allocs++;
+  counts->used += size;
+  if(counts->used > counts->peak) {
+    counts->peak = counts->used;
+  }
+  pthread_mutex_unlock(&counts->lock);
+  return malloc(size);
+}
+
+/**
+ * Counting allocator realloc function.
+ */
+static void * counting_realloc(void * context, void * ptr,
+			       size_t oldSize, size_t newSize) {
+  CompbenchCounts * counts = context;
+  void * newPtr = realloc(ptr, newSize);
+
+  if(newPtr != NULL) {
+    pthread_mutex_lock(&counts->lock);
+    counts->allocs++;
+    counts->used = counts->used - oldSize + newSize;
+    if(counts->used > counts->peak) {
+      counts->peak = counts->used;
+    }
+    pthread_mutex_unlock(&counts->lock);
+  }
+  return newPtr;
+}
+
+/**
+ * Counting allocator free function.
+ */
+static void counting_free(void * context, void * ptr, size_t size) {
+  CompbenchCounts * counts = context;
+
+  pthread_mutex_lock(&counts->lock);
+  counts->used -= size;
+  pthread_mutex_unlock(&counts->lock);
+  free(ptr);
+}
+
+/**
+ * Builds one file of the benchmark script. Each function calls the one before
+ * it, which may be in the previous file.
+ * firstFunc: the number of the first function in the file.
+ * numFuncs: the number of functions in the file.
+ * scriptLen: receives the length of the script.
+ * returns: the script, or NULL if allocation fails.
+ */
+static char * make_script(int firstFunc, int numFuncs, size_t * scriptLen) {
+  char * script = malloc((size_t)(numFuncs > 0 ? numFuncs : 1)
+			 * COMPBENCH_FUNC_LINES * COMPBENCH_MAX_LINE);
+  char * out = script;
+  int i;
+
+  if(script == NULL) {
+    return NULL;
+  }
+
+  for(i = firstFunc; i < firstFunc + numFuncs; i++) {
+    out += sprintf(out, "function %sf%i(a, b) {\n",
+		   i == 0 ? "exported " : "", i);
+    out += sprintf(out, "  var x;\n");
+    out += sprintf(out, "  var y;\n");
+    out += sprintf(out, "  x = a * (b + 3) - (a / 2) %% 7;\n");
+    if(i > 0) {
+      out += sprintf(out, "  y = f%i(x + 1, (b - a) * 2) + f%i(b, a);\n",
+		     i - 1, i - 1);
+    } else {
+      out += sprintf(out, "  y = \"base\";\n");
+    }
+    out += sprintf(out, "  if(x < y && a != b) {\n");
+    out += sprintf(out, "    x = x + 1;\n");
+    out += sprintf(out, "  } else {\n");
+    out += sprintf(out, "    y = (((x + 1) * 2) + 3) * 4;\n");
+    out += sprintf(out, "  }\n");
+    out += sprintf(out, "  return (x + y);\n");
+    out += sprintf(out, "}\n");
+  }
+
+  *scriptLen = out - script;
+  return script;
+}
+
+/**
+ * Compiles the script once.
+ * scripts: the files of the script.
+ * scriptLens: the length of each file.
+ * numFiles: the number of files.
+ * threads: the number of threads to build on.
+ * lazy: whether to build lazily, and then call f0.
+ * counts: receives the allocations made while compiling.
+ * returns: the wall clock time taken in seconds, or a negative number if
+ * compiling fails.
+ */
+static double compile_script(char ** scripts, size_t * scriptLens,
+			     int numFiles, int threads, bool lazy,
+			     CompbenchCounts * counts) {
+  GSAllocator allocator;
+  Gunderscript ginst;
+  bool success;
+  struct timespec start;
+  struct timespec end;
+  double seconds;
+  size_t base;
+
+  counts->allocs = 0;
+  counts->used = 0;
+  counts->peak = 0;
+  allocator.alloc = counting_alloc;
+  allocator.realloc = counting_realloc;
+  allocator.free = counting_free;
+  allocator.context = counts;
+
+  if(!gunderscript_new(&ginst, 100000, 55, &allocator, VMMEM_REFCOUNT)) {
+    printf("Unable to allocate Gunderscript instance.\n");
+    return -1;
+  }
+  if(lazy && !gunderscript_set_lazy(&ginst, true)) {
+    printf("Unable to enable lazy compilation.\n");
+    gunderscript_free(&ginst);
+    return -1;
+  }
+
+  /* count only what the compile allocates */
+  base = counts->used;
+  counts->allocs = 0;
+  counts->peak = base;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(numFiles == 1 && threads == 1) {
+    success = gunderscript_build(&ginst, scripts[0], scriptLens[0]);
+  } else {
+    success = gunderscript_build_files(&ginst, scripts, scriptLens, numFiles,
+				       threads, NULL);
+  }
+  if(!success) {
+    printf("Build failed on line %i: %s\n", gunderscript_err_line(&ginst),
+	   gunderscript_err_message(&ginst));
+    gunderscript_free(&ginst);
+    return -1;
+  }
+
+  /* f0 makes no calls, so this compiles just one function. it fails when it
+   * does arithmetic on its null arguments, which doesn't matter here
+   */
+  if(lazy) {
+    gunderscript_function(&ginst, "f0", 2);
+    if(gunderscript_build_err(&ginst) != COMPILERERR_SUCCESS) {
+      printf("Lazy compile failed: %s\n", gunderscript_err_message(&ginst));
+      gunderscript_free(&ginst);
+      return -1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  counts->peak -= base;
+  counts->compilerPeak = compiler_mem_peak(gunderscript_compiler(&ginst));
+  counts->arenaSize = compiler_arena_size(gunderscript_compiler(&ginst));
+
+  gunderscript_free(&ginst);
+  return seconds;
+}
+
+int main(int argc, char * argv[]) {
+  int lines = argc > 1 ? atoi(argv[1]) : 100000;
+  int runs = argc > 2 ? atoi(argv[2]) : 5;
+  int numFiles = argc > 3 ? atoi(argv[3]) : 1;
+  int threads = argc > 4 ? atoi(argv[4]) : 1;
+  bool lazy = argc > 5 && atoi(argv[5]) > 0;
+  int numFuncs = (lines + COMPBENCH_FUNC_LINES - 1) / COMPBENCH_FUNC_LINES;
+  int numLines = numFuncs * COMPBENCH_FUNC_LINES;
+  double best = -1;
+  CompbenchCounts counts;
+  size_t scriptLen = 0;
+  size_t * scriptLens;
+  char ** scripts;
+  int i;
+
+  if(numFiles < 1 || numFiles > numFuncs || threads < 1) {
+    printf("usage: compbench [lines] [runs] [files] [threads] [lazy]\n");
+    return 1;
+  }
+
+  pthread_mutex_init(&counts.lock, NULL);
+
+  /* split the functions evenly between the files */
+  scripts = calloc(numFiles, sizeof(char*));
+  scriptLens = calloc(numFiles, sizeof(size_t));
+  if(scripts == NULL || scriptLens == NULL) {
+    printf("Unable to allocate script.\n");
+    return 1;
+  }
+  for(i = 0; i < numFiles; i++) {
+    int first = (int)((long)numFuncs * i / numFiles);
+    int next = (int)((long)numFuncs * (i + 1) / numFiles);
+
+    scripts[i] = make_script(first, next - first, &scriptLens[i]);
+    if(scripts[i] == NULL) {
+      printf("Unable to allocate script.\n");
+      return 1;
+    }
+    scriptLen += scriptLens[i];
+  }
+
+  /* keep the fastest run */
+  for(i = 0; i < runs; i++) {
+    double seconds = compile_script(scripts, scriptLens, numFiles, threads,
+				    lazy, &counts);
+
+    if(seconds < 0) {
+      return 1;
+    }
+    if(best < 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+
+  printf("%s %i lines (%lu bytes) in %i files on %i threads, "
+	 "best of %i runs: %.4f s, %.0f lines/s\n",
+	 lazy ? "lazily built" : "compiled", numLines,
+	 (unsigned long)scriptLen, numFiles, threads, runs, best,
+	 best > 0 ? numLines / best : 0.0);
+  printf("allocations while compiling: %ld   peak compile memory: %lu bytes\n",
+	 counts.allocs, (unsigned long)counts.peak);
+  printf("compiler reported peak: %lu bytes   compiler arena: %lu bytes\n",
+	 (unsigned long)counts.compilerPeak, (unsigned long)counts.arenaSize);
+
+  for(i = 0; i < numFiles; i++) {
+    free(scripts[i]);
+  }
+  free(scripts);
+  free(scriptLens);
+  return 0;
+}
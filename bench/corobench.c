@@ -0,0 +1,168 @@
+/**
+ * corobench.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Coroutine benchmark. Creates the given number of coroutines that each
+ * loop on yield(), resumes them round robin for the given number of
+ * switches, and reports the time per resume and yield, next to the time per
+ * gunderscript_call() of a function that does the same work without
+ * yielding. Also reports the memory that each coroutine's stacks take.
+ * usage: corobench [coroutines] [switches] [stack size]
+ * defaults to 1000 coroutines, 1000000 switches, and a 1024 byte stack.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gunderscript.h"
+
+/* a counter that yields each count, and one step of it for a call */
+static char * script =
+  "function exported counter(n) {\n"
+  "  while(true) {\n"
+  "    n = n + 1;\n"
+  "    yield(n);\n"
+  "  }\n"
+  "}\n"
+  "function exported step(n) {\n"
+  "  n = n + 1;\n"
+  "  return (n);\n"
+  "}\n";
+
+/**
+ * Gets the wall clock time.
+ * returns: the time in seconds.
+ */
+static double now() {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Prints the time per switch, or per call, of one way of counting.
+ * name: the way.
+ * count: the number of switches or calls.
+ * seconds: the time taken.
+ */
+static void report(char * name, int count, double seconds) {
+  printf("%-26s %8.4f s  %10.1f ns each\n", name, seconds,
+	 count > 0 ? seconds * 1e9 / count : 0.0);
+}
+
+int main(int argc, char * argv[]) {
+  int numCoros = argc > 1 ? atoi(argv[1]) : 1000;
+  int switches = argc > 2 ? atoi(argv[2]) : 1000000;
+  size_t stackSize = argc > 3 ? (size_t)atoi(argv[3]) : 1024;
+  Gunderscript ginst;
+  GunderscriptFunc counter;
+  GunderscriptFunc step;
+  VMCoro ** coros;
+  VMArg arg;
+  VMArg result;
+  size_t memBefore;
+  double start;
+  double coroSum = 0;
+  double callSum = 0;
+  int i;
+
+  if(numCoros < 1 || switches < 1 || stackSize < 1) {
+    printf("usage: corobench [coroutines] [switches] [stack size]\n");
+    return 1;
+  }
+
+  if(!gunderscript_new(&ginst, 100000, 55, NULL, VMMEM_REFCOUNT)) {
+    printf("Unable to allocate Gunderscript instance.\n");
+    return 1;
+  }
+  if(!gunderscript_build(&ginst, script, strlen(script))
+     || !gunderscript_lookup(&ginst, "counter", 7, &counter)
+     || !gunderscript_lookup(&ginst, "step", 4, &step)) {
+    printf("Build failed: %s\n", gunderscript_err_message(&ginst));
+    gunderscript_free(&ginst);
+    return 1;
+  }
+
+  coros = malloc((size_t)numCoros * sizeof(VMCoro*));
+  if(coros == NULL) {
+    printf("Unable to allocate coroutines.\n");
+    return 1;
+  }
+
+  /* create the coroutines, and run each to its first yield */
+  arg = vmarg_make_number(0);
+  memBefore = vm_mem_used(gunderscript_vm(&ginst));
+  start = now();
+  for(i = 0; i < numCoros; i++) {
+    coros[i] = gunderscript_coroutine(&counter, stackSize, &arg, 1);
+    if(coros[i] == NULL) {
+      printf("Coroutine failed: %s\n", gunderscript_err_message(&ginst));
+      return 1;
+    }
+  }
+  report("gunderscript_coroutine", numCoros, now() - start);
+  printf("%-26s %10.0f bytes each\n", "coroutine stacks",
+	 (double)(vm_mem_used(gunderscript_vm(&ginst)) - memBefore)
+	 / numCoros);
+
+  for(i = 0; i < numCoros; i++) {
+    if(!gunderscript_resume(&ginst, coros[i], NULL, NULL)) {
+      printf("Resume failed: %s\n", gunderscript_err_message(&ginst));
+      return 1;
+    }
+  }
+
+  /* round robin, each resume is a switch in and a yield back out */
+  start = now();
+  for(i = 0; i < switches; i++) {
+    if(!gunderscript_resume(&ginst, coros[i % numCoros], NULL, &result)) {
+      printf("Resume failed: %s\n", gunderscript_err_message(&ginst));
+      return 1;
+    }
+    coroSum += vmarg_number(result, NULL);
+  }
+  report("gunderscript_resume", switches, now() - start);
+
+  /* the same counts, with a call per step */
+  start = now();
+  for(i = 0; i < switches; i++) {
+    arg = vmarg_make_number(i / numCoros + 1);
+    if(!gunderscript_call(&step, &arg, 1, &result)) {
+      printf("Call failed: %s\n", gunderscript_err_message(&ginst));
+      return 1;
+    }
+    callSum += vmarg_number(result, NULL);
+  }
+  report("gunderscript_call", switches, now() - start);
+
+  if(coroSum != callSum) {
+    printf("Results differ: %.0f %.0f\n", coroSum, callSum);
+    return 1;
+  }
+
+  for(i = 0; i < numCoros; i++) {
+    vmcoro_free(gunderscript_vm(&ginst), coros[i]);
+  }
+  free(coros);
+  gunderscript_free(&ginst);
+  return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * lexbench.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Lexer throughput benchmark. Generates a large script by repeating a block of
+ * typical Gunderscript source, tokenizes it several times, and reports the
+ * best throughput in MB/s.
+ * usage: lexbench [size_in_mb] [runs]
+ * defaults to 32 MB and 5 runs.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lexer.h"
+
+/* block of source that is repeated to build the benchmark script */
+static const char * const lexbenchBlock =
+  "/* computes the factorial of n\n"
+  " * recursively, for benchmarking the lexer.\n"
+  " */\n"
+  "function fact(n) {\n"
+  "  if(n <= 1) {\n"
+  "    return (1);\n"
+  "  }\n"
+  "  return (n * fact(n - 1));\n"
+  "}\n"
+  "\n"
+  "// builds a string and prints some values\n"
+  "function exported main() {\n"
+  "  var s;\n"
+  "  var i;\n"
+  "  s = \"the quick brown fox jumps over the lazy dog \\\"again\\\"\";\n"
+  "  i = 0;\n"
+  "  while(i < 200) {\n"
+  "    s = s + 'ab';                  // append two chars\n"
+  "    i = i + 1.5;\n"
+  "  }\n"
+  "  sys_print(string_length(s), \"\\n\", fact(10), 3.14159, true);\n"
+  "}\n\n";
+
+/**
+ * Builds the benchmark script.
+ * size: the minimum size of the script in bytes.
+ * scriptLen: receives the actual size of the script.
+ * returns: the script, or NULL if allocation fails.
+ */
+static char * make_script(size_t size, size_t * scriptLen) {
+  size_t blockLen = strlen(lexbenchBlock);
+  size_t numBlocks = (size + blockLen - 1) / blockLen;
+  char * script = malloc(numBlocks * blockLen);
+  size_t i;
+
+  if(script == NULL) {
+    return NULL;
+  }
+
+  for(i = 0; i < numBlocks; i++) {
+    memcpy(script + (i * blockLen), lexbenchBlock, blockLen);
+  }
+
+  *scriptLen = numBlocks * blockLen;
+  return script;
+}
+
+/**
+ * Tokenizes the script once.
+ * script: the script.
+ * scriptLen: the length of the script.
+ * numTokens: receives the number of tokens.
+ * returns: the time taken in seconds, or a negative number if lexing fails.
+ */
+static double lex_script(char * script, size_t scriptLen, long * numTokens) {
+  Lexer * lexer = lexer_new(script, scriptLen, NULL);
+  LexerType type;
+  size_t len;
+  clock_t start;
+  double seconds;
+
+  if(lexer == NULL) {
+    return -1;
+  }
+
+  /* time lexing, not copying the input in lexer_new() */
+  *numTokens = 0;
+  start = clock();
+  while(lexer_next(lexer, &type, &len) != NULL) {
+    (*numTokens)++;
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  if(lexer_get_err(lexer) != LEXERERR_SUCCESS) {
+    printf("Lexing failed on line %i: %s\n", lexer_line_num(lexer),
+	   lexer_err_to_string(lexer_get_err(lexer)));
+    seconds = -1;
+  }
+
+  lexer_free(lexer);
+  return seconds;
+}
+
+int main(int argc, char * argv[]) {
+  size_t size = (argc > 1 ? atoi(argv[1]) : 32) * 1024 * 1024;
+  int runs = argc > 2 ? atoi(argv[2]) : 5;
+  double best = -1;
+  size_t scriptLen;
+  long numTokens = 0;
+  char * script;
+  int i;
+
+  script = make_script(size, &scriptLen);
+  if(script == NULL) {
+    printf("Unable to allocate script.\n");
+    return 1;
+  }
+
+  /* keep the fastest run */
+  for(i = 0; i < runs; i++) {
+    double seconds = lex_script(script, scriptLen, &numTokens);
+
+    if(seconds < 0) {
+      free(script);
+      return 1;
+    }
+    if(best < 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+
+  printf("lexed %lu bytes, %ld tokens, best of %i runs: %.4f s, %.1f MB/s\n",
+	 (unsigned long)scriptLen, numTokens, runs, best,
+	 best > 0 ? (scriptLen / (1024.0 * 1024.0)) / best : 0.0);
+
+  free(script);
+  return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * membench.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Memory management benchmark. Runs a script once with reference counting and
+ * once with the mark-sweep collector and reports run time, peak VM memory, and
+ * collector pause times.
+ * usage: membench [script] [entry_point]
+ * defaults to bench/strings.gxs and main.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "gunderscript.h"
+#include "vmgc.h"
+
+/* maximum script size that can be loaded */
+#define MEMBENCH_MAXSCRIPT     100000
+
+/**
+ * Builds and runs the script in one memory mode and prints the results.
+ * script: the script source.
+ * scriptLen: the length of the script.
+ * entryPoint: the exported function to run.
+ * memMode: the VM memory management mode.
+ * returns: true if the script ran, false if it failed.
+ */
+static bool run_mode(char * script, size_t scriptLen,
+		     char * entryPoint, VMMemMode memMode) {
+  Gunderscript ginst;
+  VMGCStats stats;
+  clock_t start;
+  double seconds;
+  bool result;
+
+  if(!gunderscript_new(&ginst, 100000, 55, NULL, memMode)) {
+    printf("Unable to allocate Gunderscript instance.\n");
+    return false;
+  }
+
+  if(!gunderscript_build(&ginst, script, scriptLen)) {
+    printf("Build failed: %s\n", gunderscript_err_message(&ginst));
+    gunderscript_free(&ginst);
+    return false;
+  }
+
+  /* time a single run of the entry point */
+  start = clock();
+  result = gunderscript_function(&ginst, entryPoint, strlen(entryPoint));
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  if(!result) {
+    printf("Run failed: %s\n", gunderscript_err_message(&ginst));
+    gunderscript_free(&ginst);
+    return false;
+  }
+
+  /* print results */
+  vmgc_stats(gunderscript_vm(&ginst), &stats);
+  printf("%-9s time: %8.4f s   peak mem: %8lu bytes",
+	 memMode == VMMEM_GC ? "gc" : "refcount", seconds,
+	 (unsigned long)vm_mem_peak(gunderscript_vm(&ginst)));
+  if(memMode == VMMEM_GC) {
+    printf("   cycles: %lu   steps: %lu   max pause: %.6f s"
+	   "   avg pause: %.8f s",
+	   (unsigned long)stats.cycles, (unsigned long)stats.steps,
+	   stats.maxPause,
+	   stats.steps > 0 ? stats.totalPause / stats.steps : 0.0);
+  }
+  printf("\n");
+
+  gunderscript_free(&ginst);
+  return true;
+}
+
+int main(int argc, char * argv[]) {
+  static char script[MEMBENCH_MAXSCRIPT];
+  char * fileName = argc > 1 ? argv[1] : "bench/strings.gxs";
+  char * entryPoint = argc > 2 ? argv[2] : "main";
+  size_t scriptLen;
+  FILE * file;
+
+  /* load script */
+  file = fopen(fileName, "r");
+  if(file == NULL) {
+    printf("Unable to open %s\n", fileName);
+    return 1;
+  }
+  scriptLen = fread(script, 1, sizeof(script), file);
+  fclose(file);
+
+  /* run in each memory management mode */
+  if(!run_mode(script, scriptLen, entryPoint, VMMEM_REFCOUNT)
+     || !run_mode(script, scriptLen, entryPoint, VMMEM_GC)) {
+    return 1;
+  }
+
+  return 0;
+}
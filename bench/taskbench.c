@@ -0,0 +1,167 @@
+/**
+ * taskbench.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Task pool benchmark. Spawns tasks that each make garbage strings and joins
+ * each one right away, so that many of the joins claim their task before a
+ * worker does and run it on the joining VM, inside join(). Runs once with
+ * reference counting and once with the mark-sweep collector, and reports the
+ * time per spawn and join, and the joining VM's collector cycles.
+ * usage: taskbench [workers] [tasks] [loops]
+ * defaults to 2 workers, 2000 tasks, and 1000 loops per task.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gunderscript.h"
+#include "libtask.h"
+#include "vmgc.h"
+
+/* a task that makes a new string per loop, and a joiner that spawns and
+ * joins them one at a time
+ */
+static char * script =
+  "function exported work(n) {\n"
+  "  var i;\n"
+  "  var s;\n"
+  "  i = 0;\n"
+  "  while(i < n) {\n"
+  "    s = \"ab\" + \"cd\";\n"
+  "    i = i + 1;\n"
+  "  }\n"
+  "  return (s);\n"
+  "}\n"
+  "function exported fan(tasks, n) {\n"
+  "  var i;\n"
+  "  var len;\n"
+  "  i = 0;\n"
+  "  len = 0;\n"
+  "  while(i < tasks) {\n"
+  "    len = len + string_length(join(spawn(\"work\", n)));\n"
+  "    i = i + 1;\n"
+  "  }\n"
+  "  return (len);\n"
+  "}\n";
+
+/**
+ * Gets the wall clock time.
+ * returns: the time in seconds.
+ */
+static double now() {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Runs the fan out in one memory mode and prints the results.
+ * numWorkers: the number of pool workers.
+ * tasks: the number of tasks to spawn and join.
+ * loops: the loops of each task.
+ * memMode: the memory management mode of the VM and the workers.
+ * returns: true if the script ran, false if it failed.
+ */
+static bool run_mode(int numWorkers, int tasks, int loops,
+		     VMMemMode memMode) {
+  Gunderscript ginst;
+  GunderscriptFunc fan;
+  Program * program;
+  TaskPool * pool;
+  VMGCStats stats;
+  VMArg args[2];
+  VMArg result;
+  double start;
+  double seconds;
+  bool success;
+
+  if(!gunderscript_new(&ginst, 100000, 55, NULL, memMode)) {
+    printf("Unable to allocate Gunderscript instance.\n");
+    return false;
+  }
+  if(!gunderscript_build(&ginst, script, strlen(script))
+     || !gunderscript_lookup(&ginst, "fan", 3, &fan)) {
+    printf("Build failed: %s\n", gunderscript_err_message(&ginst));
+    gunderscript_free(&ginst);
+    return false;
+  }
+
+  program = gunderscript_program(&ginst);
+  pool = program != NULL
+    ? taskpool_new(program, numWorkers, 65536, NULL, memMode) : NULL;
+  if(program != NULL) {
+    program_release(program);
+  }
+  if(pool == NULL) {
+    printf("Unable to allocate task pool.\n");
+    gunderscript_free(&ginst);
+    return false;
+  }
+  vm_set_task_pool(gunderscript_vm(&ginst), pool);
+
+  args[0] = vmarg_make_number(tasks);
+  args[1] = vmarg_make_number(loops);
+  start = now();
+  success = gunderscript_call(&fan, args, 2, &result);
+  seconds = now() - start;
+
+  if(!success) {
+    printf("Run failed: %s\n", gunderscript_err_message(&ginst));
+  } else {
+    vmarg_release(gunderscript_vm(&ginst), result);
+
+    /* print results */
+    vmgc_stats(gunderscript_vm(&ginst), &stats);
+    printf("%-9s time: %8.4f s  %10.1f us per task",
+	   memMode == VMMEM_GC ? "gc" : "refcount", seconds,
+	   seconds * 1e6 / tasks);
+    if(memMode == VMMEM_GC) {
+      printf("   joiner cycles: %lu   max pause: %.6f s",
+	     (unsigned long)stats.cycles, stats.maxPause);
+    }
+    printf("\n");
+  }
+
+  taskpool_free(pool);
+  vm_set_task_pool(gunderscript_vm(&ginst), NULL);
+  gunderscript_free(&ginst);
+  return success;
+}
+
+int main(int argc, char * argv[]) {
+  int numWorkers = argc > 1 ? atoi(argv[1]) : 2;
+  int tasks = argc > 2 ? atoi(argv[2]) : 2000;
+  int loops = argc > 3 ? atoi(argv[3]) : 1000;
+
+  if(numWorkers < 1 || tasks < 1 || loops < 1) {
+    printf("usage: taskbench [workers] [tasks] [loops]\n");
+    return 1;
+  }
+
+  /* run in each memory management mode */
+  if(!run_mode(numWorkers, tasks, loops, VMMEM_REFCOUNT)
+     || !run_mode(numWorkers, tasks, loops, VMMEM_GC)) {
+    return 1;
+  }
+
+  return 0;
+}
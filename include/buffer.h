@@ -27,15 +27,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include "gsbool.h"
+#include "gsalloc.h"
 
 typedef struct {
   char * buffer;
   int index;
   int blockSize;
   int currentSize;
+  GSAllocator * allocator;
 } Buffer;
   
-Buffer * buffer_new(int initialSize, int blockSize);
+Buffer * buffer_new(int initialSize, int blockSize, GSAllocator * allocator);
 
 bool buffer_append_char(Buffer * buffer, char c);
 
@@ -52,6 +54,12 @@ int buffer_size(Buffer * buffer);
 
 int buffer_buffer_size(Buffer * buffer);
 
+void buffer_clear(Buffer * buffer);
+
+size_t buffer_mem_size(Buffer * buffer);
+
+void buffer_set_allocator(Buffer * buffer, GSAllocator * allocator);
+
 void buffer_free(Buffer * buffer);
 
 bool buffer_resize(Buffer * buffer, int newSize);
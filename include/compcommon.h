@@ -31,6 +31,7 @@
 #include "ht.h"
 #include "buffer.h"
 #include "lexer.h"
+#include "gsarena.h"
 
 /* initial size of all hashtables */
 #define COMPILER_INITIAL_HTSIZE   11
@@ -89,24 +90,101 @@ static const const char * const compilerErrorMessages [] = {
   "Malformed char constant, must be a single or escaped char"
 };
 
+/* a variable in a symbol table */
+typedef struct SymTblEntry {
+  char * name;                    /* variable name, points into the script
+				   * being compiled, NULL if slot is empty */
+  size_t len;                     /* length of name */
+  int index;                      /* slot of the variable in its frame */
+} SymTblEntry;
+
+/* open addressed symbol table for one function or block scope */
+typedef struct SymTbl {
+  SymTblEntry * entries;          /* hashed entries */
+  int capacity;                   /* number of entries, a power of two */
+  int size;                       /* number of variables */
+  struct SymTbl * parent;         /* enclosing scope, or next free table */
+} SymTbl;
+
 /* a compiler instance type */
 typedef struct Compiler {
 
-  /* stack of hashtables of symbol structs containing the index at which the
-   * variable will be stored in the frame stack frame in the byte code.
+  /* arena for compile lifetime data: symbol tables, function records and
+   * their names, and the expression stack arrays. freed by compiler_free().
+   */
+  GSArena * arena;
+  /* stack of symbol tables, linked by parent, containing the index at which
+   * each variable will be stored in the frame stack frame in the byte code.
    */
-  Stk * symTableStk;
+  SymTbl * symTbls;
+  SymTbl * freeSymTbls;           /* popped symbol tables, for reuse */
   /* an instance of virtual machine. this is used during compile time to see
    * what functions are available to the script.
    */
   VM * vm;
+  GSAllocator * allocator;        /* allocator for compiler owned memory */
+  GSAllocator * baseAllocator;    /* host allocator wrapped by allocator */
+  GSAllocator accountant;         /* accounting wrapper around baseAllocator */
+  size_t memUsed;                 /* live bytes allocated through allocator */
+  size_t memPeak;                 /* high water mark of memUsed since the
+				   * last compiler_build() began */
   HT * functionHT;                /* hashtable of function structs */
   Buffer * outBuffer;             /* buffer builder that accepts the output */
+  Buffer * borrowSites;           /* int offsets of pending OP_VAR_PUSH ops
+				   * that may become OP_VAR_PUSH_B */
+  Buffer * nativeSites;           /* int offsets of the callback index of
+				   * every OP_CALL_PTR_N, see gxcfile.c */
+  /* compilation units only, see compiler_new_unit(). NULL otherwise. */
+  Buffer * codeSites;             /* int offsets of every code address
+				   * operand, relocated when linked */
+  Buffer * callSites;             /* CompilerCallSite of every call to a
+				   * function the unit doesn't define */
+  bool lazy;                      /* write stubs instead of function code */
+  /* lazy mode only, see compiler_set_lazy(). NULL otherwise. */
+  Buffer * stubs;                 /* CompilerStub of every function, indexed
+				   * by the operand of its OP_STUB */
+  Buffer * stubLexers;            /* Lexer * of every script built, kept
+				   * for compiling their functions later */
+  struct CompilerFunc * stubFunc; /* function whose stub is being compiled,
+				   * or NULL */
+  TypeStk ** opStks;              /* shunting yard operator stacks, one per
+				   * expression nesting level, reused by
+				   * every expression at that level */
+  Stk ** opLenStks;               /* lengths of the operators in opStks */
+  int numOpStks;                  /* nesting levels allocated */
+  int exprDepth;                  /* current expression nesting level */
   CompilerErr err;                /* error code value */
   int errorLineNum;               /* line number where error occurred */
   LexerErr lexerErr;              /* the error code passed by the lexer */
 } Compiler;
 
+/* a call from a compilation unit to a function that it didn't define yet,
+ * resolved by compiler_link() */
+typedef struct CompilerCallSite {
+  int offset;                     /* offset of the OP_CALL_B */
+  int numArgs;                    /* number of arguments passed */
+  int line;                       /* line of the call, for errors */
+  size_t nameLen;                 /* length of name */
+  char * name;                    /* callee name, in the unit's arena */
+} CompilerCallSite;
+
+/* a function that will be compiled on its first call, see
+ * compiler_compile_stub() */
+typedef struct CompilerStub {
+  struct CompilerFunc * func;     /* the function */
+  Lexer * lexer;                  /* tokens of the script defining it */
+  int position;                   /* token index of its 'function' keyword */
+  int index;                      /* offset of the OP_STUB */
+  bool compiled;                  /* whether the stub was replaced */
+} CompilerStub;
+
+/* a function entry point replaced by compiler_rebuild() */
+typedef struct CompilerSwap {
+  int oldIndex;                   /* old entry point, or stub */
+  int newIndex;                   /* new entry point */
+  int frameSize;                  /* new number of args and vars */
+} CompilerSwap;
+
 /* a function struct */
 typedef struct CompilerFunc {
   char * name;                    /* the string name of a function */
@@ -115,6 +193,8 @@ typedef struct CompilerFunc {
   int numArgs;                    /* the number of arguments required */
   int numVars;                    /* the number of variables required */
   bool exported;
+  int line;                       /* line of the definition, or 0 if it was
+				   * loaded from compiled code */
 } CompilerFunc;
 
 bool tokens_equal(char * token1, size_t num1,
@@ -122,11 +202,16 @@ bool tokens_equal(char * token1, size_t num1,
 
 OpCode operator_to_opcode(char * operator, size_t len);
 
+bool symtbl_put(Compiler * c, SymTbl * tbl, char * name, size_t len,
+		bool * prevExisted);
+
+bool symtbl_get(SymTbl * tbl, char * name, size_t len, int * index);
+
 bool symtblstk_push(Compiler * c);
 
-HT * symtblstk_pop(Compiler * c);
+void symtblstk_pop(Compiler * c);
 
-HT * symtblstk_peek(Compiler * c, int offset);
+SymTbl * symtblstk_peek(Compiler * c, int offset);
 
 int operator_precedence(char * operator, size_t operatorLen);
 
@@ -134,4 +219,23 @@ int topstack_precedence(TypeStk * stk, Stk * lenStk);
 
 int topstack_type(TypeStk * stk, Stk * lenStk);
 
+bool borrowsites_add(Compiler * c, int index);
+
+int borrowsites_size(Compiler * c);
+
+void borrowsites_commit(Compiler * c);
+
+void borrowsites_discard(Compiler * c);
+
+bool codesites_add(Compiler * c, int index);
+
+bool callsites_add(Compiler * c, int index, char * name, size_t nameLen,
+		   int numArgs, int line);
+
+bool exprstks_push(Compiler * c, TypeStk ** opStk, Stk ** opLenStk);
+
+void exprstks_pop(Compiler * c);
+
+void exprstks_free(Compiler * c);
+
 #endif /* COMPCOMMON__H__ */
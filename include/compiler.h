@@ -30,10 +30,37 @@
 #include "ht.h"
 #include "vm.h"
 
-Compiler * compiler_new(VM * vm);
+/* bump whenever the compiler generates different code for the same input.
+ * part of the compile cache key, see gxccache.c
+ */
+#define COMPILER_VERSION          2
+
+Compiler * compiler_new(VM * vm, GSAllocator * allocator);
+
+Compiler * compiler_new_unit(Compiler * compiler);
 
 bool compiler_build(Compiler * compiler, char * input, size_t inputLen);
 
+bool compiler_set_lazy(Compiler * compiler, bool lazy);
+
+bool compiler_compile_stub(Compiler * compiler, int stub, int callIndex);
+
+bool compiler_compile_stubs(Compiler * compiler);
+
+bool compiler_lazy(Compiler * compiler);
+
+bool compiler_link(Compiler * compiler, Compiler ** units, int numUnits,
+		   int * errUnit);
+
+bool compiler_rebuild(Compiler * compiler, char * input, size_t inputLen);
+
+bool compiler_append(Compiler * compiler, char * code, size_t codeLen,
+		     int * nativeSites, int numNativeSites);
+
+bool compiler_define_function(Compiler * c, char * name, size_t nameLen,
+			      int index, int numArgs, int numVars,
+			      bool exported);
+
 void compiler_set_err(Compiler * compiler, CompilerErr err);
 
 CompilerFunc * compiler_function(Compiler * compiler, char * name, size_t len);
@@ -46,8 +73,18 @@ size_t compiler_bytecode_size(Compiler * compiler);
 
 char * compiler_bytecode(Compiler * compiler);
 
+int compiler_num_native_sites(Compiler * compiler);
+
+int compiler_native_site(Compiler * compiler, int site);
+
 int compiler_err_line(Compiler * compiler);
 
+size_t compiler_mem_used(Compiler * compiler);
+
+size_t compiler_mem_peak(Compiler * compiler);
+
+size_t compiler_arena_size(Compiler * compiler);
+
 LexerErr compiler_lex_err(Compiler * compiler);
 
 const char * compiler_err_to_string(Compiler * compiler, CompilerErr err);
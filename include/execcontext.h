@@ -0,0 +1,57 @@
+/**
+ * execcontext.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Per thread execution contexts for shared programs. See execcontext.c.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXECCONTEXT__H__
+#define EXECCONTEXT__H__
+
+#include "program.h"
+#include "vm.h"
+#include "gsalloc.h"
+
+/* the state of one thread running a program */
+typedef struct ExecContext {
+  Program * program;              /* retained until execcontext_free() */
+  VM * vm;                        /* stacks, errors, and objects */
+  GSAllocator * allocator;
+} ExecContext;
+
+ExecContext * execcontext_new(Program * program, size_t stackSize,
+			      GSAllocator * allocator, VMMemMode memMode);
+
+bool execcontext_exec(ExecContext * context, CompilerFunc * function);
+
+bool execcontext_call(ExecContext * context, CompilerFunc * function,
+		      VMArg * args, int argc, VMArg * result);
+
+int execcontext_call_batch(ExecContext * context, CompilerFunc * function,
+			   VMArg * args, int argc, VMArg * results,
+			   int numCalls);
+
+VM * execcontext_vm(ExecContext * context);
+
+VMErr execcontext_err(ExecContext * context);
+
+void execcontext_free(ExecContext * context);
+
+#endif /* EXECCONTEXT__H__ */
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include "gsbool.h"
 #include "vmdefs.h"
+#include "gsalloc.h"
 
 #define FRMSTK_TOP      0
 
@@ -41,14 +42,20 @@ typedef struct FrmStk {
   size_t usedStack;
   size_t stackSize;
   int stackDepth;
+  GSAllocator * allocator;
 } FrmStk;
 
-FrmStk * frmstk_new(size_t stackSize);
+/* called for each variable slot by frmstk_visit_vars() */
+typedef void (*FrmStkVarVisitor) (void * context, VarType type, void * value);
+
+FrmStk * frmstk_new(size_t stackSize, GSAllocator * allocator);
 
 bool frmstk_push(FrmStk * fs, size_t returnAddr, int numVarArgs);
 
 bool frmstk_pop(FrmStk * fs);
 
+void frmstk_clear(FrmStk * fs);
+
 void * frmstk_var_addr(FrmStk * fs, int stackDepth, int varArgsIndex);
 
 bool frmstk_var_write(FrmStk * fs, int stackDepth, int varArgsIndex,
@@ -61,6 +68,8 @@ size_t frmstk_ret_addr(FrmStk * fs);
 
 int frmstk_size(FrmStk * fs);
 
+void frmstk_visit_vars(FrmStk * fs, FrmStkVarVisitor visitor, void * context);
+
 void frmstk_free(FrmStk * fs);
 
 #endif /* FRMSTK__H__ */
@@ -0,0 +1,59 @@
+/**
+ * gsalloc.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See gsalloc.c for description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GSALLOC__H__
+#define GSALLOC__H__
+
+#include <stdlib.h>
+
+/* allocates size bytes. contents need not be zeroed. */
+typedef void * (*GSAllocFunc) (void * context, size_t size);
+
+/* resizes a block from oldSize to newSize bytes, preserving its contents. */
+typedef void * (*GSReallocFunc) (void * context, void * ptr,
+				 size_t oldSize, size_t newSize);
+
+/* frees a block that was allocated as size bytes. */
+typedef void (*GSFreeFunc) (void * context, void * ptr, size_t size);
+
+/* allocator vtable. every allocation made by the runtime goes through one */
+typedef struct GSAllocator {
+  GSAllocFunc alloc;
+  GSReallocFunc realloc;
+  GSFreeFunc free;
+  void * context;
+} GSAllocator;
+
+GSAllocator * gsalloc_default();
+
+void * gsalloc_malloc(GSAllocator * allocator, size_t size);
+
+void * gsalloc_calloc(GSAllocator * allocator, size_t num, size_t size);
+
+void * gsalloc_realloc(GSAllocator * allocator, void * ptr,
+		       size_t oldSize, size_t newSize);
+
+void gsalloc_free(GSAllocator * allocator, void * ptr, size_t size);
+
+#endif /* GSALLOC__H__ */
@@ -0,0 +1,59 @@
+/**
+ * gsarena.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See gsarena.c for description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GSARENA__H__
+#define GSARENA__H__
+
+#include <stdlib.h>
+#include "gsalloc.h"
+
+/* a block of arena memory, its data follows the header */
+typedef struct GSArenaBlock {
+  struct GSArenaBlock * next;     /* previously filled block */
+  size_t size;                    /* bytes of data in this block */
+  size_t used;                    /* bytes of data handed out */
+} GSArenaBlock;
+
+/* a bump pointer arena */
+typedef struct GSArena {
+  GSAllocator * allocator;        /* allocator that the blocks come from */
+  GSArenaBlock * blocks;          /* block being filled, then older ones */
+  size_t blockSize;               /* data bytes in a regular block */
+  size_t size;                    /* bytes held in all blocks */
+  size_t used;                    /* bytes handed out from all blocks */
+} GSArena;
+
+GSArena * gsarena_new(size_t blockSize, GSAllocator * allocator);
+
+void * gsarena_alloc(GSArena * arena, size_t size);
+
+void * gsarena_calloc(GSArena * arena, size_t num, size_t size);
+
+size_t gsarena_size(GSArena * arena);
+
+size_t gsarena_used(GSArena * arena);
+
+void gsarena_free(GSArena * arena);
+
+#endif /* GSARENA__H__ */
@@ -28,28 +28,80 @@
 #include <stdlib.h>
 #include "compiler.h"
 #include "vm.h"
+#include "gxcfile.h"
+#include "gxccache.h"
+#include "program.h"
+#include "execcontext.h"
+#include "vmpool.h"
 
 /* stores an instance of a Gunderscript environment */
 typedef struct Gunderscript {
   Compiler * compiler;
   VM * vm;
+  GXCFile * image;                /* loaded .gxc file, or NULL */
+  GXCErr imageErr;                /* last save or load error */
+  GXCCache * cache;               /* compile cache, or NULL */
 } Gunderscript;
 
+/* a function looked up once to be called many times, see gunderscript_call() */
+typedef struct GunderscriptFunc {
+  Gunderscript * instance;
+  GXCFile * image;                /* file the function is from, or NULL */
+  CompilerFunc * function;
+} GunderscriptFunc;
+
 bool gunderscript_new(Gunderscript * instance, size_t stackSize,
-		      int callbacksSize);
+		      int callbacksSize, GSAllocator * allocator,
+		      VMMemMode memMode);
 Compiler * gunderscript_compiler(Gunderscript * instance);
 
 VM * gunderscript_vm(Gunderscript * instance);
 
 bool gunderscript_build(Gunderscript * instance, char * input, size_t inputLen);
 
+bool gunderscript_build_files(Gunderscript * instance, char ** inputs,
+			      size_t * inputLens, int numInputs,
+			      int numThreads, int * errInput);
+
+bool gunderscript_rebuild(Gunderscript * instance, char * input,
+			  size_t inputLen);
+
 CompilerErr gunderscript_build_err(Gunderscript * instance);
 
+bool gunderscript_set_cache(Gunderscript * instance, char * dir);
+
+bool gunderscript_set_lazy(Gunderscript * instance, bool lazy);
+
+bool gunderscript_cache_stats(Gunderscript * instance, GXCCacheStats * stats);
+
+bool gunderscript_save(Gunderscript * instance, char * path);
+
+bool gunderscript_load(Gunderscript * instance, char * path);
+
+GXCErr gunderscript_image_err(Gunderscript * instance);
+
+Program * gunderscript_program(Gunderscript * instance);
+
 const char * gunderscript_err_message(Gunderscript * instance);
 
 bool gunderscript_function(Gunderscript * instance, char * entryPoint,
 			   size_t entryPointLen);
 
+bool gunderscript_lookup(Gunderscript * instance, char * name, size_t nameLen,
+			 GunderscriptFunc * handle);
+
+bool gunderscript_call(GunderscriptFunc * handle, VMArg * args, int argc,
+		       VMArg * result);
+
+int gunderscript_call_batch(GunderscriptFunc * handle, VMArg * args, int argc,
+			    VMArg * results, int numCalls);
+
+VMCoro * gunderscript_coroutine(GunderscriptFunc * handle, size_t stackSize,
+				VMArg * args, int argc);
+
+bool gunderscript_resume(Gunderscript * instance, VMCoro * coro,
+			 VMArg * value, VMArg * result);
+
 VMErr gunderscript_function_err(Gunderscript * instance);
 
 int gunderscript_err_line(Gunderscript * instance);
@@ -0,0 +1,71 @@
+/**
+ * gxccache.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Content addressed cache of compiled scripts. See gxccache.c.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GXCCACHE__H__
+#define GXCCACHE__H__
+
+#include <stdint.h>
+#include "compiler.h"
+#include "vm.h"
+#include "gsalloc.h"
+
+/* file extension of cache entries */
+#define GXCCACHE_EXTENSION        ".gxc"
+
+/* cache counters */
+typedef struct GXCCacheStats {
+  int hits;                       /* builds loaded from the cache */
+  int misses;                     /* builds that had to be compiled */
+  int stores;                     /* compiled builds written to the cache */
+  int storeFails;                 /* compiled builds that couldn't be written */
+} GXCCacheStats;
+
+/* builds the scripts of a cache entry into the compiler, see
+ * gxccache_build_files()
+ */
+typedef bool (*GXCCacheBuildFunc)(void * context);
+
+/* a compile cache directory */
+typedef struct GXCCache {
+  char * dir;                     /* the cache directory */
+  size_t dirLen;
+  uint64_t chainHash;             /* key of the previous build, or 0 */
+  GXCCacheStats stats;
+  GSAllocator * allocator;
+} GXCCache;
+
+GXCCache * gxccache_new(char * dir, GSAllocator * allocator);
+
+bool gxccache_build(GXCCache * cache, Compiler * compiler, VM * vm,
+		    char * input, size_t inputLen);
+
+bool gxccache_build_files(GXCCache * cache, Compiler * compiler, VM * vm,
+			  char ** inputs, size_t * inputLens, int numInputs,
+			  GXCCacheBuildFunc build, void * context);
+
+void gxccache_stats(GXCCache * cache, GXCCacheStats * stats);
+
+void gxccache_free(GXCCache * cache);
+
+#endif /* GXCCACHE__H__ */
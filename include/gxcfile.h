@@ -0,0 +1,165 @@
+/**
+ * gxcfile.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Precompiled Gunderscript bytecode (.gxc) files. See gxcfile.c.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GXCFILE__H__
+#define GXCFILE__H__
+
+#include <stdint.h>
+#include "compiler.h"
+#include "vm.h"
+#include "ht.h"
+#include "gsalloc.h"
+
+/* first bytes of every .gxc file */
+#define GXC_MAGIC                 "GXC\032"
+#define GXC_MAGIC_LEN             4
+/* bump whenever the container or the bytecode format changes */
+#define GXC_VERSION               2
+/* written in host byte order to detect files from other architectures */
+#define GXC_BYTE_ORDER_MARK       0x01020304
+/* longest native function name that can be imported */
+#define GXC_MAX_NAME_LEN          255
+
+/* errors that can occur while saving or loading a .gxc file */
+typedef enum {
+  GXCERR_SUCCESS,
+  GXCERR_ALLOC_FAILED,
+  GXCERR_OPEN_FAILED,
+  GXCERR_WRITE_FAILED,
+  GXCERR_NO_BYTECODE,
+  GXCERR_NAME_TOO_LONG,
+  GXCERR_BAD_MAGIC,
+  GXCERR_BAD_VERSION,
+  GXCERR_INCOMPATIBLE,
+  GXCERR_CORRUPT,
+  GXCERR_BAD_CHECKSUM,
+  GXCERR_MISSING_NATIVE,
+  GXCERR_PARTIAL,
+} GXCErr;
+
+/* english translations of gxc errors */
+static const char * const gxcErrorMessages [] = {
+  "Success",
+  "Memory allocation failed",
+  "Unable to open bytecode file",
+  "Unable to write bytecode file",
+  "There is no successfully built bytecode to save",
+  "Native function name is too long",
+  "Not a Gunderscript bytecode file",
+  "Bytecode file was made by an incompatible version of Gunderscript",
+  "Bytecode file was made for a different architecture",
+  "Bytecode file is corrupt or truncated",
+  "Bytecode file checksum does not match",
+  "Bytecode file calls a native function that is not registered",
+  "Bytecode file only contains part of a program"
+};
+
+/* file header, followed by the sections in the order that they are listed.
+ * offsets are from the start of the file and all values are in the byte order
+ * of the machine that wrote the file.
+ */
+typedef struct GXCHeader {
+  char magic[GXC_MAGIC_LEN];      /* GXC_MAGIC */
+  int32_t version;                /* GXC_VERSION */
+  int32_t byteOrder;              /* GXC_BYTE_ORDER_MARK */
+  int32_t intSize;                /* sizeof(int) of bytecode operands */
+  uint32_t checksum;              /* FNV-1a of everything after the header */
+  int32_t funcsOffset;            /* GXCFunc table */
+  int32_t numFuncs;
+  int32_t importsOffset;          /* GXCImport table */
+  int32_t numImports;
+  int32_t sitesOffset;            /* int32 code offsets, grouped by import */
+  int32_t numSites;
+  int32_t stringsOffset;          /* NULL terminated names */
+  int32_t stringsLen;
+  int32_t codeOffset;             /* bytecode, including string constants */
+  int32_t codeLen;
+  int32_t codeBase;               /* program offset of the first code byte.
+				   * 0 for complete programs, see gxccache.c */
+} GXCHeader;
+
+/* a script function table entry */
+typedef struct GXCFunc {
+  int32_t nameOffset;             /* offset of name in strings section */
+  int32_t nameLen;                /* length of name, without the NULL */
+  int32_t index;                  /* offset of the function in the program */
+  int32_t numArgs;
+  int32_t numVars;
+  int32_t exported;
+} GXCFunc;
+
+/* a native function imported by the code */
+typedef struct GXCImport {
+  int32_t nameOffset;             /* offset of name in strings section */
+  int32_t nameLen;                /* length of name, without the NULL */
+  int32_t callbackIndex;          /* index the code was compiled with */
+  int32_t firstSite;              /* first of this import's sites */
+  int32_t numSites;               /* number of OP_CALL_PTR_N that call it */
+} GXCImport;
+
+/* a loaded .gxc file */
+typedef struct GXCFile {
+  char * image;                   /* the mapped or read file */
+  size_t imageLen;                /* the size of the file in bytes */
+  bool mapped;                    /* image is mmap()ed rather than allocated */
+  char * code;                    /* the bytecode, inside of image */
+  size_t codeLen;
+  size_t codeBase;                /* program offset of code */
+  char * sites;                   /* int32 native call sites, inside image */
+  int numSites;
+  CompilerFunc * funcs;           /* function table, names inside of image */
+  int numFuncs;
+  HT * functionHT;                /* function name to CompilerFunc */
+  GSAllocator * allocator;
+} GXCFile;
+
+GXCErr gxcfile_save(Compiler * compiler, VM * vm, char * path);
+
+GXCErr gxcfile_save_range(Compiler * compiler, VM * vm, char * path,
+			  size_t codeStart, int siteStart);
+
+GXCFile * gxcfile_load(VM * vm, char * path, GSAllocator * allocator,
+		       GXCErr * err);
+
+CompilerFunc * gxcfile_function(GXCFile * file, char * name, size_t len);
+
+char * gxcfile_bytecode(GXCFile * file);
+
+size_t gxcfile_bytecode_size(GXCFile * file);
+
+size_t gxcfile_code_base(GXCFile * file);
+
+int gxcfile_num_functions(GXCFile * file);
+
+CompilerFunc * gxcfile_function_at(GXCFile * file, int index);
+
+int gxcfile_num_native_sites(GXCFile * file);
+
+int gxcfile_native_site(GXCFile * file, int site);
+
+void gxcfile_free(GXCFile * file);
+
+const char * gxcfile_err_to_string(GXCErr err);
+
+#endif /* GXCFILE__H__ */
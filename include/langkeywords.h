@@ -102,4 +102,54 @@
 #define LANG_OP_AND_LEN     2
 #define LANG_OP_OR       "||"
 #define LANG_OP_OR_LEN     2
+
+/* length of the longest keyword or operator above */
+#define LANG_MAX_KEYWORD_LEN 8
+
+/* the keywords and operators above, as recognized by lang_keyword(). If you
+ * add one, you must also add its case and its table entry to
+ * src/langkeywords.c.
+ */
+typedef enum {
+  LANGKW_NONE,
+  LANGKW_FUNCTION,
+  LANGKW_EXPORTED,
+  LANGKW_ENDSTATEMENT,
+  LANGKW_OPARENTH,
+  LANGKW_CPARENTH,
+  LANGKW_ARGDELIM,
+  LANGKW_OBRACKET,
+  LANGKW_CBRACKET,
+  LANGKW_OSQBRKT,
+  LANGKW_CSQBRKT,
+  LANGKW_VAR_DECL,
+  LANGKW_RETURN,
+  LANGKW_TRUE,
+  LANGKW_FALSE,
+  LANGKW_NULL,
+  LANGKW_IF,
+  LANGKW_ELSE,
+  LANGKW_DO,
+  LANGKW_WHILE,
+  LANGKW_FOR,
+  LANGKW_OP_ADD,
+  LANGKW_OP_SUB,
+  LANGKW_OP_MUL,
+  LANGKW_OP_DIV,
+  LANGKW_OP_MOD,
+  LANGKW_OP_ASSIGN,
+  LANGKW_OP_EQUALS,
+  LANGKW_OP_NOT_EQUALS,
+  LANGKW_OP_LT,
+  LANGKW_OP_GT,
+  LANGKW_OP_LTE,
+  LANGKW_OP_GTE,
+  LANGKW_OP_AND,
+  LANGKW_OP_OR,
+} LangKeyword;
+
+LangKeyword lang_keyword(char * token, size_t len);
+
+bool lang_keywords_check();
+
 #endif /* LANGKEYWORDS__H__ */
@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "gsbool.h"
+#include "gsalloc.h"
+#include "langkeywords.h"
 
 #ifndef LEXER__H__
 #define LEXER__H__
@@ -64,6 +66,15 @@ typedef enum {
   LEXERTYPE_ARGDELIM,
 } LexerType;
 
+/* a token in the token array, see lexer_tokenize() */
+typedef struct LexerToken {
+  int offset;                     /* index of the token in the input */
+  int length;                     /* length of the token in chars */
+  LexerType type;
+  int line;                       /* line number of the token */
+  LangKeyword keyword;            /* keyword or operator, or LANGKW_NONE */
+} LexerToken;
+
 /* Lexer Instance Struct */
 typedef struct Lexer {
   char * input;
@@ -71,16 +82,25 @@ typedef struct Lexer {
   char * currToken;
   size_t currTokenLen;
   LexerType currTokenType;
+  LangKeyword currTokenKeyword;
   char * nextToken;
   size_t nextTokenLen;
   LexerType nextTokenType;
+  LangKeyword nextTokenKeyword;
   LexerErr err;
   int index;
   int lineNum;
+  GSAllocator * allocator;
+  LexerToken * tokens;            /* token array, or NULL if not tokenized */
+  int numTokens;
+  int tokensSize;                 /* number of tokens allocated */
+  int tokenIndex;                 /* index of current token in tokens */
+  LexerErr tokensErr;             /* error that ended tokenization */
+  int tokensLineNum;              /* line number where tokenization ended */
 } Lexer;
 
 
-Lexer * lexer_new(char * input, size_t inputLen);
+Lexer * lexer_new(char * input, size_t inputLen, GSAllocator * allocator);
 
 void lexer_free(Lexer * l);
 
@@ -96,6 +116,22 @@ LexerType lexer_token_type(char * token, size_t len, bool definitive);
 
 char * lexer_peek(Lexer * lexer, LexerType * type, size_t * len);
 
+LangKeyword lexer_current_keyword(Lexer * l);
+
+LangKeyword lexer_peek_keyword(Lexer * l);
+
 const char * lexer_err_to_string(LexerErr err);
 
+bool lexer_tokenize(Lexer * l);
+
+char * lexer_peek_ahead(Lexer * l, int n, LexerType * type, size_t * len);
+
+int lexer_position(Lexer * l);
+
+void lexer_seek(Lexer * l, int position);
+
+int lexer_num_tokens(Lexer * l);
+
+LexerToken * lexer_token_at(Lexer * l, int index);
+
 #endif /* LEXER__H__*/
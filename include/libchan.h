@@ -0,0 +1,80 @@
+/**
+ * libchan.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Bounded lock-free channels for passing values between VMs on different
+ * threads. See libchan.c.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCHAN__H__
+#define LIBCHAN__H__
+
+#include "gunderscript.h"
+
+#define LIBCHAN_CHANNEL_TYPE        "CHAN.CHAN"
+#define LIBCHAN_CHANNEL_TYPE_LEN    9
+/* keeps the senders' and receivers' counters on separate cache lines */
+#define LIBCHAN_CACHE_LINE          64
+
+typedef struct Channel Channel;
+
+/* a value in transit between VMs */
+typedef struct ChanMessage {
+  VMArg arg;                      /* the value, unless it's an object */
+  Buffer * string;                /* a string's characters, or NULL. owned by
+				   * the channel's allocator */
+  Channel * channel;              /* a retained channel, or NULL */
+  VMLibData * frozen;             /* a referenced frozen string, or NULL */
+} ChanMessage;
+
+/* a ring buffer slot. sequence says whose turn it is, see libchan.c */
+typedef struct ChanSlot {
+  size_t sequence;
+  ChanMessage message;
+} ChanSlot;
+
+/* a bounded multi producer, multi consumer queue of messages */
+struct Channel {
+  ChanSlot * slots;               /* ring buffer of mask + 1 slots */
+  size_t mask;
+  GSAllocator * allocator;        /* owns slots and strings in transit */
+  int refCount;                   /* changed atomically */
+  char headPad[LIBCHAN_CACHE_LINE];
+  size_t head;                    /* next position to receive from */
+  char tailPad[LIBCHAN_CACHE_LINE];
+  size_t tail;                    /* next position to send to. the top bit
+				   * is set by channel_close() */
+};
+
+Channel * channel_new(int capacity, GSAllocator * allocator);
+
+Channel * channel_retain(Channel * channel);
+
+void channel_release(Channel * channel);
+
+void channel_close(Channel * channel);
+
+VMLibData * libchan_handle(VM * vm, Channel * channel);
+
+Channel * libchan_channel(VMArg arg);
+
+bool libchan_install(Gunderscript * gunderscript);
+
+#endif /* LIBCHAN__H__ */
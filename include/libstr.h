@@ -28,9 +28,11 @@
 
 #define LIBSTR_STRING_TYPE     "LIBSTR.STR"
 #define LIBSTR_STRING_TYPE_LEN    10
+/* the string type is preregistered by vm.c as the first LIBDATA type */
+#define LIBSTR_STRING_TYPEID      0
 #define LIBSTR_STRING_BLOCKSIZE   10
 
-VMLibData * libstr_string_new(int bufferLen);
+VMLibData * libstr_string_new(VM * vm, int bufferLen);
 
 char * libstr_string(VMLibData * data);
 
@@ -40,4 +42,10 @@ bool libstr_install(Gunderscript * gunderscript);
 
 bool libstr_string_append(VMLibData * data, char * string, int stringLen);
 
+Buffer * libstr_string_detach(VM * vm, VMLibData * data);
+
+VMLibData * libstr_string_attach(VM * vm, Buffer * buffer);
+
+bool libstr_string_freeze(VM * vm, VMLibData * data);
+
 #endif /*LIBSTR__H__*/
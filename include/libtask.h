@@ -0,0 +1,108 @@
+/**
+ * libtask.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Work stealing thread pool for the spawn() and join() natives. See
+ * libtask.c.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBTASK__H__
+#define LIBTASK__H__
+
+#include <pthread.h>
+#include "gunderscript.h"
+#include "libchan.h"
+
+#define LIBTASK_TASK_TYPE        "TASK.TASK"
+#define LIBTASK_TASK_TYPE_LEN    9
+
+/* states of a task, see libtask.c */
+typedef enum {
+  TASK_PENDING,                       /* queued, not yet taken by a thread */
+  TASK_RUNNING,
+  TASK_DONE,                          /* returned, result is set */
+  TASK_FAILED,                        /* stopped by a VM error, err is set */
+} TaskState;
+
+/* a value copied out of one VM so that another can have it */
+typedef struct TaskValue {
+  VMArg arg;                      /* the value, unless it's a string */
+  char * string;                  /* copy of a string's characters, or NULL */
+  int stringLen;
+  Channel * channel;              /* a retained channel, or NULL */
+  VMLibData * frozen;             /* a referenced frozen string, or NULL */
+} TaskValue;
+
+/* a call of a function spawned to run on a pool thread */
+typedef struct Task {
+  CompilerFunc * function;        /* function of the pool's program */
+  TaskValue * args;               /* copies of the arguments */
+  int argc;
+  TaskValue result;               /* copy of the return value when done */
+  TaskState state;                /* accessed atomically */
+  VMErr err;                      /* error if failed */
+  int refCount;                   /* changed atomically */
+  GSAllocator * allocator;
+} Task;
+
+/* a worker thread's deque of tasks. the worker pushes and pops at the
+ * bottom, and other threads steal from the top
+ */
+typedef struct TaskDeque {
+  Task ** tasks;                  /* ring buffer of size tasks */
+  int size;
+  int top;                        /* index of the oldest task */
+  int count;
+  pthread_mutex_t lock;
+} TaskDeque;
+
+/* a worker thread and the context that it runs tasks with */
+typedef struct TaskWorker {
+  TaskPool * pool;
+  ExecContext * context;
+  TaskDeque deque;
+  pthread_t thread;
+} TaskWorker;
+
+/* a work stealing pool of threads that run tasks of one program */
+struct TaskPool {
+  Program * program;              /* retained until taskpool_free() */
+  TaskWorker * workers;           /* array of workersSize */
+  int workersSize;
+  int numWorkers;                 /* number of workers set up */
+  int numStarted;                 /* number of worker threads started */
+  size_t stackSize;               /* frame stack size of each task */
+  GSAllocator * allocator;
+  pthread_mutex_t lock;           /* guards the fields below */
+  pthread_cond_t workCond;        /* signaled when a task is queued */
+  pthread_cond_t doneCond;        /* broadcast when a task finishes */
+  int numQueued;                  /* tasks in all deques */
+  int nextWorker;                 /* deque for spawns from other threads */
+  bool stopping;                  /* taskpool_free() was called */
+};
+
+TaskPool * taskpool_new(Program * program, int numWorkers, size_t stackSize,
+			GSAllocator * allocator, VMMemMode memMode);
+
+void taskpool_free(TaskPool * pool);
+
+bool libtask_install(Gunderscript * gunderscript);
+
+#endif /* LIBTASK__H__ */
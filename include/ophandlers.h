@@ -31,6 +31,9 @@ bool op_var_stor(VM * vm, char * byteCode,
 bool op_var_push(VM * vm,  char * byteCode, 
 		  size_t byteCodeLen, int * index);
 
+bool op_var_push_b(VM * vm,  char * byteCode, 
+		   size_t byteCodeLen, int * index);
+
 bool op_frame_push(VM * vm,  char * byteCode, 
 		   size_t byteCodeLen, int * index, bool functionCall);
 
@@ -75,4 +78,6 @@ bool op_call_ptr_n(VM * vm, char * byteCode,
 
 bool op_null_push(VM * vm,  char * byteCode, 
 		  size_t byteCodeLen, int * index);
+
+bool op_stub(VM * vm, char ** byteCode, size_t * byteCodeLen, int * index);
 #endif /* OPHANDLERS__H__ */
@@ -0,0 +1,61 @@
+/**
+ * program.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Immutable compiled programs shared between threads. See program.c.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROGRAM__H__
+#define PROGRAM__H__
+
+#include "compiler.h"
+#include "gxcfile.h"
+#include "vm.h"
+#include "gsalloc.h"
+#include "gsarena.h"
+
+/* a compiled program. read only once created, except for refCount */
+typedef struct Program {
+  char * byteCode;                /* copy of the bytecode */
+  size_t byteCodeLen;
+  CompilerFunc * funcs;           /* function table, names in arena */
+  int numFuncs;
+  int funcsSize;                  /* number of entries allocated in funcs */
+  HT * functionHT;                /* function name to CompilerFunc */
+  VMCallback * callbacks;         /* copy of the VM's native bindings */
+  int numCallbacks;
+  int refCount;                   /* changed atomically */
+  GSArena * arena;                /* function names */
+  GSAllocator * allocator;
+} Program;
+
+Program * program_from_compiler(Compiler * compiler, VM * vm,
+				GSAllocator * allocator);
+
+Program * program_from_gxcfile(GXCFile * file, VM * vm,
+			       GSAllocator * allocator);
+
+Program * program_retain(Program * program);
+
+void program_release(Program * program);
+
+CompilerFunc * program_function(Program * program, char * name, size_t len);
+
+#endif /* PROGRAM__H__ */
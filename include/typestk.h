@@ -29,10 +29,12 @@
 #include <string.h>
 #include "vmdefs.h"
 #include "gsbool.h"
+#include "gsalloc.h"
 
 typedef struct TypeStkData {
   char type;
   char data[VM_VAR_SIZE];
+  char borrowed;              /* value holds no reference, see ophandlers.c */
 }TypeStkData;
 
 typedef struct TypeStk {
@@ -40,15 +42,21 @@ typedef struct TypeStk {
   int depth;
   int blockSize;
   int size;
+  GSAllocator * allocator;
 }TypeStk;
 
-TypeStk * typestk_new(int initialDepth, int blockSize);
+TypeStk * typestk_new(int initialDepth, int blockSize, GSAllocator * allocator);
 
 void typestk_free(TypeStk * stack);
 
 
 bool typestk_push(TypeStk * stack, void * data, size_t dataSize, VarType type);
 
+bool typestk_push_borrowed(TypeStk * stack, void * data,
+			   size_t dataSize, VarType type);
+
+bool typestk_top_borrowed(TypeStk * stack);
+
 bool typestk_peek(TypeStk * stack, void * value, 
 		  size_t valueSize, VarType * type);
 
@@ -57,4 +65,6 @@ bool typestk_pop(TypeStk * stack, void * value,
 
 int typestk_size(TypeStk * stack);
 
+void typestk_clear(TypeStk * stack);
+
 #endif /* TYPESTK__H__ */
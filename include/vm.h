@@ -28,6 +28,7 @@
 #include "frmstk.h"
 #include "typestk.h"
 #include "ht.h"
+#include "gsalloc.h"
 
 /* Virtual Machine error codes */
 typedef enum {
@@ -51,6 +52,16 @@ typedef enum {
   VMERR_FILE_WRITE_FAIL,              /* error writing char to file */
   VMERR_FILE_CLOSED,                  /* trying to read or write to closed file */
   VMERR_ARGUMENT_OUT_OF_RANGE,        /* index argument is out of range */
+  VMERR_MEMORY_LIMIT,                 /* alloc would exceed VM memory limit */
+  VMERR_STUB_FAILED,                  /* a stub's function failed to compile */
+  VMERR_NOT_IN_COROUTINE,             /* yield outside of a coroutine */
+  VMERR_COROUTINE_NOT_SUSPENDED,      /* resumed a running or ended coroutine */
+  VMERR_OUT_OF_FUEL,                  /* fuel ran out outside of a coroutine */
+  VMERR_INTERRUPTED,                  /* stopped by vm_interrupt() */
+  VMERR_TIMED_OUT,                    /* run passed its time limit */
+  VMERR_NO_TASK_POOL,                 /* spawn or join without a task pool */
+  VMERR_CHANNEL_CLOSED,               /* send to a closed channel */
+  VMERR_OBJECT_FROZEN,                /* change to a frozen object */
 } VMErr;
 
 /* english translations of vm errors */
@@ -75,8 +86,34 @@ static const char * const vmErrorMessages [] = {
   "Invalid char. Failed to write to file.",
   "Trying to read or write to a closed file.",
   "Argument to native function is out of allowable range",
+  "VM memory limit exceeded",
+  "Function failed to compile on its first call",
+  "Yield called outside of a coroutine",
+  "Coroutine is running or has ended",
+  "Ran out of fuel outside of a coroutine",
+  "Run was interrupted",
+  "Run exceeded its time limit",
+  "No task pool is set for spawn or join",
+  "Send to a closed channel",
+  "Frozen objects can't be changed",
 };
 
+/* VM object memory management modes */
+typedef enum {
+  VMMEM_REFCOUNT,                     /* free objects when refCount hits 0 */
+  VMMEM_GC,                           /* free objects by mark-sweep, see vmgc.c */
+} VMMemMode;
+
+/* garbage collector statistics, see vmgc_stats() */
+typedef struct VMGCStats {
+  size_t cycles;                      /* completed mark-sweep cycles */
+  size_t steps;                       /* incremental steps taken */
+  size_t freed;                       /* objects freed by the collector */
+  size_t objects;                     /* objects currently tracked */
+  double totalPause;                  /* seconds spent in the collector */
+  double maxPause;                    /* longest single step, in seconds */
+} VMGCStats;
+
 typedef struct VMArg {
   char data[VM_VAR_SIZE];
   VarType type;
@@ -84,6 +121,46 @@ typedef struct VMArg {
 
 typedef struct VM VM;
 
+/* arguments of a running native, see op_call_ptr_n(). natives that run
+ * script code, such as join(), nest, and their arguments stay reachable by
+ * the collector until they return
+ */
+typedef struct VMNative {
+  VMArg * args;                       /* the native's arguments */
+  bool * owned;                       /* which args the caller holds
+				       * references for */
+  int argc;                           /* number of args */
+  struct VMNative * caller;           /* native that ran this one, or NULL */
+} VMNative;
+
+/* states of a coroutine, see vmcoro_new() */
+typedef enum {
+  VMCORO_NEW,                         /* not yet resumed */
+  VMCORO_SUSPENDED,                   /* yielded, waiting to be resumed */
+  VMCORO_PREEMPTED,                   /* ran out of fuel, see vm_set_fuel() */
+  VMCORO_RUNNING,                     /* running, or resumed another */
+  VMCORO_DONE,                        /* its function returned */
+  VMCORO_FAILED,                      /* stopped by a VM error */
+} VMCoroState;
+
+/* a resumable run of a function with its own stacks, see vmcoro_new() */
+typedef struct VMCoro VMCoro;
+struct VMCoro {
+  TypeStk * opStk;                /* operand stack, or the resumer's while
+				   * running, see vm_resume() */
+  FrmStk * frmStk;                /* frame stack, or the resumer's */
+  int index;                      /* next instruction, or the resumer's */
+  VMCoroState state;
+  VMArg yielded;                  /* value given to vm_yield() */
+  VMCoro * next;                  /* the VM's list of coroutines */
+  VMCoro * prev;
+};
+
+typedef struct VMLibData VMLibData;
+
+/* threads that run spawn() tasks, see libtask.c */
+typedef struct TaskPool TaskPool;
+
 
 /**
  * The function prototype for a native VM function.
@@ -96,6 +173,23 @@ typedef struct VM VM;
  */
 typedef bool (*VMCallback) (VM * vm, VMArg * arg, int argc);
 
+/**
+ * The function prototype for a stub handler, which compiles a function the
+ * first time an OP_STUB is run in its place. See vm_set_stub_handler().
+ * vm: an instance of VM.
+ * context: the context given to vm_set_stub_handler().
+ * stub: the stub number, the operand of the OP_STUB.
+ * callIndex: the index of the OP_CALL_B that called the function, or -1 if
+ * the function is the entry point.
+ * byteCode: the code being run. Receives the new code if it moved.
+ * byteCodeLen: the length of the code. Receives the new length.
+ * returns: true if the stub was replaced with code for the function, false
+ * if it couldn't be compiled.
+ */
+typedef bool (*VMStubHandler) (VM * vm, void * context, int stub,
+			       int callIndex, char ** byteCode,
+			       size_t * byteCodeLen);
+
 /* VM instance struct */
 struct VM {
   FrmStk * frmStk;                /* the stack of stack frames */
@@ -106,24 +200,130 @@ struct VM {
   int numCallbacks;               /* the number of callbacks in array */
   int index;                      /* current execution index */
   VMErr err;                      /* VM error state */
+  GSAllocator * allocator;        /* allocator for all VM owned memory */
+  GSAllocator * baseAllocator;    /* host allocator wrapped by allocator */
+  GSAllocator accountant;         /* accounting wrapper around baseAllocator */
+  size_t memUsed;                 /* live bytes allocated through allocator */
+  size_t memPeak;                 /* high water mark of memUsed */
+  size_t memLimit;                /* max memUsed, or 0 for no limit */
+  bool memLimitHit;               /* latest alloc was refused by memLimit */
+  VMMemMode memMode;              /* how VMLibData objects are freed */
+  bool gcPending;                 /* collector has work at next safe point */
+  char gcEpoch;                   /* mark value of the current gc cycle */
+  VMLibData * gcObjects;          /* list of all collector owned objects */
+  VMLibData ** gcSweep;           /* sweep cursor, NULL if not sweeping */
+  size_t gcThreshold;             /* start a cycle at this many objects */
+  size_t gcAllocBytes;            /* bytes allocated since the last cycle */
+  size_t gcByteThreshold;         /* or once this many bytes are allocated */
+  bool gcFull;                    /* next safe point runs a full cycle */
+  VMLibData ** gcRoots;           /* host registered root objects */
+  int gcNumRoots;                 /* number of roots in gcRoots */
+  int gcRootsSize;                /* capacity of gcRoots */
+  VMGCStats gcStats;              /* collector statistics */
+  VMStubHandler stubHandler;      /* compiles functions on first call */
+  void * stubContext;             /* context of stubHandler */
+  char * movedCode;               /* code to continue in after a native
+				   * call, see vm_code_moved() */
+  size_t movedCodeLen;            /* length of movedCode */
+  VMCoro * coro;                  /* running coroutine, or NULL */
+  VMCoro * coros;                 /* every coroutine, for the collector */
+  bool yielding;                  /* a native yielded the running coroutine */
+  int fuel;                       /* backward jumps and calls until the
+				   * next vm_refuel() */
+  int fuelReserve;                /* fuel not yet loaded into fuel */
+  int fuelLimit;                  /* fuel per run, or 0 for no limit */
+  double timeout;                 /* seconds per run, or 0 for no limit */
+  double deadline;                /* clock time that the run must end by */
+  int interrupted;                /* set by vm_interrupt() from any thread */
+  TaskPool * taskPool;            /* runs spawn() tasks, or NULL */
+  VMNative * native;              /* the running native, or NULL */
+  bool preempted;                 /* the running coroutine ran out of fuel */
 };
 
 
-typedef struct VMLibData VMLibData;
+VM * vm_new(size_t stackSize, int callbacksSize, GSAllocator * allocator,
+	    VMMemMode memMode);
+
+VM * vm_new_shared(size_t stackSize, VMCallback * callbacks, int numCallbacks,
+		   GSAllocator * allocator, VMMemMode memMode);
 
-VM * vm_new(size_t stackSize, int callbacksSize);
+void vm_reset(VM * vm);
+
+void vm_reset_failed(VM * vm);
+
+VMCoro * vmcoro_new(VM * vm, size_t stackSize, int startIndex,
+		    int numVarArgs, VMArg * args, int argc);
+
+VMCoroState vmcoro_state(VMCoro * coro);
+
+void vmcoro_free(VM * vm, VMCoro * coro);
+
+bool vm_resume(VM * vm, VMCoro * coro, char * byteCode, size_t byteCodeLen,
+	       VMArg * value, VMArg * result);
+
+bool vm_yield(VM * vm, VMArg value);
 
 bool vm_exec(VM * vm, char * byteCode,
 	     size_t byteCodeLen, int startIndex, int numArgs);
 
+bool vm_call(VM * vm, char * byteCode, size_t byteCodeLen, int startIndex,
+	     int numVarArgs, VMArg * args, int argc, VMArg * result);
+
+int vm_call_batch(VM * vm, char * byteCode, size_t byteCodeLen,
+		  int startIndex, int numVarArgs, VMArg * args, int argc,
+		  VMArg * results, int numCalls);
+
 bool vm_reg_callback(VM * vm, char * name, size_t nameLen, VMCallback callback);
 
 VMCallback vm_callback_from_index(VM * vm, int index);
 
 int vm_callback_index(VM * vm, char * name, size_t nameLen);
+int vm_callback_lookup(VM * vm, char * name, size_t nameLen);
+
+size_t vm_callback_name(VM * vm, int index, char * nameBuf, size_t nameBufLen);
 
 int vm_num_callbacks(VM * vm);
 
+void vm_set_stub_handler(VM * vm, VMStubHandler handler, void * context);
+
+void vm_code_moved(VM * vm, char * byteCode, size_t byteCodeLen);
+
+void vm_set_task_pool(VM * vm, TaskPool * pool);
+
+TaskPool * vm_task_pool(VM * vm);
+
+GSAllocator * vm_allocator(VM * vm);
+
+GSAllocator * vm_base_allocator(VM * vm);
+
+void vm_mem_adopt(VM * vm, size_t size);
+
+void vm_mem_disown(VM * vm, size_t size);
+
+bool vm_native_arg_unique(VM * vm, VMArg * arg, int index);
+
+void vm_set_mem_limit(VM * vm, size_t limit);
+
+size_t vm_mem_limit(VM * vm);
+
+void vm_set_fuel(VM * vm, int fuel);
+
+int vm_fuel(VM * vm);
+
+void vm_set_timeout(VM * vm, double seconds);
+
+double vm_timeout(VM * vm);
+
+void vm_interrupt(VM * vm);
+
+bool vm_poll_interrupt(VM * vm);
+
+size_t vm_mem_used(VM * vm);
+
+size_t vm_mem_peak(VM * vm);
+
+int vm_op_size(char * byteCode, size_t byteCodeLen, int index);
+
 void vm_set_err(VM * vm, VMErr err);
 
 VMErr vm_get_err(VM * vm);
@@ -142,10 +342,20 @@ bool vmarg_boolean(VMArg arg, bool * success);
 
 char * vmarg_string(VMArg arg);
 
-VMLibData * vmarg_new_string(char * string, size_t stringLen);
+VMLibData * vmarg_new_string(VM * vm, char * string, size_t stringLen);
 
 bool vmarg_is_string(VMArg arg) ;
 
+VMArg vmarg_make_number(double value);
+
+VMArg vmarg_make_boolean(bool value);
+
+VMArg vmarg_make_null();
+
+VMArg vmarg_make_libdata(VMLibData * data);
+
+void vmarg_release(VM * vm, VMArg arg);
+
 bool vmarg_push_libdata(VM * vm, VMLibData * data);
 
 bool vmarg_push_number(VM * vm, double value);
@@ -156,6 +366,15 @@ bool vmarg_push_null(VM * vm);
 
 /* define built in LIBDATA object types */
 #define VM_LIBDATA_TYPELEN    10
+/* maximum number of distinct LIBDATA types that may be registered */
+#define VM_LIBDATA_MAXTYPES   32
+/* returned by vmlibdata_type_register() when the type table is full */
+#define VM_LIBDATA_TYPE_INVALID  -1
+
+/* a small integer that identifies a registered LIBDATA type. Comparing two
+ * VMLibDataTypes is a single integer compare, unlike the type strings.
+ */
+typedef int VMLibDataType;
 
 
 /**
@@ -173,16 +392,34 @@ typedef void (*VMLibDataCleanupCallback) (VM * vm, VMLibData * data);
 
 /* a library data type struct */
 struct VMLibData {
-  char type[VM_LIBDATA_TYPELEN];          /* a type identifier */
+  VMLibDataType type;                     /* a registered type identifier */
   void * libData;                         /* pointer to library data */
   int refCount;                           /* # refs to this object */
   VMLibDataCleanupCallback cleanupCallback;
+  VMLibData * gcNext;                     /* next object in gc list */
+  char gcMark;                            /* gc mark, see vmgc.c */
+  bool frozen;                            /* shared between threads, and
+					   * refCount is atomic. see
+					   * vmlibdata_freeze() */
+  GSAllocator * frozenAllocator;          /* frees a frozen object */
+#ifdef VM_CHECK_REFCOUNTS
+  int checkRefs;                          /* refs counted by checker */
+  int checkVarRefs;                       /* var slot refs counted */
+#endif /* VM_CHECK_REFCOUNTS */
 };
 
 
-VMLibData * vmlibdata_new(char * type, size_t typeLen,
+VMLibDataType vmlibdata_type_register(char * type, size_t typeLen);
+
+const char * vmlibdata_type_name(VMLibData * data);
+
+VMLibData * vmlibdata_new(VM * vm, char * type, size_t typeLen,
 			  VMLibDataCleanupCallback cleanupCallback, void * libData);
 
+VMLibData * vmlibdata_new_typed(VM * vm, VMLibDataType type,
+				VMLibDataCleanupCallback cleanupCallback,
+				void * libData);
+
 void * vmlibdata_data(VMLibData * data);
 
 void vmlibdata_set_data(VMLibData * data, void * setData);
@@ -193,8 +430,18 @@ void vmlibdata_dec_refcount(VMLibData * data);
 
 void vmlibdata_check_cleanup(VM * vm, VMLibData * data);
 
+void vmlibdata_release(VM * vm, VMLibData * data);
+
+bool vmlibdata_freeze(VM * vm, VMLibData * data);
+
+bool vmlibdata_is_frozen(VMLibData * data);
+
+bool vmlibdata_can_share(VM * vm, VMLibData * data);
+
 bool vmlibdata_is_type(VMLibData * data, char * type, size_t typeLen);
 
+bool vmlibdata_is_typeid(VMLibData * data, VMLibDataType type);
+
 void vmlibdata_free(VM * vm, VMLibData * data);
 
 VMLibData * vmarg_libdata(VMArg arg);
@@ -80,6 +80,8 @@ typedef enum {
   OP_AND,
   OP_OR,
   OP_NULL_PUSH,
+  OP_VAR_PUSH_B, /* 30 */
+  OP_STUB,
 } OpCode;
 
 #endif /* VMDEFS__H__ */
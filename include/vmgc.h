@@ -0,0 +1,55 @@
+/**
+ * vmgc.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * See vmgc.c for description.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VMGC__H__
+#define VMGC__H__
+
+#include "vm.h"
+
+/* objects tracked before the first cycle starts */
+#define VMGC_INITIAL_THRESHOLD     256
+/* objects visited by each incremental sweep step */
+#define VMGC_SWEEP_STEP            64
+/* bytes allocated before the first cycle starts */
+#define VMGC_INITIAL_BYTES         (256 * 1024)
+
+void vmgc_track(VM * vm, VMLibData * data);
+
+void vmgc_step(VM * vm);
+
+void vmgc_account(VM * vm, size_t size);
+
+bool vmgc_reclaim(VM * vm, size_t size);
+
+void vmgc_collect(VM * vm);
+
+bool vmgc_add_root(VM * vm, VMLibData * data);
+
+bool vmgc_remove_root(VM * vm, VMLibData * data);
+
+void vmgc_stats(VM * vm, VMGCStats * stats);
+
+void vmgc_free_all(VM * vm);
+
+#endif /* VMGC__H__ */
@@ -0,0 +1,58 @@
+/**
+ * vmpool.h
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Thread safe pool of reusable execution contexts. See vmpool.c.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VMPOOL__H__
+#define VMPOOL__H__
+
+#include <pthread.h>
+#include "execcontext.h"
+#include "program.h"
+#include "gsalloc.h"
+
+/* a pool of idle execution contexts for one program */
+typedef struct VMPool {
+  Program * program;              /* retained until vmpool_free() */
+  ExecContext ** idle;            /* reset contexts, ready for checkout */
+  int numIdle;
+  int maxIdle;                    /* size of idle */
+  size_t stackSize;               /* frame stack size of new contexts */
+  VMMemMode memMode;              /* memory mode of new contexts */
+  GSAllocator * allocator;
+  pthread_mutex_t lock;           /* guards idle and numIdle */
+} VMPool;
+
+VMPool * vmpool_new(Program * program, int maxIdle, size_t stackSize,
+		    GSAllocator * allocator, VMMemMode memMode);
+
+ExecContext * vmpool_checkout(VMPool * pool);
+
+void vmpool_checkin(VMPool * pool, ExecContext * context);
+
+int vmpool_call_batch(VMPool * pool, CompilerFunc * function, VMArg * args,
+		      int argc, VMArg * results, int numCalls,
+		      int numThreads, VMErr * err);
+
+void vmpool_free(VMPool * pool);
+
+#endif /* VMPOOL__H__ */
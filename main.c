@@ -32,8 +32,18 @@
 #include "libsys.h"
 #include "ht.h"
 #include <string.h>
+#include <unistd.h>
 #include "gunderscript.h"
 
+/* file extension of precompiled bytecode files */
+#define GXC_EXTENSION      ".gxc"
+/* environment variable that enables the compile cache in this directory */
+#define CACHE_DIR_ENV      "GUNDERSCRIPT_CACHE"
+/* environment variable that sets the number of threads to compile on */
+#define BUILD_THREADS_ENV  "GUNDERSCRIPT_THREADS"
+/* environment variable that compiles each function on its first call */
+#define LAZY_ENV           "GUNDERSCRIPT_LAZY"
+
 static void print_help() {
   printf("Gunderscript Scripting Environment ");
   
@@ -58,6 +68,14 @@ static void print_help() {
   printf("Build date unavaiable; Not compiled with GCC;\n\n");
 #endif /* defined(__linux__) */
   printf("Usage: gunderscript [entrypoint] [scripts]\n");
+  printf("       gunderscript [entrypoint] [precompiled.gxc]\n");
+  printf("       gunderscript -c [output.gxc] [scripts]\n");
+  printf("Set %s to a directory to cache compiled scripts.\n", CACHE_DIR_ENV);
+  printf("Set %s to the number of threads to compile on.\n",
+	 BUILD_THREADS_ENV);
+  printf("Set %s to 1 to compile functions on their first call,\n",
+	 LAZY_ENV);
+  printf("unless %s is set.\n", CACHE_DIR_ENV);
   /*printf("  -s [stackSize]         : sets the size of the stack in bytes\n");*/
 }
 
@@ -73,6 +91,18 @@ static void print_exec_fail() {
   printf("Error compiling and executing bytecode.");
 }
 
+static void print_image_error(Gunderscript * ginst, char * file) {
+  printf("%s: %s\n", file, gxcfile_err_to_string(gunderscript_image_err(ginst)));
+}
+
+/* checks if a file name ends with the precompiled bytecode extension */
+static bool is_precompiled(char * file) {
+  size_t len = strlen(file);
+  size_t extLen = strlen(GXC_EXTENSION);
+
+  return len > extLen && strcmp(file + len - extLen, GXC_EXTENSION) == 0;
+}
+
 /*static void process_arguments(int argc, char * argv[], size_t * stackSize) {
 
   int i = 0;
@@ -136,6 +166,22 @@ static void print_compile_error(Gunderscript * ginst) {
   printf("Compiler Error: %s\n", gunderscript_err_message(ginst));
 }
 
+/* gets the number of threads to compile on */
+static int build_threads() {
+  char * threads = getenv(BUILD_THREADS_ENV);
+
+  if(threads != NULL && atoi(threads) > 0) {
+    return atoi(threads);
+  }
+
+#ifdef _SC_NPROCESSORS_ONLN
+  if(sysconf(_SC_NPROCESSORS_ONLN) > 0) {
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+#endif /* defined(_SC_NPROCESSORS_ONLN) */
+  return 1;
+}
+
 static void print_exec_error(Gunderscript * ginst) {
   printf("\n\nVM Error: %i\n", gunderscript_function_err(ginst));
   printf("Virtual Machine Error: %s\n", gunderscript_err_message(ginst));
@@ -145,16 +191,46 @@ int main(int argc, char * argv[]) {
   Gunderscript ginst;
   size_t stackSize = 100000;
   int callbacksSize = 55;
+  bool compileOnly = false;
+  char * cacheDir = getenv(CACHE_DIR_ENV);
+  char * lazy = getenv(LAZY_ENV);
+  char ** files = NULL;
+  size_t * fileLens = NULL;
+  int numFiles = 0;
+  int errFile = 0;
   int i = 0;
+  int j;
 
   /* process_arguments(argc, argv, &stackSize); */
 
   /* initialize gunderscript object */
-  if(!gunderscript_new(&ginst, stackSize, callbacksSize)) {
+  if(!gunderscript_new(&ginst, stackSize, callbacksSize, NULL,
+		       VMMEM_REFCOUNT)) {
     print_alloc_error();
     return 1;
   }
 
+  /* opt into the compile cache */
+  if(cacheDir != NULL && cacheDir[0] != '\0'
+     && !gunderscript_set_cache(&ginst, cacheDir)) {
+    print_alloc_error();
+    gunderscript_free(&ginst);
+    return 1;
+  }
+
+  /* opt into lazy compilation. the cache stores whole compiled scripts, so
+   * the two can't be combined, and the cache wins
+   */
+  if(lazy != NULL && atoi(lazy) > 0) {
+    if(cacheDir != NULL && cacheDir[0] != '\0') {
+      printf("%s is ignored because %s is set.\n", LAZY_ENV, CACHE_DIR_ENV);
+    } else if(!gunderscript_set_lazy(&ginst, true)) {
+      print_alloc_error();
+      gunderscript_free(&ginst);
+      return 1;
+    }
+  }
+
   /* check for proper number of arguments */
   if(argc < 2) {
     print_help();
@@ -162,17 +238,71 @@ int main(int argc, char * argv[]) {
     return 1;
   }
 
-  /* compile scripts one-by-one */
-  for(i = 2; i < argc; i++) {
-    size_t fileLen = 0;
-    char * fileContents = load_file(argv[i], &fileLen);
-    printf("File Length: %i chars\n", (int)fileLen);
-    if(!gunderscript_build(&ginst, fileContents, fileLen)) {
+  /* -c: compile the scripts to a bytecode file instead of running them */
+  if(strcmp(argv[1], "-c") == 0) {
+    if(argc < 4) {
+      print_help();
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    compileOnly = true;
+  }
+
+  /* run a precompiled bytecode file without compiling */
+  if(!compileOnly && argc == 3 && is_precompiled(argv[2])) {
+    if(!gunderscript_load(&ginst, argv[2])) {
+      print_image_error(&ginst, argv[2]);
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    i = argc;
+  } else {
+    i = compileOnly ? 3 : 2;
+  }
+
+  /* load the scripts and compile them all at once */
+  if(i < argc) {
+    numFiles = argc - i;
+    files = calloc(numFiles, sizeof(char*));
+    fileLens = calloc(numFiles, sizeof(size_t));
+    if(files == NULL || fileLens == NULL) {
+      print_alloc_error();
+      return 1;
+    }
+
+    for(j = 0; j < numFiles; j++) {
+      files[j] = load_file(argv[i + j], &fileLens[j]);
+      printf("File Length: %i chars\n", (int)fileLens[j]);
+    }
+
+    if(!gunderscript_build_files(&ginst, files, fileLens, numFiles,
+				 build_threads(), &errFile)) {
       print_compile_error(&ginst);
+      printf("In file: %s\n", argv[i + errFile]);
       print_build_fail();
       return 1;
     }
-    free(fileContents);
+
+    for(j = 0; j < numFiles; j++) {
+      free(files[j]);
+    }
+    free(files);
+    free(fileLens);
+  }
+
+  /* save the compiled scripts and exit */
+  if(compileOnly) {
+    if(!gunderscript_save(&ginst, argv[2])) {
+      if(gunderscript_build_err(&ginst) != COMPILERERR_SUCCESS) {
+	print_compile_error(&ginst);
+      } else {
+	print_image_error(&ginst, argv[2]);
+      }
+      gunderscript_free(&ginst);
+      return 1;
+    }
+    gunderscript_free(&ginst);
+    return 0;
   }
 
   printf("Script output:\n\n");
@@ -180,6 +310,11 @@ int main(int argc, char * argv[]) {
   /* execute the desired entry point */
   if(!gunderscript_function(&ginst, argv[1], strlen(argv[1]))) {
     print_exec_error(&ginst);
+
+    /* a function compiled on its first call had an error */
+    if(gunderscript_build_err(&ginst) != COMPILERERR_SUCCESS) {
+      print_compile_error(&ginst);
+    }
     print_exec_fail();
     return 1;
   }
@@ -30,26 +30,31 @@
  * initialSize: the initial size of the new buffer in chars.
  * blockSize: the number of bytes to add to the buffer each time it fills up and
  * needs to be expanded.
+ * allocator: the allocator to use for the buffer, or NULL for the default.
  * returns: a new buffer, or NULL if the malloc fails.
  */
-Buffer * buffer_new(int initialSize, int blockSize) {
+Buffer * buffer_new(int initialSize, int blockSize, GSAllocator * allocator) {
 
   assert(initialSize > 0);
   assert(blockSize > 0);
 
   /* allocate buffer struct */
-  Buffer * buffer = (Buffer*)calloc(1, sizeof(Buffer));
+  Buffer * buffer = (Buffer*)gsalloc_calloc(allocator, 1, sizeof(Buffer));
   if(buffer == NULL) {
     return NULL;
   }
 
-  /* allocate data for buffer */
-  buffer->buffer = (void*) calloc(initialSize, sizeof(char));
+  /* allocate data for buffer...one bigger so last char can act as null
+   * terminator for string
+   */
+  buffer->buffer = (void*) gsalloc_calloc(allocator, initialSize + 1,
+					  sizeof(char));
   if(buffer->buffer == NULL) {
-    free(buffer);
+    gsalloc_free(allocator, buffer, sizeof(Buffer));
     return NULL;
   }
 
+  buffer->allocator = allocator;
   buffer->blockSize = blockSize;
   buffer->currentSize = initialSize;
 
@@ -64,19 +69,22 @@ Buffer * buffer_new(int initialSize, int blockSize) {
  */
 bool buffer_resize(Buffer * buffer, int newSize) {
 
-  /* alloc memory and check for failure...buffer is one bigger so last char
+  /* realloc memory and check for failure...buffer is one bigger so last char
    * can act as null terminator for string
    */
-  void * newBuffer = calloc(newSize + 1, sizeof(char));
+  char * newBuffer = gsalloc_realloc(buffer->allocator, buffer->buffer,
+				     buffer->currentSize + 1, newSize + 1);
   if(newBuffer == NULL) {
     return false;
   }
 
-  /* copy data from old buffer to new one */
-  memcpy(newBuffer, buffer->buffer, buffer->index);
+  /* clear anything truncated off of the end when shrinking */
+  if(buffer->index > newSize) {
+    buffer->index = newSize;
+  }
+  newBuffer[newSize] = '\0';
 
-  /* free old buffer and replace with new one*/
-  free(buffer->buffer);
+  /* replace old buffer with new one */
   buffer->buffer = newBuffer;
   buffer->currentSize = newSize;
 
@@ -90,8 +98,7 @@ bool buffer_resize(Buffer * buffer, int newSize) {
  */
 bool buffer_append_char(Buffer * buffer, char c) {
   assert(buffer != NULL);
-  buffer_set_char(buffer, c, buffer->index);
-  return true;
+  return buffer_set_char(buffer, c, buffer->index);
 }
 
 /**
@@ -111,8 +118,7 @@ char * buffer_get_buffer(Buffer * buffer) {
  * returns: true upon success, and false on malloc error.
  */
 bool buffer_append_string(Buffer * buffer, char * input, int inputLen) {
-  buffer_set_string(buffer, input, inputLen, buffer->index);
-  return true;
+  return buffer_set_string(buffer, input, inputLen, buffer->index);
 }
 
 /**
@@ -180,12 +186,44 @@ int buffer_buffer_size(Buffer * buffer) {
   return buffer->currentSize;
 }
 
+/**
+ * Empties the buffer without releasing its memory so that it can be reused.
+ * buffer: an instance of buffer.
+ */
+void buffer_clear(Buffer * buffer) {
+  assert(buffer != NULL);
+  memset(buffer->buffer, 0, buffer->index);
+  buffer->index = 0;
+}
+
+/**
+ * Gets the number of bytes that the buffer has allocated, including itself.
+ * buffer: an instance of buffer.
+ * returns: the number of bytes.
+ */
+size_t buffer_mem_size(Buffer * buffer) {
+  assert(buffer != NULL);
+  return sizeof(Buffer) + buffer->currentSize + 1;
+}
+
+/**
+ * Hands the buffer's memory to another allocator, which must be able to free
+ * blocks from the current one, e.g. a VM's allocator and its host allocator.
+ * buffer: an instance of buffer.
+ * allocator: the allocator to resize and free the buffer with from now on.
+ */
+void buffer_set_allocator(Buffer * buffer, GSAllocator * allocator) {
+  assert(buffer != NULL);
+  assert(allocator != NULL);
+  buffer->allocator = allocator;
+}
+
 /**
  * Frees an instance of buffer.
  */
 void buffer_free(Buffer * buffer) {
   assert(buffer != NULL);
 
-  free(buffer->buffer);
-  free(buffer);
+  gsalloc_free(buffer->allocator, buffer->buffer, buffer->currentSize + 1);
+  gsalloc_free(buffer->allocator, buffer, sizeof(Buffer));
 }
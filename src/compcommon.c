@@ -26,6 +26,16 @@
 #include "lexer.h"
 #include "langkeywords.h"
 #include <assert.h>
+#include <string.h>
+
+/* TODO: make STK type auto enlarge and remove */
+static const int initialOpStkDepth = 100;
+/* number of items to add to the op stack on resize */
+static const int opStkBlockSize = 12;
+/* number of expression nesting levels to allocate stacks for at first */
+static const int exprStksInitSize = 4;
+/* initial number of entries in a symbol table, must be a power of two */
+static const int symTblInitSize = 16;
 
 /**
  * Gets the OP code associated with an operation from its string representation.
@@ -35,37 +45,37 @@
  */
 OpCode operator_to_opcode(char * operator, size_t len) {
 
-  /* TODO: improve running time complexity */
-  if(tokens_equal(operator, len, LANG_OP_ADD, LANG_OP_ADD_LEN)) {
+  switch(lang_keyword(operator, len)) {
+  case LANGKW_OP_ADD:
     return OP_ADD;
-  } else if(tokens_equal(operator, len, LANG_OP_SUB, LANG_OP_SUB_LEN)) {
+  case LANGKW_OP_SUB:
     return OP_SUB;
-  } else if(tokens_equal(operator, len, LANG_OP_MUL, LANG_OP_MUL_LEN)) {
+  case LANGKW_OP_MUL:
     return OP_MUL;
-  } else if(tokens_equal(operator, len, LANG_OP_DIV, LANG_OP_DIV_LEN)) {
+  case LANGKW_OP_DIV:
     return OP_DIV;
-  } else if(tokens_equal(operator, len, LANG_OP_EQUALS, LANG_OP_EQUALS_LEN)) {
+  case LANGKW_OP_EQUALS:
     return OP_EQUALS;
-  } else if(tokens_equal(operator, len, LANG_OP_NOT_EQUALS, LANG_OP_NOT_EQUALS_LEN)) {
+  case LANGKW_OP_NOT_EQUALS:
     return OP_NOT_EQUALS;
-  } else if(tokens_equal(operator, len, LANG_OP_LT, LANG_OP_LT_LEN)) {
+  case LANGKW_OP_LT:
     return OP_LT;
-  } else if(tokens_equal(operator, len, LANG_OP_GT, LANG_OP_GT_LEN)) {
+  case LANGKW_OP_GT:
     return OP_GT;
-  } else if(tokens_equal(operator, len, LANG_OP_LTE, LANG_OP_LTE_LEN)) {
+  case LANGKW_OP_LTE:
     return OP_LTE;
-  } else if(tokens_equal(operator, len, LANG_OP_GTE, LANG_OP_GTE_LEN)) {
+  case LANGKW_OP_GTE:
     return OP_GTE;
-  } else if(tokens_equal(operator, len, LANG_OP_AND, LANG_OP_AND_LEN)) {
+  case LANGKW_OP_AND:
     return OP_AND;
-  } else if(tokens_equal(operator, len, LANG_OP_OR, LANG_OP_OR_LEN)) {
+  case LANGKW_OP_OR:
     return OP_OR;
-  } else if(tokens_equal(operator, len, LANG_OP_MOD, LANG_OP_MOD_LEN)) {
+  case LANGKW_OP_MOD:
     return OP_MOD;
+  default:
+    /* unknown operator */
+    return -1;
   }
-
-  /* unknown operator */
-  return -1;
 }
 
 /**
@@ -88,62 +98,55 @@ bool tokens_equal(char * token1, size_t num1,
 }
 
 /**
- * Gets the top symbol table from the symbol table stack and returns a pointer,
- * without actually removing the table from the stack. This function is useful
- * for getting a reference to the current frame's symbol table so that you can
- * look up its symbols.
+ * Gets a symbol table from the symbol table stack without removing it. This
+ * function is useful for getting a reference to the current frame's symbol
+ * table so that you can look up its symbols.
  * c: an instance of Compiler.
- * returns: a pointer to the top symbol table hashtable, or NULL if the stack
- * is empty.
+ * offset: the number of tables down from the top of the stack.
+ * returns: a pointer to the symbol table, or NULL if the stack has no table
+ * at offset.
  */
-HT * symtblstk_peek(Compiler * c, int offset) {
-  DSValue value;
+SymTbl * symtblstk_peek(Compiler * c, int offset) {
+  SymTbl * tbl = c->symTbls;
 
-  /* check that peek was success */
-  if(!stk_peek_offset(c->symTableStk, offset, &value)) {
-    return NULL;
+  for(; tbl != NULL && offset > 0; offset--) {
+    tbl = tbl->parent;
   }
 
-  return value.pointerVal;
+  return tbl;
 }
 
 /**
- * Place holder for a function that gets the precedence of an operator.
+ * Gets the precedence of an operator.
  * operator: the operator to check for precedence.
  * operatorLen: the number of characters to read from operator as the operator.
- * TODO: possibly reimplement using a hash set for multicharacter operators.
  * returns: an integer that represents an operator's precedence. Higher is
  * greater. Returns 1 if unknown operator.
  */
 int operator_precedence(char * operator, size_t operatorLen) {
 
-  if(operatorLen == 1) {
-    switch(operator[0]) {
-    case '*':
-    case '/':
-    case '%':
-      return 5;
-    case '+':
-    case '-':
-      return 4;
-    case '<':
-    case '>':
-      return 3;
-    }
-  } else {
-    if(tokens_equal(operator, operatorLen, LANG_OP_EQUALS, LANG_OP_EQUALS_LEN)
-       || (tokens_equal(operator, operatorLen, LANG_OP_NOT_EQUALS, LANG_OP_NOT_EQUALS_LEN))) {
-      return 2; /* ==  or != */
-    } else if(tokens_equal(operator, operatorLen, LANG_OP_LTE, LANG_OP_LTE_LEN)
-	      || tokens_equal(operator, operatorLen, LANG_OP_GTE, LANG_OP_GTE_LEN)) {
-      return 3; /* <= or >=*/
-    } else if(tokens_equal(operator, operatorLen, LANG_OP_AND, LANG_OP_AND_LEN)
-	      || tokens_equal(operator, operatorLen, LANG_OP_OR, LANG_OP_OR_LEN)) {
-      return 1; /* && or ||*/
-    }
+  switch(lang_keyword(operator, operatorLen)) {
+  case LANGKW_OP_MUL:
+  case LANGKW_OP_DIV:
+  case LANGKW_OP_MOD:
+    return 5;
+  case LANGKW_OP_ADD:
+  case LANGKW_OP_SUB:
+    return 4;
+  case LANGKW_OP_LT:
+  case LANGKW_OP_GT:
+  case LANGKW_OP_LTE:
+  case LANGKW_OP_GTE:
+    return 3;
+  case LANGKW_OP_EQUALS:
+  case LANGKW_OP_NOT_EQUALS:
+    return 2;
+  case LANGKW_OP_AND:
+  case LANGKW_OP_OR:
+    return 1;
+  default:
+    return 1;
   }
-
-  return 1;
 }
 
 /**
@@ -197,48 +200,426 @@ int topstack_type(TypeStk * stk, Stk * lenStk) {
 }
 
 
+/**
+ * Hashes a variable name for the symbol tables (32 bit FNV-1a).
+ * name: the variable name.
+ * len: the length of name.
+ * returns: the hash.
+ */
+static unsigned long symtbl_hash(char * name, size_t len) {
+  unsigned long hash = 2166136261UL;
+  size_t i;
+
+  for(i = 0; i < len; i++) {
+    hash = ((hash ^ (unsigned char)name[i]) * 16777619UL) & 0xFFFFFFFFUL;
+  }
+
+  return hash;
+}
+
+/**
+ * Finds the entry for a variable, or the empty entry where it belongs.
+ * entries: the entries of a symbol table.
+ * capacity: the number of entries, a power of two.
+ * name: the variable name.
+ * len: the length of name.
+ * returns: the entry.
+ */
+static SymTblEntry * symtbl_find(SymTblEntry * entries, int capacity,
+				 char * name, size_t len) {
+  unsigned long mask = capacity - 1;
+  unsigned long i = symtbl_hash(name, len) & mask;
+
+  /* linear probe, the table is never full */
+  while(entries[i].name != NULL
+	&& (entries[i].len != len
+	    || memcmp(entries[i].name, name, len) != 0)) {
+    i = (i + 1) & mask;
+  }
+
+  return &entries[i];
+}
+
+/**
+ * Doubles the number of entries in a symbol table. The old entries stay in
+ * the arena until the compiler is freed, the table keeps the new ones when it
+ * is reused.
+ * c: an instance of Compiler.
+ * tbl: the symbol table.
+ * returns: true if success, false if an allocation failure occurs.
+ */
+static bool symtbl_grow(Compiler * c, SymTbl * tbl) {
+  int newCapacity = tbl->capacity * 2;
+  SymTblEntry * newEntries = gsarena_calloc(c->arena, newCapacity,
+					    sizeof(SymTblEntry));
+  int i;
+
+  if(newEntries == NULL) {
+    return false;
+  }
+
+  for(i = 0; i < tbl->capacity; i++) {
+    if(tbl->entries[i].name != NULL) {
+      *symtbl_find(newEntries, newCapacity, tbl->entries[i].name,
+		   tbl->entries[i].len) = tbl->entries[i];
+    }
+  }
+
+  tbl->entries = newEntries;
+  tbl->capacity = newCapacity;
+  return true;
+}
+
+/**
+ * Adds a variable to a symbol table. Its index is the number of variables
+ * that were in the table before it. The name is not copied, it must remain
+ * valid until the table is popped.
+ * c: an instance of Compiler.
+ * tbl: the symbol table.
+ * name: the variable name.
+ * len: the length of name.
+ * prevExisted: set to true if the variable was already in the table, in which
+ * case it is left unchanged.
+ * returns: true if success, false if an allocation failure occurs.
+ */
+bool symtbl_put(Compiler * c, SymTbl * tbl, char * name, size_t len,
+		bool * prevExisted) {
+  SymTblEntry * entry;
+
+  assert(tbl != NULL);
+  assert(name != NULL);
+
+  /* keep the load factor at or below 3/4 */
+  if((tbl->size + 1) * 4 > tbl->capacity * 3 && !symtbl_grow(c, tbl)) {
+    return false;
+  }
+
+  entry = symtbl_find(tbl->entries, tbl->capacity, name, len);
+  *prevExisted = entry->name != NULL;
+  if(!*prevExisted) {
+    entry->name = name;
+    entry->len = len;
+    entry->index = tbl->size++;
+  }
+
+  return true;
+}
+
+/**
+ * Looks up a variable in a symbol table.
+ * tbl: the symbol table.
+ * name: the variable name.
+ * len: the length of name.
+ * index: receives the slot of the variable in its frame.
+ * returns: true if the variable is in the table, false if not.
+ */
+bool symtbl_get(SymTbl * tbl, char * name, size_t len, int * index) {
+  SymTblEntry * entry;
+
+  assert(tbl != NULL);
+
+  /* parsers may look up a NULL token after a lexer error */
+  if(name == NULL) {
+    return false;
+  }
+
+  entry = symtbl_find(tbl->entries, tbl->capacity, name, len);
+  if(entry->name == NULL) {
+    return false;
+  }
+
+  *index = entry->index;
+  return true;
+}
+
 /**
  * Pushes a new symbol table onto the stack of symbol tables. The symbol table
  * is a structure that contains records of all variables and their respective
  * locations in the stack in the VM. The symbol table's position in the stack
- * represents the VM stack frame's position in the stack as well.
+ * represents the VM stack frame's position in the stack as well. Tables are
+ * allocated from the compiler's arena and reused after they are popped.
  * c: an instance of Compiler that will receive the new frame.
  * returns: true if success, false if an allocation failure occurs.
  */
 bool symtblstk_push(Compiler * c) {
+  SymTbl * symTbl;
 
   assert(c != NULL);
 
-  HT * symTbl = ht_new(COMPILER_INITIAL_HTSIZE, COMPILER_HTBLOCKSIZE, COMPILER_HTLOADFACTOR);
+  /* reuse a popped table if there is one */
+  if(c->freeSymTbls != NULL) {
+    symTbl = c->freeSymTbls;
+    c->freeSymTbls = symTbl->parent;
+  } else {
+    symTbl = gsarena_alloc(c->arena, sizeof(SymTbl));
+    if(symTbl == NULL) {
+      return false;
+    }
+
+    symTbl->entries = gsarena_calloc(c->arena, symTblInitSize,
+				     sizeof(SymTblEntry));
+    if(symTbl->entries == NULL) {
+      return false;
+    }
+    symTbl->capacity = symTblInitSize;
+    symTbl->size = 0;
+  }
+
+  symTbl->parent = c->symTbls;
+  c->symTbls = symTbl;
+  return true;
+}
+
+/**
+ * Removes the top symbol table from the symbol table stack. The table is
+ * emptied and kept for reuse by symtblstk_push().
+ * c: an instance of Compiler.
+ */
+void symtblstk_pop(Compiler * c) {
+  SymTbl * symTbl = c->symTbls;
 
-  /* check that hashtable was successfully allocated */
   if(symTbl == NULL) {
+    return;
+  }
+
+  c->symTbls = symTbl->parent;
+
+  memset(symTbl->entries, 0, symTbl->capacity * sizeof(SymTblEntry));
+  symTbl->size = 0;
+  symTbl->parent = c->freeSymTbls;
+  c->freeSymTbls = symTbl;
+}
+
+/*
+ * Borrow sites: every variable read is compiled as OP_VAR_PUSH, which gives
+ * the operand stack its own reference to objects, and its offset is recorded
+ * as a pending borrow site. If the value is consumed at a statement boundary
+ * (OP_POP, a conditional jump) without an OP_CALL_B or OP_FRM_POP in between,
+ * nothing can release the variable's reference while the value is on the stack
+ * and the pending sites are committed, patching them into OP_VAR_PUSH_B, which
+ * skips the reference count traffic. Otherwise they are discarded and remain
+ * OP_VAR_PUSH. See the invariant in ophandlers.c.
+ */
+
+/**
+ * Records a pending OP_VAR_PUSH instruction that may become a borrow.
+ * c: an instance of Compiler.
+ * index: the offset of the OP_VAR_PUSH opcode in the output buffer.
+ * returns: true if success, false if an allocation failure occurs.
+ */
+bool borrowsites_add(Compiler * c, int index) {
+  return buffer_append_string(c->borrowSites, (char*)&index, sizeof(int));
+}
+
+/**
+ * Gets the number of pending borrow sites.
+ * c: an instance of Compiler.
+ * returns: the number of sites recorded since the last commit or discard.
+ */
+int borrowsites_size(Compiler * c) {
+  return buffer_size(c->borrowSites) / sizeof(int);
+}
+
+/**
+ * Converts all pending borrow sites into OP_VAR_PUSH_B instructions. Call
+ * only when every value pushed by the sites is consumed and no function call
+ * or frame pop was compiled since they were recorded.
+ * c: an instance of Compiler.
+ */
+void borrowsites_commit(Compiler * c) {
+  char * sites = buffer_get_buffer(c->borrowSites);
+  int i;
+
+  for(i = 0; i < borrowsites_size(c); i++) {
+    int index;
+
+    memcpy(&index, sites + (i * sizeof(int)), sizeof(int));
+    buffer_set_char(c->outBuffer, OP_VAR_PUSH_B, index);
+  }
+
+  buffer_clear(c->borrowSites);
+}
+
+/**
+ * Drops all pending borrow sites, leaving them as OP_VAR_PUSH. Call before
+ * compiling anything that may release a variable while its value is on the
+ * operand stack.
+ * c: an instance of Compiler.
+ */
+void borrowsites_discard(Compiler * c) {
+  buffer_clear(c->borrowSites);
+}
+
+/*
+ * Code sites and call sites: a compilation unit (see compiler_new_unit()) is
+ * compiled as if its code began at address 0. It records where every code
+ * address operand is, so that compiler_link() can relocate them when the unit
+ * is appended to a program, and every call to a function that it doesn't
+ * define, which compiler_link() resolves against the whole program.
+ */
+
+/**
+ * Records the offset of a code address operand (jump target or OP_CALL_B
+ * function address), if this is a compilation unit.
+ * c: an instance of Compiler.
+ * index: the offset of the operand in the output buffer.
+ * returns: true if success, false if an allocation failure occurs.
+ */
+bool codesites_add(Compiler * c, int index) {
+  if(c->codeSites == NULL) {
+    return true;
+  }
+
+  return buffer_append_string(c->codeSites, (char*)&index, sizeof(int));
+}
+
+/**
+ * Records a call to a function that isn't defined yet. The OP_CALL_B at index
+ * is left with placeholder operands for compiler_link() to fill in.
+ * c: an instance of Compiler that is a compilation unit.
+ * index: the offset of the OP_CALL_B opcode in the output buffer.
+ * name: the name of the function.
+ * nameLen: the length of name.
+ * numArgs: the number of arguments passed.
+ * line: the line of the call.
+ * returns: true if success, false if an allocation failure occurs.
+ */
+bool callsites_add(Compiler * c, int index, char * name, size_t nameLen,
+		   int numArgs, int line) {
+  CompilerCallSite site;
+
+  assert(c->callSites != NULL);
+
+  site.offset = index;
+  site.numArgs = numArgs;
+  site.line = line;
+  site.nameLen = nameLen;
+  site.name = gsarena_alloc(c->arena, nameLen);
+  if(site.name == NULL) {
     return false;
   }
+  memcpy(site.name, name, nameLen);
+
+  return buffer_append_string(c->callSites, (char*)&site,
+			      sizeof(CompilerCallSite));
+}
+
+/**
+ * Allocates the operator stacks for a new expression nesting level.
+ * c: an instance of Compiler.
+ * returns: true if success, false if allocation fails.
+ */
+static bool exprstks_grow(Compiler * c) {
+  int newSize = c->numOpStks > 0 ? c->numOpStks * 2 : exprStksInitSize;
+  TypeStk ** newOpStks;
+  Stk ** newOpLenStks;
+  TypeStk * opStk;
+  Stk * opLenStk;
+
+  /* grow the arrays of stacks when they fill up. the old arrays stay in the
+   * arena, they add up to less than the new ones
+   */
+  if(c->exprDepth == c->numOpStks) {
+    newOpStks = gsarena_calloc(c->arena, newSize, sizeof(TypeStk*));
+    newOpLenStks = gsarena_calloc(c->arena, newSize, sizeof(Stk*));
+    if(newOpStks == NULL || newOpLenStks == NULL) {
+      return false;
+    }
+
+    if(c->numOpStks > 0) {
+      memcpy(newOpStks, c->opStks, c->numOpStks * sizeof(TypeStk*));
+      memcpy(newOpLenStks, c->opLenStks, c->numOpStks * sizeof(Stk*));
+    }
+    c->opStks = newOpStks;
+    c->opLenStks = newOpLenStks;
+    c->numOpStks = newSize;
+  }
+
+  /* stacks are only allocated the first time a level is reached */
+  if(c->opStks[c->exprDepth] == NULL) {
+    opStk = typestk_new(initialOpStkDepth, opStkBlockSize, c->allocator);
+    if(opStk == NULL) {
+      return false;
+    }
+    c->opStks[c->exprDepth] = opStk;
+  }
+
+  if(c->opLenStks[c->exprDepth] == NULL) {
+    opLenStk = stk_new(initialOpStkDepth);
+    if(opLenStk == NULL) {
+      return false;
+    }
+    c->opLenStks[c->exprDepth] = opLenStk;
+  }
+
+  return true;
+}
+
+/**
+ * Gets empty operator stacks for the shunting yard algorithm, for an
+ * expression one level deeper than the current one. Stacks are kept and reused
+ * by later expressions at the same level, so compiling an expression only
+ * allocates when it is nested deeper than any before it. Every successful call
+ * must be matched by exprstks_pop().
+ * c: an instance of Compiler.
+ * opStk: receives the operator stack.
+ * opLenStk: receives the stack of operator lengths.
+ * returns: true if success, false if allocation fails.
+ */
+bool exprstks_push(Compiler * c, TypeStk ** opStk, Stk ** opLenStk) {
 
-  if(!stk_push_pointer(c->symTableStk, symTbl)) {
+  if((c->exprDepth >= c->numOpStks
+      || c->opStks[c->exprDepth] == NULL
+      || c->opLenStks[c->exprDepth] == NULL)
+     && !exprstks_grow(c)) {
     return false;
   }
 
+  *opStk = c->opStks[c->exprDepth];
+  *opLenStk = c->opLenStks[c->exprDepth];
+  c->exprDepth++;
+
   return true;
 }
 
 /**
- * Gets the top symbol table from the symbol table stack and returns a pointer,
- * and removes the table from the stack. This function does NOT free the table.
- * You must free the table manually when finished with symtbl_free(), or the memory
- * will leak.
+ * Empties the operator stacks of the current expression nesting level and
+ * returns to the previous level.
  * c: an instance of Compiler.
- * returns: a pointer to the symbol table formerly at the top of the stack, or
- * NULL if the stack is empty.
  */
-HT * symtblstk_pop(Compiler * c) {
+void exprstks_pop(Compiler * c) {
+  Stk * opLenStk;
   DSValue value;
 
-  /* check that peek was success */
-  if(!stk_pop(c->symTableStk, &value)) {
-    return NULL;
+  assert(c->exprDepth > 0);
+
+  c->exprDepth--;
+  typestk_clear(c->opStks[c->exprDepth]);
+  opLenStk = c->opLenStks[c->exprDepth];
+  while(stk_size(opLenStk) > 0) {
+    stk_pop(opLenStk, &value);
+  }
+}
+
+/**
+ * Frees all expression operator stacks. The arrays that hold them belong to
+ * the compiler's arena.
+ * c: an instance of Compiler.
+ */
+void exprstks_free(Compiler * c) {
+  int i;
+
+  for(i = 0; i < c->numOpStks; i++) {
+    if(c->opStks[i] != NULL) {
+      typestk_free(c->opStks[i]);
+    }
+    if(c->opLenStks[i] != NULL) {
+      stk_free(c->opLenStks[i]);
+    }
   }
 
-  return value.pointerVal;
+  c->opStks = NULL;
+  c->opLenStks = NULL;
+  c->numOpStks = 0;
+  c->exprDepth = 0;
 }
@@ -46,37 +46,131 @@
 #include "vmdefs.h"
 #include "typestk.h"
 
-/* TODO: make symTableStk auto expand and remove this */
-static const int maxFuncDepth = 100;
+/* number of bytes the compiler arena gets from the allocator at a time */
+static const int arenaBlockSize = 16 * 1024;
 /* number of bytes in each additional block of the buffer */
 static const int bufferBlockSize = 1000;
+/* size of borrow site buffer and number of bytes to add each time it fills */
+static const int borrowSitesBlockSize = 16 * sizeof(int);
+/* size of native call site buffer and bytes to add each time it fills */
+static const int nativeSitesBlockSize = 64 * sizeof(int);
+/* size of a unit's code address site buffer and bytes to add when it fills */
+static const int codeSitesBlockSize = 256 * sizeof(int);
+/* size of a unit's call site buffer and bytes to add when it fills */
+static const int callSitesBlockSize = 64 * sizeof(CompilerCallSite);
+/* size of the lazy mode stub buffer and bytes to add when it fills */
+static const int stubsBlockSize = 64 * sizeof(CompilerStub);
+/* size of the lazy mode lexer buffer and bytes to add when it fills */
+static const int stubLexersBlockSize = 8 * sizeof(Lexer*);
+
+/**
+ * Accounting alloc: tracks compiler memory use and forwards to the host
+ * allocator.
+ * context: the Compiler instance.
+ * size: the number of bytes to allocate.
+ * returns: the new block, or NULL if the alloc fails.
+ */
+static void * compiler_account_alloc(void * context, size_t size) {
+  Compiler * compiler = context;
+  void * ptr;
+
+  ptr = compiler->baseAllocator->alloc(compiler->baseAllocator->context, size);
+  if(ptr != NULL) {
+    compiler->memUsed += size;
+    if(compiler->memUsed > compiler->memPeak) {
+      compiler->memPeak = compiler->memUsed;
+    }
+  }
+
+  return ptr;
+}
+
+/**
+ * Accounting realloc: tracks compiler memory use and forwards to the host
+ * allocator.
+ * context: the Compiler instance.
+ * ptr: the block to resize.
+ * oldSize: the current size of the block in bytes.
+ * newSize: the requested size of the block in bytes.
+ * returns: the resized block, or NULL if the alloc fails.
+ */
+static void * compiler_account_realloc(void * context, void * ptr,
+				       size_t oldSize, size_t newSize) {
+  Compiler * compiler = context;
+  void * newPtr;
+
+  newPtr = compiler->baseAllocator->realloc(compiler->baseAllocator->context,
+					    ptr, oldSize, newSize);
+  if(newPtr != NULL) {
+    compiler->memUsed = compiler->memUsed - oldSize + newSize;
+    if(compiler->memUsed > compiler->memPeak) {
+      compiler->memPeak = compiler->memUsed;
+    }
+  }
+
+  return newPtr;
+}
+
+/**
+ * Accounting free: tracks compiler memory use and forwards to the host
+ * allocator.
+ * context: the Compiler instance.
+ * ptr: the block to free.
+ * size: the size the block was allocated with.
+ */
+static void compiler_account_free(void * context, void * ptr, size_t size) {
+  Compiler * compiler = context;
+
+  compiler->memUsed -= size;
+  compiler->baseAllocator->free(compiler->baseAllocator->context, ptr, size);
+}
 
 /**
  * Creates a new compiler object that will contain the current state of the
  * compiler and its data structures.
+ * vm: the VM whose natives the compiled code may call.
+ * allocator: the allocator for compiler owned memory, or NULL for the default.
  * returns: new compiler object, or NULL if the allocation fails.
  */
-Compiler * compiler_new(VM * vm) {
+Compiler * compiler_new(VM * vm, GSAllocator * allocator) {
 
   assert(vm != NULL);
 
-  Compiler * compiler = calloc(1, sizeof(Compiler));
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  Compiler * compiler = gsalloc_calloc(allocator, 1, sizeof(Compiler));
 
   /* check for failed allocation */
   if(compiler == NULL) {
     return NULL;
   }
 
-  /* TODO: make this stack auto expand when full */
-  compiler->symTableStk = stk_new(maxFuncDepth);
+  /* route everything but the Compiler struct itself through the accountant */
+  compiler->baseAllocator = allocator;
+  compiler->accountant.alloc = compiler_account_alloc;
+  compiler->accountant.realloc = compiler_account_realloc;
+  compiler->accountant.free = compiler_account_free;
+  compiler->accountant.context = compiler;
+  compiler->allocator = &compiler->accountant;
+  allocator = compiler->allocator;
+
+  compiler->arena = gsarena_new(arenaBlockSize, allocator);
   compiler->functionHT = ht_new(COMPILER_INITIAL_HTSIZE, COMPILER_HTBLOCKSIZE, COMPILER_HTLOADFACTOR);
-  compiler->outBuffer = buffer_new(bufferBlockSize, bufferBlockSize);
+  compiler->outBuffer = buffer_new(bufferBlockSize, bufferBlockSize, allocator);
+  compiler->borrowSites = buffer_new(borrowSitesBlockSize,
+				     borrowSitesBlockSize, allocator);
+  compiler->nativeSites = buffer_new(nativeSitesBlockSize,
+				     nativeSitesBlockSize, allocator);
   compiler->vm = vm;
 
   /* check for further malloc errors */
-  if(compiler->symTableStk == NULL 
+  if(compiler->arena == NULL 
      || compiler->functionHT == NULL 
-     || compiler->outBuffer == NULL) {
+     || compiler->outBuffer == NULL
+     || compiler->borrowSites == NULL
+     || compiler->nativeSites == NULL) {
     compiler_free(compiler);
     return NULL;
   }
@@ -84,11 +178,78 @@ Compiler * compiler_new(VM * vm) {
   return compiler;
 }
 
+/**
+ * Creates a compilation unit: a compiler that builds one script independently
+ * of every other, so that several can be built at once on separate threads.
+ * Its code is compiled as if it began at address 0, and calls to functions it
+ * doesn't define are left for compiler_link() to resolve, instead of being
+ * errors. Units share compiler's VM, whose natives must not change while they
+ * build, and allocator, which must then be thread safe.
+ * compiler: the compiler that the unit will be linked into.
+ * returns: the new unit, or NULL if the allocation fails. Free it with
+ * compiler_free() after linking.
+ */
+Compiler * compiler_new_unit(Compiler * compiler) {
+  Compiler * unit;
+
+  assert(compiler != NULL);
+
+  unit = compiler_new(compiler->vm, compiler->baseAllocator);
+  if(unit == NULL) {
+    return NULL;
+  }
+
+  unit->codeSites = buffer_new(codeSitesBlockSize, codeSitesBlockSize,
+			       unit->allocator);
+  unit->callSites = buffer_new(callSitesBlockSize, callSitesBlockSize,
+			       unit->allocator);
+  if(unit->codeSites == NULL || unit->callSites == NULL) {
+    compiler_free(unit);
+    return NULL;
+  }
+
+  return unit;
+}
+
+/**
+ * Enables or disables lazy mode. In lazy mode, compiler_build() only parses
+ * the signature and variable declarations of each function, and writes an
+ * OP_STUB in its place. The function's body is compiled when the stub first
+ * runs, see compiler_compile_stub(), so building a script takes time in
+ * proportion to its number of functions rather than its size, and errors in
+ * a body aren't found until the function is first called. The tokens of
+ * every script built in lazy mode are kept until compiler_free(). Stubs
+ * written before lazy mode is disabled still work.
+ * compiler: an instance of Compiler that is not a compilation unit.
+ * lazy: true to enable lazy mode.
+ * returns: true if success, false if an allocation fails.
+ */
+bool compiler_set_lazy(Compiler * compiler, bool lazy) {
+  assert(compiler != NULL);
+  assert(compiler->callSites == NULL);
+
+  if(lazy && compiler->stubs == NULL) {
+    compiler->stubs = buffer_new(stubsBlockSize, stubsBlockSize,
+				 compiler->allocator);
+    compiler->stubLexers = buffer_new(stubLexersBlockSize,
+				      stubLexersBlockSize,
+				      compiler->allocator);
+    if(compiler->stubs == NULL || compiler->stubLexers == NULL) {
+      return false;
+    }
+  }
+
+  compiler->lazy = lazy;
+  return true;
+}
+
 /**
  * Instantiates a CompilerFunc structure for storing information about a script
  * function in the functionHT member of Compiler struct. This struct is used to
  * store record of a function declaration, its number of arguments, and its
- * respective location in the bytecode.
+ * respective location in the bytecode. The struct and its name are allocated
+ * from the compiler's arena, and are freed with it.
+ * arena: the compiler's arena.
  * name: A string with the text representation of the function. The text name
  * it is called by in the code.
  * nameLen: The number of characters to read from name for the function name.
@@ -96,55 +257,33 @@ Compiler * compiler_new(VM * vm) {
  * numArgs: the number of arguments that the function expects.
  * returns: A new instance of CompilerFunc struct, NULL if the allocation fails.
  */
-static CompilerFunc * compilerfunc_new(char * name, size_t nameLen,
+static CompilerFunc * compilerfunc_new(GSArena * arena,
+				       char * name, size_t nameLen,
 				       int index, int numArgs, int numVars,
 				       bool exported) {
   assert(index >= 0);
 
-  CompilerFunc * cf = calloc(1, sizeof(CompilerFunc));
+  CompilerFunc * cf = gsarena_alloc(arena, sizeof(CompilerFunc));
   if(cf != NULL) {
-    cf->name = calloc(nameLen + 1, sizeof(char));
-    strncpy(cf->name, name, nameLen);
+    cf->name = gsarena_alloc(arena, nameLen + 1);
+    if(cf->name == NULL) {
+      return NULL;
+    }
+    memcpy(cf->name, name, nameLen);
+    cf->name[nameLen] = '\0';
     cf->index = index;
     cf->numArgs = numArgs;
     cf->numVars = numVars;
     cf->exported = true;
+    cf->line = 0;
   }
 
   return cf;
 }
 
-/**
- * Frees a CompilerFunc struct. This must be done to every CompilerFunc
- * struct when it is removed from the hashtable.
- * cf: an instance of CompilerFunc to free the associated memory to.
- */
-static void compilerfunc_free(CompilerFunc * cf) {
-
-  assert(cf != NULL);
-
-  free(cf->name);
-  free(cf);
-}
-
-/**
- * A wrapper function that frees a symbol table. This function should be used
- * after a symbol table is popped from the symbol table stack with
- * symtblstk_pop(). Do NOT free symbol table references obtained with
- * symtblstk_peek(). They are still being used. SEGFAULTS will ensue.
- * symTbl: a hashtable/symbol table to free.
- */
-static void symtbl_free(HT * symTbl) {
-  assert(symTbl != NULL);
-
-  ht_free(symTbl);
-}
-
 /**
  * Checks a string to see if it is a reserved keyword for the scripting language
- * At the moment this function is a place holder for the keyword check
- * functionality. 
- * TODO: make more sophisticated, constant time lookup mechanism.
+ * that can't be used as a function name.
  * token: the string to check for being a keyword.
  * tokenLen: the number of characters to compare from the token string.
  * returns: true if token is a keyword, and false if it is not.
@@ -154,11 +293,7 @@ static bool is_keyword(char * token, size_t tokenLen) {
   assert(token != NULL);
   assert(tokenLen > 0);
 
-  if(tokens_equal(LANG_FUNCTION, LANG_FUNCTION_LEN, token, tokenLen)) {
-    return true;
-  }
-
-  return false;
+  return lang_keyword(token, tokenLen) == LANGKW_FUNCTION;
 }
 
 /**
@@ -181,12 +316,11 @@ static int parse_arguments(Compiler * c, Lexer * l) {
    * the tokens and store each KEYVAR type token in the symbol table as a
    * function argument
    */
-  HT * symTbl = symtblstk_peek(c, 0);
+  SymTbl * symTbl = symtblstk_peek(c, 0);
   LexerType type;
   size_t len;
   bool prevExisted;
   char * token = lexer_next(l, &type, &len);
-  DSValue value;
   int numArgs = 0;
 
   while(true) {
@@ -195,7 +329,7 @@ static int parse_arguments(Compiler * c, Lexer * l) {
     if(token == NULL || type != LEXERTYPE_KEYVAR) {
 
       /* if there was a closed parenth, there are no args, otherwise, give err */
-      if(tokens_equal(LANG_CPARENTH, LANG_CPARENTH_LEN, token, len)) {
+      if(lexer_current_keyword(l) == LANGKW_CPARENTH) {
 	return 0;
       } else {
 	c->err = COMPILERERR_EXPECTED_VARNAME;
@@ -206,9 +340,7 @@ static int parse_arguments(Compiler * c, Lexer * l) {
     /* store variable along with index at which its data will be stored in the
      * frame stack in the virtual machine
      */
-    value.intVal = ht_size(symTbl);
-    if(!ht_put_raw_key(symTbl, token, len, 
-		       &value, NULL, &prevExisted)) {
+    if(!symtbl_put(c, symTbl, token, len, &prevExisted)) {
       c->err = COMPILERERR_ALLOC_FAILED;
       return -1;
     }
@@ -222,10 +354,10 @@ static int parse_arguments(Compiler * c, Lexer * l) {
 
     /* get next token and check for anything but a comma arg delimiter */
     token = lexer_next(l, &type, &len);
-    if(!tokens_equal(token, len, LANG_ARGDELIM, LANG_ARGDELIM_LEN)) {
+    if(lexer_current_keyword(l) != LANGKW_ARGDELIM) {
 
       /* check for end of the args, or invalid token */
-      if(tokens_equal(token, len, LANG_CPARENTH, LANG_CPARENTH_LEN)) {
+      if(lexer_current_keyword(l) == LANGKW_CPARENTH) {
 	/* end of args */
 	return numArgs;
       } else {
@@ -253,17 +385,53 @@ static int parse_arguments(Compiler * c, Lexer * l) {
  * call the function. e.g. print.
  * nameLen: the number of characters to read from name.
  * numArgs: the number of arguments that the function can accept.
+ * line: the line of the definition, reported if it is defined again when
+ * compilation units are linked.
  */
 static bool function_store_definition(Compiler * c, char * name, size_t nameLen,
-			   int numArgs, int numVars, bool exported) {
+			   int numArgs, int numVars, bool exported, int line) {
+  DSValue value;
+
+  /* compiling a stub: the function was defined when its stub was written */
+  if(c->stubFunc != NULL) {
+    c->stubFunc->index = buffer_size(c->outBuffer);
+    return true;
+  }
 
   /* TODO: might need a lexer_next() call to get correct token */
+  if(!compiler_define_function(c, name, nameLen, buffer_size(c->outBuffer),
+			       numArgs, numVars, exported)) {
+    return false;
+  }
+
+  ht_get_raw_key(c->functionHT, name, nameLen, &value);
+  ((CompilerFunc*)value.pointerVal)->line = line;
+  return true;
+}
+
+/**
+ * Records a script function that begins at the given index in the bytecode.
+ * Used by the parsers for each function declaration, and to add functions
+ * from previously compiled code. See compiler_append().
+ * c: an instance of Compiler.
+ * name: the string name of the function.
+ * nameLen: the number of characters to read from name.
+ * index: the index of the byte where the function begins in the byte code.
+ * numArgs: the number of arguments that the function can accept.
+ * numVars: the number of variables that the function declares.
+ * exported: whether the function can be called from the host.
+ * returns: true if success, false and sets c->err if the function already
+ * exists or an allocation fails.
+ */
+bool compiler_define_function(Compiler * c, char * name, size_t nameLen,
+			      int index, int numArgs, int numVars,
+			      bool exported) {
   bool prevValue;
   CompilerFunc * cp;
   DSValue value;
 
   /* check for proper CompilerFunc allocation */
-  cp = compilerfunc_new(name, nameLen, buffer_size(c->outBuffer), numArgs,
+  cp = compilerfunc_new(c->arena, name, nameLen, index, numArgs,
 			numVars, exported);
   if(cp == NULL) {
     c->err = COMPILERERR_ALLOC_FAILED;
@@ -271,7 +439,11 @@ static bool function_store_definition(Compiler * c, char * name, size_t nameLen,
   }
 
   value.pointerVal = cp;
-  ht_put_raw_key(c->functionHT, cp->name, nameLen, &value, NULL, &prevValue);
+  if(!ht_put_raw_key(c->functionHT, cp->name, nameLen,
+		     &value, NULL, &prevValue)) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
 
   /* check that function didn't previously exist */
   if(prevValue) {
@@ -282,6 +454,60 @@ static bool function_store_definition(Compiler * c, char * name, size_t nameLen,
   return true;
 }
 
+/**
+ * Lazy mode: writes an OP_STUB in place of the code of the function that was
+ * just defined, and records where its definition is so that it can be
+ * compiled later by compiler_compile_stub().
+ * OP_STUB [stub:sizeof(int)]
+ * c: an instance of Compiler.
+ * l: the lexer of the script defining the function.
+ * name: the name of the function.
+ * nameLen: the length of name.
+ * position: the lexer position of the function's 'function' keyword.
+ * returns: true if success, false and sets c->err if allocation fails.
+ */
+static bool write_stub(Compiler * c, Lexer * l, char * name, size_t nameLen,
+		       int position) {
+  CompilerStub stub;
+  DSValue value;
+  int number = buffer_size(c->stubs) / sizeof(CompilerStub);
+
+  ht_get_raw_key(c->functionHT, name, nameLen, &value);
+  stub.func = value.pointerVal;
+  stub.lexer = l;
+  stub.position = position;
+  stub.index = buffer_size(c->outBuffer);
+  stub.compiled = false;
+
+  if(!buffer_append_string(c->stubs, (char*)&stub, sizeof(CompilerStub))
+     || !buffer_append_char(c->outBuffer, OP_STUB)
+     || !buffer_append_string(c->outBuffer, (char*)&number, sizeof(int))) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Lazy mode: skips the body of a function, up to the "}" that closes it. The
+ * lexer handles strings and comments, so only real brackets are counted.
+ * l: an instance of lexer, just inside the function's "{".
+ */
+static void skip_body(Lexer * l) {
+  LexerType type;
+  size_t len;
+  int depth = 1;
+
+  while(lexer_current_token(l, &type, &len) != NULL) {
+    if(lexer_current_keyword(l) == LANGKW_OBRACKET) {
+      depth++;
+    } else if(lexer_current_keyword(l) == LANGKW_CBRACKET && --depth == 0) {
+      return;
+    }
+    lexer_next(l, &type, &len);
+  }
+}
+
 /**
  * A subparser function for compiler_build() that looks at the current token,
  * checks for a 'function' token. If found, it proceeds to evaluate the function
@@ -309,6 +535,8 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
    */
    
   bool exported = false;
+  bool writeStub = c->lazy && c->stubFunc == NULL;
+  int position = lexer_position(l);
   size_t len;
   LexerType type;
   char * token = lexer_current_token(l, &type, &len);
@@ -318,14 +546,14 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
   int numVars;
 
   /* check that this is a function declaration token */
-  if(!tokens_equal(token, len, LANG_FUNCTION, LANG_FUNCTION_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_FUNCTION) {
     c->err = COMPILERERR_UNEXPECTED_TOKEN;
     return false;
   }
 
   /* advance to next token. if is is EXPORTED, take note for later */
   token = lexer_next(l, &type, &len);
-  if(tokens_equal(token, len, LANG_EXPORTED, LANG_EXPORTED_LEN)) {
+  if(lexer_current_keyword(l) == LANGKW_EXPORTED) {
     exported = true;
     token = lexer_next(l, &type, &len);
   }
@@ -340,7 +568,7 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
 
   /* check for the open parenthesis */
   token = lexer_next(l, &type, &len);
-  if(!tokens_equal(token, len, LANG_OPARENTH, LANG_OPARENTH_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_OPARENTH) {
     c->err = COMPILERERR_EXPECTED_OPARENTH;
     return true;
   }
@@ -358,7 +586,7 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
 
   /* check for open brace defining start of function "{" */
   token = lexer_next(l, &type, &len);
-  if(!tokens_equal(token, len, LANG_OBRACKET, LANG_OBRACKET_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_OBRACKET) {
     c->err = COMPILERERR_EXPECTED_OBRACKET;
     return true;
   }
@@ -375,11 +603,18 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
   token = lexer_current_token(l, &type, &len);
 
   /* store the function name, location in the output, and # of args and vars */
-  if(!function_store_definition(c, name, nameLen, numArgs, numVars, exported)) {
+  if(!function_store_definition(c, name, nameLen, numArgs, numVars, exported,
+				 lexer_line_num(l))) {
     return true;
   }
 
-  if(!parse_body(c, l)) {
+  /* lazy mode: the body is compiled when the stub first runs */
+  if(writeStub) {
+    if(!write_stub(c, l, name, nameLen, position)) {
+      return true;
+    }
+    skip_body(l);
+  } else if(!parse_body(c, l)) {
     return true;
   }
 
@@ -389,22 +624,26 @@ static bool parse_function_definitions(Compiler * c, Lexer * l) {
   /****************************** End function body ***************************/
 
   /* check for closing brace defining end of body "}" */
-  if(!tokens_equal(token, len, LANG_CBRACKET, LANG_CBRACKET_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_CBRACKET) {
     c->err = COMPILERERR_EXPECTED_CBRACKET;
     return true;
   }
 
-  /* push default return value. if no other return is given, this value is 
-   * returned */
-  buffer_append_char(c->outBuffer, OP_NULL_PUSH);
+  if(!writeStub) {
+
+    /* push default return value. if no other return is given, this value is 
+     * returned */
+    buffer_append_char(c->outBuffer, OP_NULL_PUSH);
 
-  /* pop function frame and return to calling function */
-  buffer_append_char(c->outBuffer, OP_FRM_POP);
+    /* pop function frame and return to calling function */
+    borrowsites_discard(c);
+    buffer_append_char(c->outBuffer, OP_FRM_POP);
+  }
 
   token = lexer_next(l, &type, &len);
 
   /* we're done here! pop the symbol table for this function off the stack. */
-  ht_free(symtblstk_pop(c));
+  symtblstk_pop(c);
 
   return true;
 }
@@ -434,6 +673,538 @@ char * compiler_bytecode(Compiler * compiler) {
   return buffer_get_buffer(compiler->outBuffer);
 }
 
+/**
+ * Gets the number of native function calls in the bytecode.
+ * compiler: an instance of compiler.
+ * returns: the number of OP_CALL_PTR_N instructions compiled.
+ */
+int compiler_num_native_sites(Compiler * compiler) {
+  assert(compiler != NULL);
+  return buffer_size(compiler->nativeSites) / sizeof(int);
+}
+
+/**
+ * Gets the location of a native function call's callback index in the
+ * bytecode. Bytecode that is saved and reloaded into another VM must have
+ * these rewritten because callback indices depend on registration order.
+ * compiler: an instance of compiler.
+ * site: the site number, from 0 to compiler_num_native_sites() - 1.
+ * returns: the offset of the callback index operand of an OP_CALL_PTR_N.
+ */
+int compiler_native_site(Compiler * compiler, int site) {
+  int offset;
+
+  assert(compiler != NULL);
+  assert(site >= 0 && site < compiler_num_native_sites(compiler));
+
+  memcpy(&offset, buffer_get_buffer(compiler->nativeSites)
+	 + (site * sizeof(int)), sizeof(int));
+  return offset;
+}
+
+/**
+ * Appends previously compiled bytecode, as if the script it came from was
+ * built again. The code must have been compiled by a compiler with exactly
+ * the same bytecode, so that its jump and call addresses are correct. Its
+ * functions must be added with compiler_define_function().
+ * compiler: an instance of compiler.
+ * code: the bytecode to append.
+ * codeLen: the size of code in bytes.
+ * nativeSites: the offsets of the callback index of each OP_CALL_PTR_N in
+ * code, relative to the start of the program, not of code.
+ * numNativeSites: the number of entries in nativeSites.
+ * returns: true if success, false and sets the error if an allocation fails.
+ */
+bool compiler_append(Compiler * compiler, char * code, size_t codeLen,
+		     int * nativeSites, int numNativeSites) {
+  size_t newSize;
+
+  assert(compiler != NULL);
+  assert(code != NULL);
+
+  /* grow once instead of by bufferBlockSize per block */
+  newSize = buffer_size(compiler->outBuffer) + codeLen;
+  if(buffer_buffer_size(compiler->outBuffer) < newSize
+     && !buffer_resize(compiler->outBuffer, newSize)) {
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    return false;
+  }
+
+  if(!buffer_append_string(compiler->outBuffer, code, codeLen)
+     || !buffer_append_string(compiler->nativeSites, (char*)nativeSites,
+			      numNativeSites * sizeof(int))) {
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    return false;
+  }
+
+  compiler_set_err(compiler, COMPILERERR_SUCCESS);
+  return true;
+}
+
+/**
+ * Sets a link error.
+ * compiler: the compiler being linked into.
+ * err: the error code.
+ * line: the line in the unit where the error occurred, or 0.
+ * lexerErr: the lexer error code if err is COMPILERERR_LEXER_ERR.
+ * unitIndex: the index of the unit that the error occurred in.
+ * errUnit: receives unitIndex if not NULL.
+ */
+static void link_err(Compiler * compiler, CompilerErr err, int line,
+		     LexerErr lexerErr, int unitIndex, int * errUnit) {
+  compiler->err = err;
+  compiler->errorLineNum = line;
+  compiler->lexerErr = lexerErr;
+  if(errUnit != NULL) {
+    *errUnit = unitIndex;
+  }
+}
+
+/**
+ * Adds the offset base to each int in a buffer of code offsets.
+ * code: the code to relocate.
+ * sites: a buffer of int offsets of the ints in code to relocate.
+ * base: the offset to add.
+ */
+static void relocate_sites(char * code, Buffer * sites, int base) {
+  char * siteBytes = buffer_get_buffer(sites);
+  int numSites = buffer_size(sites) / sizeof(int);
+  int site;
+  int value;
+  int i;
+
+  for(i = 0; i < numSites; i++) {
+    memcpy(&site, siteBytes + (i * sizeof(int)), sizeof(int));
+    memcpy(&value, code + site, sizeof(int));
+    value += base;
+    memcpy(code + site, &value, sizeof(int));
+  }
+}
+
+/**
+ * Adds the offset base to each int offset in a buffer of sites.
+ * sites: a buffer of int offsets.
+ * base: the offset to add.
+ */
+static void rebase_sites(Buffer * sites, int base) {
+  char * siteBytes = buffer_get_buffer(sites);
+  int numSites = buffer_size(sites) / sizeof(int);
+  int site;
+  int i;
+
+  for(i = 0; i < numSites; i++) {
+    memcpy(&site, siteBytes + (i * sizeof(int)), sizeof(int));
+    site += base;
+    memcpy(siteBytes + (i * sizeof(int)), &site, sizeof(int));
+  }
+}
+
+/**
+ * Links built compilation units into this compiler, in order, as if their
+ * scripts had been built into it one by one, except that functions may be
+ * called before they are defined. Each unit's code is appended and relocated,
+ * its functions are defined, and the call sites of all units are resolved
+ * against every function in the compiler, including previously built ones.
+ * Native calls were resolved against the shared VM when the units were built,
+ * their sites are relocated so that saved images can rebind them.
+ * compiler: an instance of Compiler that will receive the code.
+ * units: units made with compiler_new_unit() and built with compiler_build().
+ * Their buffers are modified, they can only be linked once.
+ * numUnits: the number of units.
+ * errUnit: if not NULL, receives the index of the unit that caused an error.
+ * returns: true if success, false and sets the error if a unit failed to
+ * build, a function is defined twice, a call can't be resolved, or allocation
+ * fails. On failure, the compiler may contain part of the code and must not
+ * be run.
+ */
+bool compiler_link(Compiler * compiler, Compiler ** units, int numUnits,
+		   int * errUnit) {
+  int start = buffer_size(compiler->outBuffer);
+  int base;
+  int i;
+
+  assert(compiler != NULL);
+  assert(units != NULL);
+
+  /* every unit must have built */
+  for(i = 0; i < numUnits; i++) {
+    assert(units[i]->codeSites != NULL);
+
+    if(units[i]->err != COMPILERERR_SUCCESS) {
+      link_err(compiler, units[i]->err, units[i]->errorLineNum,
+	       units[i]->lexerErr, i, errUnit);
+      return false;
+    }
+  }
+
+  /* append the code and define the functions of each unit */
+  for(i = 0; i < numUnits; i++) {
+    Compiler * unit = units[i];
+    char * code = buffer_get_buffer(unit->outBuffer);
+    HTIter iter;
+
+    base = buffer_size(compiler->outBuffer);
+    relocate_sites(code, unit->codeSites, base);
+    rebase_sites(unit->nativeSites, base);
+    if(!compiler_append(compiler, code, buffer_size(unit->outBuffer),
+			(int*)buffer_get_buffer(unit->nativeSites),
+			compiler_num_native_sites(unit))) {
+      link_err(compiler, COMPILERERR_ALLOC_FAILED, 0, LEXERERR_SUCCESS,
+	       i, errUnit);
+      return false;
+    }
+
+    ht_iter_get(unit->functionHT, &iter);
+    while(ht_iter_has_next(&iter)) {
+      DSValue value;
+      CompilerFunc * cf;
+
+      ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+      cf = value.pointerVal;
+      if(!compiler_define_function(compiler, cf->name, strlen(cf->name),
+				   cf->index + base, cf->numArgs,
+				   cf->numVars, cf->exported)) {
+	link_err(compiler, compiler->err, cf->line, LEXERERR_SUCCESS, i,
+		 errUnit);
+	return false;
+      }
+    }
+  }
+
+  /* resolve calls now that every function is defined */
+  base = start;
+  for(i = 0; i < numUnits; i++) {
+    Compiler * unit = units[i];
+    CompilerCallSite * sites = (CompilerCallSite*)
+      buffer_get_buffer(unit->callSites);
+    int numSites = buffer_size(unit->callSites) / sizeof(CompilerCallSite);
+    int j;
+
+    for(j = 0; j < numSites; j++) {
+      DSValue value;
+      CompilerFunc * cf;
+
+      if(!ht_get_raw_key(compiler->functionHT, sites[j].name,
+			 sites[j].nameLen, &value)) {
+	link_err(compiler, COMPILERERR_UNDEFINED_FUNCTION, sites[j].line,
+		 LEXERERR_SUCCESS, i, errUnit);
+	return false;
+      }
+
+      cf = value.pointerVal;
+      if(cf->numArgs != sites[j].numArgs) {
+	link_err(compiler, COMPILERERR_INCORRECT_NUMARGS, sites[j].line,
+		 LEXERERR_SUCCESS, i, errUnit);
+	return false;
+      }
+
+      /* OP_CALL_B [number_of_vars_and_args:1] [args:1] [address:int] */
+      buffer_set_char(compiler->outBuffer, cf->numArgs + cf->numVars,
+		      base + sites[j].offset + 1);
+      buffer_set_string(compiler->outBuffer, (char*)&cf->index, sizeof(int),
+			base + sites[j].offset + 3);
+    }
+
+    base += buffer_size(unit->outBuffer);
+  }
+
+  compiler_set_err(compiler, COMPILERERR_SUCCESS);
+  return true;
+}
+
+/**
+ * Orders CompilerSwaps by old entry point, for qsort() and bsearch().
+ */
+static int swap_compare(const void * a, const void * b) {
+  const CompilerSwap * swapA = a;
+  const CompilerSwap * swapB = b;
+
+  return swapA->oldIndex < swapB->oldIndex ? -1
+    : swapA->oldIndex > swapB->oldIndex;
+}
+
+/**
+ * Finds the stub of a function defined in lazy mode.
+ * compiler: an instance of Compiler.
+ * cf: the function.
+ * returns: the stub, or NULL if the function was compiled eagerly.
+ */
+static CompilerStub * find_stub(Compiler * compiler, CompilerFunc * cf) {
+  CompilerStub * stubs;
+  int numStubs;
+  int i;
+
+  if(compiler->stubs == NULL) {
+    return NULL;
+  }
+
+  stubs = (CompilerStub*)buffer_get_buffer(compiler->stubs);
+  numStubs = buffer_size(compiler->stubs) / sizeof(CompilerStub);
+  for(i = 0; i < numStubs; i++) {
+    if(stubs[i].func == cf) {
+      return &stubs[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Checks that a built unit can replace functions in the compiler: replaced
+ * functions must keep their number of arguments, because the code that
+ * calls them passes that many, and each call the unit left unresolved must
+ * resolve against the unit or the compiler.
+ * compiler: an instance of Compiler.
+ * unit: the built unit.
+ * returns: true if the unit can be swapped in, false and sets the error if
+ * not.
+ */
+static bool rebuild_check(Compiler * compiler, Compiler * unit) {
+  CompilerCallSite * sites = (CompilerCallSite*)
+    buffer_get_buffer(unit->callSites);
+  int numSites = buffer_size(unit->callSites) / sizeof(CompilerCallSite);
+  HTIter iter;
+  int i;
+
+  ht_iter_get(unit->functionHT, &iter);
+  while(ht_iter_has_next(&iter)) {
+    DSValue value;
+    CompilerFunc * cf;
+
+    ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+    cf = value.pointerVal;
+    if(ht_get_raw_key(compiler->functionHT, cf->name, strlen(cf->name),
+		      &value)
+       && ((CompilerFunc*)value.pointerVal)->numArgs != cf->numArgs) {
+      link_err(compiler, COMPILERERR_INCORRECT_NUMARGS, 0, LEXERERR_SUCCESS,
+	       0, NULL);
+      return false;
+    }
+  }
+
+  for(i = 0; i < numSites; i++) {
+    DSValue value;
+
+    if(!ht_get_raw_key(unit->functionHT, sites[i].name, sites[i].nameLen,
+		       &value)
+       && !ht_get_raw_key(compiler->functionHT, sites[i].name,
+			  sites[i].nameLen, &value)) {
+      link_err(compiler, COMPILERERR_UNDEFINED_FUNCTION, sites[i].line,
+	       LEXERERR_SUCCESS, 0, NULL);
+      return false;
+    }
+    if(((CompilerFunc*)value.pointerVal)->numArgs != sites[i].numArgs) {
+      link_err(compiler, COMPILERERR_INCORRECT_NUMARGS, sites[i].line,
+	       LEXERERR_SUCCESS, 0, NULL);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Points every OP_CALL_B in the code before end that calls a replaced entry
+ * point at its new code. Nothing else in the old code changes, so frames
+ * that are already running the old version of a function finish in it.
+ * compiler: an instance of Compiler.
+ * end: the end of the code to patch.
+ * swaps: the replaced entry points, sorted with swap_compare().
+ * numSwaps: the number of swaps.
+ */
+static void redirect_calls(Compiler * compiler, int end,
+			   CompilerSwap * swaps, int numSwaps) {
+  char * code = buffer_get_buffer(compiler->outBuffer);
+  int index = 0;
+  int size;
+
+  /* walk the code one instruction at a time. the compiler only writes valid
+   * instructions, but stop at anything else rather than patch data
+   */
+  while(index < end
+	&& (size = vm_op_size(code, end, index)) > 0) {
+
+    /* OP_CALL_B [number_of_vars_and_args:1] [args:1] [address:int] */
+    if(code[index] == OP_CALL_B) {
+      CompilerSwap key;
+      CompilerSwap * swap;
+
+      memcpy(&key.oldIndex, code + index + 3, sizeof(int));
+      swap = bsearch(&key, swaps, numSwaps, sizeof(CompilerSwap),
+		     swap_compare);
+      if(swap != NULL) {
+	code[index + 1] = swap->frameSize;
+	memcpy(code + index + 3, &swap->newIndex, sizeof(int));
+      }
+    }
+    index += size;
+  }
+}
+
+/**
+ * Hot swaps functions: builds a script containing new versions of functions
+ * that are already built, and possibly new functions, and redirects the
+ * program to them. The input is compiled into a new region at the end of the
+ * bytecode, the records of replaced functions are updated to point at it,
+ * and every call to a replaced function is patched to call the new code.
+ * Replaced functions' old code is left in place, so a frame that was
+ * suspended in it can still return through it, but it is never called again.
+ * A replaced function must keep its number of arguments. The input may call
+ * any function that is already built. Calls to native functions are bound as
+ * in compiler_build(). New code is always compiled eagerly, and lazy stubs
+ * of replaced functions are retired. Must not be called while the VM is
+ * running the compiler's code, unless the VM is told that the bytecode moved
+ * with vm_code_moved().
+ * compiler: an instance of Compiler that is not a compilation unit.
+ * input: a script defining the new functions.
+ * inputLen: the length of input.
+ * returns: true if success. On failure, the error is set, and the program is
+ * unchanged, except if allocation fails part way, in which case some of the
+ * functions may already have been replaced.
+ */
+bool compiler_rebuild(Compiler * compiler, char * input, size_t inputLen) {
+  Compiler * unit;
+  CompilerSwap * swaps;
+  CompilerCallSite * sites;
+  int numSites;
+  int maxSwaps;
+  int numSwaps = 0;
+  int base = buffer_size(compiler->outBuffer);
+  bool success = true;
+  HTIter iter;
+  int i;
+
+  assert(compiler != NULL);
+  assert(compiler->callSites == NULL);
+  assert(input != NULL);
+
+  /* build in a unit so the program is untouched if the input has errors */
+  unit = compiler_new_unit(compiler);
+  if(unit == NULL) {
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    return false;
+  }
+  if(!compiler_build(unit, input, inputLen)) {
+    link_err(compiler, unit->err, unit->errorLineNum, unit->lexerErr, 0, NULL);
+    compiler_free(unit);
+    return false;
+  }
+  if(!rebuild_check(compiler, unit)) {
+    compiler_free(unit);
+    return false;
+  }
+
+  /* each function replaces at most an entry point and a stub. one extra so
+   * that the array is never empty
+   */
+  maxSwaps = 2 * ht_size(unit->functionHT) + 1;
+  swaps = gsalloc_calloc(compiler->allocator, maxSwaps, sizeof(CompilerSwap));
+  if(swaps == NULL) {
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    compiler_free(unit);
+    return false;
+  }
+
+  /* append the new code after all of the old */
+  relocate_sites(buffer_get_buffer(unit->outBuffer), unit->codeSites, base);
+  rebase_sites(unit->nativeSites, base);
+  if(!compiler_append(compiler, buffer_get_buffer(unit->outBuffer),
+		      buffer_size(unit->outBuffer),
+		      (int*)buffer_get_buffer(unit->nativeSites),
+		      compiler_num_native_sites(unit))) {
+    gsalloc_free(compiler->allocator, swaps, maxSwaps * sizeof(CompilerSwap));
+    compiler_free(unit);
+    return false;
+  }
+
+  /* resolve the unit's calls, preferring its own functions */
+  sites = (CompilerCallSite*)buffer_get_buffer(unit->callSites);
+  numSites = buffer_size(unit->callSites) / sizeof(CompilerCallSite);
+  for(i = 0; i < numSites; i++) {
+    DSValue value;
+    CompilerFunc * cf;
+    int address;
+
+    if(ht_get_raw_key(unit->functionHT, sites[i].name, sites[i].nameLen,
+		      &value)) {
+      cf = value.pointerVal;
+      address = cf->index + base;
+    } else {
+      ht_get_raw_key(compiler->functionHT, sites[i].name, sites[i].nameLen,
+		     &value);
+      cf = value.pointerVal;
+      address = cf->index;
+    }
+
+    /* OP_CALL_B [number_of_vars_and_args:1] [args:1] [address:int] */
+    buffer_set_char(compiler->outBuffer, cf->numArgs + cf->numVars,
+		    base + sites[i].offset + 1);
+    buffer_set_string(compiler->outBuffer, (char*)&address, sizeof(int),
+		      base + sites[i].offset + 3);
+  }
+
+  /* define new functions, and point replaced ones at their new code */
+  ht_iter_get(unit->functionHT, &iter);
+  while(success && ht_iter_has_next(&iter)) {
+    DSValue value;
+    CompilerFunc * cf;
+    CompilerFunc * old;
+    CompilerStub * stub;
+    int newIndex;
+
+    ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+    cf = value.pointerVal;
+    newIndex = cf->index + base;
+    if(!ht_get_raw_key(compiler->functionHT, cf->name, strlen(cf->name),
+		       &value)) {
+      success = compiler_define_function(compiler, cf->name,
+					 strlen(cf->name), newIndex,
+					 cf->numArgs, cf->numVars,
+					 cf->exported);
+      continue;
+    }
+    old = value.pointerVal;
+
+    swaps[numSwaps].oldIndex = old->index;
+    swaps[numSwaps].newIndex = newIndex;
+    swaps[numSwaps].frameSize = cf->numArgs + cf->numVars;
+    numSwaps++;
+
+    /* retire the stub, callers that haven't been redirected yet jump to it.
+     * OP_STUB [stub:sizeof(int)] becomes OP_GOTO [goto_address:sizeof(int)]
+     */
+    stub = find_stub(compiler, old);
+    if(stub != NULL) {
+      char * code = buffer_get_buffer(compiler->outBuffer);
+
+      if(stub->index != old->index) {
+	swaps[numSwaps] = swaps[numSwaps - 1];
+	swaps[numSwaps].oldIndex = stub->index;
+	numSwaps++;
+      }
+      code[stub->index] = OP_GOTO;
+      memcpy(code + stub->index + 1, &newIndex, sizeof(int));
+      stub->compiled = true;
+    }
+
+    old->index = newIndex;
+    old->numVars = cf->numVars;
+    old->exported = cf->exported;
+  }
+
+  /* redirect the old code's calls to replaced functions */
+  qsort(swaps, numSwaps, sizeof(CompilerSwap), swap_compare);
+  redirect_calls(compiler, base, swaps, numSwaps);
+
+  gsalloc_free(compiler->allocator, swaps, maxSwaps * sizeof(CompilerSwap));
+  compiler_free(unit);
+  if(!success) {
+    return false;
+  }
+
+  compiler_set_err(compiler, COMPILERERR_SUCCESS);
+  return true;
+}
+
 /**
  * Builds a script file and adds its code to the bytecode output buffer and
  * stores references to its functions and variables in the Compiler object.
@@ -450,17 +1221,39 @@ bool compiler_build(Compiler * compiler, char * input, size_t inputLen) {
   assert(input != NULL);
   assert(inputLen > 0);
 
-  Lexer * lexer = lexer_new(input, inputLen);
+  /* measure the peak memory of this build */
+  compiler->memPeak = compiler->memUsed;
+
+  Lexer * lexer = lexer_new(input, inputLen, compiler->allocator);
   LexerType type;
   size_t tokenLen;
 
   /* check that lexer alloc didn't fail, and push symtbl for global variables */
-  if(lexer == NULL || !symtblstk_push(compiler)) {
+  if(lexer == NULL) {
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    return false;
+  }
+
+  /* tokenize the whole input up front, so the parsers index into an array.
+   * in lazy mode, the tokens are kept for compiling the functions later
+   */
+  if(!lexer_tokenize(lexer)
+     || (compiler->lazy
+	 && !buffer_append_string(compiler->stubLexers, (char*)&lexer,
+				  sizeof(Lexer*)))) {
     compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
     lexer_free(lexer);
     return false;
   }
+  if(!symtblstk_push(compiler)) {
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    if(!compiler->lazy) {
+      lexer_free(lexer);
+    }
+    return false;
+  }
   compiler_set_err(compiler, COMPILERERR_SUCCESS);
+  borrowsites_discard(compiler);
 
   /* compile loop */
   lexer_next(lexer, &type, &tokenLen);
@@ -476,15 +1269,142 @@ bool compiler_build(Compiler * compiler, char * input, size_t inputLen) {
     if(compiler->err != COMPILERERR_SUCCESS) {
       compiler->lexerErr = lexer_get_err(lexer);
       compiler->errorLineNum = lexer_line_num(lexer);
-      lexer_free(lexer);
+
+      /* drop the symbol tables of the scopes the error occurred in, their
+       * names point into the lexer's copy of the input */
+      while(symtblstk_peek(compiler, 0) != NULL) {
+	symtblstk_pop(compiler);
+      }
+      if(!compiler->lazy) {
+	lexer_free(lexer);
+      }
       return false;
     }
   }
 
   /* we're done here: pop globals symtable */
-  symtbl_free(symtblstk_pop(compiler));
+  symtblstk_pop(compiler);
+
+  if(!compiler->lazy) {
+    lexer_free(lexer);
+  }
+  return true;
+}
+
+/**
+ * Compiles the function of a stub written in lazy mode, appending its code to
+ * the bytecode.
+ * compiler: an instance of Compiler.
+ * stub: the stub.
+ * returns: true if success, false and sets the error if the function has an
+ * error or allocation fails.
+ */
+static bool compile_stub(Compiler * compiler, CompilerStub * stub) {
+
+  compiler_set_err(compiler, COMPILERERR_SUCCESS);
+  borrowsites_discard(compiler);
+
+  /* parse the definition again, from the global scope */
+  if(!symtblstk_push(compiler)) {
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    return false;
+  }
+  lexer_seek(stub->lexer, stub->position);
+  compiler->stubFunc = stub->func;
+  parse_function_definitions(compiler, stub->lexer);
+  compiler->stubFunc = NULL;
+
+  /* handle errors */
+  if(lexer_get_err(stub->lexer) != LEXERERR_SUCCESS) {
+    compiler->err = COMPILERERR_LEXER_ERR;
+  }
+  if(compiler->err != COMPILERERR_SUCCESS) {
+    compiler->lexerErr = lexer_get_err(stub->lexer);
+    compiler->errorLineNum = lexer_line_num(stub->lexer);
+    while(symtblstk_peek(compiler, 0) != NULL) {
+      symtblstk_pop(compiler);
+    }
+    return false;
+  }
+
+  symtblstk_pop(compiler);
+  stub->compiled = true;
+  return true;
+}
+
+/**
+ * Compiles the function whose OP_STUB is running, and replaces the stub with
+ * an OP_GOTO to the function's code. The OP_CALL_B that called the function
+ * is also pointed at the code, so that it skips the goto from then on. The
+ * code is appended to the bytecode, which may move it, so get
+ * compiler_bytecode() again afterwards. Called by the VM's stub handler.
+ * compiler: an instance of Compiler in lazy mode.
+ * stub: the stub number, the operand of the OP_STUB.
+ * callIndex: the offset of the calling OP_CALL_B, or -1 if none.
+ * returns: true if success, false and sets the error if the function has an
+ * error, allocation fails, or the stub doesn't exist.
+ */
+bool compiler_compile_stub(Compiler * compiler, int stub, int callIndex) {
+  CompilerStub * s;
+  char * code;
+  int address;
+
+  assert(compiler != NULL);
 
-  lexer_free(lexer);
+  if(compiler->stubs == NULL || stub < 0
+     || stub >= buffer_size(compiler->stubs) / sizeof(CompilerStub)) {
+    compiler_set_err(compiler, COMPILERERR_UNDEFINED_FUNCTION);
+    return false;
+  }
+  s = (CompilerStub*)buffer_get_buffer(compiler->stubs) + stub;
+  if(s->compiled) {
+    return true;
+  }
+
+  if(!compile_stub(compiler, s)) {
+    return false;
+  }
+
+  /* OP_STUB [stub:sizeof(int)] becomes OP_GOTO [goto_address:sizeof(int)] */
+  code = buffer_get_buffer(compiler->outBuffer);
+  address = s->func->index;
+  code[s->index] = OP_GOTO;
+  memcpy(code + s->index + 1, &address, sizeof(int));
+
+  /* OP_CALL_B [number_of_vars_and_args:1] [args:1] [address:int] */
+  if(callIndex >= 0
+     && callIndex + 3 + sizeof(int) <= buffer_size(compiler->outBuffer)
+     && code[callIndex] == OP_CALL_B
+     && memcmp(code + callIndex + 3, &s->index, sizeof(int)) == 0) {
+    memcpy(code + callIndex + 3, &address, sizeof(int));
+  }
+
+  return true;
+}
+
+/**
+ * Compiles the functions of all stubs that haven't run yet, so that the
+ * bytecode no longer needs the compiler, e.g. before saving it.
+ * compiler: an instance of Compiler.
+ * returns: true if success, false and sets the error if a function has an
+ * error or allocation fails.
+ */
+bool compiler_compile_stubs(Compiler * compiler) {
+  int numStubs;
+  int i;
+
+  assert(compiler != NULL);
+
+  if(compiler->stubs == NULL) {
+    return true;
+  }
+
+  numStubs = buffer_size(compiler->stubs) / sizeof(CompilerStub);
+  for(i = 0; i < numStubs; i++) {
+    if(!compiler_compile_stub(compiler, i, -1)) {
+      return false;
+    }
+  }
   return true;
 }
 
@@ -553,20 +1473,8 @@ CompilerFunc * compiler_function(Compiler * compiler, char * name, size_t len) {
 void compiler_free(Compiler * compiler) {
   assert(compiler != NULL);
 
-  if(compiler->symTableStk != NULL) {
-    stk_free(compiler->symTableStk);
-  }
-
+  /* function records are in the arena, freed below */
   if(compiler->functionHT != NULL) {
-    HTIter htIterator;
-    ht_iter_get(compiler->functionHT, &htIterator);
-
-    while(ht_iter_has_next(&htIterator)) {
-      DSValue value;
-      ht_iter_next(&htIterator, NULL, 0, &value, NULL, true);
-      compilerfunc_free(value.pointerVal);
-    }
-
     ht_free(compiler->functionHT);
   }
  
@@ -574,7 +1482,90 @@ void compiler_free(Compiler * compiler) {
     buffer_free(compiler->outBuffer);
   }
 
-  free(compiler);
+  if(compiler->borrowSites != NULL) {
+    buffer_free(compiler->borrowSites);
+  }
+
+  if(compiler->nativeSites != NULL) {
+    buffer_free(compiler->nativeSites);
+  }
+
+  if(compiler->codeSites != NULL) {
+    buffer_free(compiler->codeSites);
+  }
+
+  if(compiler->callSites != NULL) {
+    buffer_free(compiler->callSites);
+  }
+
+  if(compiler->stubs != NULL) {
+    buffer_free(compiler->stubs);
+  }
+
+  /* the lexers kept by lazy mode builds */
+  if(compiler->stubLexers != NULL) {
+    Lexer ** lexers = (Lexer**)buffer_get_buffer(compiler->stubLexers);
+    int i;
+
+    for(i = 0; i < buffer_size(compiler->stubLexers) / sizeof(Lexer*); i++) {
+      lexer_free(lexers[i]);
+    }
+    buffer_free(compiler->stubLexers);
+  }
+
+  exprstks_free(compiler);
+
+  /* free everything in the arena at once */
+  if(compiler->arena != NULL) {
+    gsarena_free(compiler->arena);
+  }
+
+  gsalloc_free(compiler->baseAllocator, compiler, sizeof(Compiler));
+}
+
+/**
+ * Gets whether the compiler is in lazy mode. See compiler_set_lazy().
+ * compiler: an instance of Compiler.
+ * returns: true if functions are compiled on their first call.
+ */
+bool compiler_lazy(Compiler * compiler) {
+  assert(compiler != NULL);
+  return compiler->lazy;
+}
+
+/**
+ * Gets the number of bytes of compiler owned memory currently allocated,
+ * including the arena, the bytecode output and the lexer of a build that is
+ * in progress.
+ * compiler: an instance of Compiler.
+ * returns: the live byte count.
+ */
+size_t compiler_mem_used(Compiler * compiler) {
+  assert(compiler != NULL);
+  return compiler->memUsed;
+}
+
+/**
+ * Gets the highest value that compiler_mem_used() has reached since the last
+ * call to compiler_build() began, or since compiler_new() if there was none.
+ * compiler: an instance of Compiler.
+ * returns: the peak byte count.
+ */
+size_t compiler_mem_peak(Compiler * compiler) {
+  assert(compiler != NULL);
+  return compiler->memPeak;
+}
+
+/**
+ * Gets the number of bytes held by the compiler's arena, which contains its
+ * symbol tables, function records and expression stack arrays. The arena only
+ * grows until compiler_free().
+ * compiler: an instance of Compiler.
+ * returns: the byte count.
+ */
+size_t compiler_arena_size(Compiler * compiler) {
+  assert(compiler != NULL);
+  return gsarena_size(compiler->arena);
 }
 
 /**
@@ -0,0 +1,187 @@
+/**
+ * execcontext.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * An ExecContext runs a shared Program, see program.c, on one thread at a
+ * time. It holds only what changes while code runs: the frame and operand
+ * stacks, the error state, and the objects that the code creates, all in a
+ * VM made with vm_new_shared(), which reads the program's native bindings
+ * instead of copying them. Any number of contexts may run the same program
+ * at once without locks. Objects created in a context belong to it and must
+ * not be passed to another.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include "execcontext.h"
+
+/**
+ * Creates an execution context for a program.
+ * program: the program. The context holds a reference to it until
+ * execcontext_free().
+ * stackSize: the size of the frame stack in bytes.
+ * allocator: the allocator for the context and the objects created in it,
+ * or NULL for the default allocator. Only the thread using the context
+ * allocates with it.
+ * memMode: how objects created in the context are freed, see vm_new().
+ * returns: the context, or NULL if allocation fails.
+ */
+ExecContext * execcontext_new(Program * program, size_t stackSize,
+			      GSAllocator * allocator, VMMemMode memMode) {
+  ExecContext * context;
+
+  assert(program != NULL);
+  assert(stackSize > 0);
+
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  context = gsalloc_calloc(allocator, 1, sizeof(ExecContext));
+  if(context == NULL) {
+    return NULL;
+  }
+  context->allocator = allocator;
+
+  context->vm = vm_new_shared(stackSize, program->callbacks,
+			      program->numCallbacks, allocator, memMode);
+  if(context->vm == NULL) {
+    gsalloc_free(allocator, context, sizeof(ExecContext));
+    return NULL;
+  }
+
+  context->program = program_retain(program);
+  return context;
+}
+
+/**
+ * Runs a function of the context's program.
+ * context: the context. No other thread may be using it.
+ * function: a function of the context's program, see program_function().
+ * returns: true if success, false if a VM error occurred. Get the error with
+ * execcontext_err().
+ */
+bool execcontext_exec(ExecContext * context, CompilerFunc * function) {
+  assert(context != NULL);
+  assert(function != NULL);
+
+  /* a failed run leaves its frames behind */
+  vm_reset_failed(context->vm);
+
+  return vm_exec(context->vm, context->program->byteCode,
+		 context->program->byteCodeLen, function->index,
+		 function->numArgs + function->numVars);
+}
+
+/**
+ * Calls a function of the context's program with arguments from the host,
+ * and gets its return value. See vm_call().
+ * context: the context. No other thread may be using it.
+ * function: a function of the context's program, see program_function().
+ * Look it up once and keep it, it lives as long as the program.
+ * args: the arguments. Objects must have been created in this context.
+ * argc: the number of arguments, which must match the function's.
+ * result: receives the return value, or NULL to discard it. Release objects
+ * with vmarg_release().
+ * returns: true if success, false if a VM error occurred. Get the error with
+ * execcontext_err().
+ */
+bool execcontext_call(ExecContext * context, CompilerFunc * function,
+		      VMArg * args, int argc, VMArg * result) {
+  assert(context != NULL);
+  assert(function != NULL);
+
+  if(argc != function->numArgs) {
+    vm_set_err(context->vm, VMERR_INVALID_PARAM);
+    return false;
+  }
+
+  /* a failed run leaves its frames behind */
+  vm_reset_failed(context->vm);
+
+  return vm_call(context->vm, context->program->byteCode,
+		 context->program->byteCodeLen, function->index,
+		 function->numArgs + function->numVars, args, argc, result);
+}
+
+/**
+ * Calls a function of the context's program once for each of an array of
+ * argument tuples. See vm_call_batch().
+ * context: the context. No other thread may be using it.
+ * function: a function of the context's program, see program_function().
+ * args: numCalls tuples of argc arguments each, one after another.
+ * argc: the number of arguments in each tuple, which must match the
+ * function's.
+ * results: receives numCalls return values, or NULL to discard them.
+ * numCalls: the number of calls.
+ * returns: the number of calls that succeeded. If less than numCalls, the
+ * call after them failed. Get the error with execcontext_err().
+ */
+int execcontext_call_batch(ExecContext * context, CompilerFunc * function,
+			   VMArg * args, int argc, VMArg * results,
+			   int numCalls) {
+  assert(context != NULL);
+  assert(function != NULL);
+
+  if(argc != function->numArgs) {
+    vm_set_err(context->vm, VMERR_INVALID_PARAM);
+    return 0;
+  }
+
+  /* a failed run leaves its frames behind */
+  vm_reset_failed(context->vm);
+
+  return vm_call_batch(context->vm, context->program->byteCode,
+		       context->program->byteCodeLen, function->index,
+		       function->numArgs + function->numVars, args, argc,
+		       results, numCalls);
+}
+
+/**
+ * Gets the VM that holds the context's state, e.g. to check its memory use
+ * or set a memory limit. Natives called by the program receive it.
+ * context: the context.
+ * returns: the context's VM.
+ */
+VM * execcontext_vm(ExecContext * context) {
+  assert(context != NULL);
+  return context->vm;
+}
+
+/**
+ * Gets the error that occurred during the last execcontext_exec().
+ * context: the context.
+ * returns: a VMErr.
+ */
+VMErr execcontext_err(ExecContext * context) {
+  assert(context != NULL);
+  return vm_get_err(context->vm);
+}
+
+/**
+ * Frees an execution context and drops its reference to its program.
+ * context: the context.
+ */
+void execcontext_free(ExecContext * context) {
+  assert(context != NULL);
+
+  vm_free(context->vm);
+  program_release(context->program);
+  gsalloc_free(context->allocator, context, sizeof(ExecContext));
+}
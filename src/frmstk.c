@@ -42,20 +42,22 @@ static const size_t typeSize = 1;
 /**
  * Creates new instance of a frmstk with a preallocated buffer.
  * stackSize: Number of bytes in preallocated buffer.
+ * allocator: the allocator to use, or NULL for the default.
  * returns: new FrmStk* object, or NULL if allocation fails.
  */
-FrmStk * frmstk_new(size_t stackSize) {
-  FrmStk * fs = calloc(1, sizeof(FrmStk));
+FrmStk * frmstk_new(size_t stackSize, GSAllocator * allocator) {
+  FrmStk * fs = gsalloc_calloc(allocator, 1, sizeof(FrmStk));
 
   assert(stackSize > 0);
 
   if(fs != NULL) {
-    fs->buffer = calloc(1, stackSize);
+    fs->buffer = gsalloc_calloc(allocator, 1, stackSize);
     if(fs->buffer != NULL) {
       fs->stackSize = stackSize;
+      fs->allocator = allocator;
       return fs;
     } else {
-      free(fs);
+      gsalloc_free(allocator, fs, sizeof(FrmStk));
     }
   }
   return NULL;
@@ -126,6 +128,18 @@ bool frmstk_pop(FrmStk * fs) {
   return false;
 }
 
+/**
+ * Pops every frame at once, keeping the preallocated buffer. Release the
+ * objects in the frames' variables first, see frmstk_visit_vars().
+ * fs: the current frmstack object.
+ */
+void frmstk_clear(FrmStk * fs) {
+  assert(fs != NULL);
+
+  fs->usedStack = 0;
+  fs->stackDepth = 0;
+}
+
 /**
  * Gets the address of a framestack variable in the specified frame.
  * This function should not be used unless absolutely neccessary. Instead,
@@ -290,6 +304,35 @@ int frmstk_size(FrmStk * fs) {
   return fs->stackDepth;
 }
 
+/**
+ * Calls visitor once for every variable slot in every frame on the stack, top
+ * frame first. This is how the garbage collector finds objects referenced by
+ * variables without walking the frames once per variable.
+ * fs: the framestack instance.
+ * visitor: the function to call for each slot. It receives the slot's type
+ * and a pointer to its VM_VAR_SIZE bytes of possibly unaligned data.
+ * context: a pointer passed through to visitor.
+ */
+void frmstk_visit_vars(FrmStk * fs, FrmStkVarVisitor visitor, void * context) {
+  unsigned char * frameEnd;
+
+  assert(fs != NULL);
+  assert(visitor != NULL);
+
+  /* walk down from the top frame. each frame is its vars then its header */
+  frameEnd = (unsigned char*)fs->buffer + fs->usedStack;
+  while(frameEnd > (unsigned char*)fs->buffer) {
+    FrameHeader * header = (FrameHeader*)(frameEnd - sizeof(FrameHeader));
+    unsigned char * slot = (unsigned char*)header
+      - (header->numVarArgs * (VM_VAR_SIZE + typeSize));
+
+    frameEnd = slot;
+    for(; slot < (unsigned char*)header; slot += VM_VAR_SIZE + typeSize) {
+      visitor(context, (VarType)*slot, slot + typeSize);
+    }
+  }
+}
+
 /**
  * Frees the frame stack instance and preallocated buffer.
  * fs: the framestack instance to free.
@@ -298,6 +341,6 @@ void frmstk_free(FrmStk * fs) {
   assert(fs != NULL);
   assert(fs->buffer != NULL);
 
-  free(fs->buffer);
-  free(fs);
+  gsalloc_free(fs->allocator, fs->buffer, fs->stackSize);
+  gsalloc_free(fs->allocator, fs, sizeof(FrmStk));
 }
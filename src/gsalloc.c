@@ -0,0 +1,167 @@
+/**
+ * gsalloc.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Pluggable allocator interface. Every subsystem of the runtime (VM,
+ * compiler, buffers, stacks, and libraries) allocates through a GSAllocator
+ * vtable so that hosts can substitute arenas, alternate mallocs, or
+ * accounting wrappers. Free and realloc calls are always given the size of
+ * the original block so that allocators need not track sizes themselves.
+ * A NULL allocator means the default stdlib backed allocator.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <assert.h>
+#include "gsalloc.h"
+
+/* default alloc: plain malloc. */
+static void * default_alloc(void * context, size_t size) {
+  return malloc(size);
+}
+
+/* default realloc: plain realloc. */
+static void * default_realloc(void * context, void * ptr,
+			      size_t oldSize, size_t newSize) {
+  return realloc(ptr, newSize);
+}
+
+/* default free: plain free. */
+static void default_free(void * context, void * ptr, size_t size) {
+  free(ptr);
+}
+
+/* stdlib backed allocator used when none is specified */
+static GSAllocator defaultAllocator = {
+  default_alloc,
+  default_realloc,
+  default_free,
+  NULL
+};
+
+/**
+ * Gets the default, stdlib backed allocator.
+ * returns: a pointer to the statically allocated default allocator.
+ */
+GSAllocator * gsalloc_default() {
+  return &defaultAllocator;
+}
+
+/**
+ * Allocates a block of memory with the given allocator.
+ * allocator: the allocator to use, or NULL for the default.
+ * size: the number of bytes to allocate.
+ * returns: the new block, or NULL if the allocation fails.
+ */
+void * gsalloc_malloc(GSAllocator * allocator, size_t size) {
+  if(allocator == NULL) {
+    allocator = &defaultAllocator;
+  }
+
+  /* don't ask allocators for zero byte blocks */
+  if(size == 0) {
+    size = 1;
+  }
+
+  return allocator->alloc(allocator->context, size);
+}
+
+/**
+ * Allocates a zeroed array of num elements of size bytes each, like calloc.
+ * allocator: the allocator to use, or NULL for the default.
+ * num: the number of elements.
+ * size: the size of each element in bytes.
+ * returns: the new zeroed block, or NULL if the allocation fails.
+ */
+void * gsalloc_calloc(GSAllocator * allocator, size_t num, size_t size) {
+  size_t total = num * size;
+  void * ptr;
+
+  /* check for multiplication overflow */
+  if(size != 0 && total / size != num) {
+    return NULL;
+  }
+
+  ptr = gsalloc_malloc(allocator, total);
+  if(ptr != NULL) {
+    memset(ptr, 0, total);
+  }
+
+  return ptr;
+}
+
+/**
+ * Resizes a block of memory. Any newly added bytes are zeroed so that
+ * callers may rely on calloc-like semantics when growing buffers.
+ * allocator: the allocator that allocated ptr, or NULL for the default.
+ * ptr: the block to resize. If NULL, a new zeroed block is allocated.
+ * oldSize: the current size of the block in bytes.
+ * newSize: the requested size of the block in bytes.
+ * returns: the resized block, or NULL if the allocation fails, in which case
+ * the original block is left untouched.
+ */
+void * gsalloc_realloc(GSAllocator * allocator, void * ptr,
+		       size_t oldSize, size_t newSize) {
+  void * newPtr;
+
+  if(ptr == NULL) {
+    return gsalloc_calloc(allocator, 1, newSize);
+  }
+
+  if(allocator == NULL) {
+    allocator = &defaultAllocator;
+  }
+
+  /* don't ask allocators for zero byte blocks */
+  if(oldSize == 0) {
+    oldSize = 1;
+  }
+  if(newSize == 0) {
+    newSize = 1;
+  }
+
+  newPtr = allocator->realloc(allocator->context, ptr, oldSize, newSize);
+  if(newPtr != NULL && newSize > oldSize) {
+    memset((char*)newPtr + oldSize, 0, newSize - oldSize);
+  }
+
+  return newPtr;
+}
+
+/**
+ * Frees a block of memory.
+ * allocator: the allocator that allocated ptr, or NULL for the default.
+ * ptr: the block to free. May be NULL.
+ * size: the size in bytes that the block was allocated with.
+ */
+void gsalloc_free(GSAllocator * allocator, void * ptr, size_t size) {
+  if(ptr == NULL) {
+    return;
+  }
+
+  if(allocator == NULL) {
+    allocator = &defaultAllocator;
+  }
+
+  /* zero byte blocks were allocated as one byte */
+  if(size == 0) {
+    size = 1;
+  }
+
+  allocator->free(allocator->context, ptr, size);
+}
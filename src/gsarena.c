@@ -0,0 +1,196 @@
+/**
+ * gsarena.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Bump pointer arena for data that lives as long as its owner, such as the
+ * compiler's symbol tables and function records. Allocations are carved out
+ * of large blocks obtained from a GSAllocator and are never freed one by one.
+ * Everything is released at once by gsarena_free().
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <assert.h>
+#include "gsarena.h"
+
+/* every allocation is aligned for the most strictly aligned of these */
+typedef union GSArenaAlign {
+  long longVal;
+  double doubleVal;
+  void * pointerVal;
+} GSArenaAlign;
+
+/* rounds n up to the arena alignment */
+#define GSARENA_ROUND(n) \
+  (((n) + sizeof(GSArenaAlign) - 1) & ~(sizeof(GSArenaAlign) - 1))
+/* size of a block header, rounded so that block data is aligned */
+#define GSARENA_HEADER_SIZE    GSARENA_ROUND(sizeof(GSArenaBlock))
+
+/**
+ * Creates a new arena. No memory is reserved until the first allocation.
+ * blockSize: the number of bytes to get from the allocator at a time.
+ * allocator: the allocator for the blocks, or NULL for the default.
+ * returns: the new arena, or NULL if the allocation fails.
+ */
+GSArena * gsarena_new(size_t blockSize, GSAllocator * allocator) {
+  GSArena * arena;
+
+  assert(blockSize > 0);
+
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  arena = gsalloc_calloc(allocator, 1, sizeof(GSArena));
+  if(arena == NULL) {
+    return NULL;
+  }
+
+  arena->allocator = allocator;
+  arena->blockSize = GSARENA_ROUND(blockSize);
+  return arena;
+}
+
+/**
+ * Gets a new block from the allocator.
+ * arena: an instance of arena.
+ * size: the number of data bytes in the block.
+ * returns: the block, or NULL if the allocation fails.
+ */
+static GSArenaBlock * block_new(GSArena * arena, size_t size) {
+  GSArenaBlock * block = gsalloc_malloc(arena->allocator,
+					GSARENA_HEADER_SIZE + size);
+
+  if(block != NULL) {
+    block->size = size;
+    block->used = 0;
+    arena->size += GSARENA_HEADER_SIZE + size;
+  }
+
+  return block;
+}
+
+/**
+ * Allocates memory from the arena. The memory is valid until gsarena_free().
+ * arena: an instance of arena.
+ * size: the number of bytes to allocate.
+ * returns: the memory, aligned for any type, or NULL if the allocation fails.
+ */
+void * gsarena_alloc(GSArena * arena, size_t size) {
+  GSArenaBlock * block;
+
+  assert(arena != NULL);
+
+  block = arena->blocks;
+  size = GSARENA_ROUND(size > 0 ? size : 1);
+
+  /* get a new block if this doesn't fit in the current one */
+  if(block == NULL || block->size - block->used < size) {
+
+    /* allocations larger than a block get a block of their own, which goes
+     * behind the current block so that the rest of it is still filled
+     */
+    if(size > arena->blockSize) {
+      GSArenaBlock * bigBlock = block_new(arena, size);
+
+      if(bigBlock == NULL) {
+	return NULL;
+      }
+
+      bigBlock->used = size;
+      if(block != NULL) {
+	bigBlock->next = block->next;
+	block->next = bigBlock;
+      } else {
+	bigBlock->next = NULL;
+	arena->blocks = bigBlock;
+      }
+      arena->used += size;
+      return (char*)bigBlock + GSARENA_HEADER_SIZE;
+    }
+
+    block = block_new(arena, arena->blockSize);
+    if(block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  block->used += size;
+  arena->used += size;
+  return (char*)block + GSARENA_HEADER_SIZE + block->used - size;
+}
+
+/**
+ * Allocates zeroed memory from the arena.
+ * arena: an instance of arena.
+ * num: the number of items.
+ * size: the size of each item.
+ * returns: the memory, or NULL if the allocation fails.
+ */
+void * gsarena_calloc(GSArena * arena, size_t num, size_t size) {
+  void * ptr = gsarena_alloc(arena, num * size);
+
+  if(ptr != NULL) {
+    memset(ptr, 0, num * size);
+  }
+
+  return ptr;
+}
+
+/**
+ * Gets the number of bytes that the arena has taken from its allocator.
+ * Nothing is returned to the allocator before gsarena_free(), so this is also
+ * the most memory the arena has held.
+ * arena: an instance of arena.
+ * returns: the number of bytes, including block headers.
+ */
+size_t gsarena_size(GSArena * arena) {
+  assert(arena != NULL);
+
+  return arena->size;
+}
+
+/**
+ * Gets the number of bytes handed out by the arena.
+ * arena: an instance of arena.
+ * returns: the number of bytes allocated, including alignment padding.
+ */
+size_t gsarena_used(GSArena * arena) {
+  assert(arena != NULL);
+
+  return arena->used;
+}
+
+/**
+ * Frees the arena and everything allocated from it.
+ * arena: an instance of arena.
+ */
+void gsarena_free(GSArena * arena) {
+  GSArenaBlock * block;
+
+  assert(arena != NULL);
+
+  while((block = arena->blocks) != NULL) {
+    arena->blocks = block->next;
+    gsalloc_free(arena->allocator, block, GSARENA_HEADER_SIZE + block->size);
+  }
+
+  gsalloc_free(arena->allocator, arena, sizeof(GSArena));
+}
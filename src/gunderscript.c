@@ -24,10 +24,33 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
 #include "gunderscript.h"
 #include "libsys.h"
 #include "libmath.h"
 #include "libstr.h"
+#include "libchan.h"
+#include "libtask.h"
+
+/* state shared by the threads of gunderscript_build_files() */
+typedef struct BuildJob {
+  Compiler ** units;              /* one compilation unit per input */
+  char ** inputs;                 /* script of each unit */
+  size_t * inputLens;             /* length of each script */
+  int numInputs;                  /* number of inputs */
+  int next;                       /* next input to build */
+  pthread_mutex_t lock;           /* protects next */
+} BuildJob;
+
+/* arguments of link_files(), which is also the compile cache's build */
+typedef struct LinkJob {
+  Gunderscript * instance;
+  char ** inputs;                 /* the scripts */
+  size_t * inputLens;             /* length of each script */
+  int numInputs;                  /* number of scripts */
+  int numThreads;                 /* most threads to build on */
+  int * errInput;                 /* receives the script with an error */
+} LinkJob;
 
 /**
  * Creates a new instance of Gunderscript object with a compiler and 
@@ -40,18 +63,23 @@
  * how many native functions can be bound to this instance. Increase
  * this value if vm_reg_callback() fails, or if gunderscript_new()
  * always returns false.
+ * allocator: the allocator used by the compiler, the VM, and all libraries,
+ * or NULL for the default malloc backed allocator. It must outlive the
+ * instance.
+ * memMode: how the VM frees objects. See vm_new().
  * returns: true if creation succeeds, and false if fails. Failure can
  * occur due to malloc failure or if callbacksSize is too small to
  * contain all of the standard libraries.
  */
 bool gunderscript_new(Gunderscript * instance, size_t stackSize,
-		      int callbacksSize) {
+		      int callbacksSize, GSAllocator * allocator,
+		      VMMemMode memMode) {
   assert(instance != NULL);
   assert(stackSize > 0);
   assert(callbacksSize > 0);
 
   /* allocate virtual machine */
-  instance->vm = vm_new(stackSize, callbacksSize);
+  instance->vm = vm_new(stackSize, callbacksSize, allocator, memMode);
   if(instance->vm == NULL) {
     return false;
   }
@@ -59,18 +87,24 @@ bool gunderscript_new(Gunderscript * instance, size_t stackSize,
   /* initialize system libraries */
   if(!libsys_install(instance)
      || !libmath_install(instance)
-     || !libstr_install(instance)) {
+     || !libstr_install(instance)
+     || !libtask_install(instance)
+     || !libchan_install(instance)) {
     vm_free(instance->vm);
     return false;
   }
 
   /* allocate compiler instance */
-  instance->compiler = compiler_new(instance->vm);
+  instance->compiler = compiler_new(instance->vm, allocator);
   if(instance->compiler == NULL) {
     vm_free(instance->vm);
     return false;
   }
 
+  instance->image = NULL;
+  instance->imageErr = GXCERR_SUCCESS;
+  instance->cache = NULL;
+
   return true;
 }
 
@@ -108,9 +142,302 @@ bool gunderscript_build(Gunderscript * instance, char * input, size_t inputLen)
   assert(instance != NULL);
   assert(input != NULL);
   assert(inputLen > 0);
+
+  if(instance->cache != NULL) {
+    return gxccache_build(instance->cache, instance->compiler, instance->vm,
+			  input, inputLen);
+  }
+
   return compiler_build(instance->compiler, input, inputLen);
 }
 
+/**
+ * Hot swaps functions without restarting: builds a script that redefines
+ * functions that are already built, and possibly defines new ones, and points
+ * every call to a replaced function at its new code. The input can be a
+ * single function or a whole edited script file. Frames that are suspended in
+ * the old code finish in it. See compiler_rebuild(). May be called from a
+ * native function while a script is running, which continues in the new code
+ * when the native returns, and frames running the old version of a replaced
+ * function finish in it. If it fails, functions can't be run until a rebuild
+ * succeeds, as with any other compile error.
+ * instance: an instance of Gunderscript.
+ * input: a pointer to a buffer of Gunderscript code.
+ * inputLen: the length of the input.
+ * returns: true if success, false if the input has an error, changes the
+ * number of arguments of a function, or allocation fails, or if the compile
+ * cache is enabled or a .gxc file is loaded.
+ */
+bool gunderscript_rebuild(Gunderscript * instance, char * input,
+			  size_t inputLen) {
+  assert(instance != NULL);
+  assert(input != NULL);
+  assert(inputLen > 0);
+
+  /* cache entries depend on the exact builds before them, and a loaded file
+   * replaces the compiler's code
+   */
+  if(instance->cache != NULL || instance->image != NULL) {
+    return false;
+  }
+
+  if(!compiler_rebuild(instance->compiler, input, inputLen)) {
+    return false;
+  }
+
+  /* the code may have moved under a running script */
+  vm_code_moved(instance->vm, compiler_bytecode(instance->compiler),
+		compiler_bytecode_size(instance->compiler));
+  return true;
+}
+
+/**
+ * Stub handler for lazy mode: compiles the function of a stub with the
+ * instance's compiler. See vm_set_stub_handler().
+ * vm: the instance's VM.
+ * context: the Gunderscript instance.
+ * stub: the stub number.
+ * callIndex: the offset of the calling OP_CALL_B, or -1.
+ * byteCode: receives the compiler's bytecode, which may have moved.
+ * byteCodeLen: receives the length of the bytecode.
+ * returns: true if the function was compiled, false if not.
+ */
+static bool stub_handler(VM * vm, void * context, int stub, int callIndex,
+			 char ** byteCode, size_t * byteCodeLen) {
+  Gunderscript * instance = context;
+
+  /* code loaded from a .gxc file never has stubs */
+  if(instance->image != NULL
+     || !compiler_compile_stub(instance->compiler, stub, callIndex)) {
+    return false;
+  }
+
+  *byteCode = compiler_bytecode(instance->compiler);
+  *byteCodeLen = compiler_bytecode_size(instance->compiler);
+  return true;
+}
+
+/**
+ * Enables or disables lazy compilation. Scripts built in lazy mode have only
+ * their function signatures compiled, and each function is compiled the
+ * first time it is called, so the time taken to build depends on how many
+ * functions there are, not on how much code, and errors in a function's body
+ * aren't reported until it is first called. See compiler_set_lazy(). Must be
+ * called before building the scripts that it should apply to.
+ * instance: an instance of Gunderscript.
+ * lazy: true to enable lazy compilation.
+ * returns: true if success, false if the compile cache is enabled, or if
+ * allocation fails.
+ */
+bool gunderscript_set_lazy(Gunderscript * instance, bool lazy) {
+  assert(instance != NULL);
+
+  /* the cache stores whole compiled scripts */
+  if(instance->cache != NULL
+     || !compiler_set_lazy(instance->compiler, lazy)) {
+    return false;
+  }
+
+  if(lazy) {
+    vm_set_stub_handler(instance->vm, stub_handler, instance);
+  }
+  return true;
+}
+
+/**
+ * Build thread: builds inputs of a BuildJob until none are left.
+ * arg: the BuildJob.
+ * returns: NULL.
+ */
+static void * build_worker(void * arg) {
+  BuildJob * job = arg;
+  int i;
+
+  while(true) {
+    pthread_mutex_lock(&job->lock);
+    i = job->next++;
+    pthread_mutex_unlock(&job->lock);
+
+    if(i >= job->numInputs) {
+      return NULL;
+    }
+
+    /* errors are kept in the unit and reported by compiler_link() */
+    compiler_build(job->units[i], job->inputs[i], job->inputLens[i]);
+  }
+}
+
+/**
+ * Builds the scripts of a LinkJob, each as its own compilation unit on one of
+ * up to numThreads threads, then links them in order.
+ * arg: the LinkJob.
+ * returns: true if success, false if a script failed to build or link.
+ */
+static bool link_files(void * arg) {
+  LinkJob * link = arg;
+  Gunderscript * instance = link->instance;
+  char ** inputs = link->inputs;
+  size_t * inputLens = link->inputLens;
+  int numInputs = link->numInputs;
+  int numThreads = link->numThreads;
+  int * errInput = link->errInput;
+  GSAllocator * allocator;
+  BuildJob job;
+  pthread_t * threads;
+  int numStarted = 0;
+  bool success;
+  int i;
+
+  if(numThreads > numInputs) {
+    numThreads = numInputs;
+  }
+  if(numThreads < 1) {
+    numThreads = 1;
+  }
+
+  job.inputs = inputs;
+  job.inputLens = inputLens;
+  job.numInputs = numInputs;
+  job.next = 0;
+  allocator = vm_allocator(instance->vm);
+  job.units = gsalloc_calloc(allocator, numInputs + 1, sizeof(Compiler*));
+  threads = gsalloc_calloc(allocator, numThreads, sizeof(pthread_t));
+  if(job.units == NULL || threads == NULL) {
+    if(job.units != NULL) {
+      gsalloc_free(allocator, job.units, (numInputs + 1) * sizeof(Compiler*));
+    }
+    if(threads != NULL) {
+      gsalloc_free(allocator, threads, numThreads * sizeof(pthread_t));
+    }
+    compiler_set_err(instance->compiler, COMPILERERR_ALLOC_FAILED);
+    return false;
+  }
+
+  for(i = 0; i < numInputs; i++) {
+    job.units[i] = compiler_new_unit(instance->compiler);
+    if(job.units[i] == NULL) {
+      break;
+    }
+  }
+
+  /* build on the other threads and this one. if a thread can't be started
+   * the remaining threads take its share
+   */
+  if(i == numInputs && pthread_mutex_init(&job.lock, NULL) == 0) {
+    for(numStarted = 0; numStarted < numThreads - 1; numStarted++) {
+      if(pthread_create(&threads[numStarted], NULL,
+			build_worker, &job) != 0) {
+	break;
+      }
+    }
+    build_worker(&job);
+
+    for(i = 0; i < numStarted; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    success = compiler_link(instance->compiler, job.units, numInputs,
+			    errInput);
+  } else {
+    compiler_set_err(instance->compiler, COMPILERERR_ALLOC_FAILED);
+    success = false;
+  }
+
+  for(i = 0; job.units[i] != NULL; i++) {
+    compiler_free(job.units[i]);
+  }
+  gsalloc_free(allocator, job.units, (numInputs + 1) * sizeof(Compiler*));
+  gsalloc_free(allocator, threads, numThreads * sizeof(pthread_t));
+
+  return success;
+}
+
+/**
+ * Builds several scripts at once, each as its own compilation unit on one of
+ * up to numThreads threads, then links them in order. The result is the same
+ * as calling gunderscript_build() for each input in order, except that scripts
+ * may call functions defined later or in other scripts. With the compile
+ * cache enabled, the scripts are cached together as one build. With lazy
+ * compilation enabled, the scripts are still compiled in full.
+ * Natives must not be registered and the allocator must be thread safe
+ * while this runs.
+ * instance: an instance of Gunderscript.
+ * inputs: the scripts.
+ * inputLens: the length of each script.
+ * numInputs: the number of scripts.
+ * numThreads: the most threads to build on, including the calling thread.
+ * errInput: if not NULL, receives the index of the script that caused an
+ * error.
+ * returns: true if success, false if a script failed to build or link.
+ */
+bool gunderscript_build_files(Gunderscript * instance, char ** inputs,
+			      size_t * inputLens, int numInputs,
+			      int numThreads, int * errInput) {
+  LinkJob link;
+
+  assert(instance != NULL);
+  assert(inputs != NULL);
+  assert(inputLens != NULL);
+
+  link.instance = instance;
+  link.inputs = inputs;
+  link.inputLens = inputLens;
+  link.numInputs = numInputs;
+  link.numThreads = numThreads;
+  link.errInput = errInput;
+
+  if(instance->cache != NULL) {
+    return gxccache_build_files(instance->cache, instance->compiler,
+				instance->vm, inputs, inputLens, numInputs,
+				link_files, &link);
+  }
+
+  return link_files(&link);
+}
+
+/**
+ * Enables the compile cache. Once enabled, gunderscript_build() loads the
+ * bytecode of previously built scripts from the cache directory instead of
+ * compiling them. See gxccache.c. Must be called before the first build, and
+ * after all natives are registered.
+ * instance: an instance of Gunderscript.
+ * dir: the cache directory. It is created if it doesn't exist.
+ * returns: true if success, false if scripts were already built, if lazy
+ * compilation is enabled, or if allocation fails.
+ */
+bool gunderscript_set_cache(Gunderscript * instance, char * dir) {
+  assert(instance != NULL);
+  assert(dir != NULL);
+
+  if(instance->cache != NULL
+     || compiler_lazy(instance->compiler)
+     || compiler_bytecode_size(instance->compiler) > 0) {
+    return false;
+  }
+
+  instance->cache = gxccache_new(dir, vm_allocator(instance->vm));
+  return instance->cache != NULL;
+}
+
+/**
+ * Gets the compile cache hit and miss counters.
+ * instance: an instance of Gunderscript.
+ * stats: receives the counters.
+ * returns: true if success, false if the cache is not enabled.
+ */
+bool gunderscript_cache_stats(Gunderscript * instance, GXCCacheStats * stats) {
+  assert(instance != NULL);
+  assert(stats != NULL);
+
+  if(instance->cache == NULL) {
+    return false;
+  }
+
+  gxccache_stats(instance->cache, stats);
+  return true;
+}
+
 /**
  * Gets any compiler errors that may have occurred.
  * instance: an instance of Gunderscript.
@@ -121,6 +448,98 @@ CompilerErr gunderscript_build_err(Gunderscript * instance) {
   return compiler_get_err(instance->compiler);
 }
 
+/**
+ * Saves the bytecode built so far to a precompiled .gxc file that can be run
+ * later with gunderscript_load() without recompiling. See gxcfile.c.
+ * instance: an instance of Gunderscript that has successfully built all of
+ * its scripts.
+ * path: the file to write.
+ * returns: true if success, false if an error occurs. Get the error with
+ * gunderscript_image_err(), or gunderscript_build_err() if a lazily compiled
+ * function failed to compile.
+ */
+bool gunderscript_save(Gunderscript * instance, char * path) {
+  assert(instance != NULL);
+  assert(path != NULL);
+
+  /* the file can't compile stubs when it is run */
+  if(!compiler_compile_stubs(instance->compiler)) {
+    return false;
+  }
+
+  instance->imageErr = gxcfile_save(instance->compiler, instance->vm, path);
+  return instance->imageErr == GXCERR_SUCCESS;
+}
+
+/**
+ * Loads a precompiled .gxc file. Once loaded, gunderscript_function() runs
+ * functions from the file instead of from built scripts.
+ * instance: an instance of Gunderscript.
+ * path: the file to load.
+ * returns: true if success, false if an error occurs. Get the error with
+ * gunderscript_image_err().
+ */
+bool gunderscript_load(Gunderscript * instance, char * path) {
+  GXCFile * image;
+
+  assert(instance != NULL);
+  assert(path != NULL);
+
+  image = gxcfile_load(instance->vm, path, vm_allocator(instance->vm),
+		       &instance->imageErr);
+  if(image == NULL) {
+    return false;
+  }
+
+  /* compile cache entries can't be run on their own */
+  if(gxcfile_code_base(image) != 0) {
+    gxcfile_free(image);
+    instance->imageErr = GXCERR_PARTIAL;
+    return false;
+  }
+
+  /* replace any previously loaded file */
+  if(instance->image != NULL) {
+    gxcfile_free(instance->image);
+  }
+  instance->image = image;
+
+  return true;
+}
+
+/**
+ * Gets the error from the last call to gunderscript_save() or
+ * gunderscript_load().
+ * instance: an instance of Gunderscript.
+ * returns: a GXCErr, defined in gxcfile.h.
+ */
+GXCErr gunderscript_image_err(Gunderscript * instance) {
+  assert(instance != NULL);
+  return instance->imageErr;
+}
+
+/**
+ * Makes an immutable snapshot of the scripts built so far, or of the loaded
+ * .gxc file, that many threads can run at once, each with its own
+ * ExecContext, see execcontext.c. The program is independent of the
+ * instance, which can go on building, or be freed.
+ * instance: an instance of Gunderscript.
+ * returns: a program with a reference count of 1, release it with
+ * program_release(), or NULL if a lazily compiled function fails to
+ * compile, or allocation fails.
+ */
+Program * gunderscript_program(Gunderscript * instance) {
+  assert(instance != NULL);
+
+  if(instance->image != NULL) {
+    return program_from_gxcfile(instance->image, instance->vm,
+				instance->compiler->baseAllocator);
+  }
+
+  return program_from_compiler(instance->compiler, instance->vm,
+			       instance->compiler->baseAllocator);
+}
+
 /**
  * Gets a textual error message representing the last error, if there is one.
  * instance: an instance of Gunderscript.
@@ -136,6 +555,8 @@ const char * gunderscript_err_message(Gunderscript * instance) {
       return compiler_err_to_string(instance->compiler,
 				  compiler_get_err(instance->compiler));
     }
+  } else if(instance->imageErr != GXCERR_SUCCESS) {
+    return gxcfile_err_to_string(instance->imageErr);
   } else {
     return vm_err_to_string(vm_get_err(instance->vm));
   }
@@ -151,6 +572,50 @@ int gunderscript_err_line(Gunderscript * instance) {
   return compiler_err_line(instance->compiler);
 }
 
+/**
+ * Gets the code that functions run in, from the loaded file, or the compiler.
+ * instance: an instance of Gunderscript.
+ * byteCodeLen: receives the length of the code.
+ * returns: the code, or NULL if there is none, or the build failed.
+ */
+static char * gunderscript_code(Gunderscript * instance, size_t * byteCodeLen) {
+  if(instance->image != NULL) {
+    *byteCodeLen = gxcfile_bytecode_size(instance->image);
+    return gxcfile_bytecode(instance->image);
+  }
+
+  *byteCodeLen = compiler_bytecode_size(instance->compiler);
+  return compiler_bytecode(instance->compiler);
+}
+
+/**
+ * Runs a function of the loaded file, or of the built scripts.
+ * instance: an instance of Gunderscript.
+ * function: the function.
+ * args: the arguments, or NULL.
+ * argc: the number of arguments.
+ * result: receives the return value, or NULL to discard it.
+ * returns: true if a success, and false if an error occurs.
+ */
+static bool gunderscript_run(Gunderscript * instance, CompilerFunc * function,
+			     VMArg * args, int argc, VMArg * result) {
+  char * byteCode;
+  size_t byteCodeLen;
+
+  /* get the code each time, building or rebuilding may have moved it */
+  byteCode = gunderscript_code(instance, &byteCodeLen);
+  if(byteCode == NULL) {
+    return false;
+  }
+
+  /* a failed run leaves its frames behind */
+  vm_reset_failed(instance->vm);
+  
+  /* execute function in the virtual machine */
+  return vm_call(instance->vm, byteCode, byteCodeLen, function->index,
+		 function->numArgs + function->numVars, args, argc, result);
+}
+
 /**
  * Runs the specified Gunderscript "exported" function.
  * instance: an instance of Gunderscript.
@@ -160,22 +625,180 @@ int gunderscript_err_line(Gunderscript * instance) {
  */
 bool gunderscript_function(Gunderscript * instance, char * entryPoint,
 			   size_t entryPointLen) {
+  GunderscriptFunc handle;
+
+  if(!gunderscript_lookup(instance, entryPoint, entryPointLen, &handle)) {
+    return false;
+  }
+
+  return gunderscript_run(instance, handle.function, NULL, 0, NULL);
+}
+
+/**
+ * Looks up an exported function once, so that a host that calls it for
+ * every event doesn't hash its name each time. See gunderscript_call().
+ * instance: an instance of Gunderscript.
+ * name: the name of the function.
+ * nameLen: the length of name in chars.
+ * handle: receives the handle. It stays valid when the function is rebuilt
+ * with gunderscript_rebuild(), and until the instance is freed or a .gxc
+ * file is loaded.
+ * returns: true if success, false if the function doesn't exist or wasn't
+ * exported.
+ */
+bool gunderscript_lookup(Gunderscript * instance, char * name, size_t nameLen,
+			 GunderscriptFunc * handle) {
   CompilerFunc * function;
 
-  /* get compiler function definitions */
-  function = compiler_function(instance->compiler, entryPoint, entryPointLen);
+  assert(instance != NULL);
+  assert(handle != NULL);
+
+  /* get function definitions from the loaded file, or the compiler */
+  if(instance->image != NULL) {
+    function = gxcfile_function(instance->image, name, nameLen);
+  } else {
+    function = compiler_function(instance->compiler, name, nameLen);
+  }
   if(function == NULL) {
     return false;
   }
-  
-  /* execute function in the virtual machine */
-  if(!vm_exec(instance->vm, compiler_bytecode(instance->compiler), 
-	      compiler_bytecode_size(instance->compiler), function->index,
-	      function->numArgs + function->numVars)) {
+
+  handle->instance = instance;
+  handle->image = instance->image;
+  handle->function = function;
+  return true;
+}
+
+/**
+ * Calls a function looked up with gunderscript_lookup(). The arguments are
+ * copied straight into the function's variables, and the return value is
+ * handed back, so nothing is looked up by name.
+ * handle: the function.
+ * args: the arguments, made with vmarg_make_*(). Objects, e.g. strings made
+ * with vmarg_new_string(), are freed when the function returns unless the
+ * host holds a reference to them.
+ * argc: the number of arguments, which must match the function's.
+ * result: receives the return value, or NULL to discard it. If it is an
+ * object, release it with vmarg_release() when done, see vm_call().
+ * returns: true if a success, and false if an error occurs. Get the error
+ * with gunderscript_function_err().
+ */
+bool gunderscript_call(GunderscriptFunc * handle, VMArg * args, int argc,
+		       VMArg * result) {
+  assert(handle != NULL);
+  assert(handle->instance != NULL);
+  assert(handle->image == handle->instance->image);
+
+  if(argc != handle->function->numArgs) {
+    vm_set_err(handle->instance->vm, VMERR_INVALID_PARAM);
     return false;
   }
 
-  return true;
+  return gunderscript_run(handle->instance, handle->function,
+			  args, argc, result);
+}
+
+/**
+ * Calls a function looked up with gunderscript_lookup() once for each of an
+ * array of argument tuples, e.g. to score many records. The function's frame
+ * is pushed once and reused by each call, see vm_call_batch(). To split a
+ * batch across threads, use vmpool_call_batch() with a program from
+ * gunderscript_program().
+ * handle: the function.
+ * args: numCalls tuples of argc arguments each, one after another. See
+ * gunderscript_call().
+ * argc: the number of arguments in each tuple, which must match the
+ * function's.
+ * results: receives numCalls return values, or NULL to discard them.
+ * Release objects with vmarg_release().
+ * numCalls: the number of calls.
+ * returns: the number of calls that succeeded. If less than numCalls, the
+ * call after them failed. Get the error with gunderscript_function_err().
+ */
+int gunderscript_call_batch(GunderscriptFunc * handle, VMArg * args, int argc,
+			    VMArg * results, int numCalls) {
+  Gunderscript * instance;
+  char * byteCode;
+  size_t byteCodeLen;
+
+  assert(handle != NULL);
+  assert(handle->instance != NULL);
+  assert(handle->image == handle->instance->image);
+
+  instance = handle->instance;
+  if(argc != handle->function->numArgs) {
+    vm_set_err(instance->vm, VMERR_INVALID_PARAM);
+    return 0;
+  }
+
+  byteCode = gunderscript_code(instance, &byteCodeLen);
+  if(byteCode == NULL) {
+    return 0;
+  }
+
+  /* a failed run leaves its frames behind */
+  vm_reset_failed(instance->vm);
+
+  return vm_call_batch(instance->vm, byteCode, byteCodeLen,
+		       handle->function->index,
+		       handle->function->numArgs + handle->function->numVars,
+		       args, argc, results, numCalls);
+}
+
+/**
+ * Creates a coroutine that runs a function looked up with
+ * gunderscript_lookup(). The function starts running on the first
+ * gunderscript_resume(), and runs until it calls yield(), or returns. See
+ * vmcoro_new().
+ * handle: the function.
+ * stackSize: the size of the coroutine's frame stack in bytes.
+ * args: the arguments. See gunderscript_call().
+ * argc: the number of arguments, which must match the function's.
+ * returns: the coroutine, free it with vmcoro_free(), or NULL if argc is
+ * wrong or allocation fails. Get the error with gunderscript_function_err().
+ */
+VMCoro * gunderscript_coroutine(GunderscriptFunc * handle, size_t stackSize,
+				VMArg * args, int argc) {
+  assert(handle != NULL);
+  assert(handle->instance != NULL);
+  assert(handle->image == handle->instance->image);
+
+  if(argc != handle->function->numArgs) {
+    vm_set_err(handle->instance->vm, VMERR_INVALID_PARAM);
+    return NULL;
+  }
+
+  return vmcoro_new(handle->instance->vm, stackSize, handle->function->index,
+		    handle->function->numArgs + handle->function->numVars,
+		    args, argc);
+}
+
+/**
+ * Runs a coroutine until it yields, runs out of fuel, or returns. See
+ * vm_resume() and vm_set_fuel().
+ * instance: an instance of Gunderscript.
+ * coro: a coroutine of the instance, new, suspended, or preempted.
+ * value: the value that yield() returns in the coroutine, or NULL for null.
+ * result: receives the value given to yield(), or the function's return
+ * value, or NULL to discard it. Release objects with vmarg_release().
+ * returns: true if the coroutine yielded, was preempted, or returned, see
+ * vmcoro_state(), false if an error occurred. Get the error with
+ * gunderscript_function_err().
+ */
+bool gunderscript_resume(Gunderscript * instance, VMCoro * coro,
+			 VMArg * value, VMArg * result) {
+  char * byteCode;
+  size_t byteCodeLen;
+
+  assert(instance != NULL);
+  assert(coro != NULL);
+
+  byteCode = gunderscript_code(instance, &byteCodeLen);
+  if(byteCode == NULL) {
+    return false;
+  }
+
+  return vm_resume(instance->vm, coro, byteCode, byteCodeLen, value, result);
 }
 
 /**
@@ -195,6 +818,12 @@ VMErr gunderscript_function_err(Gunderscript * instance) {
  */
 void gunderscript_free(Gunderscript * instance) {
   assert(instance != NULL);
+  if(instance->image != NULL) {
+    gxcfile_free(instance->image);
+  }
+  if(instance->cache != NULL) {
+    gxccache_free(instance->cache);
+  }
   compiler_free(instance->compiler);
   vm_free(instance->vm);
 }
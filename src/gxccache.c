@@ -0,0 +1,428 @@
+/**
+ * gxccache.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * An opt-in, content addressed cache of compiled scripts, shared by every
+ * process that uses the same cache directory.
+ *
+ * Each build is keyed by a 64 bit FNV-1a hash of the script sources, the
+ * names and indices of the VM's native functions, the compiler and bytecode
+ * versions, and the key of the build before it. Scripts built into the same
+ * compiler call each other by absolute address, so a build's code is only
+ * reusable after exactly the same sequence of builds, which the chained key
+ * guarantees. Scripts linked together are one build, keyed on all of them,
+ * since they may call functions defined later. On a miss, the build is
+ * compiled and the code that it added is saved with gxcfile_save_range(). On
+ * a hit, that code is mapped and appended to the compiler without lexing or
+ * parsing.
+ *
+ * Entries are written to a temporary file and renamed into place, so
+ * processes sharing a cache never see partially written entries. Corrupt or
+ * unreadable entries are treated as misses and overwritten.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "gxccache.h"
+#include "gxcfile.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#else
+#include <direct.h>
+#include <process.h>
+#endif /* _WIN32 */
+
+/* FNV-1a 64 bit hash parameters */
+#define FNV64_OFFSET_BASIS        0xcbf29ce484222325ULL
+#define FNV64_PRIME               0x100000001b3ULL
+
+/* chars needed for a key in hex */
+#define KEY_CHARS                 16
+/* chars needed for the temporary file suffix: ".<pid>.tmp" */
+#define TMP_SUFFIX_CHARS          32
+
+/**
+ * Adds bytes to a 64 bit FNV-1a hash.
+ * hash: the hash so far, initially FNV64_OFFSET_BASIS.
+ * data: the bytes to add.
+ * len: the number of bytes.
+ * returns: the new hash.
+ */
+static uint64_t hash_add(uint64_t hash, void * data, size_t len) {
+  unsigned char * bytes = data;
+  size_t i;
+
+  for(i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= FNV64_PRIME;
+  }
+
+  return hash;
+}
+
+/**
+ * Adds an int to a hash.
+ * hash: the hash so far.
+ * value: the value to add.
+ * returns: the new hash.
+ */
+static uint64_t hash_add_int(uint64_t hash, int value) {
+  return hash_add(hash, &value, sizeof(int));
+}
+
+/**
+ * Computes the cache key for building scripts into a compiler.
+ * cache: the cache.
+ * vm: the VM whose natives the scripts may call.
+ * inputs: the script sources.
+ * inputLens: the length of each script in bytes.
+ * numInputs: the number of scripts.
+ * returns: the key.
+ */
+static uint64_t build_key(GXCCache * cache, VM * vm, char ** inputs,
+			  size_t * inputLens, int numInputs) {
+  uint64_t hash = FNV64_OFFSET_BASIS;
+  char name[GXC_MAX_NAME_LEN];
+  int i;
+
+  /* versions of everything that affects the code */
+  hash = hash_add_int(hash, COMPILER_VERSION);
+  hash = hash_add_int(hash, GXC_VERSION);
+  hash = hash_add_int(hash, sizeof(int));
+
+  /* native function set, compiled code embeds their indices */
+  hash = hash_add_int(hash, vm_num_callbacks(vm));
+  for(i = 0; i < vm_num_callbacks(vm); i++) {
+    size_t nameLen = vm_callback_name(vm, i, name, sizeof(name));
+
+    if(nameLen > sizeof(name)) {
+      nameLen = sizeof(name);
+    }
+    hash = hash_add_int(hash, nameLen);
+    hash = hash_add(hash, name, nameLen);
+  }
+
+  /* the builds before this one, and these scripts */
+  hash = hash_add(hash, &cache->chainHash, sizeof(uint64_t));
+  for(i = 0; i < numInputs; i++) {
+    hash = hash_add(hash, &inputLens[i], sizeof(size_t));
+    hash = hash_add(hash, inputs[i], inputLens[i]);
+  }
+
+  return hash;
+}
+
+/**
+ * Allocates the path of a cache entry.
+ * cache: the cache.
+ * key: the entry's key.
+ * temporary: if true, gets a unique temporary path for writing the entry.
+ * pathSize: receives the size of the allocation.
+ * returns: the path, or NULL if allocation fails.
+ */
+static char * entry_path(GXCCache * cache, uint64_t key, bool temporary,
+			 size_t * pathSize) {
+  char * path;
+  int len;
+
+  *pathSize = cache->dirLen + KEY_CHARS + strlen(GXCCACHE_EXTENSION)
+    + TMP_SUFFIX_CHARS + 2;
+  path = gsalloc_malloc(cache->allocator, *pathSize);
+  if(path == NULL) {
+    return NULL;
+  }
+
+  len = sprintf(path, "%s/%08lx%08lx%s", cache->dir,
+		(unsigned long)(key >> 32), (unsigned long)(key & 0xffffffffUL),
+		GXCCACHE_EXTENSION);
+
+  if(temporary) {
+#ifndef _WIN32
+    sprintf(path + len, ".%ld.tmp", (long)getpid());
+#else
+    sprintf(path + len, ".%ld.tmp", (long)_getpid());
+#endif /* _WIN32 */
+  }
+
+  return path;
+}
+
+/**
+ * Appends a cache entry to the compiler.
+ * cache: the cache.
+ * compiler: the compiler.
+ * vm: the VM, used to bind the entry's native calls.
+ * path: the entry's path.
+ * returns: true if the entry was appended, false if it doesn't exist, is
+ * unusable, or if appending fails. If appending fails, the compiler's error is
+ * set.
+ */
+static bool load_entry(GXCCache * cache, Compiler * compiler, VM * vm,
+		       char * path) {
+  GXCFile * file = gxcfile_load(vm, path, cache->allocator, NULL);
+  int * sites = NULL;
+  int numSites;
+  bool success;
+  int i;
+
+  if(file == NULL) {
+    return false;
+  }
+
+  /* entry must continue exactly where the compiler's code ends */
+  if(gxcfile_code_base(file) != compiler_bytecode_size(compiler)) {
+    gxcfile_free(file);
+    return false;
+  }
+
+  /* copy native sites out of the file so that they're aligned ints */
+  numSites = gxcfile_num_native_sites(file);
+  sites = gsalloc_calloc(cache->allocator, numSites, sizeof(int));
+  if(sites == NULL) {
+    gxcfile_free(file);
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    return false;
+  }
+  for(i = 0; i < numSites; i++) {
+    sites[i] = gxcfile_native_site(file, i);
+  }
+
+  /* append the code, then define its functions */
+  success = compiler_append(compiler, gxcfile_bytecode(file),
+			    gxcfile_bytecode_size(file), sites, numSites);
+  for(i = 0; success && i < gxcfile_num_functions(file); i++) {
+    CompilerFunc * cf = gxcfile_function_at(file, i);
+
+    success = compiler_define_function(compiler, cf->name, strlen(cf->name),
+				       cf->index, cf->numArgs, cf->numVars,
+				       cf->exported);
+  }
+
+  gsalloc_free(cache->allocator, sites, numSites * sizeof(int));
+  gxcfile_free(file);
+  return success;
+}
+
+/**
+ * Writes the code added by the last build to a cache entry.
+ * cache: the cache.
+ * compiler: the compiler.
+ * vm: the VM.
+ * key: the key of the build.
+ * codeStart: the size of the compiler's code before the build.
+ * siteStart: the number of native sites before the build.
+ * returns: true if the entry was written.
+ */
+static bool store_entry(GXCCache * cache, Compiler * compiler, VM * vm,
+			uint64_t key, size_t codeStart, int siteStart) {
+  size_t pathSize, tmpPathSize;
+  char * path = entry_path(cache, key, false, &pathSize);
+  char * tmpPath = entry_path(cache, key, true, &tmpPathSize);
+  bool success = false;
+
+  if(path != NULL && tmpPath != NULL) {
+
+    /* write to a temporary file and move it into place */
+    if(gxcfile_save_range(compiler, vm, tmpPath, codeStart, siteStart)
+       == GXCERR_SUCCESS) {
+#ifdef _WIN32
+      remove(path);
+#endif /* _WIN32 */
+      success = rename(tmpPath, path) == 0;
+    }
+
+    if(!success) {
+      remove(tmpPath);
+    }
+  }
+
+  gsalloc_free(cache->allocator, path, pathSize);
+  gsalloc_free(cache->allocator, tmpPath, tmpPathSize);
+  return success;
+}
+
+/**
+ * Creates a compile cache. The directory is created if it doesn't exist.
+ * dir: the cache directory. It may be shared by many processes.
+ * allocator: the allocator for the cache, or NULL for the default.
+ * returns: a new cache, or NULL if allocation fails.
+ */
+GXCCache * gxccache_new(char * dir, GSAllocator * allocator) {
+  GXCCache * cache;
+
+  assert(dir != NULL);
+
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  cache = gsalloc_calloc(allocator, 1, sizeof(GXCCache));
+  if(cache == NULL) {
+    return NULL;
+  }
+  cache->allocator = allocator;
+  cache->dirLen = strlen(dir);
+  cache->dir = gsalloc_calloc(allocator, cache->dirLen + 1, sizeof(char));
+  if(cache->dir == NULL) {
+    gsalloc_free(allocator, cache, sizeof(GXCCache));
+    return NULL;
+  }
+  strcpy(cache->dir, dir);
+
+  /* create the directory, failures show up as store failures later */
+#ifndef _WIN32
+  mkdir(dir, 0755);
+#else
+  _mkdir(dir);
+#endif /* _WIN32 */
+
+  return cache;
+}
+
+/**
+ * Builds a script, using the cache if possible. This does the same thing as
+ * compiler_build(), and must be used for every build into the compiler, since
+ * the cache key depends on all builds before this one.
+ * cache: the cache.
+ * compiler: the compiler to build into.
+ * vm: the VM the script is compiled for.
+ * input: the script source.
+ * inputLen: the length of input in bytes.
+ * returns: true if the script was built, false if the compiler failed. Get
+ * the error from the compiler.
+ */
+bool gxccache_build(GXCCache * cache, Compiler * compiler, VM * vm,
+		    char * input, size_t inputLen) {
+  assert(input != NULL);
+
+  return gxccache_build_files(cache, compiler, vm, &input, &inputLen, 1,
+			      NULL, NULL);
+}
+
+/**
+ * Builds several scripts as one cache entry, using the cache if possible.
+ * The entry is keyed on all of the scripts, so scripts built together, such
+ * as by linking units that call each other, are cached together. Like
+ * gxccache_build(), this must be used for every build into the compiler.
+ * cache: the cache.
+ * compiler: the compiler to build into.
+ * vm: the VM the scripts are compiled for.
+ * inputs: the script sources.
+ * inputLens: the length of each script in bytes.
+ * numInputs: the number of scripts.
+ * build: on a miss, builds the scripts into the compiler, or NULL to build
+ * them one by one with compiler_build().
+ * context: passed to build.
+ * returns: true if the scripts were built, false if the compiler failed. Get
+ * the error from the compiler.
+ */
+bool gxccache_build_files(GXCCache * cache, Compiler * compiler, VM * vm,
+			  char ** inputs, size_t * inputLens, int numInputs,
+			  GXCCacheBuildFunc build, void * context) {
+  uint64_t key;
+  size_t codeStart;
+  int siteStart;
+  size_t pathSize;
+  char * path;
+  bool hit;
+  int i;
+
+  assert(cache != NULL);
+  assert(compiler != NULL);
+  assert(vm != NULL);
+  assert(inputs != NULL);
+  assert(inputLens != NULL);
+
+  compiler_set_err(compiler, COMPILERERR_SUCCESS);
+  key = build_key(cache, vm, inputs, inputLens, numInputs);
+  codeStart = compiler_bytecode_size(compiler);
+  siteStart = compiler_num_native_sites(compiler);
+
+  /* try to load the cached build */
+  path = entry_path(cache, key, false, &pathSize);
+  if(path == NULL) {
+    compiler_set_err(compiler, COMPILERERR_ALLOC_FAILED);
+    return false;
+  }
+  hit = load_entry(cache, compiler, vm, path);
+  gsalloc_free(cache->allocator, path, pathSize);
+
+  if(hit) {
+    cache->stats.hits++;
+  } else {
+
+    /* a failed append leaves the compiler unusable */
+    if(compiler_get_err(compiler) != COMPILERERR_SUCCESS) {
+      return false;
+    }
+
+    cache->stats.misses++;
+    if(build != NULL) {
+      if(!build(context)) {
+	return false;
+      }
+    } else {
+      for(i = 0; i < numInputs; i++) {
+	if(!compiler_build(compiler, inputs[i], inputLens[i])) {
+	  return false;
+	}
+      }
+    }
+
+    /* scripts without functions add no code and have nothing to store */
+    if(compiler_bytecode_size(compiler) > codeStart) {
+      if(store_entry(cache, compiler, vm, key, codeStart, siteStart)) {
+	cache->stats.stores++;
+      } else {
+	cache->stats.storeFails++;
+      }
+    }
+  }
+
+  cache->chainHash = key;
+  return true;
+}
+
+/**
+ * Gets the cache's hit and miss counters.
+ * cache: the cache.
+ * stats: receives the counters.
+ */
+void gxccache_stats(GXCCache * cache, GXCCacheStats * stats) {
+  assert(cache != NULL);
+  assert(stats != NULL);
+
+  *stats = cache->stats;
+}
+
+/**
+ * Frees a compile cache. The cache directory is left as is.
+ * cache: the cache.
+ */
+void gxccache_free(GXCCache * cache) {
+  assert(cache != NULL);
+
+  gsalloc_free(cache->allocator, cache->dir, cache->dirLen + 1);
+  gsalloc_free(cache->allocator, cache, sizeof(GXCCache));
+}
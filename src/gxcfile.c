@@ -0,0 +1,861 @@
+/**
+ * gxcfile.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Saves compiled bytecode to precompiled Gunderscript (.gxc) files and loads
+ * them again so that scripts don't have to be lexed and compiled every time
+ * a program starts.
+ *
+ * A .gxc file is a GXCHeader followed by the function table, the native
+ * import table, the native call sites, a string table of names, and the code.
+ * Files normally hold a complete program. Files written by
+ * gxcfile_save_range() hold only the code and functions that were appended to
+ * a program by one build, and record where in the program that code starts,
+ * for the compile cache in gxccache.c.
+ * String constants are stored inline in the code by OP_STR_PUSH, so the code
+ * section is also the constant pool. Everything after the header is covered
+ * by an FNV-1a checksum.
+ *
+ * Files are loaded with mmap() and executed in place. Native callback indices
+ * depend on the order that natives were registered in, so each import is
+ * looked up by name in the loading VM and its call sites are rewritten if the
+ * index changed. The file is mapped privately, so rewriting only copies the
+ * pages that contain those call sites, and nothing at all when the loading VM
+ * registers natives in the same order as the one that saved the file.
+ * Platforms without mmap() read the file into memory instead.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "gxcfile.h"
+#include "buffer.h"
+#include "vmdefs.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* _WIN32 */
+
+/* FNV-1a 32 bit checksum parameters */
+#define FNV_OFFSET_BASIS          2166136261u
+#define FNV_PRIME                 16777619u
+
+/* size of the string table buffer and bytes to add each time it fills */
+static const int stringsBlockSize = 256;
+
+/**
+ * Adds bytes to an FNV-1a checksum.
+ * checksum: the checksum so far, initially FNV_OFFSET_BASIS.
+ * data: the bytes to add.
+ * len: the number of bytes.
+ * returns: the new checksum.
+ */
+static uint32_t checksum_add(uint32_t checksum, char * data, size_t len) {
+  size_t i;
+
+  for(i = 0; i < len; i++) {
+    checksum ^= (unsigned char)data[i];
+    checksum *= FNV_PRIME;
+  }
+
+  return checksum;
+}
+
+/**
+ * Writes a section of the file and adds it to the checksum.
+ * fp: the output file.
+ * data: the section data.
+ * len: the number of bytes to write.
+ * checksum: pointer to the running checksum.
+ * returns: true if success, false if the write failed.
+ */
+static bool write_section(FILE * fp, void * data, size_t len,
+			  uint32_t * checksum) {
+  if(len == 0) {
+    return true;
+  }
+
+  *checksum = checksum_add(*checksum, data, len);
+  return fwrite(data, 1, len, fp) == len;
+}
+
+/**
+ * Finds the import for a callback index, adding it if it doesn't exist yet.
+ * vm: the VM the code was compiled for, used to look up names.
+ * imports: the import table.
+ * numImports: pointer to the number of imports in the table.
+ * strings: the string table.
+ * callbackIndex: the callback index from an OP_CALL_PTR_N.
+ * err: receives an error code if this function fails.
+ * returns: the import, or NULL if an error occurs.
+ */
+static GXCImport * import_for_index(VM * vm, GXCImport * imports,
+				    int * numImports, Buffer * strings,
+				    int callbackIndex, GXCErr * err) {
+  char name[GXC_MAX_NAME_LEN];
+  size_t nameLen;
+  GXCImport * import;
+  int i;
+
+  for(i = 0; i < *numImports; i++) {
+    if(imports[i].callbackIndex == callbackIndex) {
+      return &imports[i];
+    }
+  }
+
+  /* new import, look up its name */
+  nameLen = vm_callback_name(vm, callbackIndex, name, sizeof(name));
+  if(nameLen == 0) {
+    *err = GXCERR_MISSING_NATIVE;
+    return NULL;
+  }
+  if(nameLen > sizeof(name)) {
+    *err = GXCERR_NAME_TOO_LONG;
+    return NULL;
+  }
+
+  import = &imports[(*numImports)++];
+  import->nameOffset = buffer_size(strings);
+  import->nameLen = nameLen;
+  import->callbackIndex = callbackIndex;
+  import->firstSite = 0;
+  import->numSites = 0;
+
+  if(!buffer_append_string(strings, name, nameLen)
+     || !buffer_append_char(strings, '\0')) {
+    *err = GXCERR_ALLOC_FAILED;
+    return NULL;
+  }
+
+  return import;
+}
+
+/* tables built from a compiler by gxcfile_save_range() */
+typedef struct GXCTables {
+  size_t codeStart;               /* first byte of code to save */
+  int siteStart;                  /* first native call site to save */
+  GXCFunc * funcs;
+  int numFuncs;
+  GXCImport * imports;            /* at most one per site */
+  int numImports;
+  int32_t * sites;
+  int numSites;                   /* sites from siteStart onward */
+  Buffer * strings;
+} GXCTables;
+
+/**
+ * Fills in the function, import, site and string tables from a compiler.
+ * compiler: a compiler that has successfully built all of the scripts.
+ * vm: the VM the scripts were compiled for.
+ * tables: allocated tables, large enough for every function and site, and
+ * with codeStart and siteStart set.
+ * returns: GXCERR_SUCCESS, or an error code.
+ */
+static GXCErr build_tables(Compiler * compiler, VM * vm, GXCTables * tables) {
+  char * code = compiler_bytecode(compiler);
+  GXCErr err = GXCERR_SUCCESS;
+  HTIter iter;
+  int i;
+
+  /* function table, only including functions in the saved code */
+  ht_iter_get(compiler->functionHT, &iter);
+  tables->numFuncs = 0;
+  while(ht_iter_has_next(&iter)) {
+    GXCFunc * entry;
+    DSValue value;
+    CompilerFunc * cf;
+
+    ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+    cf = value.pointerVal;
+    if((size_t)cf->index < tables->codeStart) {
+      continue;
+    }
+
+    entry = &tables->funcs[tables->numFuncs++];
+    entry->nameOffset = buffer_size(tables->strings);
+    entry->nameLen = strlen(cf->name);
+    entry->index = cf->index;
+    entry->numArgs = cf->numArgs;
+    entry->numVars = cf->numVars;
+    entry->exported = cf->exported;
+
+    if(!buffer_append_string(tables->strings, cf->name, entry->nameLen)
+       || !buffer_append_char(tables->strings, '\0')) {
+      return GXCERR_ALLOC_FAILED;
+    }
+  }
+
+  /* import table, counting the sites of each import */
+  for(i = 0; i < tables->numSites; i++) {
+    int callbackIndex;
+    GXCImport * import;
+
+    memcpy(&callbackIndex,
+	   code + compiler_native_site(compiler, tables->siteStart + i),
+	   sizeof(int));
+    import = import_for_index(vm, tables->imports, &tables->numImports,
+			      tables->strings, callbackIndex, &err);
+    if(import == NULL) {
+      return err;
+    }
+    import->numSites++;
+  }
+
+  /* lay out each import's sites contiguously, then fill them in */
+  for(i = 1; i < tables->numImports; i++) {
+    tables->imports[i].firstSite = tables->imports[i - 1].firstSite
+      + tables->imports[i - 1].numSites;
+  }
+  for(i = 0; i < tables->numImports; i++) {
+    tables->imports[i].numSites = 0;
+  }
+  for(i = 0; i < tables->numSites; i++) {
+    int offset = compiler_native_site(compiler, tables->siteStart + i);
+    int callbackIndex;
+    GXCImport * import;
+
+    memcpy(&callbackIndex, code + offset, sizeof(int));
+    import = import_for_index(vm, tables->imports, &tables->numImports,
+			      tables->strings, callbackIndex, &err);
+    tables->sites[import->firstSite + import->numSites++] = offset;
+  }
+
+  /* pad string table so that the code starts on an aligned offset */
+  while(buffer_size(tables->strings) % sizeof(int32_t) != 0) {
+    if(!buffer_append_char(tables->strings, '\0')) {
+      return GXCERR_ALLOC_FAILED;
+    }
+  }
+
+  return GXCERR_SUCCESS;
+}
+
+/**
+ * Writes the header, the tables, and the code to a file.
+ * path: the file to write.
+ * tables: the tables from build_tables().
+ * code: the bytecode to save, starting at tables->codeStart.
+ * codeLen: the number of bytes to save.
+ * returns: GXCERR_SUCCESS, or an error code.
+ */
+static GXCErr write_file(char * path, GXCTables * tables,
+			 char * code, int codeLen) {
+  uint32_t checksum = FNV_OFFSET_BASIS;
+  GXCHeader header;
+  FILE * fp;
+  bool success;
+
+  /* fill in the header */
+  memset(&header, 0, sizeof(GXCHeader));
+  memcpy(header.magic, GXC_MAGIC, GXC_MAGIC_LEN);
+  header.version = GXC_VERSION;
+  header.byteOrder = GXC_BYTE_ORDER_MARK;
+  header.intSize = sizeof(int);
+  header.funcsOffset = sizeof(GXCHeader);
+  header.numFuncs = tables->numFuncs;
+  header.importsOffset = header.funcsOffset
+    + (tables->numFuncs * sizeof(GXCFunc));
+  header.numImports = tables->numImports;
+  header.sitesOffset = header.importsOffset
+    + (tables->numImports * sizeof(GXCImport));
+  header.numSites = tables->numSites;
+  header.stringsOffset = header.sitesOffset
+    + (tables->numSites * sizeof(int32_t));
+  header.stringsLen = buffer_size(tables->strings);
+  header.codeOffset = header.stringsOffset + header.stringsLen;
+  header.codeLen = codeLen;
+  header.codeBase = tables->codeStart;
+
+  fp = fopen(path, "wb");
+  if(fp == NULL) {
+    return GXCERR_OPEN_FAILED;
+  }
+
+  /* write a placeholder header, the sections, and then the real header once
+   * the checksum is known
+   */
+  success = fwrite(&header, sizeof(GXCHeader), 1, fp) == 1
+    && write_section(fp, tables->funcs,
+		     tables->numFuncs * sizeof(GXCFunc), &checksum)
+    && write_section(fp, tables->imports,
+		     tables->numImports * sizeof(GXCImport), &checksum)
+    && write_section(fp, tables->sites,
+		     tables->numSites * sizeof(int32_t), &checksum)
+    && write_section(fp, buffer_get_buffer(tables->strings),
+		     header.stringsLen, &checksum)
+    && write_section(fp, code, codeLen, &checksum);
+
+  header.checksum = checksum;
+  success = success && fseek(fp, 0L, SEEK_SET) == 0
+    && fwrite(&header, sizeof(GXCHeader), 1, fp) == 1;
+
+  if(fclose(fp) != 0 || !success) {
+    return GXCERR_WRITE_FAILED;
+  }
+
+  return GXCERR_SUCCESS;
+}
+
+/**
+ * Saves the bytecode and function table of a compiler to a .gxc file.
+ * compiler: a compiler that has successfully built all of the scripts.
+ * vm: the VM the scripts were compiled for. Native function names are looked
+ * up in this VM.
+ * path: the file to write. It is replaced if it exists.
+ * returns: GXCERR_SUCCESS, or an error code if the file could not be saved.
+ */
+GXCErr gxcfile_save(Compiler * compiler, VM * vm, char * path) {
+  return gxcfile_save_range(compiler, vm, path, 0, 0);
+}
+
+/**
+ * Saves the part of a compiler's bytecode starting at codeStart to a .gxc
+ * file, along with the functions and native calls within it. Such files
+ * can't be run on their own, but can be appended to a compiler that has
+ * exactly codeStart bytes of code. See gxccache.c.
+ * compiler: a compiler that has successfully built all of the scripts.
+ * vm: the VM the scripts were compiled for.
+ * path: the file to write. It is replaced if it exists.
+ * codeStart: the first byte of code to save.
+ * siteStart: the first native call site in the saved code. See
+ * compiler_num_native_sites().
+ * returns: GXCERR_SUCCESS, or an error code if the file could not be saved.
+ */
+GXCErr gxcfile_save_range(Compiler * compiler, VM * vm, char * path,
+			  size_t codeStart, int siteStart) {
+  GSAllocator * allocator;
+  GXCTables tables;
+  GXCErr err;
+  int allocFuncs;
+
+  assert(compiler != NULL);
+  assert(vm != NULL);
+  assert(path != NULL);
+  assert(siteStart >= 0 && siteStart <= compiler_num_native_sites(compiler));
+
+  if(compiler_bytecode(compiler) == NULL
+     || compiler_bytecode_size(compiler) <= codeStart) {
+    return GXCERR_NO_BYTECODE;
+  }
+
+  /* allocate tables */
+  allocator = compiler->allocator;
+  memset(&tables, 0, sizeof(GXCTables));
+  tables.codeStart = codeStart;
+  tables.siteStart = siteStart;
+  allocFuncs = ht_size(compiler->functionHT);
+  tables.numSites = compiler_num_native_sites(compiler) - siteStart;
+  tables.funcs = gsalloc_calloc(allocator, allocFuncs, sizeof(GXCFunc));
+  tables.imports = gsalloc_calloc(allocator, tables.numSites,
+				  sizeof(GXCImport));
+  tables.sites = gsalloc_calloc(allocator, tables.numSites, sizeof(int32_t));
+  tables.strings = buffer_new(stringsBlockSize, stringsBlockSize, allocator);
+
+  /* build and write */
+  if(tables.funcs == NULL || tables.imports == NULL
+     || tables.sites == NULL || tables.strings == NULL) {
+    err = GXCERR_ALLOC_FAILED;
+  } else if((err = build_tables(compiler, vm, &tables)) == GXCERR_SUCCESS) {
+    err = write_file(path, &tables, compiler_bytecode(compiler) + codeStart,
+		     compiler_bytecode_size(compiler) - codeStart);
+  }
+
+  /* cleanup */
+  if(tables.strings != NULL) {
+    buffer_free(tables.strings);
+  }
+  gsalloc_free(allocator, tables.sites, tables.numSites * sizeof(int32_t));
+  gsalloc_free(allocator, tables.imports,
+	       tables.numSites * sizeof(GXCImport));
+  gsalloc_free(allocator, tables.funcs, allocFuncs * sizeof(GXCFunc));
+
+  return err;
+}
+
+/**
+ * Maps a file into memory, or reads it on platforms without mmap().
+ * file: the GXCFile that receives the image.
+ * path: the file to map.
+ * returns: GXCERR_SUCCESS, or an error code if the file can't be read.
+ */
+static GXCErr map_image(GXCFile * file, char * path) {
+#ifndef _WIN32
+  struct stat info;
+  int fd = open(path, O_RDONLY);
+
+  if(fd == -1) {
+    return GXCERR_OPEN_FAILED;
+  }
+
+  if(fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(GXCHeader)) {
+    close(fd);
+    return GXCERR_CORRUPT;
+  }
+
+  /* private writable mapping so that native rebinding is copy on write */
+  file->imageLen = info.st_size;
+  file->image = mmap(NULL, file->imageLen, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(file->image == MAP_FAILED) {
+    file->image = NULL;
+    return GXCERR_OPEN_FAILED;
+  }
+  file->mapped = true;
+
+  return GXCERR_SUCCESS;
+#else
+  FILE * fp = fopen(path, "rb");
+  long size;
+
+  if(fp == NULL) {
+    return GXCERR_OPEN_FAILED;
+  }
+
+  if(fseek(fp, 0L, SEEK_END) != 0 || (size = ftell(fp)) < 0
+     || size < (long)sizeof(GXCHeader)) {
+    fclose(fp);
+    return GXCERR_CORRUPT;
+  }
+  rewind(fp);
+
+  file->imageLen = size;
+  file->image = gsalloc_malloc(file->allocator, file->imageLen);
+  if(file->image == NULL) {
+    fclose(fp);
+    return GXCERR_ALLOC_FAILED;
+  }
+
+  if(fread(file->image, 1, file->imageLen, fp) != file->imageLen) {
+    fclose(fp);
+    return GXCERR_CORRUPT;
+  }
+  fclose(fp);
+  file->mapped = false;
+
+  return GXCERR_SUCCESS;
+#endif /* _WIN32 */
+}
+
+/**
+ * Checks that a section lies between the end of the header and the end of
+ * the file.
+ * file: the GXCFile.
+ * offset: the offset of the section.
+ * count: the number of entries in the section.
+ * size: the size of each entry in bytes.
+ * returns: true if the section is in bounds.
+ */
+static bool section_valid(GXCFile * file, int32_t offset,
+			  int32_t count, size_t size) {
+  if(offset < (int32_t)sizeof(GXCHeader) || count < 0
+     || (size_t)offset > file->imageLen) {
+    return false;
+  }
+
+  return (size_t)count <= (file->imageLen - offset) / size;
+}
+
+/**
+ * Checks that a name lies within the string table and is NULL terminated.
+ * header: the file header.
+ * strings: the string table.
+ * nameOffset: the offset of the name in the string table.
+ * nameLen: the length of the name.
+ * returns: true if the name is valid.
+ */
+static bool name_valid(GXCHeader * header, char * strings,
+		       int32_t nameOffset, int32_t nameLen) {
+  return nameOffset >= 0 && nameLen > 0
+    && nameOffset < header->stringsLen
+    && nameLen < header->stringsLen - nameOffset
+    && strings[nameOffset + nameLen] == '\0';
+}
+
+/**
+ * Builds the function table from the file's GXCFunc entries.
+ * file: the GXCFile.
+ * header: the file header.
+ * returns: GXCERR_SUCCESS, or an error code.
+ */
+static GXCErr load_functions(GXCFile * file, GXCHeader * header) {
+  char * strings = file->image + header->stringsOffset;
+  int i;
+
+  file->funcs = gsalloc_calloc(file->allocator, header->numFuncs,
+			       sizeof(CompilerFunc));
+  file->numFuncs = header->numFuncs;
+  file->functionHT = ht_new(COMPILER_INITIAL_HTSIZE, COMPILER_HTBLOCKSIZE,
+			    COMPILER_HTLOADFACTOR);
+  if(file->funcs == NULL || file->functionHT == NULL) {
+    return GXCERR_ALLOC_FAILED;
+  }
+
+  for(i = 0; i < header->numFuncs; i++) {
+    GXCFunc entry;
+    CompilerFunc * cf = &file->funcs[i];
+    DSValue value;
+    bool prevExisted;
+
+    memcpy(&entry, file->image + header->funcsOffset + (i * sizeof(GXCFunc)),
+	   sizeof(GXCFunc));
+
+    if(!name_valid(header, strings, entry.nameOffset, entry.nameLen)
+       || entry.index < header->codeBase
+       || entry.index - header->codeBase >= header->codeLen
+       || entry.numArgs < 0 || entry.numVars < 0) {
+      return GXCERR_CORRUPT;
+    }
+
+    /* names point into the image, nothing is copied */
+    cf->name = strings + entry.nameOffset;
+    cf->index = entry.index;
+    cf->numArgs = entry.numArgs;
+    cf->numVars = entry.numVars;
+    cf->exported = entry.exported != 0;
+
+    value.pointerVal = cf;
+    if(!ht_put_raw_key(file->functionHT, cf->name, entry.nameLen,
+		       &value, NULL, &prevExisted)) {
+      return GXCERR_ALLOC_FAILED;
+    }
+    if(prevExisted) {
+      return GXCERR_CORRUPT;
+    }
+  }
+
+  return GXCERR_SUCCESS;
+}
+
+/**
+ * Binds each native import to the loading VM's callback of the same name,
+ * rewriting the call sites whose callback index differs.
+ * file: the GXCFile.
+ * vm: the VM that will run the code.
+ * header: the file header.
+ * returns: GXCERR_SUCCESS, or an error code.
+ */
+static GXCErr bind_imports(GXCFile * file, VM * vm, GXCHeader * header) {
+  char * strings = file->image + header->stringsOffset;
+  int i, j;
+
+  for(i = 0; i < header->numImports; i++) {
+    GXCImport import;
+    int newIndex;
+
+    memcpy(&import, file->image + header->importsOffset
+	   + (i * sizeof(GXCImport)), sizeof(GXCImport));
+
+    if(!name_valid(header, strings, import.nameOffset, import.nameLen)
+       || import.firstSite < 0 || import.numSites < 0
+       || import.firstSite > header->numSites
+       || import.numSites > header->numSites - import.firstSite) {
+      return GXCERR_CORRUPT;
+    }
+
+    newIndex = vm_callback_index(vm, strings + import.nameOffset,
+				 import.nameLen);
+    if(newIndex == -1) {
+      return GXCERR_MISSING_NATIVE;
+    }
+
+    for(j = import.firstSite; j < import.firstSite + import.numSites; j++) {
+      int32_t site;
+      int oldIndex;
+
+      memcpy(&site, file->image + header->sitesOffset
+	     + (j * sizeof(int32_t)), sizeof(int32_t));
+
+      /* site must be the callback index operand of an OP_CALL_PTR_N
+       * OP_CALL_PTR_N [args:1] [callback_index:sizeof(int)]
+       */
+      site -= header->codeBase;
+      if(site < 2 || site > header->codeLen - (int32_t)sizeof(int)
+	 || file->code[site - 2] != OP_CALL_PTR_N) {
+	return GXCERR_CORRUPT;
+      }
+
+      memcpy(&oldIndex, file->code + site, sizeof(int));
+      if(oldIndex != import.callbackIndex) {
+	return GXCERR_CORRUPT;
+      }
+
+      if(newIndex != oldIndex) {
+	memcpy(file->code + site, &newIndex, sizeof(int));
+      }
+    }
+  }
+
+  return GXCERR_SUCCESS;
+}
+
+/**
+ * Checks the header of a mapped file.
+ * file: the GXCFile.
+ * header: receives a copy of the header.
+ * returns: GXCERR_SUCCESS, or an error code.
+ */
+static GXCErr check_header(GXCFile * file, GXCHeader * header) {
+
+  memcpy(header, file->image, sizeof(GXCHeader));
+
+  /* check that this file was written by this version of the writer */
+  if(memcmp(header->magic, GXC_MAGIC, GXC_MAGIC_LEN) != 0) {
+    return GXCERR_BAD_MAGIC;
+  }
+  if(header->version != GXC_VERSION) {
+    return GXCERR_BAD_VERSION;
+  }
+  if(header->byteOrder != GXC_BYTE_ORDER_MARK
+     || header->intSize != sizeof(int)) {
+    return GXCERR_INCOMPATIBLE;
+  }
+
+  /* check that every section is within the file */
+  if(!section_valid(file, header->funcsOffset, header->numFuncs,
+		    sizeof(GXCFunc))
+     || !section_valid(file, header->importsOffset, header->numImports,
+		       sizeof(GXCImport))
+     || !section_valid(file, header->sitesOffset, header->numSites,
+		       sizeof(int32_t))
+     || !section_valid(file, header->stringsOffset, header->stringsLen, 1)
+     || !section_valid(file, header->codeOffset, header->codeLen, 1)
+     || header->codeLen == 0 || header->codeBase < 0) {
+    return GXCERR_CORRUPT;
+  }
+
+  if(checksum_add(FNV_OFFSET_BASIS, file->image + sizeof(GXCHeader),
+		  file->imageLen - sizeof(GXCHeader)) != header->checksum) {
+    return GXCERR_BAD_CHECKSUM;
+  }
+
+  return GXCERR_SUCCESS;
+}
+
+/**
+ * Loads a .gxc file for execution. The bytecode is executed directly from the
+ * mapped file.
+ * vm: the VM that will run the code. Its natives are bound by name.
+ * path: the .gxc file to load.
+ * allocator: the allocator for the tables, or NULL for the default.
+ * err: receives GXCERR_SUCCESS or an error code. May be NULL.
+ * returns: a new GXCFile, or NULL if the file can't be loaded.
+ */
+GXCFile * gxcfile_load(VM * vm, char * path, GSAllocator * allocator,
+		       GXCErr * err) {
+  GXCFile * file;
+  GXCHeader header;
+  GXCErr result;
+
+  assert(vm != NULL);
+  assert(path != NULL);
+
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  file = gsalloc_calloc(allocator, 1, sizeof(GXCFile));
+  if(file == NULL) {
+    if(err != NULL) {
+      *err = GXCERR_ALLOC_FAILED;
+    }
+    return NULL;
+  }
+  file->allocator = allocator;
+
+  /* map and check the file, then bind it to the VM */
+  result = map_image(file, path);
+  if(result == GXCERR_SUCCESS) {
+    result = check_header(file, &header);
+  }
+  if(result == GXCERR_SUCCESS) {
+    file->code = file->image + header.codeOffset;
+    file->codeLen = header.codeLen;
+    file->codeBase = header.codeBase;
+    file->sites = file->image + header.sitesOffset;
+    file->numSites = header.numSites;
+    result = load_functions(file, &header);
+  }
+  if(result == GXCERR_SUCCESS) {
+    result = bind_imports(file, vm, &header);
+  }
+
+  if(err != NULL) {
+    *err = result;
+  }
+
+  if(result != GXCERR_SUCCESS) {
+    gxcfile_free(file);
+    return NULL;
+  }
+
+  return file;
+}
+
+/**
+ * Gets an exported function from a loaded file.
+ * file: a GXCFile.
+ * name: the name of the function.
+ * len: the length of name.
+ * returns: the function, or NULL if it does not exist or was not exported.
+ */
+CompilerFunc * gxcfile_function(GXCFile * file, char * name, size_t len) {
+  DSValue value;
+  CompilerFunc * cf;
+
+  assert(file != NULL);
+  assert(name != NULL);
+  assert(len > 0);
+
+  if(!ht_get_raw_key(file->functionHT, name, len, &value)) {
+    return NULL;
+  }
+  cf = value.pointerVal;
+
+  /* make sure function was declared with exported keyword */
+  if(!cf->exported) {
+    return NULL;
+  }
+
+  return cf;
+}
+
+/**
+ * Gets the bytecode of a loaded file.
+ * file: a GXCFile.
+ * returns: the bytecode, which points into the mapped file.
+ */
+char * gxcfile_bytecode(GXCFile * file) {
+  assert(file != NULL);
+  return file->code;
+}
+
+/**
+ * Gets the size of the bytecode of a loaded file.
+ * file: a GXCFile.
+ * returns: the size in bytes.
+ */
+size_t gxcfile_bytecode_size(GXCFile * file) {
+  assert(file != NULL);
+  return file->codeLen;
+}
+
+/**
+ * Gets the offset in the program where the file's code belongs. This is 0
+ * for files with a complete program, which are the only files that can be
+ * executed with gxcfile_bytecode().
+ * file: a GXCFile.
+ * returns: the offset of the file's first byte of code in the program.
+ */
+size_t gxcfile_code_base(GXCFile * file) {
+  assert(file != NULL);
+  return file->codeBase;
+}
+
+/**
+ * Gets the number of script functions in a loaded file, including functions
+ * that were not exported.
+ * file: a GXCFile.
+ * returns: the number of functions.
+ */
+int gxcfile_num_functions(GXCFile * file) {
+  assert(file != NULL);
+  return file->numFuncs;
+}
+
+/**
+ * Gets a script function from a loaded file by its position in the table.
+ * file: a GXCFile.
+ * index: the position, from 0 to gxcfile_num_functions() - 1.
+ * returns: the function. Its index is an offset in the program.
+ */
+CompilerFunc * gxcfile_function_at(GXCFile * file, int index) {
+  assert(file != NULL);
+  assert(index >= 0 && index < file->numFuncs);
+  return &file->funcs[index];
+}
+
+/**
+ * Gets the number of native function calls in a loaded file.
+ * file: a GXCFile.
+ * returns: the number of OP_CALL_PTR_N instructions.
+ */
+int gxcfile_num_native_sites(GXCFile * file) {
+  assert(file != NULL);
+  return file->numSites;
+}
+
+/**
+ * Gets the location of a native function call's callback index.
+ * file: a GXCFile.
+ * site: the site number, from 0 to gxcfile_num_native_sites() - 1.
+ * returns: the offset of the callback index operand in the program.
+ */
+int gxcfile_native_site(GXCFile * file, int site) {
+  int32_t offset;
+
+  assert(file != NULL);
+  assert(site >= 0 && site < file->numSites);
+
+  memcpy(&offset, file->sites + (site * sizeof(int32_t)), sizeof(int32_t));
+  return offset;
+}
+
+/**
+ * Unmaps a loaded file and frees its tables.
+ * file: a GXCFile.
+ */
+void gxcfile_free(GXCFile * file) {
+  assert(file != NULL);
+
+  if(file->functionHT != NULL) {
+    ht_free(file->functionHT);
+  }
+
+  gsalloc_free(file->allocator, file->funcs,
+	       file->numFuncs * sizeof(CompilerFunc));
+
+  if(file->image != NULL) {
+#ifndef _WIN32
+    if(file->mapped) {
+      munmap(file->image, file->imageLen);
+    } else {
+      gsalloc_free(file->allocator, file->image, file->imageLen);
+    }
+#else
+    gsalloc_free(file->allocator, file->image, file->imageLen);
+#endif /* _WIN32 */
+  }
+
+  gsalloc_free(file->allocator, file, sizeof(GXCFile));
+}
+
+/**
+ * Gets a string representation of a gxc error.
+ * err: the error to translate to text.
+ * returns: the text form of this error.
+ */
+const char * gxcfile_err_to_string(GXCErr err) {
+  return gxcErrorMessages[err];
+}
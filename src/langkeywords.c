@@ -0,0 +1,180 @@
+/**
+ * langkeywords.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Recognizes the keywords and operators in langkeywords.h with a perfect hash.
+ *
+ * The hash of a token is computed from its first char, last char, and length,
+ * and every keyword's hash is a case label in lang_keyword(). Case labels are
+ * constant expressions, so the table is generated by the compiler, and if two
+ * keywords ever hash to the same slot, the duplicate case is a compile error.
+ * If adding a keyword causes one, change the LANG_HASH multipliers until there
+ * are no collisions. A token is then a keyword only if a single compare
+ * against the keyword in its slot succeeds.
+ *
+ * A case label can't index a string, so each keyword's first and last chars
+ * are typed in by hand next to its name. lang_keywords_check(), which the
+ * lexer asserts, catches one that no longer matches langkeywords.h.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "langkeywords.h"
+
+/* perfect hash of a token from its first char, last char, and length */
+#define LANG_HASH(first, last, len)  (((first) + ((last) * 2) + ((len) * 11)) & 127)
+
+/* a case for the slot of the keyword with LANG_<name> and LANGKW_<name> */
+#define KEYWORD_CASE(first, last, name)				\
+  case LANG_HASH(first, last, LANG_##name##_LEN):		\
+    keyword = LANGKW_##name;					\
+    keywordStr = LANG_##name;					\
+    keywordLen = LANG_##name##_LEN;				\
+    break
+
+/* an entry of the keywords table, for LANG_<name> and LANGKW_<name> */
+#define KEYWORD_ENTRY(name)					\
+  { LANG_##name, LANG_##name##_LEN, sizeof(LANG_##name) - 1, LANGKW_##name }
+
+/* every keyword, with its length from langkeywords.h and from its string */
+static const struct {
+  const char * str;
+  size_t len;
+  size_t strLen;
+  LangKeyword keyword;
+} keywords[] = {
+  KEYWORD_ENTRY(FUNCTION),
+  KEYWORD_ENTRY(EXPORTED),
+  KEYWORD_ENTRY(ENDSTATEMENT),
+  KEYWORD_ENTRY(OPARENTH),
+  KEYWORD_ENTRY(CPARENTH),
+  KEYWORD_ENTRY(ARGDELIM),
+  KEYWORD_ENTRY(OBRACKET),
+  KEYWORD_ENTRY(CBRACKET),
+  KEYWORD_ENTRY(OSQBRKT),
+  KEYWORD_ENTRY(CSQBRKT),
+  KEYWORD_ENTRY(VAR_DECL),
+  KEYWORD_ENTRY(RETURN),
+  KEYWORD_ENTRY(TRUE),
+  KEYWORD_ENTRY(FALSE),
+  KEYWORD_ENTRY(NULL),
+  KEYWORD_ENTRY(IF),
+  KEYWORD_ENTRY(ELSE),
+  KEYWORD_ENTRY(DO),
+  KEYWORD_ENTRY(WHILE),
+  KEYWORD_ENTRY(FOR),
+  KEYWORD_ENTRY(OP_ADD),
+  KEYWORD_ENTRY(OP_SUB),
+  KEYWORD_ENTRY(OP_MUL),
+  KEYWORD_ENTRY(OP_DIV),
+  KEYWORD_ENTRY(OP_MOD),
+  KEYWORD_ENTRY(OP_ASSIGN),
+  KEYWORD_ENTRY(OP_EQUALS),
+  KEYWORD_ENTRY(OP_NOT_EQUALS),
+  KEYWORD_ENTRY(OP_LT),
+  KEYWORD_ENTRY(OP_GT),
+  KEYWORD_ENTRY(OP_LTE),
+  KEYWORD_ENTRY(OP_GTE),
+  KEYWORD_ENTRY(OP_AND),
+  KEYWORD_ENTRY(OP_OR),
+};
+
+/**
+ * Identifies a keyword or operator in constant time.
+ * token: the token. Need not be NULL terminated.
+ * len: the length of the token in chars.
+ * returns: the keyword, or LANGKW_NONE if the token is not one.
+ */
+LangKeyword lang_keyword(char * token, size_t len) {
+  LangKeyword keyword;
+  const char * keywordStr;
+  size_t keywordLen;
+
+  if(token == NULL || len == 0 || len > LANG_MAX_KEYWORD_LEN) {
+    return LANGKW_NONE;
+  }
+
+  switch(LANG_HASH((unsigned char)token[0],
+		   (unsigned char)token[len - 1], len)) {
+    KEYWORD_CASE('f', 'n', FUNCTION);
+    KEYWORD_CASE('e', 'd', EXPORTED);
+    KEYWORD_CASE(';', ';', ENDSTATEMENT);
+    KEYWORD_CASE('(', '(', OPARENTH);
+    KEYWORD_CASE(')', ')', CPARENTH);
+    KEYWORD_CASE(',', ',', ARGDELIM);
+    KEYWORD_CASE('{', '{', OBRACKET);
+    KEYWORD_CASE('}', '}', CBRACKET);
+    KEYWORD_CASE('[', '[', OSQBRKT);
+    KEYWORD_CASE(']', ']', CSQBRKT);
+    KEYWORD_CASE('v', 'r', VAR_DECL);
+    KEYWORD_CASE('r', 'n', RETURN);
+    KEYWORD_CASE('t', 'e', TRUE);
+    KEYWORD_CASE('f', 'e', FALSE);
+    KEYWORD_CASE('n', 'l', NULL);
+    KEYWORD_CASE('i', 'f', IF);
+    KEYWORD_CASE('e', 'e', ELSE);
+    KEYWORD_CASE('d', 'o', DO);
+    KEYWORD_CASE('w', 'e', WHILE);
+    KEYWORD_CASE('f', 'r', FOR);
+    KEYWORD_CASE('+', '+', OP_ADD);
+    KEYWORD_CASE('-', '-', OP_SUB);
+    KEYWORD_CASE('*', '*', OP_MUL);
+    KEYWORD_CASE('/', '/', OP_DIV);
+    KEYWORD_CASE('%', '%', OP_MOD);
+    KEYWORD_CASE('=', '=', OP_ASSIGN);
+    KEYWORD_CASE('=', '=', OP_EQUALS);
+    KEYWORD_CASE('!', '=', OP_NOT_EQUALS);
+    KEYWORD_CASE('<', '<', OP_LT);
+    KEYWORD_CASE('>', '>', OP_GT);
+    KEYWORD_CASE('<', '=', OP_LTE);
+    KEYWORD_CASE('>', '=', OP_GTE);
+    KEYWORD_CASE('&', '&', OP_AND);
+    KEYWORD_CASE('|', '|', OP_OR);
+  default:
+    return LANGKW_NONE;
+  }
+
+  /* the token hashed to a keyword's slot, check that it is the keyword */
+  if(len != keywordLen || memcmp(token, keywordStr, len) != 0) {
+    return LANGKW_NONE;
+  }
+
+  return keyword;
+}
+
+/**
+ * Checks that every keyword in langkeywords.h is recognized as itself, i.e.
+ * that its LANG_<name>_LEN is the length of its string, and that the chars
+ * typed into its case in lang_keyword() are its first and last. Cheap enough
+ * to assert whenever a lexer is created.
+ * returns: true if every keyword is recognized, and false if not.
+ */
+bool lang_keywords_check() {
+  size_t i;
+
+  for(i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    if(keywords[i].len != keywords[i].strLen
+       || lang_keyword((char*)keywords[i].str, keywords[i].len)
+       != keywords[i].keyword) {
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -35,6 +35,17 @@
 #include <assert.h>
 #include "gsbool.h"
 
+/* whitespace, comments, and string bodies are scanned 16 bytes at a time on
+ * machines with SSE2. Define LEXER_NO_SIMD to use only the scalar scanners.
+ */
+#if defined(__SSE2__) && !defined(LEXER_NO_SIMD)
+#include <emmintrin.h>
+#define LEXER_SSE2
+#endif /* __SSE2__ */
+
+/* bytes scanned per vector */
+#define LEXER_CHUNK               16
+
 /**
  * Prevents subsequent lexer_next() calls, finalizing the lexer.
  * l: a lexer object instance.
@@ -49,29 +60,32 @@ static void finalize_lexer(Lexer * l) {
  * Creates a new lexer object.
  * input: The input string to lex.
  * inputLen: the number of characters in the input buffer.
+ * allocator: the allocator to use, or NULL for the default.
  * returns: A new lexer object, or NULL if the 
  */
-Lexer * lexer_new(char * input, size_t inputLen) {
+Lexer * lexer_new(char * input, size_t inputLen, GSAllocator * allocator) {
 
   assert(input != NULL);
   assert(inputLen > 0);
+  assert(lang_keywords_check());
 
   /* allocate lexer, return NULL if fails */
-  Lexer * lexer = calloc(1, sizeof(Lexer));
+  Lexer * lexer = gsalloc_calloc(allocator, 1, sizeof(Lexer));
   if(lexer == NULL) {
     return NULL;
   }
 
   /* create operator set and allocate input storage string and handle failure */
-  lexer->input = calloc(inputLen + 1, sizeof(char));
+  lexer->input = gsalloc_calloc(allocator, inputLen + 1, sizeof(char));
   if(lexer->input == NULL) {
-    free(lexer);
+    gsalloc_free(allocator, lexer, sizeof(Lexer));
     return NULL;
   }
 
   strncpy(lexer->input, input, inputLen);
   lexer->inputLen = inputLen;
   lexer->lineNum = 1;
+  lexer->allocator = allocator;
 
   return lexer;
 }
@@ -84,74 +98,130 @@ Lexer * lexer_new(char * input, size_t inputLen) {
 void lexer_free(Lexer * l) {
   assert(l != NULL);
 
-  free(l->input);
-  free(l);
-}
-
-/**
- * Checks to see if character is a whitespace character, such as end line,
- * return carriage, tab, or space.
- * c: a char value to check.
- * returns: true if c is a whitespace char, and false if not.
- */
-static bool is_white_space(char c) {
-
-  switch(c) {
-  case ' ':
-  case '\t':
-  case '\r':
-  case '\n':
-    return true;
+  if(l->tokens != NULL) {
+    gsalloc_free(l->allocator, l->tokens, l->tokensSize * sizeof(LexerToken));
   }
-
-  return false;
-}
-
-/**
- * Returns the next char in the input string. This wrapper is for convenience.
- * Warning: this method does not do bounds checking.
- * l: an instance of lexer.
- * returns: the next char from the input.
- */
-static char next_char(Lexer * l) {
-  return l->input[l->index];
-}
-
-/**
- * Advances the next_char index to the next char in the input string.
- * Warning: this method does no bounds checking.
- * l: an instance of lexer.
- */
-static void advance_char(Lexer * l) {
-
-  /* if new line, increment line number */
-  if(next_char(l) == '\n') {
-    l->lineNum++;
+  gsalloc_free(l->allocator, l->input, l->inputLen + 1);
+  gsalloc_free(l->allocator, l, sizeof(Lexer));
+}
+
+/* character classes. The low bits of a charClasses entry are the kind of token
+ * that a char starts, and the high bits are flags for the kinds of tokens that
+ * the char may continue.
+ */
+#define CLASS_MASK                0x0f
+#define CLASS_OPERATOR            0x00
+#define CLASS_SPACE               0x01
+#define CLASS_SLASH               0x02
+#define CLASS_QUOTE               0x03
+#define CLASS_APOSTROPHE          0x04
+#define CLASS_KEYVAR              0x05
+#define CLASS_DIGIT               0x06
+#define CLASS_BRACKET             0x07
+#define CLASS_PARENTHESIS         0x08
+#define CLASS_ARGDELIM            0x09
+#define CLASS_ENDSTATEMENT        0x0a
+#define CHAR_KEYVAR               0x10  /* letters, digits, and underscores */
+#define CHAR_OPERATOR             0x20  /* not letters, digits, space, '"', ';' */
+#define CHAR_NUMBER               0x40  /* digits and decimal points */
+
+/* table entries, named by the chars that they describe */
+#define SP  (CLASS_SPACE)
+#define SL  (CLASS_SLASH | CHAR_OPERATOR)
+#define QT  (CLASS_QUOTE)
+#define AP  (CLASS_APOSTROPHE | CHAR_OPERATOR)
+#define LT  (CLASS_KEYVAR | CHAR_KEYVAR)
+#define US  (CLASS_KEYVAR | CHAR_KEYVAR | CHAR_OPERATOR)
+#define DG  (CLASS_DIGIT | CHAR_KEYVAR | CHAR_NUMBER)
+#define DT  (CLASS_OPERATOR | CHAR_OPERATOR | CHAR_NUMBER)
+#define BR  (CLASS_BRACKET | CHAR_OPERATOR)
+#define PR  (CLASS_PARENTHESIS | CHAR_OPERATOR)
+#define CM  (CLASS_ARGDELIM | CHAR_OPERATOR)
+#define SC  (CLASS_ENDSTATEMENT)
+#define OP  (CLASS_OPERATOR | CHAR_OPERATOR)
+
+/* class of every char, indexed by unsigned char value */
+static const unsigned char charClasses[256] = {
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, SP, SP, OP, OP, SP, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP,
+  SP, OP, QT, OP, OP, OP, OP, AP, PR, PR, OP, OP, CM, OP, DT, SL,
+  DG, DG, DG, DG, DG, DG, DG, DG, DG, DG, OP, SC, OP, OP, OP, OP,
+  OP, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT,
+  LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, BR, OP, BR, OP, US,
+  OP, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT,
+  LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, BR, OP, BR, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP,
+  OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP, OP
+};
+
+#undef SP
+#undef SL
+#undef QT
+#undef AP
+#undef LT
+#undef US
+#undef DG
+#undef DT
+#undef BR
+#undef PR
+#undef CM
+#undef SC
+#undef OP
+
+/**
+ * Gets the class of a char.
+ * c: the char.
+ * returns: the char's charClasses entry.
+ */
+static int char_class(char c) {
+  return charClasses[(unsigned char)c];
+}
+
+#ifdef LEXER_SSE2
+/**
+ * Gets the index of the lowest set bit.
+ * mask: a non-zero bit mask.
+ * returns: the index of the lowest set bit.
+ */
+static int first_bit(unsigned int mask) {
+#ifdef __GNUC__
+  return __builtin_ctz(mask);
+#else
+  int i = 0;
+
+  assert(mask != 0);
+  while((mask & 1) == 0) {
+    mask >>= 1;
+    i++;
   }
-
-  l->index++;
+  return i;
+#endif /* __GNUC__ */
 }
 
 /**
- * Gets the previous character in the input string.
- * Warning: this method does not do bounds checking.
- * l: an instance of lexer.
- * returns: the previous character.
+ * Counts the set bits.
+ * mask: a bit mask.
+ * returns: the number of set bits.
  */
-static char prev_char(Lexer * l) {
-  assert(l->index > 0);
-  return l->input[l->index - 1];
-}
+static int count_bits(unsigned int mask) {
+#ifdef __GNUC__
+  return __builtin_popcount(mask);
+#else
+  int count = 0;
 
-/**
- * Returns the next character in the input string without advancing current char
- * iterator.
- * l: an instance of lexer.
- * returns: the char in the sequence after the current char.
- */
-static char peek_char(Lexer * l) {
-  return l->input[l->index + 1];
+  for(; mask != 0; mask &= mask - 1) {
+    count++;
+  }
+  return count;
+#endif /* __GNUC__ */
 }
+#endif /* LEXER_SSE2 */
 
 /**
  * Gets the number of uniterated characters remaining in the input string.
@@ -175,455 +245,270 @@ static void set_type(LexerType * outType, LexerType newType) {
 }
 
 /**
- * lexer_next() whitespace subparser.
- * Advances current character index until current contiguous block of whitespace
- * has been passed completed.
- * l: an instance of lexer object.
- * returns: true if current character was a whitespace char when subparser was
- * first called, or false if the current character was not a whitespace
- * character.
- */
-static bool next_parse_whitespace(Lexer * l) {
-
-  if(is_white_space(next_char(l))) {
-
-    /* skip all whitespace characters */
-    while(remaining_chars(l) > 0 && is_white_space(next_char(l))) {
-      advance_char(l);
-    }
-
-    return true;
+ * Sets the next token and moves the lexer past it. Keywords and operators are
+ * identified here, once per token, so that the parsers can compare enums.
+ * l: an instance of lexer.
+ * begin: index of the first char of the token.
+ * end: index of the char after the token.
+ * next: index of the char to continue lexing from.
+ * type: the type of the token.
+ */
+static void set_next_token(Lexer * l, int begin, int end, int next,
+			   LexerType type) {
+  l->nextToken = l->input + begin;
+  l->nextTokenLen = end - begin;
+  l->nextTokenType = type;
+  l->err = LEXERERR_SUCCESS;
+  l->index = next;
+
+  /* string and char constants that look like keywords aren't keywords */
+  if(type == LEXERTYPE_STRING || type == LEXERTYPE_CHAR
+     || type == LEXERTYPE_NUMBER) {
+    l->nextTokenKeyword = LANGKW_NONE;
+  } else {
+    l->nextTokenKeyword = lang_keyword(l->nextToken, l->nextTokenLen);
   }
-
-  return false;
 }
 
 /**
- * lexer_next() comments subparser.
- * Whenever a comment start operator is encountered, advances current char index
- * until the matching comment terminator is encountered. If a multiline comment
- * is encountered, but it does not have a matching terminator, the l->err flag
- * is set to LEXERERR_UNTERMINATED_COMMENT, the next l->nextToken is set to NULL
- * but method still returns true.
- * l: a lexer object.
- * returns: true if this subparser was called when first chars were a start
- * comment operator, and returns false if current character was not comment
- * related and nothing was done.
+ * Sets a syntax error, finalizing the lexer.
+ * l: an instance of lexer.
+ * err: the error.
  */
-static bool next_parse_comments(Lexer * l) {
-
-  /* if there is another character after this one, check this one and the next
-   * one to see if they are single line comment characters: "//". If so, skip the
-   * comment characters.
-   */
-  if(remaining_chars(l) > 0
-     && next_char(l) == '/'
-     && peek_char(l) == '/') {
-
-    while(remaining_chars(l) > 0 && next_char(l) != '\n') {
-      advance_char(l);
-    }
-
-    return true;
-  }
-
-  /* if there is another character after the current one, check it to see if they
-   * are single line line comment characters. If so, skip the comment chars
-   */
-  if(remaining_chars(l) > 0
-     && next_char(l) == '/'
-     && peek_char(l) == '*') {
-
-    while(remaining_chars(l) > 0) {
-      if(l->index > 0 && prev_char(l) == '*' && next_char(l) == '/') {
-
-	/* prevent the closing / from being re-evaluated next iteration */
-	advance_char(l);
-	return true;
-      }
-      advance_char(l);
-    }
-
-    l->err = LEXERERR_UNTERMINATED_COMMENT;
-    finalize_lexer(l);
-  }
-
-  return false;
+static void set_err(Lexer * l, LexerErr err) {
+  l->err = err;
+  l->nextToken = NULL;
+  l->nextTokenLen = 0;
+  finalize_lexer(l);
 }
 
 /**
- * lexer_next() strings subparser.
- * If current character is a quotation mark, ", this function begins parsing to
- * find the matching end quotation mark. Upon finding it, the l->nextToken
- * pointer is set to point to the beginning of the string, and l->nextTokenLen is
- * set to the length of the string. If no end quotation mark is encountered,
- * l->err is set to LEXERERR_UNTERMINATED_STRING and l->nextToken is set to NULL,
- * but function returns true;
+ * Finds the next occurrence of any of three chars. On machines with SSE2, the
+ * input is searched 16 bytes at a time. To search for fewer chars, pass the
+ * same char more than once.
  * l: an instance of lexer.
- * returns: true if the first character the lexer encountered was a quotation
- * mark, and false if not.
- */
-static bool next_parse_strings(Lexer * l) {
-
-  /* this is the beginning of a string */
-  if(next_char(l) == '"') {
-    int beginStrIndex = l->index + 1;
-
-    /* add characters to the string */
-    l->index++;
-    for(; remaining_chars(l) > 0; advance_char(l)) {
-
-      /* handle escaping of quotes */
-      if(next_char(l) == '\\'){
-        advance_char(l);
-      } else if(next_char(l) == '"') {
-	/* encountered end of string, return it */
-	l->nextTokenLen = (l->index - beginStrIndex);
-	l->nextToken = l->input + beginStrIndex;
-	l->err = LEXERERR_SUCCESS;
-
-	l->nextTokenType = LEXERTYPE_STRING;
-
-	/* increment index again to prevent the end quote from being evaluated
-	 * next iteration.
-	 */
-	advance_char(l);
-	return true;
-      }
-
-      /* prevent newlines from being put in strings */
-      if(next_char(l) == '\n') {
-	l->err = LEXERERR_NEWLINE_IN_STRING_UNTERMINATED_ESCAPE;
-	finalize_lexer(l);
-	return true;
+ * index: the index to start searching at.
+ * a: a char to search for.
+ * b: a char to search for.
+ * c: a char to search for.
+ * returns: the index of the first match, or the input length if there is none.
+ */
+static int find_chars(Lexer * l, int index, char a, char b, char c) {
+  int inputLen = l->inputLen;
+  char * input = l->input;
+
+#ifdef LEXER_SSE2
+  {
+    const __m128i matchA = _mm_set1_epi8(a);
+    const __m128i matchB = _mm_set1_epi8(b);
+    const __m128i matchC = _mm_set1_epi8(c);
+
+    for(; index + LEXER_CHUNK <= inputLen; index += LEXER_CHUNK) {
+      __m128i chunk = _mm_loadu_si128((__m128i*)(input + index));
+      int mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, matchA),
+				     _mm_cmpeq_epi8(chunk, matchB)),
+			_mm_cmpeq_epi8(chunk, matchC)));
+
+      if(mask != 0) {
+	return index + first_bit(mask);
       }
-    
     }
-
-    /* error occurred, set token to null and quit */
-    l->nextToken = NULL;
-    l->err = LEXERERR_UNTERMINATED_STRING;
-    finalize_lexer(l);
-    return true;
   }
-  return false;
-}
-
-/**
- * lexer_next() char subparser.
- * If current character is a single quote, ', this function begins parsing to
- * find the matching end quote. Upon finding it, the l->nextToken
- * pointer is set to point to the beginning of the contained string, and 
- * l->nextTokenLen is set to the length of the string. If no end quote 
- * is encountered, l->err is set to LEXERERR_UNTERMINATED_STRING and 
- * l->nextToken is set to NULL, but function returns true;
- * l: an instance of lexer.
- * returns: true if the first character the lexer encountered was a single quote
- * and false if not.
- */
-static bool next_parse_chars(Lexer * l) {
-
-  /* this is the beginning of a char */
-  if(next_char(l) == '\'') {
-    int beginStrIndex = l->index + 1;
+#endif /* LEXER_SSE2 */
 
-    /* add characters to the char string */
-    l->index++;
-    for(; remaining_chars(l) > 0; advance_char(l)) {
+  for(; index < inputLen; index++) {
+    char ch = input[index];
 
-      /* handle escaping of quotes */
-      if(next_char(l) == '\\'){
-        advance_char(l);
-      } else if(next_char(l) == '\'') {
-	/* encountered end of string, return it */
-	l->nextTokenLen = (l->index - beginStrIndex);
-	l->nextToken = l->input + beginStrIndex;
-
-	l->err = LEXERERR_SUCCESS;
-
-	l->nextTokenType = LEXERTYPE_CHAR;
-
-	/* increment index again to prevent the end quote from being evaluated
-	 * next iteration.
-	 */
-	advance_char(l);
-	return true;
-      }
-
-      /* prevent newlines from being put in strings */
-      if(next_char(l) == '\n') {
-	l->err = LEXERERR_NEWLINE_IN_STRING_UNTERMINATED_ESCAPE;
-	finalize_lexer(l);
-	return true;
-      }
-    
+    if(ch == a || ch == b || ch == c) {
+      return index;
     }
-
-    /* error occurred, set token to null and quit */
-    l->nextToken = NULL;
-    l->err = LEXERERR_UNTERMINATED_STRING;
-    finalize_lexer(l);
-    return true;
   }
-  return false;
-}
 
-/**
- * Checks to determine if the character is a letter.
- * c: the letter to check.
- * returns: true if a letter, and false if not.
- */
-static bool is_letter(char c) {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+  return inputLen;
 }
 
 /**
- * Checks if is digit.
- * c: digit to check.
- * returns: true if is digit, false if not.
+ * Skips a contiguous block of whitespace, counting the lines in it. Long runs,
+ * such as indentation, are skipped 16 bytes at a time on machines with SSE2.
+ * l: an instance of lexer. The current char must be whitespace.
  */
-static bool is_digit(char c) {
-  return (c >= '0' && c <= '9');
-}
+static void skip_whitespace(Lexer * l) {
+  int inputLen = l->inputLen;
+  char * input = l->input;
+  int index = l->index;
 
-/**
- * lexer_next() keyvars subparser.
- * If current character is a letter, this method parses to the end of the
- * contiguous body of letters and numbers and then sets l->nextToken to the
- * start of the keyword or variable, and l->nextTokenLen to the the length
- * of the keyword or variable.
- * l: an instance of lexer.
- * returns: true if the first char was a letter, and false if not.
- */
-static bool next_parse_keyvars(Lexer * l) {
+  /* most runs are a single space, don't bother with vectors for them */
+  if(input[index] != '\n' && index + 1 < inputLen
+     && char_class(input[index + 1]) != CLASS_SPACE) {
+    l->index = index + 1;
+    return;
+  }
 
-  if(is_letter(next_char(l)) || next_char(l) == '_') {
-    int beginStrIndex = l->index;
+#ifdef LEXER_SSE2
+  {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for(; index + LEXER_CHUNK <= inputLen; index += LEXER_CHUNK) {
+      __m128i chunk = _mm_loadu_si128((__m128i*)(input + index));
+      __m128i newlines = _mm_cmpeq_epi8(chunk, newline);
+      unsigned int lineMask = _mm_movemask_epi8(newlines);
+      unsigned int spaceMask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+				     _mm_cmpeq_epi8(chunk, tab)),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), newlines)));
+
+      /* a non-whitespace char ends the run inside of this chunk */
+      if(spaceMask != 0xffff) {
+	int runLen = first_bit(~spaceMask);
+
+	l->lineNum += count_bits(lineMask & ((1U << runLen) - 1));
+	l->index = index + runLen;
+	return;
+      }
 
-    /* extract entire word */
-    while(remaining_chars(l) > 0 
-	  && (is_letter(next_char(l)) 
-	      || is_digit(next_char(l)) 
-	      || next_char(l) == '_')) {
-      advance_char(l);
+      l->lineNum += count_bits(lineMask);
     }
+  }
+#endif /* LEXER_SSE2 */
 
-    l->nextTokenLen = (l->index - beginStrIndex);
-    l->nextToken = l->input + beginStrIndex;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_KEYVAR;
-
-    return true;
+  for(; index < inputLen && char_class(input[index]) == CLASS_SPACE; index++) {
+    if(input[index] == '\n') {
+      l->lineNum++;
+    }
   }
 
-  return false;
+  l->index = index;
 }
 
 /**
- * lexer_next() numbers subparser.
- * If current character is a digit, begins parsing until end of digits is reached
- * making note of decimal points along the way. If more than one decimal point is
- * encountered, l->err is set to LEXERERR_DUPLICATE_DECIMAL_PT, l->nextToken is
- * set to NULL, and the function returns true. Otherwise, the function sets
- * l->nextToken to the pointer to the first digit in the number, and l->tokenLen
- * to the number of digits in the number (plus one if there is a decimal pt).
- * l: an instance of lexer.
- * returns: true if the first character encountered is a digit, and false if not.
+ * Skips a multiline comment, counting the lines in it. If the comment is
+ * unterminated, l->err is set to LEXERERR_UNTERMINATED_COMMENT.
+ * l: an instance of lexer. The current chars must be slash star.
  */
-static bool next_parse_numbers(Lexer * l) {
+static void skip_multiline_comment(Lexer * l) {
 
-  if(is_digit(next_char(l))) {
-    int beginStrIndex = l->index;
-    bool decimalDetected = false;
+  /* search from the star, so that slash star slash is a complete comment */
+  int index = l->index + 1;
 
-    /* move index to end of number */
-    while(remaining_chars(l) > 0 
-	  && (is_digit(next_char(l)) || next_char(l) == '.')) {
+  while(true) {
+    index = find_chars(l, index, '*', '\n', '\n');
 
-      /* prevent multiple decimal points in one number */
-      if(next_char(l) == '.') {
-
-	if(decimalDetected) {
-	  l->err = LEXERERR_DUPLICATE_DECIMAL_PT;
-	  finalize_lexer(l);
-	  l->nextToken = NULL;
-	  l->nextTokenLen = 0;
-	  return true;
-	}
-
-	decimalDetected = true;
-      }
-
-      advance_char(l);
+    if(index >= (int)l->inputLen) {
+      set_err(l, LEXERERR_UNTERMINATED_COMMENT);
+      return;
     }
 
-    /* if last character in digit grouping is a '.' throw a fit.
-     * Numbers must start and end with digits.
-     */
-    if(prev_char(l) == '.') {
-      l->err = LEXERERR_TRAILING_DECIMAL_PT;
-      finalize_lexer(l);
-      l->nextToken = NULL;
-      l->nextTokenLen = 0;
-      return true;
+    if(l->input[index] == '\n') {
+      l->lineNum++;
+    } else if(l->input[index + 1] == '/') {
+      l->index = index + 2;
+      return;
     }
 
-    /* success, save number to currentToken pointer */
-    l->nextTokenLen = (l->index - beginStrIndex);
-    l->nextToken = l->input + beginStrIndex;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_NUMBER;
-
-    return true;
+    index++;
   }
-
-  return false;
 }
 
 /**
- * Superficially decides if character is an operator character (not a letter,
- * digit, or whitespace).
- * c: the char to check.
- * returns: true if c is an operator, false if not.
+ * lexer_next() strings and chars subparser.
+ * Finds the matching end quote of a string or char constant and sets
+ * l->nextToken to the contained string. Backslash escapes the char after it.
+ * If there is no matching end quote, l->err is set to
+ * LEXERERR_UNTERMINATED_STRING, and if a newline is found first, l->err is set
+ * to LEXERERR_NEWLINE_IN_STRING_UNTERMINATED_ESCAPE.
+ * l: an instance of lexer. The current char must be the quote.
+ * quote: the quote char, '"' or '\''.
+ * type: LEXERTYPE_STRING or LEXERTYPE_CHAR.
  */
-static bool is_operator(char c) {
-  return (!is_digit(c) && !is_letter(c) && !is_white_space(c)
-	  && c != '"' && c != ';');
-}
-
-/**
- * Checks if a character is a bracket or curly brace.
- * c: the char to check.
- * returns: true if c is a bracket, false if not.
- */
-static bool is_bracket(char c) {
-  return c == '{' || c == '}' || c == '[' || c == ']';
-}
+static void next_parse_quoted(Lexer * l, char quote, LexerType type) {
+  int begin = l->index + 1;
+  int index = begin;
 
-/**
- * Checks if a character is a parenthesis.
- * c: the char to check.
- * returns: true if c is a parenthesis, false if not.
- */
-static bool is_parenthesis(char c) {
-  return c == '(' || c == ')';
-}
+  while(true) {
+    index = find_chars(l, index, quote, '\\', '\n');
 
-/**
- * lexer_next() operators subparser.
- * If current character is an operator char (see is_operator()), function copies
- * current character and all characters following operator that are operators
- * to the l->nextToken pointer, and sets l->nextTokenLen to the length of this
- * multicharacter operator.
- * l: an instance of lexer.
- * returns: true if the first character is an operator, and false if not.
- */
-static bool next_parse_operators(Lexer * l) {
-
-  if(is_operator(next_char(l))) {
-    int beginStrIndex = l->index;
-    char * token;
-    size_t tokenLen;
+    if(index >= (int)l->inputLen) {
+      set_err(l, LEXERERR_UNTERMINATED_STRING);
+      return;
+    }
 
-    /* move index to end of symbols */
-    while(remaining_chars(l) > 0 
-	  && is_operator(next_char(l))) {
-      advance_char(l);
+    if(l->input[index] == quote) {
+      set_next_token(l, begin, index, index + 1, type);
+      return;
     }
 
-    tokenLen = (l->index - beginStrIndex);
-    token  = l->input + beginStrIndex;
+    /* skip the escaped char, which may not be a new line */
+    if(l->input[index] == '\\') {
+      index++;
+      if(index >= (int)l->inputLen) {
+	set_err(l, LEXERERR_UNTERMINATED_STRING);
+	return;
+      }
+    }
 
-    l->nextToken = token;
-    l->nextTokenLen = tokenLen;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_OPERATOR;
+    if(l->input[index] == '\n') {
+      set_err(l, LEXERERR_NEWLINE_IN_STRING_UNTERMINATED_ESCAPE);
+      return;
+    }
 
-    return true;
+    index++;
   }
-  return false;
 }
 
 /**
- * lexer_next() brackets subparser.
- * If current character is a bracket or curly brace), the current character
- * will be set to the l->nextToken pointer, and
- * l->nextTokenLen will be set to the length of the symbol (always 1).
- * l: an instance of lexer.
- * returns: true if the current character is a logiparenth and false if not.
- */
-static bool next_parse_brackets(Lexer * l) {
-
-  if(is_bracket(next_char(l))) {
-    l->nextToken = l->input + l->index;
-    l->nextTokenLen = 1;
-    l->nextTokenType = LEXERTYPE_BRACKETS;
-    l->err = LEXERERR_SUCCESS;
-    advance_char(l);
-
-    return true;
+ * lexer_next() numbers subparser.
+ * Parses to the end of the digits and decimal points. If there is more than
+ * one decimal point, or the number ends in one, l->err is set to
+ * LEXERERR_DUPLICATE_DECIMAL_PT or LEXERERR_TRAILING_DECIMAL_PT.
+ * l: an instance of lexer. The current char must be a digit.
+ */
+static void next_parse_number(Lexer * l) {
+  int begin = l->index;
+  int index = begin;
+  bool decimalDetected = false;
+
+  for(; index < (int)l->inputLen
+	&& (char_class(l->input[index]) & CHAR_NUMBER); index++) {
+
+    /* prevent multiple decimal points in one number */
+    if(l->input[index] == '.') {
+      if(decimalDetected) {
+	set_err(l, LEXERERR_DUPLICATE_DECIMAL_PT);
+	return;
+      }
+      decimalDetected = true;
+    }
   }
 
-  return false;
-}
-
-/**
- * lexer_next() parenthesis subparser.
- * If current character is a parenthesis, the current character
- * will be set to the l->nextToken pointer, and
- * l->nextTokenLen will be set to the length of the symbol (always 1).
- * l: an instance of lexer.
- * returns: true if the current character is a logiparenth and false if not.
- */
-static bool next_parse_parenthesis(Lexer * l) {
-
-  if(is_parenthesis(next_char(l))) {
-    l->nextToken = l->input + l->index;
-    l->nextTokenLen = 1;
-    l->nextTokenType = LEXERTYPE_PARENTHESIS;
-    l->err = LEXERERR_SUCCESS;
-    advance_char(l);
-
-    return true;
+  /* numbers must start and end with digits */
+  if(l->input[index - 1] == '.') {
+    set_err(l, LEXERERR_TRAILING_DECIMAL_PT);
+    return;
   }
 
-  return false;
+  set_next_token(l, begin, index, index, LEXERTYPE_NUMBER);
 }
 
 /**
- * lexer_next() end statement subparser. If current character is an endstatement
- * character, function returns true and sets l->nextToken to the current character.
+ * lexer_next() keyvars and operators subparser. Parses to the end of the
+ * contiguous block of chars that have the given flag.
  * l: an instance of lexer.
- * returns: true if current character is an endstatement.
+ * flag: CHAR_KEYVAR or CHAR_OPERATOR.
+ * type: LEXERTYPE_KEYVAR or LEXERTYPE_OPERATOR.
  */
-static bool next_parse_endstatement(Lexer * l) {
-  if(next_char(l) == ';') {
-    l->nextToken = l->input + l->index;
-    l->nextTokenLen = 1;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_ENDSTATEMENT;
-    advance_char(l);
-    return true;
-  }
-  return false;
-}
+static void next_parse_run(Lexer * l, int flag, LexerType type) {
+  int begin = l->index;
+  int index = begin + 1;
 
-/**
- * lexer_next() comma subparser. If current character is a comma
- * character, function returns true and sets l->nextToken to the current character.
- * l: an instance of lexer.
- * returns: true if current character is a comma.
- */
-static bool next_parse_argdelim(Lexer * l) {
-  if(next_char(l) == ',') {
-    l->nextToken = l->input + l->index;
-    l->nextTokenLen = 1;
-    l->err = LEXERERR_SUCCESS;
-    l->nextTokenType = LEXERTYPE_ARGDELIM;
-    advance_char(l);
-    return true;
+  while(index < (int)l->inputLen && (char_class(l->input[index]) & flag)) {
+    index++;
   }
-  return false;
+
+  set_next_token(l, begin, index, index, type);
 }
 
 /**
@@ -638,64 +523,78 @@ static void update_next_token(Lexer * l) {
   l->currToken = l->nextToken;
   l->currTokenLen = l->nextTokenLen;
   l->currTokenType = l->nextTokenType;
-
-  /* Recursive Descent Parsing Loop:
-   * Each iteration, the lexer attempts to handle the current set of characters
-   * by feeding the current, previous, and next characters into a sub parser.
-   * The sub parser will then look at the current character and decide whether
-   * or not it can handle the current situation. For example, if the whitespace
-   * parser sees a whitespace character, it will move the iterator index forward
-   * until no more remain. It then returns true to signify that it could handle
-   * the current situation, and the if/else chain restarts from the top. Lets say
-   * the next symbol is a digit. The whitespace parser will be called again. Since
-   * it doesn't know how to handle digits, it returns false and the digit is passed
-   * down the chain until it reaches the number parser that can handle it.
+  l->currTokenKeyword = l->nextTokenKeyword;
+  l->nextTokenType = LEXERTYPE_UNKNOWN;
+  l->nextTokenKeyword = LANGKW_NONE;
+
+  /* Each iteration looks up the class of the current char, which decides the
+   * kind of token that starts here. Whitespace and comments are skipped and
+   * the loop continues, every other class produces a token (or an error) and
+   * returns.
    */
   while(remaining_chars(l) > 0) {
+    int index = l->index;
 
-    l->nextTokenType = LEXERTYPE_UNKNOWN;
+    switch(char_class(l->input[index]) & CLASS_MASK) {
+    case CLASS_SPACE:
+      skip_whitespace(l);
+      break;
 
-    /* Recursive Descent Chain:
-     * I know the McCabe's complexity is CRAZY high, but in this I case, I
-     * believe that it is excusible because it greatly simplifies the rest of
-     * the code document and makes the code much more understandable...the 
-     * primary goal of good computer science.
-     *
-     * Basically, control just cascades down until it finds a method that
-     * can handle the data.
-     */
-    if(next_parse_whitespace(l)) {
+    case CLASS_SLASH:
 
-      /* do nothing, but restart if/else chain when whitespace is detected */
+      /* single line comment, ends at the new line */
+      if(l->input[index + 1] == '/') {
+	l->index = find_chars(l, index + 2, '\n', '\n', '\n');
+	break;
+      }
 
-    } else if(next_parse_comments(l)) {
-      if(l->err != LEXERERR_SUCCESS) {
+      /* multiline comment */
+      if(l->input[index + 1] == '*') {
+	skip_multiline_comment(l);
+	if(l->err != LEXERERR_SUCCESS) {
+	  return;
+	}
 	break;
       }
-    } else if(next_parse_strings(l)) {
+
+      next_parse_run(l, CHAR_OPERATOR, LEXERTYPE_OPERATOR);
       return;
-    } else if(next_parse_chars(l)) {
+
+    case CLASS_QUOTE:
+      next_parse_quoted(l, '"', LEXERTYPE_STRING);
       return;
-    } else if(next_parse_keyvars(l)){
+
+    case CLASS_APOSTROPHE:
+      next_parse_quoted(l, '\'', LEXERTYPE_CHAR);
       return;
-    } else if(next_parse_numbers(l)){
+
+    case CLASS_KEYVAR:
+      next_parse_run(l, CHAR_KEYVAR, LEXERTYPE_KEYVAR);
       return;
-    } else if(next_parse_brackets(l)) {
+
+    case CLASS_DIGIT:
+      next_parse_number(l);
       return;
-    } else if(next_parse_argdelim(l)) {
+
+    case CLASS_BRACKET:
+      set_next_token(l, index, index + 1, index + 1, LEXERTYPE_BRACKETS);
       return;
-    } else if(next_parse_parenthesis(l)) {
+
+    case CLASS_PARENTHESIS:
+      set_next_token(l, index, index + 1, index + 1, LEXERTYPE_PARENTHESIS);
       return;
-    } else if(next_parse_operators(l)) {
+
+    case CLASS_ARGDELIM:
+      set_next_token(l, index, index + 1, index + 1, LEXERTYPE_ARGDELIM);
       return;
-    } else if(next_parse_endstatement(l)) {
+
+    case CLASS_ENDSTATEMENT:
+      set_next_token(l, index, index + 1, index + 1, LEXERTYPE_ENDSTATEMENT);
       return;
-    } else {
 
-      /* none of the parsers can handle the current situation */
-      /* temporary warning that helps with debugging */
-      printf("WARNING: Control reached end of Recursive Parse Loop\n");
-      break;
+    default:
+      next_parse_run(l, CHAR_OPERATOR, LEXERTYPE_OPERATOR);
+      return;
     }
   }
 
@@ -726,6 +625,41 @@ char * lexer_current_token(Lexer * l, LexerType * type, size_t * len) {
 
 }
 
+/**
+ * Gets the keyword or operator of the token returned by the previous call to
+ * lexer_next.
+ * l: an instance of lexer.
+ * returns: the keyword, or LANGKW_NONE if the token is not a keyword or
+ * operator, or there is no token.
+ */
+LangKeyword lexer_current_keyword(Lexer * l) {
+
+  assert(l != NULL);
+
+  if(l->err != LEXERERR_SUCCESS || l->currToken == NULL) {
+    return LANGKW_NONE;
+  }
+
+  return l->currTokenKeyword;
+}
+
+/**
+ * Gets the keyword or operator of the token after the current one.
+ * l: an instance of lexer.
+ * returns: the keyword, or LANGKW_NONE if the token is not a keyword or
+ * operator, or there is no token.
+ */
+LangKeyword lexer_peek_keyword(Lexer * l) {
+
+  assert(l != NULL);
+
+  if(l->err != LEXERERR_SUCCESS || l->nextToken == NULL) {
+    return LANGKW_NONE;
+  }
+
+  return l->nextTokenKeyword;
+}
+
 /**
  * Gets the last error experienced by lexer. If lexer_next() returns NULL,
  * call this method to find out the cause of the error. LEXERERR_SUCCESS means
@@ -752,6 +686,48 @@ int lexer_line_num(Lexer * l) {
   return l->lineNum;
 }
 
+/**
+ * Loads the current and next token fields from the token array, as they would
+ * be if the input was being lexed one token at a time. This includes the
+ * error, which appears once the token before it is the current token.
+ * lexer: an instance of lexer that has been tokenized.
+ */
+static void load_tokens(Lexer * lexer) {
+  int next = lexer->tokenIndex + 1;
+
+  if(lexer->tokenIndex >= 0 && lexer->tokenIndex < lexer->numTokens) {
+    LexerToken * token = lexer->tokens + lexer->tokenIndex;
+
+    lexer->currToken = lexer->input + token->offset;
+    lexer->currTokenLen = token->length;
+    lexer->currTokenType = token->type;
+    lexer->currTokenKeyword = token->keyword;
+  } else {
+    lexer->currToken = NULL;
+    lexer->currTokenLen = 0;
+    lexer->currTokenType = LEXERTYPE_UNKNOWN;
+    lexer->currTokenKeyword = LANGKW_NONE;
+  }
+
+  if(next < lexer->numTokens) {
+    LexerToken * token = lexer->tokens + next;
+
+    lexer->nextToken = lexer->input + token->offset;
+    lexer->nextTokenLen = token->length;
+    lexer->nextTokenType = token->type;
+    lexer->nextTokenKeyword = token->keyword;
+    lexer->lineNum = token->line;
+    lexer->err = LEXERERR_SUCCESS;
+  } else {
+    lexer->nextToken = NULL;
+    lexer->nextTokenLen = 0;
+    lexer->nextTokenType = LEXERTYPE_UNKNOWN;
+    lexer->nextTokenKeyword = LANGKW_NONE;
+    lexer->lineNum = lexer->tokensLineNum;
+    lexer->err = lexer->tokensErr;
+  }
+}
+
 /**
  * Advances the currToken and nextToken fields of the lexer object to the next
  * token.
@@ -759,6 +735,13 @@ int lexer_line_num(Lexer * l) {
  */
 static void update_tokens(Lexer * lexer) {
 
+  /* tokenized input, just move to the next token in the array */
+  if(lexer->tokens != NULL) {
+    lexer->tokenIndex++;
+    load_tokens(lexer);
+    return;
+  }
+
   /* first time updating tokens, fill both currToken and nextToken by running
    * update_next_token a second time
    */
@@ -832,3 +815,180 @@ char * lexer_next(Lexer * lexer, LexerType * type, size_t * len) {
 const char * lexer_err_to_string(LexerErr err) {
   return lexerErrorMessages[err];
 }
+
+/**
+ * Appends the lexer's next token to the token array.
+ * l: an instance of lexer.
+ * returns: true if success, false if allocation fails.
+ */
+static bool append_token(Lexer * l) {
+  LexerToken * token;
+
+  /* double the array when it fills up */
+  if(l->numTokens == l->tokensSize) {
+    int newSize = l->tokensSize * 2;
+    LexerToken * newTokens = gsalloc_realloc(l->allocator, l->tokens,
+					     l->tokensSize * sizeof(LexerToken),
+					     newSize * sizeof(LexerToken));
+    if(newTokens == NULL) {
+      return false;
+    }
+    l->tokens = newTokens;
+    l->tokensSize = newSize;
+  }
+
+  token = l->tokens + l->numTokens;
+  token->offset = l->nextToken - l->input;
+  token->length = l->nextTokenLen;
+  token->type = l->nextTokenType;
+  token->line = l->lineNum;
+  token->keyword = l->nextTokenKeyword;
+  l->numTokens++;
+
+  return true;
+}
+
+/**
+ * Tokenizes the entire input into an array of tokens. Afterwards,
+ * lexer_next(), lexer_peek(), and lexer_current_token() index into the array
+ * instead of lexing, and the lexer supports arbitrary lookahead with
+ * lexer_peek_ahead() and backtracking with lexer_position() and lexer_seek().
+ * Lexer errors are reported at the same point that they would be if the input
+ * was lexed one token at a time. Must be called before the first
+ * lexer_next().
+ * l: an instance of lexer.
+ * returns: true if success, false if allocation fails. If allocation fails,
+ * the lexer can still be used without the token array.
+ */
+bool lexer_tokenize(Lexer * l) {
+  int startLineNum;
+
+  assert(l != NULL);
+  assert(l->index == 0);
+  assert(l->tokens == NULL);
+
+  startLineNum = l->lineNum;
+
+  /* estimate one token for every four chars */
+  l->tokensSize = l->inputLen / 4 + 1;
+  l->tokens = gsalloc_malloc(l->allocator,
+			     l->tokensSize * sizeof(LexerToken));
+  if(l->tokens == NULL) {
+    return false;
+  }
+
+  /* lex until the end of the input or an error */
+  while(true) {
+    update_next_token(l);
+    if(l->nextToken == NULL) {
+      break;
+    }
+
+    if(!append_token(l)) {
+      gsalloc_free(l->allocator, l->tokens,
+		   l->tokensSize * sizeof(LexerToken));
+      l->tokens = NULL;
+      l->numTokens = 0;
+      l->index = 0;
+      l->lineNum = startLineNum;
+      l->err = LEXERERR_SUCCESS;
+      return false;
+    }
+  }
+
+  /* save the error for when the parser gets to it */
+  l->tokensErr = l->err;
+  l->tokensLineNum = l->lineNum;
+  l->tokenIndex = -1;
+  load_tokens(l);
+  l->err = LEXERERR_SUCCESS;
+
+  return true;
+}
+
+/**
+ * Gets a token after the current token without advancing the lexer. The lexer
+ * must have been tokenized with lexer_tokenize() to look more than one token
+ * ahead.
+ * l: an instance of lexer.
+ * n: how far ahead to look. 1 is the same as lexer_peek().
+ * type: a pointer that will recv. the type of the token. May be NULL.
+ * len: a pointer that will recv. the length of the token in characters.
+ * returns: the token, or NULL if there are not n more tokens, or there is a
+ * lexer error before it.
+ */
+char * lexer_peek_ahead(Lexer * l, int n, LexerType * type, size_t * len) {
+  LexerToken * token;
+  int index;
+
+  assert(l != NULL);
+  assert(n > 0);
+  assert(len != NULL);
+
+  if(l->tokens == NULL) {
+    assert(n == 1);
+    return lexer_peek(l, type, len);
+  }
+
+  index = l->tokenIndex + n;
+  if(l->err != LEXERERR_SUCCESS || index >= l->numTokens) {
+    return NULL;
+  }
+
+  token = l->tokens + index;
+  set_type(type, token->type);
+  *len = token->length;
+  return l->input + token->offset;
+}
+
+/**
+ * Gets the position of the current token, for backtracking with lexer_seek().
+ * l: an instance of lexer that has been tokenized.
+ * returns: the index of the current token in the token array.
+ */
+int lexer_position(Lexer * l) {
+  assert(l != NULL);
+  assert(l->tokens != NULL);
+  return l->tokenIndex;
+}
+
+/**
+ * Moves the lexer back (or forward) to a position returned by
+ * lexer_position(). This also restores the error and line number state that
+ * the lexer had at that position.
+ * l: an instance of lexer that has been tokenized.
+ * position: the position.
+ */
+void lexer_seek(Lexer * l, int position) {
+  assert(l != NULL);
+  assert(l->tokens != NULL);
+  assert(position >= -1 && position <= l->numTokens);
+
+  l->tokenIndex = position;
+  load_tokens(l);
+}
+
+/**
+ * Gets the number of tokens in the token array.
+ * l: an instance of lexer that has been tokenized.
+ * returns: the number of tokens before the end of the input, or before the
+ * first lexer error.
+ */
+int lexer_num_tokens(Lexer * l) {
+  assert(l != NULL);
+  assert(l->tokens != NULL);
+  return l->numTokens;
+}
+
+/**
+ * Gets a token from the token array.
+ * l: an instance of lexer that has been tokenized.
+ * index: the index of the token.
+ * returns: the token. Its offset is relative to the lexer's copy of the input.
+ */
+LexerToken * lexer_token_at(Lexer * l, int index) {
+  assert(l != NULL);
+  assert(l->tokens != NULL);
+  assert(index >= 0 && index < l->numTokens);
+  return l->tokens + index;
+}
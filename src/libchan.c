@@ -0,0 +1,742 @@
+/**
+ * libchan.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Channels for pipelines of script stages on separate threads. A Channel is
+ * a bounded queue of values that any number of VMs send to and receive from
+ * at once, with the chan_send(), chan_recv(), chan_try_recv(), and
+ * chan_close() natives. chan_new() makes one in a script, and the host can
+ * make one with channel_new() and hand it to VMs with libchan_handle(). A
+ * channel handle may also be passed to spawn(), or sent over a channel.
+ *
+ * The queue is a ring buffer of slots, each with a sequence number that says
+ * which lap of the ring the slot is ready for. A sender claims the position
+ * at tail with a compare and swap once the slot's sequence says it's empty,
+ * writes the message, and then publishes it by advancing the sequence. A
+ * receiver does the same at head. No thread ever waits on a lock, only on
+ * the ring being full or empty, which chan_send() and chan_recv() wait out by
+ * spinning, then yielding, then sleeping, while checking for interrupts.
+ * Closing sets the top bit of tail, so that no send can claim a position
+ * after it, and the channel is drained once head reaches the rest of tail.
+ *
+ * Numbers, booleans, null, strings, and channels can be sent. A string that
+ * the sender's argument holds the only reference to, e.g. the result of a
+ * concatenation, is moved: its buffer is taken out of the object and given
+ * to the receiver without copying. A frozen string is shared, see freeze().
+ * Other strings are copied. Channels sent
+ * over channels are reference counted, so a channel that is sent to itself
+ * is never freed.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include "libchan.h"
+#include "libstr.h"
+
+/* how many times a blocked send or receive retries before it yields */
+static const int spinLimit = 64;
+/* how many times it yields the CPU before it starts to sleep */
+static const int yieldLimit = 64;
+/* the shortest and longest sleeps between retries, in nanoseconds */
+static const long minSleepNs = 1000;
+static const long maxSleepNs = 1000 * 1000;
+/* the bit of a channel's tail that channel_close() sets */
+static const size_t closedBit = ~((size_t)-1 >> 1);
+
+/* the LIBDATA type ID for channel handles, assigned once by
+ * libchan_install()
+ */
+static VMLibDataType channelTypeId = VM_LIBDATA_TYPE_INVALID;
+static pthread_once_t channelTypeOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Creates a channel.
+ * capacity: the number of messages that can be queued before senders wait.
+ * Rounded up to a power of two, and to at least 2, since a slot's sequence
+ * can't tell a full one slot ring from an empty one.
+ * allocator: the allocator for the channel and the strings that it carries,
+ * or NULL for the default allocator. It must be thread safe. Strings are
+ * moved, not copied, between VMs that use it as their host allocator.
+ * returns: the channel, with a reference count of 1, or NULL if allocation
+ * fails.
+ */
+Channel * channel_new(int capacity, GSAllocator * allocator) {
+  Channel * channel;
+  size_t size = 2;
+  size_t i;
+
+  assert(capacity > 0);
+
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  while(size < (size_t)capacity) {
+    size <<= 1;
+  }
+
+  channel = gsalloc_calloc(allocator, 1, sizeof(Channel));
+  if(channel == NULL) {
+    return NULL;
+  }
+
+  channel->slots = gsalloc_calloc(allocator, size, sizeof(ChanSlot));
+  if(channel->slots == NULL) {
+    gsalloc_free(allocator, channel, sizeof(Channel));
+    return NULL;
+  }
+
+  /* slot i is ready for the send at position i */
+  for(i = 0; i < size; i++) {
+    channel->slots[i].sequence = i;
+  }
+  channel->mask = size - 1;
+  channel->allocator = allocator;
+  channel->refCount = 1;
+
+  return channel;
+}
+
+/**
+ * Sends a message, unless the channel is full or closed.
+ * channel: the channel.
+ * message: the message. The channel owns it if this succeeds.
+ * returns: true if sent, false if full or closed.
+ */
+static bool channel_try_send(Channel * channel, ChanMessage * message) {
+  size_t pos = __atomic_load_n(&channel->tail, __ATOMIC_RELAXED);
+  ChanSlot * slot;
+  long diff;
+
+  while(true) {
+
+    /* closed. no position can be claimed from now on, since the compare and
+     * swap below expects tail without the closed bit
+     */
+    if(pos & closedBit) {
+      return false;
+    }
+
+    slot = &channel->slots[pos & channel->mask];
+    diff = (long)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+
+    /* the slot is empty for this lap, claim the position */
+    if(diff == 0) {
+      if(__atomic_compare_exchange_n(&channel->tail, &pos, pos + 1, true,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	break;
+      }
+    } else if(diff < 0) {
+      /* the slot still holds the message from the last lap */
+      return false;
+    } else {
+      /* another sender took the position */
+      pos = __atomic_load_n(&channel->tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->message = *message;
+  __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * Receives a message, unless the channel is empty.
+ * channel: the channel.
+ * message: receives the message. The caller owns it if this succeeds.
+ * returns: true if received, false if empty.
+ */
+static bool channel_try_recv(Channel * channel, ChanMessage * message) {
+  size_t pos = __atomic_load_n(&channel->head, __ATOMIC_RELAXED);
+  ChanSlot * slot;
+  long diff;
+
+  while(true) {
+    slot = &channel->slots[pos & channel->mask];
+    diff = (long)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE)
+		  - (pos + 1));
+
+    /* the slot has been sent to for this lap, claim the position */
+    if(diff == 0) {
+      if(__atomic_compare_exchange_n(&channel->head, &pos, pos + 1, true,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	break;
+      }
+    } else if(diff < 0) {
+      /* no send has reached the slot yet */
+      return false;
+    } else {
+      /* another receiver took the position */
+      pos = __atomic_load_n(&channel->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  *message = slot->message;
+
+  /* ready the slot for the send one lap later */
+  __atomic_store_n(&slot->sequence, pos + channel->mask + 1,
+		   __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * Frees the objects of a message that was never received.
+ * message: the message.
+ */
+static void chanmessage_free(ChanMessage * message) {
+  if(message->string != NULL) {
+    buffer_free(message->string);
+  }
+  if(message->channel != NULL) {
+    channel_release(message->channel);
+  }
+  if(message->frozen != NULL) {
+    vmlibdata_release(NULL, message->frozen);
+  }
+}
+
+/**
+ * Adds a reference to a channel. May be called from any thread.
+ * channel: the channel.
+ * returns: the channel.
+ */
+Channel * channel_retain(Channel * channel) {
+  assert(channel != NULL);
+
+  __sync_add_and_fetch(&channel->refCount, 1);
+  return channel;
+}
+
+/**
+ * Drops a reference to a channel, and frees it, and any messages still in
+ * it, when the last one is dropped. May be called from any thread.
+ * channel: the channel.
+ */
+void channel_release(Channel * channel) {
+  ChanMessage message;
+
+  assert(channel != NULL);
+
+  if(__sync_sub_and_fetch(&channel->refCount, 1) > 0) {
+    return;
+  }
+
+  while(channel_try_recv(channel, &message)) {
+    chanmessage_free(&message);
+  }
+
+  gsalloc_free(channel->allocator, channel->slots,
+	       (channel->mask + 1) * sizeof(ChanSlot));
+  gsalloc_free(channel->allocator, channel, sizeof(Channel));
+}
+
+/**
+ * Closes a channel. Sends to it fail from then on, and receives return null
+ * once the messages already sent to it are received. A send that claimed its
+ * position before the close still succeeds. May be called from any thread.
+ * channel: the channel.
+ */
+void channel_close(Channel * channel) {
+  assert(channel != NULL);
+
+  __atomic_fetch_or(&channel->tail, closedBit, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Checks whether a channel is closed.
+ * channel: the channel.
+ * returns: true if closed.
+ */
+static bool channel_closed(Channel * channel) {
+  return (__atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE) & closedBit) != 0;
+}
+
+/**
+ * Checks whether a closed channel has no messages left, not even ones that a
+ * send has claimed a position for but not yet written.
+ * channel: the channel.
+ * returns: true if the channel is closed and every message sent to it has
+ * been received.
+ */
+static bool channel_drained(Channel * channel) {
+  size_t tail = __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE);
+
+  /* tail can't move once closed, so head can only catch up to it */
+  return (tail & closedBit) != 0
+    && __atomic_load_n(&channel->head, __ATOMIC_ACQUIRE)
+       == (tail & ~closedBit);
+}
+
+/**
+ * Waits a little for a full or empty channel to change: a spin at first,
+ * then a yield of the CPU, then sleeps that get longer.
+ * vm: the waiting VM.
+ * attempts: the number of times that the caller has waited so far, which
+ * this increments. Start at 0.
+ * returns: true to try again, false if the VM was interrupted or timed out,
+ * in which case its error is set.
+ */
+static bool chan_wait(VM * vm, int * attempts) {
+  struct timespec sleep;
+  long ns;
+  int shift;
+
+  (*attempts)++;
+  if(*attempts < spinLimit) {
+    return true;
+  }
+
+  if(vm_poll_interrupt(vm)) {
+    return false;
+  }
+
+  if(*attempts < spinLimit + yieldLimit) {
+    sched_yield();
+    return true;
+  }
+
+  shift = *attempts - spinLimit - yieldLimit;
+  ns = shift < 10 ? minSleepNs << shift : maxSleepNs;
+  sleep.tv_sec = 0;
+  sleep.tv_nsec = ns < maxSleepNs ? ns : maxSleepNs;
+  nanosleep(&sleep, NULL);
+  return true;
+}
+
+/**
+ * Frees a channel handle's reference when the handle is freed.
+ * vm: the VM that owns the handle.
+ * data: the handle.
+ */
+static void channel_cleanup(VM * vm, VMLibData * data) {
+  channel_release(vmlibdata_data(data));
+}
+
+/**
+ * Makes a handle for a channel in a VM, e.g. to pass a host's channel to a
+ * script as an argument.
+ * vm: the VM.
+ * channel: the channel. The handle holds its own reference.
+ * returns: the handle, with no references to it yet, or NULL if allocation
+ * fails.
+ */
+VMLibData * libchan_handle(VM * vm, Channel * channel) {
+  VMLibData * data;
+
+  assert(vm != NULL);
+  assert(channel != NULL);
+
+  data = vmlibdata_new_typed(vm, channelTypeId, channel_cleanup,
+			     channel_retain(channel));
+  if(data == NULL) {
+    channel_release(channel);
+  }
+  return data;
+}
+
+/**
+ * Gets the channel of a channel handle.
+ * arg: the value.
+ * returns: the channel, or NULL if the value isn't a channel handle.
+ */
+Channel * libchan_channel(VMArg arg) {
+  VMLibData * data = vmarg_libdata(arg);
+
+  if(data == NULL || !vmlibdata_is_typeid(data, channelTypeId)) {
+    return NULL;
+  }
+  return vmlibdata_data(data);
+}
+
+/**
+ * Makes a message of a native's argument.
+ * vm: the sending VM.
+ * channel: the channel that it will be sent over.
+ * arg: the native's arguments.
+ * index: the index of the argument to send.
+ * message: receives the message. Free it with chanmessage_free() if it
+ * isn't sent.
+ * returns: true if success, false if the value can't be sent, or allocation
+ * fails, in which case the VM's error is set.
+ */
+static bool chanmessage_make(VM * vm, Channel * channel, VMArg * arg,
+			     int index, ChanMessage * message) {
+  VMLibData * data = vmarg_libdata(arg[index]);
+  int len;
+
+  message->arg = arg[index];
+  message->string = NULL;
+  message->channel = NULL;
+  message->frozen = NULL;
+
+  if(data == NULL) {
+    return true;
+  }
+  message->arg = vmarg_make_null();
+
+  if(libchan_channel(arg[index]) != NULL) {
+    message->channel = channel_retain(libchan_channel(arg[index]));
+    return true;
+  }
+
+  if(!vmarg_is_string(arg[index])) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  /* frozen strings are shared, the message keeps a reference */
+  if(vmlibdata_is_frozen(data)) {
+    vmlibdata_inc_refcount(data);
+    message->frozen = data;
+    return true;
+  }
+
+  /* no one else can see the string, so take its buffer */
+  if(vm_native_arg_unique(vm, arg, index)
+     && vm_base_allocator(vm) == channel->allocator) {
+    message->string = libstr_string_detach(vm, data);
+    return true;
+  }
+
+  /* string buffers can't be empty, even for an empty string */
+  len = libstr_string_length(data);
+  message->string = buffer_new(len > 0 ? len : 1, LIBSTR_STRING_BLOCKSIZE,
+			       channel->allocator);
+  if(message->string == NULL
+     || !buffer_append_string(message->string, libstr_string(data), len)) {
+    chanmessage_free(message);
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Pushes a received message as a native's return value.
+ * vm: the receiving VM.
+ * channel: the channel that it came from.
+ * message: the message. The VM owns its objects from now on.
+ * returns: true if a value was pushed, false if the value is null, or
+ * allocation fails, in which case the VM's error is set.
+ */
+static bool chanmessage_push(VM * vm, Channel * channel,
+			     ChanMessage * message) {
+  VMLibData * data = NULL;
+  Buffer * buffer = message->string;
+  bool pushed;
+
+  if(message->channel != NULL) {
+    data = libchan_handle(vm, message->channel);
+    channel_release(message->channel);
+  } else if(message->frozen != NULL
+	    && vmlibdata_can_share(vm, message->frozen)) {
+    data = message->frozen;
+  } else if(message->frozen != NULL) {
+
+    /* the VM can't hold a shared string, copy it. string buffers can't be
+     * empty, even for an empty string
+     */
+    data = libstr_string_new(vm, libstr_string_length(message->frozen) > 0
+			     ? libstr_string_length(message->frozen) : 1);
+    if(data != NULL
+       && !libstr_string_append(data, libstr_string(message->frozen),
+				libstr_string_length(message->frozen))) {
+      vmlibdata_check_cleanup(vm, data);
+      data = NULL;
+    }
+  } else if(buffer != NULL && vm_base_allocator(vm) == channel->allocator) {
+    data = libstr_string_attach(vm, buffer);
+  } else if(buffer != NULL) {
+
+    /* the VM can't free the channel's memory, copy it */
+    data = libstr_string_new(vm, buffer_buffer_size(buffer));
+    if(data != NULL && !libstr_string_append(data, buffer_get_buffer(buffer),
+					     buffer_size(buffer))) {
+      vmlibdata_check_cleanup(vm, data);
+      data = NULL;
+    }
+    buffer_free(buffer);
+  } else {
+    switch(vmarg_type(message->arg)) {
+    case TYPE_NUMBER:
+      return vmarg_push_number(vm, vmarg_number(message->arg, NULL));
+    case TYPE_BOOLEAN:
+      return vmarg_push_boolean(vm, vmarg_boolean(message->arg, NULL));
+    default:
+      return false;
+    }
+  }
+
+  pushed = data != NULL && vmarg_push_libdata(vm, data);
+  if(data != NULL && !pushed) {
+    vmlibdata_check_cleanup(vm, data);
+  }
+
+  /* the VM's stack holds its own reference to a shared string now */
+  if(message->frozen != NULL) {
+    vmlibdata_release(vm, message->frozen);
+  }
+
+  if(!pushed) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * VMNative: chan_new( capacity )
+ * Accepts the number of messages that the channel can hold before senders
+ * wait. Returns a new channel.
+ */
+static bool vmn_chan_new(VM * vm, VMArg * arg, int argc) {
+  Channel * channel;
+  VMLibData * data;
+  double capacity;
+
+  /* check for correct number of arguments */
+  if(argc != 1) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+
+    /* this function does not return a value */
+    return false;
+  }
+
+  /* check argument type */
+  if(vmarg_type(arg[0]) != TYPE_NUMBER) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  /* check capacity range */
+  capacity = vmarg_number(arg[0], NULL);
+  if(capacity < 1 || capacity > INT_MAX / 2) {
+    vm_set_err(vm, VMERR_ARGUMENT_OUT_OF_RANGE);
+    return false;
+  }
+
+  /* the channel outlives the VM's allocator if it's passed on */
+  channel = channel_new((int)capacity, vm_base_allocator(vm));
+  if(channel == NULL) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  data = libchan_handle(vm, channel);
+  channel_release(channel);
+  if(data == NULL || !vmarg_push_libdata(vm, data)) {
+    if(data != NULL) {
+      vmlibdata_check_cleanup(vm, data);
+    }
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * VMNative: chan_send( channel, value )
+ * Accepts a channel and a number, boolean, null, string, or channel. Waits
+ * for room in the channel, if it's full, and sends the value. Fails if the
+ * channel is closed.
+ */
+static bool vmn_chan_send(VM * vm, VMArg * arg, int argc) {
+  Channel * channel;
+  ChanMessage message;
+  int attempts = 0;
+
+  /* check for correct number of arguments */
+  if(argc != 2) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+
+    /* this function does not return a value */
+    return false;
+  }
+
+  /* check argument 1 type */
+  if((channel = libchan_channel(arg[0])) == NULL) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  if(channel_closed(channel)) {
+    vm_set_err(vm, VMERR_CHANNEL_CLOSED);
+    return false;
+  }
+
+  if(!chanmessage_make(vm, channel, arg, 1, &message)) {
+    return false;
+  }
+
+  while(!channel_try_send(channel, &message)) {
+    if(channel_closed(channel)) {
+      vm_set_err(vm, VMERR_CHANNEL_CLOSED);
+      chanmessage_free(&message);
+      return false;
+    }
+    if(!chan_wait(vm, &attempts)) {
+      chanmessage_free(&message);
+      return false;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * VMNative: chan_recv( channel )
+ * Accepts a channel. Waits for a message, if the channel is empty, and
+ * returns it. Returns null once the channel is closed and empty.
+ */
+static bool vmn_chan_recv(VM * vm, VMArg * arg, int argc) {
+  Channel * channel;
+  ChanMessage message;
+  int attempts = 0;
+
+  /* check for correct number of arguments */
+  if(argc != 1) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+
+    /* this function does not return a value */
+    return false;
+  }
+
+  /* check argument type */
+  if((channel = libchan_channel(arg[0])) == NULL) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  while(!channel_try_recv(channel, &message)) {
+
+    /* a send that claimed its position before the close may still be
+     * writing its message, so wait for it
+     */
+    if(channel_drained(channel)) {
+      return false;
+    }
+    if(!chan_wait(vm, &attempts)) {
+      return false;
+    }
+  }
+
+  return chanmessage_push(vm, channel, &message);
+}
+
+/**
+ * VMNative: chan_try_recv( channel )
+ * Accepts a channel. Returns the next message, or null if the channel is
+ * empty, without waiting.
+ */
+static bool vmn_chan_try_recv(VM * vm, VMArg * arg, int argc) {
+  Channel * channel;
+  ChanMessage message;
+
+  /* check for correct number of arguments */
+  if(argc != 1) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+
+    /* this function does not return a value */
+    return false;
+  }
+
+  /* check argument type */
+  if((channel = libchan_channel(arg[0])) == NULL) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  if(!channel_try_recv(channel, &message)) {
+    return false;
+  }
+
+  return chanmessage_push(vm, channel, &message);
+}
+
+/**
+ * VMNative: chan_close( channel )
+ * Accepts a channel, and closes it. See channel_close().
+ */
+static bool vmn_chan_close(VM * vm, VMArg * arg, int argc) {
+  Channel * channel;
+
+  /* check for correct number of arguments */
+  if(argc != 1) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+
+    /* this function does not return a value */
+    return false;
+  }
+
+  /* check argument type */
+  if((channel = libchan_channel(arg[0])) == NULL) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  channel_close(channel);
+  return false;
+}
+
+/**
+ * Registers the channel handle LIBDATA type. Run once, by pthread_once(), so
+ * that instances installed on several threads at once agree on the ID.
+ */
+static void libchan_register_types() {
+  channelTypeId = vmlibdata_type_register(LIBCHAN_CHANNEL_TYPE,
+					  LIBCHAN_CHANNEL_TYPE_LEN);
+}
+
+/**
+ * Installs the channel natives in the given instance of Gunderscript.
+ * gunderscript: the instance to receive the library.
+ * returns: true upon success, and false upon failure. If failure occurs,
+ * you probably did not allocate enough callbacks space in the call to
+ * gunderscript_new().
+ */
+bool libchan_install(Gunderscript * gunderscript) {
+
+  /* register the channel handle LIBDATA type */
+  pthread_once(&channelTypeOnce, libchan_register_types);
+  if(channelTypeId == VM_LIBDATA_TYPE_INVALID) {
+    return false;
+  }
+
+  if(!vm_reg_callback(gunderscript_vm(gunderscript),
+		      "chan_new", 8, vmn_chan_new)
+     || !vm_reg_callback(gunderscript_vm(gunderscript),
+			 "chan_send", 9, vmn_chan_send)
+     || !vm_reg_callback(gunderscript_vm(gunderscript),
+			 "chan_recv", 9, vmn_chan_recv)
+     || !vm_reg_callback(gunderscript_vm(gunderscript),
+			 "chan_try_recv", 13, vmn_chan_try_recv)
+     || !vm_reg_callback(gunderscript_vm(gunderscript),
+			 "chan_close", 10, vmn_chan_close)) {
+    return false;
+  }
+
+  return true;
+}
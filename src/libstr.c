@@ -40,19 +40,24 @@
 static void string_cleanup(VM * vm, VMLibData * data) {
   Buffer * buffer = vmlibdata_data(data);
 
-  buffer_free(buffer);
+  /* the buffer may have been moved out, see libstr_string_detach() */
+  if(buffer != NULL) {
+    buffer_free(buffer);
+  }
 }
 
 /**
  * Creates a new string buffer encased in a VMLibData. Use vmarg_push_libdata()
  * with TYPE_LIBDATA to push this string to the VM's stack.
+ * vm: the VM instance whose allocator will own the string.
  * bufferLen: the length of the string buffer.
  * returns: the new VMLibData object. See vmlibdata_*() functions for more info.
  */
-VMLibData * libstr_string_new(int bufferLen) {
+VMLibData * libstr_string_new(VM * vm, int bufferLen) {
 
   /* allocate workshop object */
-  Buffer * buffer = buffer_new(bufferLen, LIBSTR_STRING_BLOCKSIZE);
+  Buffer * buffer = buffer_new(bufferLen, LIBSTR_STRING_BLOCKSIZE,
+			       vm_allocator(vm));
   VMLibData * data;
 
   if(buffer == NULL) {
@@ -60,8 +65,8 @@ VMLibData * libstr_string_new(int bufferLen) {
   }
 
   /* allocate VMLibData */
-  data = vmlibdata_new(LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN,
-		       string_cleanup, buffer);
+  data = vmlibdata_new_typed(vm, LIBSTR_STRING_TYPEID,
+			     string_cleanup, buffer);
   if(data == NULL) {
     buffer_free(buffer);
     return NULL;
@@ -79,7 +84,7 @@ VMLibData * libstr_string_new(int bufferLen) {
  * once asserts are disabled. You should error check accordingly.
  */
 char * libstr_string(VMLibData * data) {
-  assert(vmlibdata_is_type(data, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN));
+  assert(vmlibdata_is_typeid(data, LIBSTR_STRING_TYPEID));
 
   return buffer_get_buffer( ((Buffer*)vmlibdata_data(data)) );
 }
@@ -97,6 +102,78 @@ int libstr_string_length(VMLibData * data) {
   return buffer_size( ((Buffer*)vmlibdata_data(data)) );
 }
 
+/**
+ * Moves a string's buffer out of its object, without copying it, so that it
+ * can be given to another VM with libstr_string_attach(). The buffer is
+ * owned by the VM's base allocator until then. Only for a string that is
+ * about to be freed, e.g. a native's argument that vm_native_arg_unique()
+ * says is unique, since the object is left without a buffer.
+ * vm: the VM that owns the string.
+ * data: the string.
+ * returns: the buffer. Free it with buffer_free() if it is never attached.
+ */
+Buffer * libstr_string_detach(VM * vm, VMLibData * data) {
+  Buffer * buffer = vmlibdata_data(data);
+
+  assert(vmlibdata_is_typeid(data, LIBSTR_STRING_TYPEID));
+  assert(buffer != NULL);
+
+  vmlibdata_set_data(data, NULL);
+  vm_mem_disown(vm, buffer_mem_size(buffer));
+  buffer_set_allocator(buffer, vm_base_allocator(vm));
+  return buffer;
+}
+
+/**
+ * Makes a string object around a buffer from libstr_string_detach(). The
+ * buffer must have been allocated by this VM's base allocator.
+ * vm: the VM that will own the string.
+ * buffer: the buffer. The VM owns it from now on, even if this fails.
+ * returns: the new string object, or NULL if allocation fails.
+ */
+VMLibData * libstr_string_attach(VM * vm, Buffer * buffer) {
+  VMLibData * data;
+
+  buffer_set_allocator(buffer, vm_allocator(vm));
+  vm_mem_adopt(vm, buffer_mem_size(buffer));
+
+  data = vmlibdata_new_typed(vm, LIBSTR_STRING_TYPEID,
+			     string_cleanup, buffer);
+  if(data == NULL) {
+    buffer_free(buffer);
+    return NULL;
+  }
+
+  return data;
+}
+
+/**
+ * Freezes a string so that VMs on other threads can share it rather than
+ * copy it, see vmlibdata_freeze(). The string's buffer moves to the VM's
+ * base allocator, and string_append(), string_prealloc(), and
+ * string_set_char_at() fail on it from then on. Strings of VMMEM_GC VMs
+ * stay thread local, since their collector can't see other VMs' references.
+ * vm: the VM that owns the string.
+ * data: the string.
+ * returns: true if the string is frozen, false if it stays thread local.
+ */
+bool libstr_string_freeze(VM * vm, VMLibData * data) {
+  Buffer * buffer = vmlibdata_data(data);
+
+  assert(vmlibdata_is_typeid(data, LIBSTR_STRING_TYPEID));
+
+  if(vmlibdata_is_frozen(data)) {
+    return true;
+  }
+  if(!vmlibdata_freeze(vm, data)) {
+    return false;
+  }
+
+  vm_mem_disown(vm, buffer_mem_size(buffer));
+  buffer_set_allocator(buffer, vm_base_allocator(vm));
+  return true;
+}
+
 /**
  * Appends the specified string to the end of the string in this VMLibData.
  * data: the VMLibData containing the string buffer.
@@ -167,7 +244,7 @@ static bool vmn_str(VM * vm, VMArg * arg, int argc) {
   }
 
   /* allocate string workshop */
-  data = libstr_string_new(bufferSize);
+  data = libstr_string_new(vm, bufferSize);
   if(data == NULL) {
     vm_set_err(vm, VMERR_ALLOC_FAILED);
     return false;
@@ -203,7 +280,7 @@ static bool vmn_str_length(VM * vm, VMArg * arg, int argc) {
   data = vmarg_libdata(arg[0]);
 
   /* check libdata type */
-  if(!vmlibdata_is_type(data, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN)) {
+  if(!vmlibdata_is_typeid(data, LIBSTR_STRING_TYPEID)) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
     return false;
   }
@@ -241,11 +318,17 @@ static bool vmn_str_prealloc(VM * vm, VMArg * arg, int argc) {
   data = vmarg_libdata(arg[0]);
 
   /* check libdata type */
-  if(!vmlibdata_is_type(data, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN)) {
+  if(!vmlibdata_is_typeid(data, LIBSTR_STRING_TYPEID)) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
     return false;
   }
 
+  /* frozen strings are shared, and can't be changed */
+  if(vmlibdata_is_frozen(data)) {
+    vm_set_err(vm, VMERR_OBJECT_FROZEN);
+    return false;
+  }
+
   /* check argument 2 type */
   if(vmarg_type(arg[1]) != TYPE_NUMBER) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
@@ -264,8 +347,11 @@ static bool vmn_str_prealloc(VM * vm, VMArg * arg, int argc) {
   buffer = vmlibdata_data(data);
 
   /* can't make it smaller, only bigger */
-  buffer_resize(buffer, newSize >= buffer_size(buffer)
-		? newSize : buffer_size(buffer));
+  if(!buffer_resize(buffer, newSize >= buffer_size(buffer)
+		    ? newSize : buffer_size(buffer))) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
 
   /* push null result */
   vmarg_push_null(vm);
@@ -301,11 +387,17 @@ static bool vmn_str_append(VM * vm, VMArg * arg, int argc) {
   data = vmarg_libdata(arg[0]);
 
   /* check libdata type */
-  if(!vmlibdata_is_type(data, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN)) {
+  if(!vmlibdata_is_typeid(data, LIBSTR_STRING_TYPEID)) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
     return false;
   }
 
+  /* frozen strings are shared, and can't be changed */
+  if(vmlibdata_is_frozen(data)) {
+    vm_set_err(vm, VMERR_OBJECT_FROZEN);
+    return false;
+  }
+
   /* check argument 2 type */
   if(!vmarg_is_string(arg[1])) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
@@ -358,7 +450,7 @@ static bool vmn_str_char_at(VM * vm, VMArg * arg, int argc) {
   data = vmarg_libdata(arg[0]);
 
   /* check libdata type */
-  if(!vmlibdata_is_type(data, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN)) {
+  if(!vmlibdata_is_typeid(data, LIBSTR_STRING_TYPEID)) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
     return false;
   }
@@ -414,7 +506,7 @@ static bool vmn_char_to_str(VM * vm, VMArg * arg, int argc) {
     return false;
   }
 
-  newStrData = vmarg_new_string(character, 1);
+  newStrData = vmarg_new_string(vm, character, 1);
 
   /* push char as a number */
   if(newStrData == NULL || !vmarg_push_libdata(vm, newStrData)) {
@@ -455,11 +547,17 @@ static bool vmn_str_set_char_at(VM * vm, VMArg * arg, int argc) {
   data = vmarg_libdata(arg[0]);
 
   /* check libdata type */
-  if(!vmlibdata_is_type(data, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN)) {
+  if(!vmlibdata_is_typeid(data, LIBSTR_STRING_TYPEID)) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
     return false;
   }
 
+  /* frozen strings are shared, and can't be changed */
+  if(vmlibdata_is_frozen(data)) {
+    vm_set_err(vm, VMERR_OBJECT_FROZEN);
+    return false;
+  }
+
   /* extract the buffer */
   buffer = vmlibdata_data(data);
 
@@ -489,6 +587,41 @@ static bool vmn_str_set_char_at(VM * vm, VMArg * arg, int argc) {
   return false;
 }
 
+/**
+ * VMNative: freeze( string )
+ * Accepts a string and freezes it, so that tasks and channel messages share
+ * it with other VMs rather than copying it. Returns the same string. The
+ * string can't be changed after, and stays thread local in a VM that uses
+ * the garbage collector.
+ */
+static bool vmn_str_freeze(VM * vm, VMArg * arg, int argc) {
+  VMLibData * data;
+
+  /* check for proper number of arguments */
+  if(argc != 1) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+    return false;
+  }
+
+  /* check argument type */
+  if(!vmarg_is_string(arg[0])) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  data = vmarg_libdata(arg[0]);
+  libstr_string_freeze(vm, data);
+
+  /* push the same string back */
+  if(!vmarg_push_libdata(vm, data)) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  /* this function does return a value */
+  return true;
+}
+
 /**
  * Installs the Libstr library in the given instance of Gunderscript.
  * gunderscript: the instance to receive the library.
@@ -513,6 +646,8 @@ bool libstr_install(Gunderscript * gunderscript) {
 			 "char_to_string", 14, vmn_char_to_str)
      || !vm_reg_callback(gunderscript_vm(gunderscript), 
 			 "string_set_char_at", 18, vmn_str_set_char_at)
+     || !vm_reg_callback(gunderscript_vm(gunderscript), 
+			 "freeze", 6, vmn_str_freeze)
 ) {
     return false;
   }
@@ -28,10 +28,23 @@
 #include "libsys.h"
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #define LIBSYS_GETLINE_MAXLEN          255
 #define LIBSYS_TOSTRING_MAXLEN         25
 
+/* the LIBDATA type ID for file handles, assigned once by libsys_install() */
+static VMLibDataType fileTypeId = VM_LIBDATA_TYPE_INVALID;
+static pthread_once_t fileTypeOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Registers the file handle LIBDATA type. Run once, by pthread_once(), so
+ * that instances installed on several threads at once agree on the ID.
+ */
+static void libsys_register_types() {
+  fileTypeId = vmlibdata_type_register(LIBSYS_FILE_TYPE, LIBSYS_FILE_TYPE_LEN);
+}
+
 /**
  * VMNative: sys_print( value1, value2, ... )
  * Accepts unlimited number of arguments. Prints them on the screen in their
@@ -85,7 +98,7 @@ static bool vmn_getline(VM * vm, VMArg * arg, int argc) {
 
   /* get the input from the console */
   if(fgets(line, LIBSYS_GETLINE_MAXLEN, stdin) != NULL) {
-    result = vmarg_new_string(line, strlen(line));
+    result = vmarg_new_string(vm, line, strlen(line));
     
     /* check for malloc error */
     if(result == NULL) {
@@ -161,20 +174,20 @@ static bool vmn_type(VM * vm, VMArg * arg, int argc) {
   /* get the input from the console */
   switch(arg[0].type) {
   case TYPE_NULL:
-    result = vmarg_new_string("NULL", 4);
+    result = vmarg_new_string(vm, "NULL", 4);
     break;
   case TYPE_BOOLEAN:
-    result = vmarg_new_string("BOOLEAN", 7);
+    result = vmarg_new_string(vm, "BOOLEAN", 7);
     break;
   case TYPE_NUMBER:
-    result = vmarg_new_string("NUMBER", 6);
+    result = vmarg_new_string(vm, "NUMBER", 6);
     break;
   case TYPE_LIBDATA: {
     char libDataType[20];
     strcpy(libDataType, "LIBDATA{");
-    strcat(libDataType, vmarg_libdata(arg[0])->type);
+    strcat(libDataType, vmlibdata_type_name(vmarg_libdata(arg[0])));
     strcat(libDataType, "}");
-    result = vmarg_new_string(libDataType, strlen(libDataType));
+    result = vmarg_new_string(vm, libDataType, strlen(libDataType));
     break;
     }
   }
@@ -289,7 +302,8 @@ static bool vmn_file_open(VM * vm, VMArg * arg, int argc) {
     vmarg_push_null(vm);
   }
 
-  filePointer = vmlibdata_new(LIBSYS_FILE_TYPE, LIBSYS_FILE_TYPE_LEN, filepointer_free, file);
+  filePointer = vmlibdata_new_typed(vm, fileTypeId,
+				    filepointer_free, file);
    
   /* push return value */
   if(!vmarg_push_libdata(vm, filePointer)){
@@ -327,7 +341,8 @@ static bool vmn_file_open_read(VM * vm, VMArg * arg, int argc) {
     vmarg_push_null(vm);
   }
 
-  filePointer = vmlibdata_new(LIBSYS_FILE_TYPE, LIBSYS_FILE_TYPE_LEN, filepointer_free, file);
+  filePointer = vmlibdata_new_typed(vm, fileTypeId,
+				    filepointer_free, file);
    
   /* push return value */
   if(!vmarg_push_libdata(vm, filePointer)){
@@ -365,7 +380,8 @@ static bool vmn_file_open_write(VM * vm, VMArg * arg, int argc) {
     vmarg_push_null(vm);
   }
 
-  filePointer = vmlibdata_new(LIBSYS_FILE_TYPE, LIBSYS_FILE_TYPE_LEN, filepointer_free, file);
+  filePointer = vmlibdata_new_typed(vm, fileTypeId,
+				    filepointer_free, file);
    
   /* push return value */
   if(!vmarg_push_libdata(vm, filePointer)){
@@ -393,7 +409,7 @@ static bool vmn_file_close(VM * vm, VMArg * arg, int argc) {
 
   /* check argument 1 type */
   if((filePointer = vmarg_libdata(arg[0])) == NULL ||
-        !vmlibdata_is_type(vmarg_libdata(arg[0]), LIBSYS_FILE_TYPE, LIBSYS_FILE_TYPE_LEN )) {
+        !vmlibdata_is_typeid(vmarg_libdata(arg[0]), fileTypeId)) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
     return false;
   }
@@ -423,7 +439,7 @@ static bool vmn_file_read_char(VM * vm, VMArg * arg, int argc) {
 
   /* check argument 1 type */
   if((filePointer = vmarg_libdata(arg[0])) == NULL ||
-        !vmlibdata_is_type(vmarg_libdata(arg[0]), LIBSYS_FILE_TYPE, LIBSYS_FILE_TYPE_LEN )) {
+        !vmlibdata_is_typeid(vmarg_libdata(arg[0]), fileTypeId)) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
     return false;
   }
@@ -457,7 +473,7 @@ static bool vmn_file_write_char(VM * vm, VMArg * arg, int argc) {
 
   /* check argument 1 type */
   if((c = (int) vmarg_number(arg[0], NULL)) == NULL || (filePointer = vmarg_libdata(arg[1])) == NULL ||
-        !vmlibdata_is_type(vmarg_libdata(arg[1]), LIBSYS_FILE_TYPE, LIBSYS_FILE_TYPE_LEN )) {
+        !vmlibdata_is_typeid(vmarg_libdata(arg[1]), fileTypeId)) {
     vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
     return false;
   }
@@ -610,7 +626,7 @@ static bool vmn_to_string(VM * vm, VMArg * arg, int argc) {
       return true;
     } else {
       strcpy(newString, "LIBDATA{");
-      strcat(newString, vmarg_libdata(arg[0])->type);
+      strcat(newString, vmlibdata_type_name(vmarg_libdata(arg[0])));
       strcat(newString, "}");
     }
     break;
@@ -620,7 +636,7 @@ static bool vmn_to_string(VM * vm, VMArg * arg, int argc) {
   }
 
   /* allocate response string */
-  result = vmarg_new_string(newString, strlen(newString));
+  result = vmarg_new_string(vm, newString, strlen(newString));
   if(result == NULL) {
     vm_set_err(vm, VMERR_ALLOC_FAILED);
     return false;
@@ -708,6 +724,25 @@ static bool vmn_to_boolean(VM * vm, VMArg * arg, int argc) {
   return true;
 }
 
+/**
+ * VMNative: yield( value )
+ * Accepts zero or one arguments. Suspends the running coroutine, giving value
+ * to the host's vm_resume(). Returns the value that the coroutine is resumed
+ * with. Fails outside of a coroutine.
+ */
+static bool vmn_yield(VM * vm, VMArg * arg, int argc) {
+
+  /* check for correct number of arguments */
+  if(argc > 1) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+
+    /* this function does not return a value */
+    return false;
+  }
+
+  /* vm_resume() pushes the return value */
+  return vm_yield(vm, argc == 1 ? arg[0] : vmarg_make_null());
+}
 
 /**
  * Installs the Libsys library in the given instance of Gunderscript.
@@ -717,6 +752,13 @@ static bool vmn_to_boolean(VM * vm, VMArg * arg, int argc) {
  * gunderscript_new().
  */
 bool libsys_install(Gunderscript * gunderscript) {
+
+  /* register the file handle LIBDATA type */
+  pthread_once(&fileTypeOnce, libsys_register_types);
+  if(fileTypeId == VM_LIBDATA_TYPE_INVALID) {
+    return false;
+  }
+
   if(!vm_reg_callback(gunderscript_vm(gunderscript), "sys_print", 9, vmn_print)
      || !vm_reg_callback(gunderscript_vm(gunderscript), "sys_shell", 9, vmn_shell)
      || !vm_reg_callback(gunderscript_vm(gunderscript), "sys_getline", 11, vmn_getline)
@@ -736,7 +778,8 @@ bool libsys_install(Gunderscript * gunderscript) {
      || !vm_reg_callback(gunderscript_vm(gunderscript), "is_string", 9, vmn_is_string)
      || !vm_reg_callback(gunderscript_vm(gunderscript), "to_string", 9, vmn_to_string)
      || !vm_reg_callback(gunderscript_vm(gunderscript), "to_number", 9, vmn_to_number)
-     || !vm_reg_callback(gunderscript_vm(gunderscript), "to_boolean", 10, vmn_to_boolean)) {
+     || !vm_reg_callback(gunderscript_vm(gunderscript), "to_boolean", 10, vmn_to_boolean)
+     || !vm_reg_callback(gunderscript_vm(gunderscript), "yield", 5, vmn_yield)) {
     return false;
   }
 
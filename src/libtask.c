@@ -0,0 +1,901 @@
+/**
+ * libtask.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * The spawn() and join() natives, which let a script fan work out across
+ * threads, and the work stealing TaskPool that runs it. spawn() queues a call
+ * of a function of the pool's program and returns a task handle, and join()
+ * waits for the call and returns its return value.
+ *
+ * Each worker thread of the pool has an ExecContext over the shared program,
+ * and a deque of tasks. A worker pushes the tasks that it spawns onto the
+ * bottom of its own deque and takes them back from the bottom, so the most
+ * recent, and most likely cached, work runs first. Idle workers steal the
+ * oldest tasks from the top of the others' deques. A thread that joins a task
+ * that hasn't started runs it itself, and while the task runs elsewhere it
+ * helps by running other queued tasks, so that workers blocked in join()
+ * can't use up the pool.
+ *
+ * Objects belong to a single VM, so values are deep copied in and out of
+ * tasks: spawn() copies the arguments, the worker copies the return value,
+ * and join() makes a new copy in the joining VM. Numbers, booleans, null, and
+ * strings can be passed, and so can channels and frozen strings, which are
+ * shared rather than copied. Other objects, e.g. files, can't.
+ *
+ * Each task runs as a coroutine on its thread's VM, so a task run inside of a
+ * join() has its own stacks, and if it fails it leaves nothing behind on the
+ * joiner's. A task that calls yield() gets null back, and one that runs out
+ * of fuel goes on, since there is nothing else for the thread to switch to.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "libtask.h"
+#include "libstr.h"
+
+/* the number of tasks that a deque has room for when first pushed to */
+static const int dequeInitSize = 16;
+/* how long join() sleeps between checks for an interrupt, in nanoseconds */
+static const long joinPollNs = 10 * 1000 * 1000;
+
+/* the LIBDATA type ID for task handles, assigned once by libtask_install() */
+static VMLibDataType taskTypeId = VM_LIBDATA_TYPE_INVALID;
+static pthread_once_t taskTypeOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Copies a value out of a VM.
+ * vm: the VM that the value is from.
+ * allocator: the allocator for the copy.
+ * value: receives the copy. Free it with taskvalue_free().
+ * arg: the value.
+ * returns: true if success, false if the value is an object other than a
+ * string or channel, or allocation fails, in which case the VM's error is
+ * set.
+ */
+static bool taskvalue_copy(VM * vm, GSAllocator * allocator,
+			   TaskValue * value, VMArg arg) {
+  VMLibData * data;
+
+  value->arg = arg;
+  value->string = NULL;
+  value->stringLen = 0;
+  value->channel = NULL;
+  value->frozen = NULL;
+
+  if(vmarg_type(arg) != TYPE_LIBDATA) {
+    return true;
+  }
+
+  /* channels are made to be shared, pass the channel itself */
+  if(libchan_channel(arg) != NULL) {
+    value->arg = vmarg_make_null();
+    value->channel = channel_retain(libchan_channel(arg));
+    return true;
+  }
+
+  if(!vmarg_is_string(arg)) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  /* frozen strings are shared, the value keeps a reference */
+  data = vmarg_libdata(arg);
+  value->arg = vmarg_make_null();
+  if(vmlibdata_is_frozen(data)) {
+    vmlibdata_inc_refcount(data);
+    value->frozen = data;
+    return true;
+  }
+
+  /* keep the characters, the object stays with the VM */
+  value->stringLen = libstr_string_length(data);
+  value->string = gsalloc_malloc(allocator, value->stringLen + 1);
+  if(value->string == NULL) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  memcpy(value->string, libstr_string(data), value->stringLen);
+  value->string[value->stringLen] = '\0';
+  return true;
+}
+
+/**
+ * Makes a copied value in a VM.
+ * vm: the VM.
+ * value: the copied value.
+ * arg: receives the value. A string is a new object that nothing holds a
+ * reference to yet, or a frozen string that the value keeps alive.
+ * returns: true if success, false if allocation fails, in which case the
+ * VM's error is set.
+ */
+static bool taskvalue_arg(VM * vm, TaskValue * value, VMArg * arg) {
+  VMLibData * data;
+  char * string = value->string;
+  int stringLen = value->stringLen;
+
+  if(value->channel != NULL) {
+    data = libchan_handle(vm, value->channel);
+    if(data == NULL) {
+      vm_set_err(vm, VMERR_ALLOC_FAILED);
+      return false;
+    }
+    *arg = vmarg_make_libdata(data);
+    return true;
+  }
+
+  /* a frozen string is shared if this VM can, and copied if not */
+  if(value->frozen != NULL) {
+    if(vmlibdata_can_share(vm, value->frozen)) {
+      *arg = vmarg_make_libdata(value->frozen);
+      return true;
+    }
+    string = libstr_string(value->frozen);
+    stringLen = libstr_string_length(value->frozen);
+  } else if(value->string == NULL) {
+    *arg = value->arg;
+    return true;
+  }
+
+  /* string buffers can't be empty, even for an empty string */
+  data = libstr_string_new(vm, stringLen > 0 ? stringLen : 1);
+  if(data == NULL || !libstr_string_append(data, string, stringLen)) {
+    if(data != NULL) {
+      vmlibdata_check_cleanup(vm, data);
+    }
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  *arg = vmarg_make_libdata(data);
+  return true;
+}
+
+/**
+ * Frees a copied value.
+ * allocator: the allocator that it was copied with.
+ * value: the value.
+ */
+static void taskvalue_free(GSAllocator * allocator, TaskValue * value) {
+  if(value->string != NULL) {
+    gsalloc_free(allocator, value->string, value->stringLen + 1);
+    value->string = NULL;
+  }
+  if(value->channel != NULL) {
+    channel_release(value->channel);
+    value->channel = NULL;
+  }
+  if(value->frozen != NULL) {
+    vmlibdata_release(NULL, value->frozen);
+    value->frozen = NULL;
+  }
+}
+
+/**
+ * Adds a reference to a task.
+ * task: the task.
+ * returns: the task.
+ */
+static Task * task_retain(Task * task) {
+  __sync_add_and_fetch(&task->refCount, 1);
+  return task;
+}
+
+/**
+ * Drops a reference to a task, and frees it when the last one is dropped.
+ * May be called from any thread.
+ * task: the task.
+ */
+static void task_release(Task * task) {
+  int i;
+
+  if(__sync_sub_and_fetch(&task->refCount, 1) > 0) {
+    return;
+  }
+
+  for(i = 0; i < task->argc; i++) {
+    taskvalue_free(task->allocator, &task->args[i]);
+  }
+  if(task->args != NULL) {
+    gsalloc_free(task->allocator, task->args, task->argc * sizeof(TaskValue));
+  }
+  taskvalue_free(task->allocator, &task->result);
+  gsalloc_free(task->allocator, task, sizeof(Task));
+}
+
+/**
+ * Creates a task with copies of its arguments.
+ * vm: the VM that spawned the task.
+ * allocator: the pool's allocator.
+ * function: the function to call.
+ * args: the arguments.
+ * argc: the number of arguments.
+ * returns: the task, with a reference count of 1, or NULL if an argument
+ * can't be copied, or allocation fails, in which case the VM's error is set.
+ */
+static Task * task_new(VM * vm, GSAllocator * allocator,
+		       CompilerFunc * function, VMArg * args, int argc) {
+  Task * task;
+  int i;
+
+  task = gsalloc_calloc(allocator, 1, sizeof(Task));
+  if(task == NULL) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return NULL;
+  }
+
+  task->function = function;
+  task->state = TASK_PENDING;
+  task->err = VMERR_SUCCESS;
+  task->result.arg = vmarg_make_null();
+  task->refCount = 1;
+  task->allocator = allocator;
+
+  if(argc == 0) {
+    return task;
+  }
+
+  task->args = gsalloc_calloc(allocator, argc, sizeof(TaskValue));
+  if(task->args == NULL) {
+    gsalloc_free(allocator, task, sizeof(Task));
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return NULL;
+  }
+  task->argc = argc;
+
+  for(i = 0; i < argc; i++) {
+    if(!taskvalue_copy(vm, allocator, &task->args[i], args[i])) {
+      task_release(task);
+      return NULL;
+    }
+  }
+
+  return task;
+}
+
+/**
+ * Takes a pending task to run it. Every thread that finds the task, in a
+ * deque or in join(), tries to take it, and only one succeeds.
+ * task: the task.
+ * returns: true if the caller must run the task, false if someone else has.
+ */
+static bool task_claim(Task * task) {
+  return __sync_bool_compare_and_swap(&task->state, TASK_PENDING,
+				      TASK_RUNNING);
+}
+
+/**
+ * Frees a task handle's reference when the handle is freed.
+ * vm: the VM that owns the handle.
+ * data: the handle.
+ */
+static void task_cleanup(VM * vm, VMLibData * data) {
+  task_release(vmlibdata_data(data));
+}
+
+/**
+ * Pushes a task onto the bottom of a deque, making room if it's full.
+ * allocator: the pool's allocator.
+ * deque: the deque.
+ * task: the task. The deque takes over the caller's reference.
+ * returns: true if success, false if allocation fails.
+ */
+static bool deque_push(GSAllocator * allocator, TaskDeque * deque,
+		       Task * task) {
+  Task ** tasks;
+  int size;
+  int i;
+
+  pthread_mutex_lock(&deque->lock);
+  if(deque->count == deque->size) {
+    size = deque->size > 0 ? deque->size * 2 : dequeInitSize;
+    tasks = gsalloc_calloc(allocator, size, sizeof(Task*));
+    if(tasks == NULL) {
+      pthread_mutex_unlock(&deque->lock);
+      return false;
+    }
+
+    /* unwrap the ring, oldest first */
+    for(i = 0; i < deque->count; i++) {
+      tasks[i] = deque->tasks[(deque->top + i) % deque->size];
+    }
+    if(deque->tasks != NULL) {
+      gsalloc_free(allocator, deque->tasks, deque->size * sizeof(Task*));
+    }
+    deque->tasks = tasks;
+    deque->size = size;
+    deque->top = 0;
+  }
+
+  deque->tasks[(deque->top + deque->count) % deque->size] = task;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+  return true;
+}
+
+/**
+ * Takes a task from a deque.
+ * deque: the deque.
+ * bottom: true to take the newest task, as the deque's worker does, or false
+ * to take the oldest, as thieves do.
+ * returns: the task and its reference, or NULL if the deque is empty.
+ */
+static Task * deque_take(TaskDeque * deque, bool bottom) {
+  Task * task = NULL;
+
+  pthread_mutex_lock(&deque->lock);
+  if(deque->count > 0) {
+    deque->count--;
+    if(bottom) {
+      task = deque->tasks[(deque->top + deque->count) % deque->size];
+    } else {
+      task = deque->tasks[deque->top];
+      deque->top = (deque->top + 1) % deque->size;
+    }
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return task;
+}
+
+/**
+ * Finds the worker that a VM belongs to.
+ * pool: the pool.
+ * vm: the VM.
+ * returns: the worker, or NULL if the VM isn't one of the pool's.
+ */
+static TaskWorker * taskpool_worker(TaskPool * pool, VM * vm) {
+  int i;
+
+  for(i = 0; i < pool->numWorkers; i++) {
+    if(execcontext_vm(pool->workers[i].context) == vm) {
+      return &pool->workers[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Queues a task, on the deque of the worker that spawned it, or on the next
+ * worker's in turn if it was spawned by another thread, and wakes a worker.
+ * pool: the pool.
+ * worker: the spawning worker, or NULL.
+ * task: the task. The queue adds its own reference.
+ * returns: true if success, false if allocation fails.
+ */
+static bool taskpool_push(TaskPool * pool, TaskWorker * worker, Task * task) {
+
+  if(worker == NULL) {
+    pthread_mutex_lock(&pool->lock);
+    worker = &pool->workers[pool->nextWorker];
+    pool->nextWorker = (pool->nextWorker + 1) % pool->numWorkers;
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  if(!deque_push(pool->allocator, &worker->deque, task_retain(task))) {
+    task_release(task);
+    return false;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->numQueued++;
+  pthread_cond_signal(&pool->workCond);
+  pthread_mutex_unlock(&pool->lock);
+  return true;
+}
+
+/**
+ * Takes a queued task: the newest from the worker's own deque, or else the
+ * oldest from another worker's.
+ * pool: the pool.
+ * worker: the worker looking for work, or NULL for another thread.
+ * returns: the task and its reference, or NULL if none are queued. It may
+ * already have been claimed by a join().
+ */
+static Task * taskpool_take(TaskPool * pool, TaskWorker * worker) {
+  Task * task = NULL;
+  int start = 0;
+  int i;
+
+  if(worker != NULL) {
+    task = deque_take(&worker->deque, true);
+    start = (worker - pool->workers) + 1;
+  }
+
+  /* steal, starting after this worker so that thieves spread out */
+  for(i = 0; i < pool->numWorkers && task == NULL; i++) {
+    TaskWorker * victim = &pool->workers[(start + i) % pool->numWorkers];
+
+    if(victim != worker) {
+      task = deque_take(&victim->deque, false);
+    }
+  }
+
+  if(task != NULL) {
+    pthread_mutex_lock(&pool->lock);
+    pool->numQueued--;
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return task;
+}
+
+/**
+ * Marks a task as finished and wakes the threads that are joining it.
+ * pool: the pool.
+ * task: the task.
+ * err: VMERR_SUCCESS if its result is set, or the error that stopped it.
+ */
+static void taskpool_finish(TaskPool * pool, Task * task, VMErr err) {
+  pthread_mutex_lock(&pool->lock);
+  task->err = err;
+  __atomic_store_n(&task->state, err == VMERR_SUCCESS ? TASK_DONE
+		   : TASK_FAILED, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&pool->doneCond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Runs a claimed task as a coroutine on a VM, and finishes it.
+ * pool: the pool.
+ * vm: the VM of the thread that claimed it, which must run the pool's
+ * program.
+ * task: the task.
+ */
+static void taskpool_run(TaskPool * pool, VM * vm, Task * task) {
+  CompilerFunc * function = task->function;
+  VMArg * args = NULL;
+  VMCoro * coro = NULL;
+  VMArg result;
+  VMErr err = VMERR_SUCCESS;
+  bool success = true;
+  int made = 0;
+  int i;
+
+  /* make the arguments in this VM */
+  if(task->argc > 0) {
+    args = gsalloc_calloc(pool->allocator, task->argc, sizeof(VMArg));
+    if(args == NULL) {
+      vm_set_err(vm, VMERR_ALLOC_FAILED);
+      success = false;
+    }
+  }
+  for(; success && made < task->argc; made++) {
+    success = taskvalue_arg(vm, &task->args[made], &args[made]);
+  }
+
+  if(success) {
+    coro = vmcoro_new(vm, pool->stackSize, function->index,
+		      function->numArgs + function->numVars,
+		      args, task->argc);
+    success = coro != NULL;
+  }
+
+  /* the coroutine's frame holds the arguments now, or nothing does */
+  for(i = 0; i < made; i++) {
+    if(vmarg_type(args[i]) == TYPE_LIBDATA) {
+      vmlibdata_check_cleanup(vm, vmarg_libdata(args[i]));
+    }
+  }
+
+  /* a task has no one to yield to. yield() returns null, and running out of
+   * fuel only gives the VM a chance to check the time limit
+   */
+  while(success) {
+    success = vm_resume(vm, coro, pool->program->byteCode,
+			pool->program->byteCodeLen, NULL, &result);
+    if(!success || vmcoro_state(coro) == VMCORO_DONE) {
+      break;
+    }
+    vmarg_release(vm, result);
+  }
+
+  if(success) {
+    success = taskvalue_copy(vm, task->allocator, &task->result, result);
+    vmarg_release(vm, result);
+  }
+
+  /* the error is the task's, not the caller's */
+  if(!success) {
+    err = vm_get_err(vm);
+    vm_set_err(vm, VMERR_SUCCESS);
+  }
+
+  if(coro != NULL) {
+    vmcoro_free(vm, coro);
+  }
+  if(args != NULL) {
+    gsalloc_free(pool->allocator, args, task->argc * sizeof(VMArg));
+  }
+
+  taskpool_finish(pool, task, err);
+}
+
+/**
+ * Worker thread: runs queued tasks until the pool is freed.
+ * arg: the TaskWorker.
+ * returns: NULL.
+ */
+static void * taskpool_worker_main(void * arg) {
+  TaskWorker * worker = arg;
+  TaskPool * pool = worker->pool;
+  Task * task;
+
+  while(true) {
+    task = taskpool_take(pool, worker);
+    if(task != NULL) {
+      if(task_claim(task)) {
+	taskpool_run(pool, execcontext_vm(worker->context), task);
+      }
+      task_release(task);
+      continue;
+    }
+
+    /* sleep until a task is queued */
+    pthread_mutex_lock(&pool->lock);
+    while(pool->numQueued == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->workCond, &pool->lock);
+    }
+    if(pool->stopping) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+/**
+ * Creates a pool of threads that run tasks spawned by a program. Set it on
+ * each VM that runs the program and calls spawn(), with vm_set_task_pool().
+ * The pool sets itself on its workers' VMs, so that tasks can spawn tasks.
+ * program: the program. The pool holds a reference to it until
+ * taskpool_free().
+ * numWorkers: the number of threads, e.g. the number of cores.
+ * stackSize: the frame stack size of each task, in bytes.
+ * allocator: the allocator for the pool, its tasks, and its workers'
+ * contexts, or NULL for the default allocator. It must be thread safe.
+ * memMode: the memory mode of each worker's context, see vm_new().
+ * returns: the pool, or NULL if allocation fails, or a thread can't be
+ * started.
+ */
+TaskPool * taskpool_new(Program * program, int numWorkers, size_t stackSize,
+			GSAllocator * allocator, VMMemMode memMode) {
+  TaskPool * pool;
+  int i;
+
+  assert(program != NULL);
+  assert(numWorkers > 0);
+  assert(stackSize > 0);
+
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  pool = gsalloc_calloc(allocator, 1, sizeof(TaskPool));
+  if(pool == NULL) {
+    return NULL;
+  }
+
+  pool->workers = gsalloc_calloc(allocator, numWorkers, sizeof(TaskWorker));
+  if(pool->workers == NULL) {
+    gsalloc_free(allocator, pool, sizeof(TaskPool));
+    return NULL;
+  }
+
+  if(pthread_mutex_init(&pool->lock, NULL) != 0) {
+    gsalloc_free(allocator, pool->workers, numWorkers * sizeof(TaskWorker));
+    gsalloc_free(allocator, pool, sizeof(TaskPool));
+    return NULL;
+  }
+  pthread_cond_init(&pool->workCond, NULL);
+  pthread_cond_init(&pool->doneCond, NULL);
+
+  pool->program = program_retain(program);
+  pool->workersSize = numWorkers;
+  pool->stackSize = stackSize;
+  pool->allocator = allocator;
+
+  /* numWorkers counts the workers that taskpool_free() must clean up */
+  for(i = 0; i < numWorkers; i++) {
+    TaskWorker * worker = &pool->workers[i];
+
+    worker->pool = pool;
+    worker->context = execcontext_new(program, stackSize, allocator, memMode);
+    if(worker->context == NULL) {
+      break;
+    }
+    if(pthread_mutex_init(&worker->deque.lock, NULL) != 0) {
+      execcontext_free(worker->context);
+      break;
+    }
+    vm_set_task_pool(execcontext_vm(worker->context), pool);
+    pool->numWorkers++;
+  }
+
+  /* start the threads once every worker can be stolen from */
+  while(pool->numWorkers == numWorkers && pool->numStarted < numWorkers) {
+    if(pthread_create(&pool->workers[pool->numStarted].thread, NULL,
+		      taskpool_worker_main,
+		      &pool->workers[pool->numStarted]) != 0) {
+      break;
+    }
+    pool->numStarted++;
+  }
+
+  if(pool->numStarted < numWorkers) {
+    taskpool_free(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+/**
+ * Stops a pool's threads, once they finish the tasks that they're running,
+ * and frees the pool. Tasks that never started fail with VMERR_INTERRUPTED.
+ * VMs that the pool was set on must not call spawn() or join() after this.
+ * pool: the pool.
+ */
+void taskpool_free(TaskPool * pool) {
+  Task * task;
+  int i;
+
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->workCond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(i = 0; i < pool->numStarted; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+
+  for(i = 0; i < pool->numWorkers; i++) {
+    TaskWorker * worker = &pool->workers[i];
+
+    while((task = deque_take(&worker->deque, true)) != NULL) {
+      if(task_claim(task)) {
+	taskpool_finish(pool, task, VMERR_INTERRUPTED);
+      }
+      task_release(task);
+    }
+
+    if(worker->deque.tasks != NULL) {
+      gsalloc_free(pool->allocator, worker->deque.tasks,
+		   worker->deque.size * sizeof(Task*));
+    }
+    pthread_mutex_destroy(&worker->deque.lock);
+    execcontext_free(worker->context);
+  }
+
+  pthread_cond_destroy(&pool->workCond);
+  pthread_cond_destroy(&pool->doneCond);
+  pthread_mutex_destroy(&pool->lock);
+  program_release(pool->program);
+  gsalloc_free(pool->allocator, pool->workers,
+	       pool->workersSize * sizeof(TaskWorker));
+  gsalloc_free(pool->allocator, pool, sizeof(TaskPool));
+}
+
+/**
+ * VMNative: spawn( functionName, arg1, arg2, ... )
+ * Accepts the name of an exported function of the program, and its
+ * arguments, which may be numbers, booleans, null, strings, or channels.
+ * Queues a call of the function on the VM's task pool, and returns a task
+ * handle for join().
+ */
+static bool vmn_spawn(VM * vm, VMArg * arg, int argc) {
+  TaskPool * pool = vm_task_pool(vm);
+  CompilerFunc * function;
+  VMLibData * handle;
+  Task * task;
+
+  /* check for correct number of arguments */
+  if(argc < 1) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+
+    /* this function does not return a value */
+    return false;
+  }
+
+  /* check 1st arg is string */
+  if(!vmarg_is_string(arg[0])) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  if(pool == NULL) {
+    vm_set_err(vm, VMERR_NO_TASK_POOL);
+    return false;
+  }
+
+  function = program_function(pool->program, vmarg_string(arg[0]),
+			      libstr_string_length(vmarg_libdata(arg[0])));
+  if(function == NULL) {
+    vm_set_err(vm, VMERR_CALLBACK_NOT_EXIST);
+    return false;
+  }
+  if(argc - 1 != function->numArgs) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+    return false;
+  }
+
+  task = task_new(vm, pool->allocator, function, arg + 1, argc - 1);
+  if(task == NULL) {
+    return false;
+  }
+
+  /* the handle takes over the task's first reference */
+  handle = vmlibdata_new_typed(vm, taskTypeId, task_cleanup, task);
+  if(handle == NULL) {
+    task_release(task);
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  if(!taskpool_push(pool, taskpool_worker(pool, vm), task)
+     || !vmarg_push_libdata(vm, handle)) {
+    vmlibdata_check_cleanup(vm, handle);
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * VMNative: join( task )
+ * Accepts a task handle from spawn(). Waits for the task and returns its
+ * function's return value. Fails with the task's error if the task failed.
+ * If the task hasn't started, it runs in this call, and while it runs on
+ * another thread this thread runs other queued tasks.
+ */
+static bool vmn_join(VM * vm, VMArg * arg, int argc) {
+  TaskPool * pool = vm_task_pool(vm);
+  TaskWorker * worker;
+  TaskState state;
+  Task * task;
+  Task * other;
+  VMArg result;
+  struct timespec until;
+
+  /* check for correct number of arguments */
+  if(argc != 1) {
+    vm_set_err(vm, VMERR_INCORRECT_NUMARGS);
+
+    /* this function does not return a value */
+    return false;
+  }
+
+  /* check argument 1 type */
+  if(vmarg_libdata(arg[0]) == NULL
+     || !vmlibdata_is_typeid(vmarg_libdata(arg[0]), taskTypeId)) {
+    vm_set_err(vm, VMERR_INVALID_TYPE_ARGUMENT);
+    return false;
+  }
+
+  if(pool == NULL) {
+    vm_set_err(vm, VMERR_NO_TASK_POOL);
+    return false;
+  }
+
+  task = vmlibdata_data(vmarg_libdata(arg[0]));
+  worker = taskpool_worker(pool, vm);
+
+  while(true) {
+    state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE);
+    if(state == TASK_DONE || state == TASK_FAILED) {
+      break;
+    }
+
+    /* run it here if no one has started it */
+    if(task_claim(task)) {
+      taskpool_run(pool, vm, task);
+      continue;
+    }
+
+    /* help with the rest of the queue while it runs */
+    other = taskpool_take(pool, worker);
+    if(other != NULL) {
+      if(task_claim(other)) {
+	taskpool_run(pool, vm, other);
+      }
+      task_release(other);
+      continue;
+    }
+
+    if(vm_poll_interrupt(vm)) {
+      return false;
+    }
+
+    /* wait for a task to finish, waking to check for an interrupt */
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += joinPollNs;
+    if(until.tv_nsec >= 1000000000) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if(__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) == TASK_RUNNING) {
+      pthread_cond_timedwait(&pool->doneCond, &pool->lock, &until);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  if(state == TASK_FAILED) {
+    vm_set_err(vm, task->err);
+    return false;
+  }
+
+  if(!taskvalue_arg(vm, &task->result, &result)) {
+    return false;
+  }
+
+  /* push return value */
+  switch(vmarg_type(result)) {
+  case TYPE_LIBDATA:
+    if(!vmarg_push_libdata(vm, vmarg_libdata(result))) {
+      vmlibdata_check_cleanup(vm, vmarg_libdata(result));
+      vm_set_err(vm, VMERR_ALLOC_FAILED);
+      return false;
+    }
+    return true;
+  case TYPE_NUMBER:
+    return vmarg_push_number(vm, vmarg_number(result, NULL));
+  case TYPE_BOOLEAN:
+    return vmarg_push_boolean(vm, vmarg_boolean(result, NULL));
+  default:
+    return false;
+  }
+}
+
+/**
+ * Registers the task handle LIBDATA type. Run once, by pthread_once(), so
+ * that instances installed on several threads at once agree on the ID.
+ */
+static void libtask_register_types() {
+  taskTypeId = vmlibdata_type_register(LIBTASK_TASK_TYPE,
+				       LIBTASK_TASK_TYPE_LEN);
+}
+
+/**
+ * Installs the spawn() and join() natives in the given instance of
+ * Gunderscript. They fail until a TaskPool is set on the VM that runs them.
+ * gunderscript: the instance to receive the library.
+ * returns: true upon success, and false upon failure. If failure occurs,
+ * you probably did not allocate enough callbacks space in the call to
+ * gunderscript_new().
+ */
+bool libtask_install(Gunderscript * gunderscript) {
+
+  /* register the task handle LIBDATA type */
+  pthread_once(&taskTypeOnce, libtask_register_types);
+  if(taskTypeId == VM_LIBDATA_TYPE_INVALID) {
+    return false;
+  }
+
+  if(!vm_reg_callback(gunderscript_vm(gunderscript), "spawn", 5, vmn_spawn)
+     || !vm_reg_callback(gunderscript_vm(gunderscript), "join", 4, vmn_join)) {
+    return false;
+  }
+
+  return true;
+}
@@ -38,8 +38,32 @@
 #define OP_FALSE            0
 #define OP_NO_RETURN       -1
 
+/*
+ * Reference ownership invariant:
+ * Between instructions, the refCount of every VMLibData is equal to the number
+ * of frame stack variable slots that hold it, plus the number of OWNED operand
+ * stack entries that hold it, plus any references held by the host through
+ * vmgc_add_root(). Each operand stack entry is either:
+ *
+ *   OWNED:    pushed with opstk_push(). The entry holds one reference, which
+ *             passes to whoever pops it.
+ *   BORROWED: pushed with opstk_push_borrowed() by OP_VAR_PUSH_B. The entry
+ *             holds no reference. The compiler only emits OP_VAR_PUSH_B when
+ *             it can prove that no OP_CALL_B or OP_FRM_POP executes while the
+ *             entry is on the stack, so the variable it was read from keeps
+ *             the object alive until the entry is popped.
+ *
+ * Handlers that pop a LIBDATA operand must release it with opstk_release()
+ * when they are done with it, which only drops a reference if the entry was
+ * owned. A borrowed operand that is stored somewhere longer lived, such as a
+ * new frame's argument slot, must take its own reference first. Builds with
+ * VM_CHECK_REFCOUNTS defined verify this invariant before every instruction.
+ * See vm_check_refcounts() in vm.c.
+ */
+
 /**
- * Pushes an operand onto the operand stack.
+ * Pushes an owned operand onto the operand stack. For objects, the stack
+ * takes a new reference.
  * vm: an instance of vm.
  * data: pointer to the data to push to the stack.
  * dataSize: the size of the operand in bytes.
@@ -57,23 +81,65 @@ static bool opstk_push(VM * vm, void * data, size_t dataSize, VarType type) {
   return typestk_push(vm->opStk, data, dataSize, type);
 }
 
+/**
+ * Pushes a borrowed operand onto the operand stack. No reference is taken.
+ * Only valid for values read from variables. See the invariant above.
+ * vm: an instance of vm.
+ * data: pointer to the data to push to the stack.
+ * dataSize: the size of the operand in bytes.
+ * type: the type of this operand.
+ * returns: true if success, and false if typestk error occurs.
+ */
+static bool opstk_push_borrowed(VM * vm, void * data,
+				size_t dataSize, VarType type) {
+  return typestk_push_borrowed(vm->opStk, data, dataSize, type);
+}
+
+/**
+ * Drops the reference held by a popped operand, freeing the object if it was
+ * the last one. Does nothing for borrowed operands and non-objects.
+ * vm: an instance of VM.
+ * data: pointer to the popped value.
+ * type: the type of the popped value.
+ * owned: whether the popped entry owned a reference.
+ */
+static void opstk_release(VM * vm, void * data, VarType type, bool owned) {
+  if(type == TYPE_LIBDATA && owned) {
+    VMLibData * object;
+
+    memcpy(&object, data, sizeof(VMLibData*));
+    vmlibdata_release(vm, object);
+  }
+}
+
 /**
  * Pops an operand from the operand stack.
  * vm: an instance of VM.
  * data: pointer to a buffer to receive the value.
  * dataSize: the size of the data buffer in bytes.
  * type: pointer to a VarType that will receive the type of the operand.
+ * owned: pointer to a bool that receives whether the caller now holds the
+ * entry's reference and must opstk_release() it. If NULL, the operand is
+ * released immediately, for handlers that only use primitive values.
  * returns: true if success, and false if typestk error occurs. See typestk.c.
  */
-static bool opstk_pop(VM * vm, void * data, size_t dataSize, VarType * type) {
+static bool opstk_pop(VM * vm, void * data, size_t dataSize,
+		      VarType * type, bool * owned) {
+  bool borrowed = typestk_top_borrowed(vm->opStk);
   bool result = typestk_pop(vm->opStk, data, dataSize, type);
-  
-  /* decrement ref count for this object */
-  if(*type == TYPE_LIBDATA) {
-    vmlibdata_dec_refcount( *((VMLibData**)data) );
+
+  if(!result) {
+    return false;
   }
 
-  return result;
+  /* hand reference to caller, or drop it now if the caller doesn't want it */
+  if(owned != NULL) {
+    *owned = !borrowed;
+  } else if(*type == TYPE_LIBDATA && !borrowed) {
+    opstk_release(vm, data, *type, true);
+  }
+
+  return true;
 }
 
 /**
@@ -159,8 +225,7 @@ bool op_var_stor(VM * vm, char * byteCode,
   frmstk_var_read(vm->frmStk, stackDepth, 
 		  varArgsIndex, &oldDataStruct, sizeof(VMLibData*), &oldType);
   if(oldType == TYPE_LIBDATA) {
-    vmlibdata_dec_refcount(oldDataStruct);
-    vmlibdata_check_cleanup(vm, oldDataStruct);
+    vmlibdata_release(vm, oldDataStruct);
   }
 
   /* write the value to a variable slot in the frame stack */
@@ -183,7 +248,6 @@ bool op_var_push(VM * vm,  char * byteCode,
   char stackDepth = byteCode[++(*index)];
   char varArgsIndex = byteCode[++(*index)];
   char data[VM_VAR_SIZE];
-  VMLibData * dataStruct;
   VarType type;  
 
   /* check that there are enough tokens in the input */
@@ -208,16 +272,53 @@ bool op_var_push(VM * vm,  char * byteCode,
     return false;
   }
 
-  /* increment ref count for objects */
-  frmstk_var_read(vm->frmStk, stackDepth, 
-		  varArgsIndex, &dataStruct, sizeof(VMLibData*), &type);
-  if(type == TYPE_LIBDATA) {
-    vmlibdata_inc_refcount(dataStruct);
+  /* push value to op stack, taking a reference for objects */
+  if(!opstk_push(vm, data, VM_VAR_SIZE, type)) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
   }
-  
 
-  /* push value to op stack */
-  if(!opstk_push(vm, data, VM_VAR_SIZE, type)) {
+  return true;
+}
+
+/**
+ * Reads a variable from the specified stack frame depth and index and pushes
+ * it into the op stack as a borrowed operand, without taking a reference. The
+ * compiler emits this instead of OP_VAR_PUSH only when the value is provably
+ * consumed before the variable can release it.
+ * OP_VAR_PUSH_B [stack_depth:1] [arg_index:1]
+ */
+bool op_var_push_b(VM * vm,  char * byteCode, 
+		   size_t byteCodeLen, int * index) {
+  char stackDepth = byteCode[++(*index)];
+  char varArgsIndex = byteCode[++(*index)];
+  char data[VM_VAR_SIZE];
+  VarType type;  
+
+  /* check that there are enough tokens in the input */
+  if((byteCodeLen - *index) < 2) {
+    vm_set_err(vm, VMERR_UNEXPECTED_END_OF_OPCODES);
+    return false;
+  }
+
+  /* move to next byte */
+  (*index)++;
+
+  /* handle empty frame stack error case */
+  if(!(frmstk_size(vm->frmStk) > 0)) {
+    vm_set_err(vm, VMERR_FRMSTK_EMPTY);
+    return false;
+  }
+
+  /* read value from framestack variable slot */
+  if(!frmstk_var_read(vm->frmStk, stackDepth, 
+		     varArgsIndex, data, VM_VAR_SIZE, &type)) {
+    vm_set_err(vm, VMERR_FRMSTK_VAR_ACCESS_FAILED);
+    return false;
+  }
+
+  /* push value to op stack without a reference */
+  if(!opstk_push_borrowed(vm, data, VM_VAR_SIZE, type)) {
     vm_set_err(vm, VMERR_ALLOC_FAILED);
     return false;
   }
@@ -287,8 +388,17 @@ bool op_frame_push(VM * vm,  char * byteCode,
     for(i = args - 1; i >= 0; i--) {
       char data[VM_VAR_SIZE];
       VarType type;
-
-      opstk_pop(vm, &data, VM_VAR_SIZE, &type);
+      bool owned;
+
+      /* owned arguments pass their reference to the variable, borrowed ones
+       * must take their own
+       */
+      opstk_pop(vm, &data, VM_VAR_SIZE, &type, &owned);
+      if(type == TYPE_LIBDATA && !owned) {
+	VMLibData * object;
+	memcpy(&object, data, sizeof(VMLibData*));
+	vmlibdata_inc_refcount(object);
+      }
       frmstk_var_write(vm->frmStk, FRMSTK_TOP, i, &data, VM_VAR_SIZE, type);
     }
 
@@ -327,8 +437,7 @@ bool op_frame_pop(VM * vm,  char * byteCode,
   for(i = 0; frmstk_var_read(vm->frmStk, 0, i, &arg, 
 			     sizeof(VMLibData*), &type); i++) {
     if(type == TYPE_LIBDATA) {
-      vmlibdata_dec_refcount(arg);
-      vmlibdata_check_cleanup(vm, arg);
+      vmlibdata_release(vm, arg);
     }
   }
   
@@ -384,26 +493,31 @@ bool op_add(VM * vm,  char * byteCode,
     VMLibData * data1;
     VMLibData * data2;
     VMLibData * result;
+    bool owned1;
+    bool owned2;
 
     /* pop topmost libdata structs */
-    opstk_pop(vm, &data1, sizeof(VMLibData*), &type1);
-    opstk_pop(vm, &data2, sizeof(VMLibData*), &type2);
+    opstk_pop(vm, &data1, sizeof(VMLibData*), &type1, &owned1);
+    opstk_pop(vm, &data2, sizeof(VMLibData*), &type2, &owned2);
 
     /* check to make sure these libdata structs contain strings */
-    if(!vmlibdata_is_type(data1, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN)
-       || !vmlibdata_is_type(data2, LIBSTR_STRING_TYPE, LIBSTR_STRING_TYPE_LEN)) {
+    if(!vmlibdata_is_typeid(data1, LIBSTR_STRING_TYPEID)
+       || !vmlibdata_is_typeid(data2, LIBSTR_STRING_TYPEID)) {
+      opstk_release(vm, &data1, type1, owned1);
+      opstk_release(vm, &data2, type2, owned2);
       vm_set_err(vm, VMERR_INVALID_TYPE_IN_OPERATION);
       return false;
     }    
 
     /* create result string LibData struct */
-    result = libstr_string_new(libstr_string_length(data1)
+    result = libstr_string_new(vm, libstr_string_length(data1)
 			       + libstr_string_length(data2));
     if(result == NULL) {
+      opstk_release(vm, &data1, type1, owned1);
+      opstk_release(vm, &data2, type2, owned2);
       vm_set_err(vm, VMERR_ALLOC_FAILED);
       return false;
     }
-    vmlibdata_inc_refcount(result);
 
     /* write strings to new string */
     libstr_string_append(result, libstr_string(data1), 
@@ -411,18 +525,17 @@ bool op_add(VM * vm,  char * byteCode,
     libstr_string_append(result, libstr_string(data2), 
 			 libstr_string_length(data2));
 
+    /* cleanup memory */
+    opstk_release(vm, &data1, type1, owned1);
+    opstk_release(vm, &data2, type2, owned2);
+
     /* push result to operand stack */
     if(!opstk_push(vm, &result, sizeof(VMLibData*), TYPE_LIBDATA)) {
+      vmlibdata_check_cleanup(vm, result);
       vm_set_err(vm, VMERR_ALLOC_FAILED);
       return false;
     }
 
-    /* cleanup memory */
-    vmlibdata_dec_refcount(data1);
-    vmlibdata_dec_refcount(data2);
-    vmlibdata_check_cleanup(vm, data1);
-    vmlibdata_check_cleanup(vm, data2);
-
     return true;
   } else if(type1 == TYPE_NUMBER && type2 == TYPE_NUMBER) {
     /* handle add operation: */
@@ -431,8 +544,8 @@ bool op_add(VM * vm,  char * byteCode,
     double value2;
 
     /* pop topmost two double values */
-    opstk_pop(vm, &value1, sizeof(double), &type1);
-    opstk_pop(vm, &value2, sizeof(double), &type2);
+    opstk_pop(vm, &value1, sizeof(double), &type1, NULL);
+    opstk_pop(vm, &value2, sizeof(double), &type2, NULL);
     
     value1 += value2;
     opstk_push(vm, &value1, sizeof(double), type1);
@@ -462,8 +575,8 @@ bool op_dual_operand_math(VM * vm,  char * byteCode,
     return false;
   }
 
-  opstk_pop(vm, &value2, sizeof(double), &type1);
-  opstk_pop(vm, &value1, sizeof(double), &type2);
+  opstk_pop(vm, &value2, sizeof(double), &type1, NULL);
+  opstk_pop(vm, &value1, sizeof(double), &type2, NULL);
     
   /* check that both operands are numbers..fail other types */
   if(type1 != TYPE_NUMBER || type2 != TYPE_NUMBER) {
@@ -521,8 +634,8 @@ bool op_dual_comparison(VM * vm,  char * byteCode,
     return false;
   }
 
-  opstk_pop(vm, &value2, sizeof(double), &type1);
-  opstk_pop(vm, &value1, sizeof(double), &type2);
+  opstk_pop(vm, &value2, sizeof(double), &type1, NULL);
+  opstk_pop(vm, &value1, sizeof(double), &type2, NULL);
     
   /* check data types */
   if(type1 != type2 || (type1 == TYPE_LIBDATA || type2 == TYPE_LIBDATA)
@@ -583,8 +696,8 @@ bool op_boolean_logic(VM * vm,  char * byteCode,
     return false;
   }
 
-  opstk_pop(vm, &value2, sizeof(bool), &type1);
-  opstk_pop(vm, &value1, sizeof(bool), &type2);
+  opstk_pop(vm, &value2, sizeof(bool), &type1, NULL);
+  opstk_pop(vm, &value1, sizeof(bool), &type2, NULL);
     
   /* check data types */
   if(type1 != TYPE_BOOLEAN || type2 != TYPE_BOOLEAN) {
@@ -657,15 +770,10 @@ bool op_pop(VM * vm,  char * byteCode,
     return false;
   }
 
-  opstk_pop(vm, &value, sizeof(char*), &type);
+  /* pop and release the value, freeing objects that are no longer used */
+  opstk_pop(vm, &value, sizeof(char*), &type, NULL);
   (*index)++;
 
-   /* free objects that were popped and passed */
-  if(type == TYPE_LIBDATA) {
-    vmlibdata_dec_refcount((VMLibData*)value);
-    vmlibdata_check_cleanup(vm, (VMLibData*)value);
-  }
-
   return true;
 }
 
@@ -750,7 +858,7 @@ bool op_str_push(VM * vm, char * byteCode,
   }
 
   /* create new string buffer */
-  string = libstr_string_new((int)strLen);
+  string = libstr_string_new(vm, (int)strLen);
   if(string == NULL) {
     vm_set_err(vm, VMERR_ALLOC_FAILED);
     return false;
@@ -758,8 +866,8 @@ bool op_str_push(VM * vm, char * byteCode,
 
   /* push new string */
   libstr_string_append(string, byteCode + *index, strLen);
-  vmlibdata_inc_refcount(string);
   if(!opstk_push(vm, &string, sizeof(VMLibData*), TYPE_LIBDATA)) {
+    vmlibdata_check_cleanup(vm, string);
     vm_set_err(vm, VMERR_ALLOC_FAILED);
     return false;
   }
@@ -784,7 +892,7 @@ bool op_not(VM * vm, char * byteCode,
     return false;
   }
   
-  opstk_pop(vm, &value, sizeof(bool), &type);
+  opstk_pop(vm, &value, sizeof(bool), &type, NULL);
 
   value = !value;
 
@@ -817,7 +925,7 @@ bool op_cond_goto(VM * vm, char * byteCode,
     return false;
   }
 
-  opstk_pop(vm, &value, sizeof(bool), &type);
+  opstk_pop(vm, &value, sizeof(bool), &type, NULL);
 
   (*index)++;
 
@@ -881,6 +989,47 @@ bool op_goto(VM * vm, char * byteCode,
   return true;
 }
 
+/**
+ * Runs a function stub, which the compiler writes in place of a function that
+ * it will compile on its first call. The VM's stub handler compiles the
+ * function and overwrites the stub with an OP_GOTO to the function's code,
+ * which runs next. The code may move when the function is appended to it, so
+ * byteCode and byteCodeLen are updated. See vm_set_stub_handler().
+ * OP_STUB [stub:sizeof(int)]
+ */
+bool op_stub(VM * vm, char ** byteCode, size_t * byteCodeLen, int * index) {
+  int stub;
+  int returnAddr;
+  int callIndex = -1;
+
+  /* check that there are enough bytes in byte code for the stub number */
+  if(!((*byteCodeLen - (*index + 1)) >= sizeof(int))) {
+    vm_set_err(vm, VMERR_UNEXPECTED_END_OF_OPCODES);
+    return false;
+  }
+
+  memcpy(&stub, *byteCode + *index + 1, sizeof(int));
+
+  /* the stub is the first instruction of the function, so the frame on top
+   * returns to the end of the OP_CALL_B that called it, if any
+   * OP_CALL_B [number_of_vars_and_args:1] [args:1] [function_address:sizeof(int)]
+   */
+  returnAddr = frmstk_ret_addr(vm->frmStk);
+  if(returnAddr != OP_NO_RETURN) {
+    callIndex = returnAddr - ((3 * sizeof(char)) + sizeof(int));
+  }
+
+  if(vm->stubHandler == NULL
+     || !vm->stubHandler(vm, vm->stubContext, stub, callIndex,
+			 byteCode, byteCodeLen)) {
+    vm_set_err(vm, VMERR_STUB_FAILED);
+    return false;
+  }
+
+  /* the index is unchanged, so the OP_GOTO that replaced the stub runs next */
+  return true;
+}
+
 /**
  * Calls the specified native function, using the specified number of values
  * from the top of the stack as arguments. callback_index is the index where
@@ -893,6 +1042,8 @@ bool op_call_ptr_n(VM * vm, char * byteCode,
   char numArgs = 0;
   int callbackIndex, i;
   VMArg args[VM_MAX_NARGS];
+  bool owned[VM_MAX_NARGS];
+  VMNative native;
   VMCallback callback;
 
   /* handle not enough bytes in bytecode error case */
@@ -932,27 +1083,33 @@ bool op_call_ptr_n(VM * vm, char * byteCode,
 
   /* create array of arguments */
   for(i = numArgs - 1; i >= 0; i--) {
-    opstk_pop(vm, &args[i].data, VM_VAR_SIZE, &args[i].type);
+    opstk_pop(vm, &args[i].data, VM_VAR_SIZE, &args[i].type, &owned[i]);
   }
 
-  /* call the callback function
-   * if returns false, no return value was given. push a null */
+  /* call the callback function, with its args' ownership for
+   * vm_native_arg_unique(), and its args rooted for the collector in case it
+   * runs script code. if returns false, no return value was given.
+   * push a null */
+  native.args = args;
+  native.owned = owned;
+  native.argc = numArgs;
+  native.caller = vm->native;
+  vm->native = &native;
   if(! ((*callback)(vm, args, numArgs)) ) {
     double value = 0;
     opstk_push(vm, &value, sizeof(double), TYPE_NULL);
   }
+  vm->native = native.caller;
+
+  /* release references held by owned arguments */
+  for(i = 0; i < numArgs; i++) {
+    opstk_release(vm, args[i].data, args[i].type, owned[i]);
+  }
 
   /* check for native function errors */
   if(vm->err != VMERR_SUCCESS) {
     return false;
   }
 
-  /* decrement any variable reference counters */
-  for(i = 0; i < numArgs; i++) {
-    if(args[i].type == TYPE_LIBDATA) {
-       vmlibdata_dec_refcount(vmarg_libdata(args[i]));
-       vmlibdata_check_cleanup(vm, vmarg_libdata(args[i]));
-    }
-  }
   return true;
 }
@@ -34,11 +34,6 @@
 /* max number of digits in a number value */
 #define  COMPILER_NUM_MAX_DIGITS   50
 
-/* TODO: make STK type auto enlarge and remove */
-static const int initialOpStkDepth = 100;
-/* number of items to add to the op stack on resize */
-static const int opStkBlockSize = 12;
-
 /* private function declarations */
 static bool parse_line(Compiler * c, Lexer * l, bool innerCall);
 bool parse_block(Compiler * c, Lexer * l);
@@ -102,7 +97,7 @@ static bool write_from_stack(Compiler * c, TypeStk * opStk,
     len = value.longVal;
 
     /* if there is an open parenthesis...  */
-    if(tokens_equal(LANG_OPARENTH, LANG_OPARENTH_LEN, token, len)) {
+    if(lang_keyword(token, len) == LANGKW_OPARENTH) {
 
       /* if top of stack is a parenthesis, it is a mismatch! */
       if(!parenthExpected) {
@@ -380,7 +375,7 @@ static bool parse_parenthesis(Compiler * c, TypeStk * opStk, Stk * opLenStk,
   /* handle open parenthesis:
    * push them onto the stack for order of operations handling
    */
-  if(tokens_equal(LANG_OPARENTH, LANG_OPARENTH_LEN, token, len)) {
+  if(lang_keyword(token, len) == LANGKW_OPARENTH) {
     typestk_push(opStk, &token, sizeof(char*), type);
     stk_push_long(opLenStk, len);
 
@@ -507,6 +502,12 @@ bool parse_straight_code_loop(Compiler * c, Lexer * l, TypeStk * opStk,
   char * token = lexer_current_token(l, &type, &len);
   int parenthDepth = 0;
 
+  /* no current token if the lexer failed, type is not set */
+  if(token == NULL) {
+    c->err = COMPILERERR_UNEXPECTED_TOKEN;
+    return false;
+  }
+
   /* straight code token parse loop */
   do {
 
@@ -562,7 +563,7 @@ bool parse_straight_code_loop(Compiler * c, Lexer * l, TypeStk * opStk,
        * set end parenthesis encountered 
        */
       if(parenthDepth < 0 && innerCall) {
-	if(tokens_equal(token, len, LANG_CPARENTH, LANG_CPARENTH_LEN) 
+	if(lexer_current_keyword(l) == LANGKW_CPARENTH 
 	   && parenthEncountered != NULL) {
 	  *parenthEncountered = true;
 	  return true;
@@ -647,12 +648,13 @@ bool parse_straight_code(Compiler * c, Lexer * l,
   /* TODO: return false for every sb_append* function upon failure */
   bool result;
 
-  /* allocate stacks for operators and their lengths, a.k.a. 
+  TypeStk * opStk;
+  Stk * opLenStk;
+
+  /* get stacks for operators and their lengths, a.k.a. 
    * the "side track in shunting yard" 
    */
-  TypeStk * opStk = typestk_new(initialOpStkDepth, opStkBlockSize);
-  Stk * opLenStk = stk_new(initialOpStkDepth);
-  if(opStk == NULL || opLenStk == NULL) {
+  if(!exprstks_push(c, &opStk, &opLenStk)) {
     c->err = COMPILERERR_ALLOC_FAILED;
     return false;
   }
@@ -665,9 +667,8 @@ bool parse_straight_code(Compiler * c, Lexer * l,
   result = parse_straight_code_loop(c, l, opStk, opLenStk, innerCall,
 				    parenthEncountered);
 
-  /* free stacks */
-  typestk_free(opStk);
-  stk_free(opLenStk);
+  /* empty stacks for the next expression */
+  exprstks_pop(c);
 
   return result;
 }
@@ -676,6 +677,7 @@ bool parse_straight_code(Compiler * c, Lexer * l,
  * Writes the function call op codes, telling VM to pop last 'arguments' number
  * of args off of stack to use as arguments to the function call.
  * c: compiler instance.
+ * l: lexer instance, for the line of the call.
  * functionName: the name of the function to look up and write the call for.
  * functionNameLen: the length of the function name in chars.
  * arguments: the number of arguments that this function accepts.
@@ -684,15 +686,16 @@ bool parse_straight_code(Compiler * c, Lexer * l,
  * result: returns true if success, and false if an error occurs. Upon error,
  * c->err receives the error code.
  */
-static bool function_call(Compiler * c, char * functionName, 
+static bool function_call(Compiler * c, Lexer * l, char * functionName, 
 			  size_t functionNameLen, int arguments, 
 			  bool * returnCall) {
 
   DSValue value;
   int callbackIndex;
+  int callbackSite;
 
   /* check if function is "return" pseudo-function */
-  if(tokens_equal(functionName, functionNameLen, LANG_RETURN, LANG_RETURN_LEN)) {
+  if(lang_keyword(functionName, functionNameLen) == LANGKW_RETURN) {
 
     /* make sure there is only one return value */
     if(arguments != 1) {
@@ -701,7 +704,10 @@ static bool function_call(Compiler * c, char * functionName,
     }
 
     /* TODO: pop multiple frames if current frame isn't a function frame */
-    /* return from current function to return value stored in stack frame */
+    /* return from current function to return value stored in stack frame.
+     * the frame's variables are released with values still on the stack.
+     */
+    borrowsites_discard(c);
     buffer_append_char(c->outBuffer, OP_FRM_POP);
     *returnCall = true;
     return true;
@@ -710,12 +716,20 @@ static bool function_call(Compiler * c, char * functionName,
   *returnCall = false;
 
   /* check if the function name is a C built-in function */
-  callbackIndex = vm_callback_index(c->vm, functionName, functionNameLen);
+  callbackIndex = vm_callback_lookup(c->vm, functionName, functionNameLen);
   if(callbackIndex != -1) {
 
-    /* function is native, write the OPCodes for native call */
+    /* function is native, write the OPCodes for native call and record where
+     * the callback index is so that it can be rebound if saved to a file
+     */
     buffer_append_char(c->outBuffer, OP_CALL_PTR_N);
     buffer_append_char(c->outBuffer, arguments);
+    callbackSite = buffer_size(c->outBuffer);
+    if(!buffer_append_string(c->nativeSites, (char*)&callbackSite,
+			     sizeof(int))) {
+      c->err = COMPILERERR_ALLOC_FAILED;
+      return false;
+    }
     buffer_append_string(c->outBuffer, (char*)(&callbackIndex), sizeof(int));
     return true;
 
@@ -734,11 +748,34 @@ static bool function_call(Compiler * c, char * functionName,
 	return false;
       }
 
-      /* function exists, lets write the OPCodes */
+      /* function exists, lets write the OPCodes. the callee may assign to
+       * variables whose values are on the stack, so nothing can be borrowed
+       */
+      borrowsites_discard(c);
       buffer_append_char(c->outBuffer, OP_CALL_B);
       buffer_append_char(c->outBuffer, funcDef->numArgs + funcDef->numVars);
       buffer_append_char(c->outBuffer, funcDef->numArgs);
+      if(!codesites_add(c, buffer_size(c->outBuffer))) {
+	c->err = COMPILERERR_ALLOC_FAILED;
+	return false;
+      }
       buffer_append_string(c->outBuffer, (char*)(&funcDef->index), sizeof(int));
+    } else if(c->callSites != NULL) {
+      int address = 0;
+
+      /* compilation unit: the function may be defined later, or in another
+       * unit. write a placeholder call for compiler_link() to resolve
+       */
+      borrowsites_discard(c);
+      if(!callsites_add(c, buffer_size(c->outBuffer), functionName,
+			functionNameLen, arguments, lexer_line_num(l))) {
+	c->err = COMPILERERR_ALLOC_FAILED;
+	return false;
+      }
+      buffer_append_char(c->outBuffer, OP_CALL_B);
+      buffer_append_char(c->outBuffer, 0);
+      buffer_append_char(c->outBuffer, arguments);
+      buffer_append_string(c->outBuffer, (char*)(&address), sizeof(int));
     } else {
       c->err = COMPILERERR_UNDEFINED_FUNCTION;
       return false;
@@ -763,7 +800,7 @@ static int parse_arguments(Compiler * c, Lexer * l, char * token,
   bool endOfArgs = false;
 
   /* check if this function has arguments */
-  if(!tokens_equal(token, len, LANG_CPARENTH, LANG_CPARENTH_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_CPARENTH) {
 
     /* loop through the arguments one by one */
     do {
@@ -803,14 +840,14 @@ static bool parse_while_statement(Compiler * c, Lexer * l) {
   token = lexer_current_token(l, &type, &len);
 
   /* check if this is an while statement */
-  if(!tokens_equal(token, len, LANG_WHILE, LANG_WHILE_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_WHILE) {
     return false;
   }
 
   token = lexer_next(l, &type, &len);
 
   /* check for an open parenthesis token */
-  if(!tokens_equal(token, len, LANG_OPARENTH, LANG_OPARENTH_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_OPARENTH) {
     c->err = COMPILERERR_MALFORMED_IFORLOOP;
     return false;
   }
@@ -832,8 +869,13 @@ static bool parse_while_statement(Compiler * c, Lexer * l) {
   /* fill jump instruction with placeholder bytes since we don't know the
    * end of the function address yet
    */
+  borrowsites_commit(c);
   buffer_append_char(c->outBuffer, OP_FCOND_GOTO);
   jumpInstAddr = buffer_size(c->outBuffer);
+  if(!codesites_add(c, jumpInstAddr)) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return true;
+  }
   buffer_append_string(c->outBuffer, (char*)(&address), sizeof(int));
 
   /* retrieve current token */
@@ -846,6 +888,10 @@ static bool parse_while_statement(Compiler * c, Lexer * l) {
 
   /* write jump to beginning of loop instruction */
   buffer_append_char(c->outBuffer, OP_GOTO);
+  if(!codesites_add(c, buffer_size(c->outBuffer))) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return true;
+  }
   buffer_append_string(c->outBuffer, (char*)(&beforeWhileAddr), sizeof(int));
 
   /* write jump to end of body address for while statement */
@@ -873,7 +919,7 @@ static bool parse_do_while_statement(Compiler * c, Lexer * l) {
   token = lexer_current_token(l, &type, &len);
 
   /* check if this is a do while statement */
-  if(!tokens_equal(token, len, LANG_DO, LANG_DO_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_DO) {
     return false;
   }
 
@@ -892,7 +938,7 @@ static bool parse_do_while_statement(Compiler * c, Lexer * l) {
   token = lexer_current_token(l, &type, &len);
 
   /* check for the while statement */
-  if(!tokens_equal(token, len, LANG_WHILE, LANG_WHILE_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_WHILE) {
     c->err =  COMPILERERR_MALFORMED_IFORLOOP;
     return true;
   }
@@ -900,7 +946,7 @@ static bool parse_do_while_statement(Compiler * c, Lexer * l) {
   token = lexer_next(l, &type, &len);
 
   /* check for an open parenthesis token */
-  if(!tokens_equal(token, len, LANG_OPARENTH, LANG_OPARENTH_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_OPARENTH) {
     c->err = COMPILERERR_MALFORMED_IFORLOOP;
     return false;
   }
@@ -920,11 +966,16 @@ static bool parse_do_while_statement(Compiler * c, Lexer * l) {
   }
 
   /* write the jump address */
+  borrowsites_commit(c);
   buffer_append_char(c->outBuffer, OP_TCOND_GOTO);
+  if(!codesites_add(c, buffer_size(c->outBuffer))) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return true;
+  }
   buffer_append_string(c->outBuffer, (char*)(&beforeDoAddr), sizeof(int));
 
   /* check for a ';' token */
-  if(!tokens_equal(token, len, LANG_ENDSTATEMENT, LANG_ENDSTATEMENT_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_ENDSTATEMENT) {
     c->err = COMPILERERR_EXPECTED_ENDSTATEMENT;
     return false;
   }
@@ -954,14 +1005,14 @@ static bool parse_if_statement(Compiler * c, Lexer * l) {
   token = lexer_current_token(l, &type, &len);
 
   /* check if this is an if statement */
-  if(!tokens_equal(token, len, LANG_IF, LANG_IF_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_IF) {
     return false;
   }
 
   token = lexer_next(l, &type, &len);
 
   /* check for an open parenthesis token */
-  if(!tokens_equal(token, len, LANG_OPARENTH, LANG_OPARENTH_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_OPARENTH) {
     c->err = COMPILERERR_MALFORMED_IFORLOOP;
     return true;
   }
@@ -980,8 +1031,13 @@ static bool parse_if_statement(Compiler * c, Lexer * l) {
   /* fill jump instruction with placeholder bytes since we don't know the
    * end of the function address yet
    */
+  borrowsites_commit(c);
   buffer_append_char(c->outBuffer, OP_FCOND_GOTO);
   ifJumpInstAddr = buffer_size(c->outBuffer);
+  if(!codesites_add(c, ifJumpInstAddr)) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return true;
+  }
   buffer_append_string(c->outBuffer, (char*)(&address), sizeof(int));
 
   /* retrieve current token */
@@ -995,7 +1051,7 @@ static bool parse_if_statement(Compiler * c, Lexer * l) {
   token = lexer_current_token(l, &type, &len);
 
   /* check if this if block has an else as well */
-  if(!tokens_equal(token, len, LANG_ELSE, LANG_ELSE_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_ELSE) {
     /* write jump address for if statement */
     address = buffer_size(c->outBuffer);
     buffer_set_string(c->outBuffer, (char*)&address, sizeof(int), ifJumpInstAddr);
@@ -1007,6 +1063,10 @@ static bool parse_if_statement(Compiler * c, Lexer * l) {
    */
   buffer_append_char(c->outBuffer, OP_GOTO);
   elseJumpInstAddr = buffer_size(c->outBuffer);
+  if(!codesites_add(c, elseJumpInstAddr)) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return true;
+  }
   buffer_append_string(c->outBuffer, (char*)(&address), sizeof(int));
 
   /* write jump address for if statement so that it is after the else jump */
@@ -1058,7 +1118,7 @@ static bool parse_function_call(Compiler * c, Lexer * l, bool * noPop) {
   token = lexer_peek(l, NULL, &len);
 
   /* check if peeked token is a parenth */
-  if(!tokens_equal(token, len,LANG_OPARENTH, LANG_OPARENTH_LEN)) {
+  if(lexer_peek_keyword(l) != LANGKW_OPARENTH) {
     return false;
   }
 
@@ -1072,7 +1132,7 @@ static bool parse_function_call(Compiler * c, Lexer * l, bool * noPop) {
   argCount = parse_arguments(c, l, token, type, len);
 
   /* writes a call to the specified function, or returns if error */
-  function_call(c, functionToken, functionTokenLen, argCount, noPop);
+  function_call(c, l, functionToken, functionTokenLen, argCount, noPop);
 
   return true;
 }
@@ -1089,21 +1149,21 @@ static bool parse_function_call(Compiler * c, Lexer * l, bool * noPop) {
 static bool assignment(Compiler * c, Lexer * l, char * variable, 
 		       size_t variableLen) {
 
-  DSValue value;
+  int varIndex;
   char i = 0;
-  HT * ht = symtblstk_peek(c, i);
+  SymTbl * symTbl = symtblstk_peek(c, i);
 
   /* get variable depth */
-  for(i = 0; true; i++, ht = symtblstk_peek(c, i)) {
+  for(i = 0; true; i++, symTbl = symtblstk_peek(c, i)) {
 
     /* reached bottom of stack, variable not found */
-    if(ht == NULL) {
+    if(symTbl == NULL) {
       c->err = COMPILERERR_UNDEFINED_VARIABLE;
       return false;
     }
 
     /* found variable in this stack, stop iterating */
-    if(ht_get_raw_key(ht, variable, variableLen, &value)) {
+    if(symtbl_get(symTbl, variable, variableLen, &varIndex)) {
       break;
     }
   }
@@ -1113,7 +1173,7 @@ static bool assignment(Compiler * c, Lexer * l, char * variable,
    * storage slot in the frame stack. */
   buffer_append_char(c->outBuffer, OP_VAR_STOR);
   buffer_append_char(c->outBuffer, i);
-  buffer_append_char(c->outBuffer, value.intVal);
+  buffer_append_char(c->outBuffer, varIndex);
 
   return true;
 }
@@ -1127,26 +1187,23 @@ static bool assignment(Compiler * c, Lexer * l, char * variable,
  * c->err is set.
  */
 static bool parse_assignment_statement(Compiler * c, Lexer * l) {
-  char * token;
   size_t len;
   LexerType type;
 
   char * varToken;
   size_t varTokenLen;
+  int outerSites;
 
   /* get the current token */
-  token = lexer_current_token(l, &type, &len);
+  lexer_current_token(l, &type, &len);
 
   /* check if first token is a keyvar */
   if(type != LEXERTYPE_KEYVAR) {
     return false;
   }
 
-   /* peek ahead one token */
-  token = lexer_peek(l, NULL, &len);
-
   /* check if peeked token is an assignment statement */
-  if(!tokens_equal(token, len, LANG_OP_ASSIGN, LANG_OP_ASSIGN_LEN)) {
+  if(lexer_peek_keyword(l) != LANGKW_OP_ASSIGN) {
     return false;
   }
 
@@ -1154,16 +1211,25 @@ static bool parse_assignment_statement(Compiler * c, Lexer * l) {
   varToken = lexer_current_token(l, NULL, &varTokenLen);
 
   /* skip to the value tokens */
-  token = lexer_next(l, &type, &len);
-  token = lexer_next(l, &type, &len);
+  lexer_next(l, &type, &len);
+  lexer_next(l, &type, &len);
 
   /* do line of code following '=" */
+  outerSites = borrowsites_size(c);
   if(!parse_straight_code(c, l, false, NULL)) {
     return true;
   }
 
+  /* values pushed before this assignment began, e.g. earlier arguments of a
+   * call, may be read from the variable that is about to be overwritten
+   */
+  if(outerSites > 0) {
+    borrowsites_discard(c);
+  }
+
   /* do assignment...return if fails..but we're already done, return anyways */
   assignment(c, l, varToken, varTokenLen);
+  borrowsites_commit(c);
   buffer_append_char(c->outBuffer, OP_POP);
   return true;
 }
@@ -1180,22 +1246,22 @@ static bool parse_assignment_statement(Compiler * c, Lexer * l) {
 static bool reference(Compiler * c, Lexer * l, 
 		      char * variable, size_t variableLen) {
 
-  DSValue value;
+  int varIndex;
   char i = 0;
   char varSlot;
-  HT * ht = symtblstk_peek(c, i);
+  SymTbl * symTbl = symtblstk_peek(c, i);
 
   /* get variable depth */
-  for(i = 0; true; i++, ht = symtblstk_peek(c, i)) {
+  for(i = 0; true; i++, symTbl = symtblstk_peek(c, i)) {
 
     /* reached bottom of stack, variable not found */
-    if(ht == NULL) {
+    if(symTbl == NULL) {
       c->err = COMPILERERR_UNDEFINED_VARIABLE;
       return false;
     }
 
     /* found variable in this stack, stop iterating */
-    if(ht_get_raw_key(ht, variable, variableLen, &value)) {
+    if(symtbl_get(symTbl, variable, variableLen, &varIndex)) {
       break;
     }
   }
@@ -1205,8 +1271,13 @@ static bool reference(Compiler * c, Lexer * l,
    * stack in the VM to the VM OP stack.
    */
   /* TODO: need to add ability to search LOWER frames for variables */
-  varSlot = value.intVal;
+  varSlot = varIndex;
 
+  /* record the push so it can become a borrow if the value is consumed safely */
+  if(!borrowsites_add(c, buffer_size(c->outBuffer))) {
+    c->err = COMPILERERR_ALLOC_FAILED;
+    return false;
+  }
   buffer_append_char(c->outBuffer, OP_VAR_PUSH);
   buffer_append_char(c->outBuffer, i);
   buffer_append_char(c->outBuffer, varSlot);
@@ -1222,28 +1293,24 @@ static bool reference(Compiler * c, Lexer * l,
  */
 static bool parse_static_constant(Compiler * c, Lexer * l) {
 
-  char * token;
   size_t len;
   LexerType type;
 
-  /* get current token */
-  token = lexer_current_token(l, &type, &len);
-
   /* check if current token is one of the possible static constants */
-  if(tokens_equal(token, len, LANG_TRUE, LANG_TRUE_LEN)) {
+  if(lexer_current_keyword(l) == LANGKW_TRUE) {
     buffer_append_char(c->outBuffer, OP_BOOL_PUSH);
     buffer_append_char(c->outBuffer, true);
-  } else if(tokens_equal(token, len, LANG_FALSE, LANG_FALSE_LEN)) {
+  } else if(lexer_current_keyword(l) == LANGKW_FALSE) {
     buffer_append_char(c->outBuffer, OP_BOOL_PUSH);
     buffer_append_char(c->outBuffer, false);
-  } else if(tokens_equal(token, len, LANG_NULL, LANG_NULL_LEN)) {
+  } else if(lexer_current_keyword(l) == LANGKW_NULL) {
     buffer_append_char(c->outBuffer, OP_NULL_PUSH);
   } else {
     return false;
   }
 
   /* advance token */
-  token = lexer_next(l, &type, &len);
+  lexer_next(l, &type, &len);
 
   return true;
 }
@@ -1267,8 +1334,8 @@ static bool parse_variable_reference(Compiler * c, Lexer * l) {
   token = lexer_peek(l, NULL, &len);
 
   /* make sure this is not an assignment statement or function call */
-  if(tokens_equal(token, len, LANG_OP_ASSIGN, LANG_OP_ASSIGN_LEN)
-     || tokens_equal(token, len, LANG_OPARENTH, LANG_OPARENTH_LEN)) {
+  if(lexer_peek_keyword(l) == LANGKW_OP_ASSIGN
+     || lexer_peek_keyword(l) == LANGKW_OPARENTH) {
     return false;
   }
 
@@ -1327,6 +1394,7 @@ static bool parse_line(Compiler * c, Lexer * l, bool innerCall) {
   /* if noPop is false (this line is NOT a return value): */
   if(!noPop && !innerCall) {
     /* pop line return value off of stack */
+    borrowsites_commit(c);
     buffer_append_char(c->outBuffer, OP_POP);
   }
   return true;
@@ -1354,20 +1422,15 @@ static bool define_variable(Compiler * c, Lexer * l) {
    *
    * var [variable_name];
    */
-  HT * symTbl = symtblstk_peek(c, 0);
+  SymTbl * symTbl = symtblstk_peek(c, 0);
   LexerType type;
-  char * token;
   size_t len;
   char * varName;
   size_t varNameLen;
   bool prevExisted;
-  DSValue newValue;
-
-  /* get current token cached in the lexer */
-  token = lexer_current_token(l, &type, &len);
 
   /* make sure next token is a variable decl. keyword, otherwise, return */
-  if(!tokens_equal(LANG_VAR_DECL, LANG_VAR_DECL_LEN, token, len)) {
+  if(lexer_current_keyword(l) != LANGKW_VAR_DECL) {
     return false;
   }
 
@@ -1381,9 +1444,7 @@ static bool define_variable(Compiler * c, Lexer * l) {
   /* store variable along with index at which its data will be stored in the
    * frame stack in the virtual machine
    */
-  newValue.intVal = ht_size(symTbl);
-  if(!ht_put_raw_key(symTbl, varName, varNameLen,
-		     &newValue, NULL, &prevExisted)) {
+  if(!symtbl_put(c, symTbl, varName, varNameLen, &prevExisted)) {
     c->err = COMPILERERR_ALLOC_FAILED;
     return true;
   }
@@ -1401,13 +1462,13 @@ static bool define_variable(Compiler * c, Lexer * l) {
     return false;
     }*/
 
-  token = lexer_next(l, &type, &len);
+  lexer_next(l, &type, &len);
   /* check for terminating semicolon */
   if(type != LEXERTYPE_ENDSTATEMENT) {
     c->err = COMPILERERR_EXPECTED_ENDSTATEMENT;
     return false;
   }
-  token = lexer_next(l, &type, &len);
+  lexer_next(l, &type, &len);
 
   return true;
 }
@@ -1508,23 +1569,15 @@ bool parse_body_statement(Compiler * c, Lexer * l) {
  * an error, c->err is set to a relevant error code.
  */
 bool parse_body(Compiler * c, Lexer * l) {
-  LexerType type;
-  char * token;
-  size_t len;
-
-  token = lexer_current_token(l, &type, &len);
 
   /* keep executing lines of code until we hit a '}' */
-  while(!tokens_equal(token, len, LANG_CBRACKET, LANG_CBRACKET_LEN)) {
+  while(lexer_current_keyword(l) != LANGKW_CBRACKET) {
     if(!parse_body_statement(c, l)) {
       return false;
     }
-    token = lexer_current_token(l, &type, &len);
   }
 
   /* TODO: throw error if method doesn't end with curly brace */
-  token = lexer_current_token(l, &type, &len);
- 
   return true;
 }
 
@@ -1537,22 +1590,18 @@ bool parse_body(Compiler * c, Lexer * l) {
  * start of a block. c->err is set on an error.
  */
 bool parse_block(Compiler * c, Lexer * l) {
-  char * token;
   size_t len;
   LexerType type;
   int varCount = 0;
   int varCountAddr = 0;
 
-  /* get current token */
-  token = lexer_current_token(l, &type, &len);
-
   /* check if this is a block */
-  if(!tokens_equal(token, len, LANG_OBRACKET, LANG_OBRACKET_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_OBRACKET) {
     return false;
   }
 
   /* get next token */
-  token = lexer_next(l, &type, &len);
+  lexer_next(l, &type, &len);
 
   /* we're going down a level. push new symbol table to stack */
   if(!symtblstk_push(c)) {
@@ -1581,20 +1630,18 @@ bool parse_block(Compiler * c, Lexer * l) {
     return true;
   }
 
-  /* retrieve next token (it was modified by define_variables and parse_body */
-  token = lexer_current_token(l, &type, &len);
-
   /* check for closing brace defining end of block "}" */
-  if(!tokens_equal(token, len, LANG_CBRACKET, LANG_CBRACKET_LEN)) {
+  if(lexer_current_keyword(l) != LANGKW_CBRACKET) {
     c->err = COMPILERERR_EXPECTED_CBRACKET;
     return true;
   }
 
   /* pop block frame */
+  borrowsites_discard(c);
   buffer_append_char(c->outBuffer, OP_FRM_POP);
 
   /* we're done here! pop the symbol table for this block off the stack. */
-  ht_free(symtblstk_pop(c));
+  symtblstk_pop(c);
 
   lexer_next(l, &type, &len);
   return true;
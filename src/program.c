@@ -0,0 +1,307 @@
+/**
+ * program.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * A Program is a snapshot of compiled code that many threads can run at
+ * once: a copy of the bytecode, the function table, and the native bindings
+ * that the code's OP_CALL_PTR_N instructions index. Nothing in it changes
+ * after it is created, so threads read it without locks. Each thread runs it
+ * with its own ExecContext, see execcontext.c, which holds the stacks and
+ * error state that a VM would otherwise share.
+ *
+ * Programs are reference counted with atomic operations. Every ExecContext
+ * holds a reference, so a program stays alive until the last context that
+ * runs it is freed, even if the host has already dropped it, e.g. after
+ * rebuilding the scripts and making a new one.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <assert.h>
+#include "program.h"
+
+/* size of the blocks that function names are allocated from */
+static const int arenaBlockSize = 4 * 1024;
+
+/* allocations are never empty, even for a program without code or natives */
+#define PROGRAM_ALLOC_COUNT(n)    ((n) > 0 ? (n) : 1)
+
+/**
+ * Frees a program and everything it owns.
+ * program: the program.
+ */
+static void program_free(Program * program) {
+
+  if(program->functionHT != NULL) {
+    ht_free(program->functionHT);
+  }
+
+  if(program->arena != NULL) {
+    gsarena_free(program->arena);
+  }
+
+  if(program->funcs != NULL) {
+    gsalloc_free(program->allocator, program->funcs,
+		 program->funcsSize * sizeof(CompilerFunc));
+  }
+
+  if(program->callbacks != NULL) {
+    gsalloc_free(program->allocator, program->callbacks,
+		 PROGRAM_ALLOC_COUNT(program->numCallbacks)
+		 * sizeof(VMCallback));
+  }
+
+  if(program->byteCode != NULL) {
+    gsalloc_free(program->allocator, program->byteCode,
+		 PROGRAM_ALLOC_COUNT(program->byteCodeLen));
+  }
+
+  gsalloc_free(program->allocator, program, sizeof(Program));
+}
+
+/**
+ * Creates a program with a copy of some bytecode and of a VM's natives, and
+ * room for its functions, which must then be added with program_add().
+ * vm: the VM that the code was compiled against.
+ * byteCode: the bytecode.
+ * byteCodeLen: the length of byteCode.
+ * numFuncs: the number of functions that will be added.
+ * allocator: the allocator for the program, which must be thread safe if the
+ * program may be released on another thread.
+ * returns: the program, with a reference count of 1, or NULL if allocation
+ * fails.
+ */
+static Program * program_new(VM * vm, char * byteCode, size_t byteCodeLen,
+			     int numFuncs, GSAllocator * allocator) {
+  Program * program;
+  int i;
+
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  program = gsalloc_calloc(allocator, 1, sizeof(Program));
+  if(program == NULL) {
+    return NULL;
+  }
+  program->allocator = allocator;
+  program->refCount = 1;
+
+  /* copy the code, the funcs array is filled in by program_add() */
+  program->byteCodeLen = byteCodeLen;
+  program->byteCode = gsalloc_malloc(allocator,
+				     PROGRAM_ALLOC_COUNT(byteCodeLen));
+  program->funcsSize = PROGRAM_ALLOC_COUNT(numFuncs);
+  program->funcs = gsalloc_calloc(allocator, program->funcsSize,
+				  sizeof(CompilerFunc));
+  program->functionHT = ht_new(COMPILER_INITIAL_HTSIZE, COMPILER_HTBLOCKSIZE,
+			       COMPILER_HTLOADFACTOR);
+  program->arena = gsarena_new(arenaBlockSize, allocator);
+  if(program->byteCode == NULL
+     || program->funcs == NULL
+     || program->functionHT == NULL
+     || program->arena == NULL) {
+    program_free(program);
+    return NULL;
+  }
+  memcpy(program->byteCode, byteCode, byteCodeLen);
+
+  /* copy the native bindings, code indexes them by registration order */
+  program->numCallbacks = vm_num_callbacks(vm);
+  program->callbacks = gsalloc_calloc(allocator,
+				      PROGRAM_ALLOC_COUNT(program->numCallbacks),
+				      sizeof(VMCallback));
+  if(program->callbacks == NULL) {
+    program_free(program);
+    return NULL;
+  }
+  for(i = 0; i < program->numCallbacks; i++) {
+    program->callbacks[i] = vm_callback_from_index(vm, i);
+  }
+
+  return program;
+}
+
+/**
+ * Adds a function to a program that is being created.
+ * program: the program.
+ * cf: the function. Its name is copied.
+ * returns: true if success, false if allocation fails.
+ */
+static bool program_add(Program * program, CompilerFunc * cf) {
+  CompilerFunc * copy = &program->funcs[program->numFuncs];
+  size_t nameLen = strlen(cf->name);
+  DSValue value;
+  bool prevValue;
+
+  assert(program->numFuncs < program->funcsSize);
+
+  *copy = *cf;
+  copy->name = gsarena_alloc(program->arena, nameLen + 1);
+  if(copy->name == NULL) {
+    return false;
+  }
+  memcpy(copy->name, cf->name, nameLen + 1);
+
+  value.pointerVal = copy;
+  if(!ht_put_raw_key(program->functionHT, copy->name, nameLen,
+		     &value, NULL, &prevValue)) {
+    return false;
+  }
+
+  program->numFuncs++;
+  return true;
+}
+
+/**
+ * Creates a program from the scripts built by a compiler. Functions that
+ * lazy mode hasn't compiled yet are compiled first, because the program
+ * can't compile them when they're called.
+ * compiler: a compiler that has built its scripts without errors.
+ * vm: the compiler's VM, whose natives the program binds.
+ * allocator: the allocator for the program, thread safe if it may be
+ * released on another thread, or NULL for the default allocator.
+ * returns: a program with a reference count of 1, or NULL if a function
+ * fails to compile, in which case the compiler's error is set, or if
+ * allocation fails.
+ */
+Program * program_from_compiler(Compiler * compiler, VM * vm,
+				GSAllocator * allocator) {
+  Program * program;
+  HTIter iter;
+
+  assert(compiler != NULL);
+  assert(vm != NULL);
+
+  if(!compiler_compile_stubs(compiler)
+     || compiler_bytecode(compiler) == NULL) {
+    return NULL;
+  }
+
+  program = program_new(vm, compiler_bytecode(compiler),
+			compiler_bytecode_size(compiler),
+			ht_size(compiler->functionHT), allocator);
+  if(program == NULL) {
+    return NULL;
+  }
+
+  ht_iter_get(compiler->functionHT, &iter);
+  while(ht_iter_has_next(&iter)) {
+    DSValue value;
+
+    ht_iter_next(&iter, NULL, 0, &value, NULL, false);
+    if(!program_add(program, value.pointerVal)) {
+      program_free(program);
+      return NULL;
+    }
+  }
+
+  return program;
+}
+
+/**
+ * Creates a program from a loaded .gxc file. The file can be freed
+ * afterwards.
+ * file: a complete program loaded with gxcfile_load().
+ * vm: the VM that the file was loaded into, whose natives the program binds.
+ * allocator: the allocator for the program, thread safe if it may be
+ * released on another thread, or NULL for the default allocator.
+ * returns: a program with a reference count of 1, or NULL if allocation
+ * fails.
+ */
+Program * program_from_gxcfile(GXCFile * file, VM * vm,
+			       GSAllocator * allocator) {
+  Program * program;
+  int i;
+
+  assert(file != NULL);
+  assert(vm != NULL);
+  assert(gxcfile_code_base(file) == 0);
+
+  program = program_new(vm, gxcfile_bytecode(file),
+			gxcfile_bytecode_size(file),
+			gxcfile_num_functions(file), allocator);
+  if(program == NULL) {
+    return NULL;
+  }
+
+  for(i = 0; i < gxcfile_num_functions(file); i++) {
+    if(!program_add(program, gxcfile_function_at(file, i))) {
+      program_free(program);
+      return NULL;
+    }
+  }
+
+  return program;
+}
+
+/**
+ * Adds a reference to a program. May be called from any thread.
+ * program: the program.
+ * returns: program.
+ */
+Program * program_retain(Program * program) {
+  assert(program != NULL);
+
+  __sync_add_and_fetch(&program->refCount, 1);
+  return program;
+}
+
+/**
+ * Drops a reference to a program, and frees it if it was the last. May be
+ * called from any thread.
+ * program: the program.
+ */
+void program_release(Program * program) {
+  assert(program != NULL);
+
+  if(__sync_sub_and_fetch(&program->refCount, 1) == 0) {
+    program_free(program);
+  }
+}
+
+/**
+ * Gets an exported function of a program. Only reads the program, so any
+ * number of threads may call it at once.
+ * program: the program.
+ * name: the name of the function.
+ * len: the length of name.
+ * returns: the function, or NULL if it doesn't exist or wasn't exported.
+ * It lives as long as the program.
+ */
+CompilerFunc * program_function(Program * program, char * name, size_t len) {
+  DSValue value;
+  CompilerFunc * cf;
+
+  assert(program != NULL);
+  assert(name != NULL);
+  assert(len > 0);
+
+  if(!ht_get_raw_key(program->functionHT, name, len, &value)) {
+    return NULL;
+  }
+  cf = value.pointerVal;
+
+  /* make sure function was declared with exported keyword */
+  if(!cf->exported) {
+    return NULL;
+  }
+
+  return cf;
+}
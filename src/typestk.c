@@ -30,9 +30,11 @@
  * initialDepth: how many indicies deep do you want the stack to be.
  * blockSize: the number of spaces that will be added each time the
  * stack overflows. If zero, stack will not expand.
+ * allocator: the allocator to use, or NULL for the default.
  * returns: A new stack object, or NULL if unable to allocate.
  */
-TypeStk * typestk_new(int initialDepth, int blockSize) {
+TypeStk * typestk_new(int initialDepth, int blockSize,
+		      GSAllocator * allocator) {
 
   assert(initialDepth >= 0);
   assert(blockSize >= 0);
@@ -41,20 +43,22 @@ TypeStk * typestk_new(int initialDepth, int blockSize) {
   if(initialDepth >= 0) {
 
     /* allocate stack object */
-    TypeStk * newList = (TypeStk*)calloc(1, sizeof(TypeStk));
+    TypeStk * newList = (TypeStk*)gsalloc_calloc(allocator, 1,
+						 sizeof(TypeStk));
     if(newList != NULL) {
       newList->size = 0;
       newList->depth = initialDepth;
       newList->blockSize = blockSize;
+      newList->allocator = allocator;
 
       /* allocate mem for items */
-      newList->stack = (TypeStkData*)calloc(newList->depth,
-					     sizeof(TypeStkData));
+      newList->stack = (TypeStkData*)gsalloc_calloc(allocator, newList->depth,
+						    sizeof(TypeStkData));
       /* check for successful alloc */
       if(newList->stack != NULL) {
 	return newList;
       } else {
-	free(newList);
+	gsalloc_free(allocator, newList, sizeof(TypeStk));
       }
     }
   }
@@ -73,8 +77,9 @@ void typestk_free(TypeStk * stack) {
   assert(stack != NULL);
   assert(stack->stack != NULL);
 
-  free(stack->stack);
-  free(stack);
+  gsalloc_free(stack->allocator, stack->stack,
+	       stack->depth * sizeof(TypeStkData));
+  gsalloc_free(stack->allocator, stack, sizeof(TypeStk));
 }
 
 /**
@@ -85,12 +90,12 @@ void typestk_free(TypeStk * stack) {
  * fails.
  */
 static bool resize_stack(TypeStk * stack, int newSize) {
-  TypeStkData * newBuffer = calloc(newSize, sizeof(TypeStkData));
+  TypeStkData * newBuffer = gsalloc_realloc(stack->allocator, stack->stack,
+					    stack->depth * sizeof(TypeStkData),
+					    newSize * sizeof(TypeStkData));
   
-  /* copy data to new buffer, free old one, and swap pointers */
+  /* swap pointers to resized buffer */
   if(newBuffer != NULL) {
-    memcpy(newBuffer, stack->stack, sizeof(TypeStkData) * stack->size);
-    free(stack->stack);
     stack->stack = newBuffer;
     stack->depth = newSize;
 
@@ -147,6 +152,7 @@ bool typestk_push(TypeStk * stack, void * data, size_t dataSize, VarType type) {
   if((stack->size < stack->depth) 
      && dataSize > 0 && dataSize <= VM_VAR_SIZE) {
     stack->stack[stack->size].type = type;
+    stack->stack[stack->size].borrowed = false;
     memcpy(stack->stack[stack->size].data, data, dataSize);
     stack->size++;
     return true;
@@ -157,6 +163,41 @@ bool typestk_push(TypeStk * stack, void * data, size_t dataSize, VarType type) {
   }
 }
 
+/**
+ * Pushes a value onto the stack and flags it as borrowed. The stack itself
+ * does not interpret the flag. The VM uses it to mark operands that do not own
+ * a reference to their object. See ophandlers.c.
+ * stack: an instance of TypeStk.
+ * data: the data to put in the stack.
+ * dataSize: the number of bytes to copy to the stack. This must be greater than
+ * 0 and less than VM_VAR_SIZE.
+ * type: a one byte value that can be used to specify the type of the value.
+ * returns: true if the operation succeeds and false if stack is full or alloc
+ * fails.
+ */
+bool typestk_push_borrowed(TypeStk * stack, void * data,
+			   size_t dataSize, VarType type) {
+  if(!typestk_push(stack, data, dataSize, type)) {
+    return false;
+  }
+
+  stack->stack[stack->size - 1].borrowed = true;
+  return true;
+}
+
+/**
+ * Checks if the value at the top of the stack was pushed with
+ * typestk_push_borrowed().
+ * stack: an instance of TypeStk.
+ * returns: true if the top value is borrowed, false if not or if the stack is
+ * empty.
+ */
+bool typestk_top_borrowed(TypeStk * stack) {
+  assert(stack != NULL);
+
+  return stack->size > 0 && stack->stack[stack->size - 1].borrowed;
+}
+
 /**
  * Gets the value at the top of the stack without popping it off.
  * stack: an instance of TypeStk.
@@ -231,3 +272,14 @@ int typestk_size(TypeStk * stack) {
 
   return stack->size;
 }
+
+/**
+ * Removes all items from the stack without releasing its memory, so that it
+ * can be reused. Like typestk_free(), this doesn't free any pointers in it.
+ * stack: an instance of stack.
+ */
+void typestk_clear(TypeStk * stack) {
+  assert(stack != NULL);
+
+  stack->size = 0;
+}
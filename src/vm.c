@@ -41,70 +41,527 @@
 #include "gsbool.h"
 #include "libstr.h"
 #include "ophandlers.h"
+#include "vmgc.h"
 #include <stdint.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
 
 /* the initial size of the op stack */
 static const int opStkInitSize = 60;
 /* the number of bytes in size the op stack increases in each expansion */
 static const int opStkBlockSize = 60;
+/* the initial size of a coroutine's op stack, small since there are many */
+static const int coroOpStkInitSize = 8;
+/* the most backward jumps and calls between clock reads, with a time limit */
+static const int deadlineCheckInterval = 256;
+
+/* table of registered LIBDATA type names, indexed by VMLibDataType. The
+ * string type is preregistered so that the VM can use it without libstr
+ * having been installed. Types are registered at library install time, from
+ * any thread, and a name is never changed once its ID is published.
+ */
+static char libDataTypes[VM_LIBDATA_MAXTYPES][VM_LIBDATA_TYPELEN + 1] = {
+  LIBSTR_STRING_TYPE
+};
+/* the number of types in the libDataTypes table. stored with release and
+ * loaded with acquire, so that a reader sees the names that it counts
+ */
+static int numLibDataTypes = 1;
+/* serializes vmlibdata_type_register() appends */
+static pthread_mutex_t libDataTypesLock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
- * Initializes a VM with a preallocated maximum frame stack that is stackSize
- * bytes in size and can have up to callbacksSize callbacks registered to it.
+ * Accounting alloc: fails allocations that would exceed the VM's memory limit
+ * and otherwise forwards them to the host allocator.
+ * context: the VM instance.
+ * size: the number of bytes to allocate.
+ * returns: the new block, or NULL if over the limit or the alloc fails.
+ */
+static void * vm_account_alloc(void * context, size_t size) {
+  VM * vm = context;
+  void * ptr;
+
+  /* the flag describes only the latest allocation, see vm_set_err() */
+  vm->memLimitHit = false;
+
+  /* refuse allocation before it reaches malloc if over budget, unless the
+   * collector can free enough garbage first
+   */
+  if(vm->memLimit != 0 && size > vm->memLimit - vm->memUsed
+     && !(vm->memMode == VMMEM_GC && vmgc_reclaim(vm, size))) {
+    vm->memLimitHit = true;
+    return NULL;
+  }
+
+  ptr = vm->baseAllocator->alloc(vm->baseAllocator->context, size);
+  if(ptr != NULL) {
+    vm->memUsed += size;
+    if(vm->memUsed > vm->memPeak) {
+      vm->memPeak = vm->memUsed;
+    }
+    if(vm->memMode == VMMEM_GC) {
+      vmgc_account(vm, size);
+    }
+  }
+
+  return ptr;
+}
+
+/**
+ * Accounting realloc: only growth counts against the memory limit.
+ * context: the VM instance.
+ * ptr: the block to resize.
+ * oldSize: the current size of the block in bytes.
+ * newSize: the requested size of the block in bytes.
+ * returns: the resized block, or NULL if over the limit or the alloc fails.
+ */
+static void * vm_account_realloc(void * context, void * ptr,
+				 size_t oldSize, size_t newSize) {
+  VM * vm = context;
+  void * newPtr;
+
+  vm->memLimitHit = false;
+
+  /* refuse growth before it reaches realloc if over budget */
+  if(newSize > oldSize && vm->memLimit != 0
+     && newSize - oldSize > vm->memLimit - vm->memUsed
+     && !(vm->memMode == VMMEM_GC && vmgc_reclaim(vm, newSize - oldSize))) {
+    vm->memLimitHit = true;
+    return NULL;
+  }
+
+  newPtr = vm->baseAllocator->realloc(vm->baseAllocator->context,
+				      ptr, oldSize, newSize);
+  if(newPtr != NULL) {
+    vm->memUsed = vm->memUsed - oldSize + newSize;
+    if(vm->memUsed > vm->memPeak) {
+      vm->memPeak = vm->memUsed;
+    }
+    if(vm->memMode == VMMEM_GC && newSize > oldSize) {
+      vmgc_account(vm, newSize - oldSize);
+    }
+  }
+
+  return newPtr;
+}
+
+/**
+ * Accounting free: returns the block's bytes to the VM's budget.
+ * context: the VM instance.
+ * ptr: the block to free.
+ * size: the size the block was allocated with.
+ */
+static void vm_account_free(void * context, void * ptr, size_t size) {
+  VM * vm = context;
+
+  vm->memUsed -= size;
+  vm->baseAllocator->free(vm->baseAllocator->context, ptr, size);
+}
+
+/**
+ * Allocates a VM and its stacks, without a callbacks table.
  * stackSize: size of the frame stack in bytes.
- * callbacksSize: the maximum number of callbacks that may be registered.
+ * allocator: the host allocator, or NULL for the default allocator.
+ * memMode: how VMLibData objects are freed.
  * returns: a new VM instance, or NULL if allocation fails.
  */
-VM * vm_new(size_t stackSize, int callbacksSize) {
+static VM * vm_alloc(size_t stackSize, GSAllocator * allocator,
+		     VMMemMode memMode) {
 
-  assert(stackSize > 0);
-  assert(callbacksSize > 0);
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
 
-  VM * vm = calloc(1, sizeof(VM));
+  VM * vm = gsalloc_calloc(allocator, 1, sizeof(VM));
 
   if(vm == NULL) {
     return NULL;
   }
 
-  vm->frmStk = frmstk_new(stackSize);
+  /* route everything but the VM struct itself through the accountant */
+  vm->baseAllocator = allocator;
+  vm->accountant.alloc = vm_account_alloc;
+  vm->accountant.realloc = vm_account_realloc;
+  vm->accountant.free = vm_account_free;
+  vm->accountant.context = vm;
+  vm->allocator = &vm->accountant;
+  allocator = vm->allocator;
+
+  vm->memMode = memMode;
+  vm->gcThreshold = VMGC_INITIAL_THRESHOLD;
+  vm->gcByteThreshold = VMGC_INITIAL_BYTES;
+
+  vm->frmStk = frmstk_new(stackSize, allocator);
   if(vm->frmStk == NULL) {
-    free(vm);
+    gsalloc_free(vm->baseAllocator, vm, sizeof(VM));
     return NULL;
   }
 
-  vm->opStk = typestk_new(opStkInitSize, opStkBlockSize);
+  vm->opStk = typestk_new(opStkInitSize, opStkBlockSize, allocator);
   if(vm->opStk == NULL) {
     frmstk_free(vm->frmStk);
-    free(vm);
+    gsalloc_free(vm->baseAllocator, vm, sizeof(VM));
     return NULL;
   }
 
-  vm->callbacksSize = callbacksSize;
+  return vm;
+}
 
-  vm->callbacks = calloc(vm->callbacksSize, sizeof(VMCallback));
-  if(vm->callbacks == NULL) {
-    typestk_free(vm->opStk);
-    frmstk_free(vm->frmStk);
-    free(vm);
+/**
+ * Initializes a VM with a preallocated maximum frame stack that is stackSize
+ * bytes in size and can have up to callbacksSize callbacks registered to it.
+ * stackSize: size of the frame stack in bytes.
+ * callbacksSize: the maximum number of callbacks that may be registered.
+ * allocator: the allocator used for all memory owned by the VM, including
+ * VMLibData objects created by natives, or NULL for the default allocator.
+ * The VM wraps it to count its usage. See vm_set_mem_limit().
+ * memMode: VMMEM_REFCOUNT to free objects as soon as their reference count
+ * drops to zero, or VMMEM_GC to free them with the incremental mark-sweep
+ * collector in vmgc.c.
+ * returns: a new VM instance, or NULL if allocation fails.
+ */
+VM * vm_new(size_t stackSize, int callbacksSize, GSAllocator * allocator,
+	    VMMemMode memMode) {
+  VM * vm;
+
+  assert(stackSize > 0);
+  assert(callbacksSize > 0);
+
+  vm = vm_alloc(stackSize, allocator, memMode);
+  if(vm == NULL) {
     return NULL;
   }
 
+  vm->callbacksSize = callbacksSize;
+  vm->callbacks = gsalloc_calloc(vm->allocator, vm->callbacksSize,
+				 sizeof(VMCallback));
   vm->callbacksHT = ht_new(vm->callbacksSize, 10, 1.0);
-  if(vm->callbacksHT == NULL) {
-    free(vm->callbacks);
-    typestk_free(vm->opStk);
-    frmstk_free(vm->frmStk);
-    free(vm);
+  if(vm->callbacks == NULL || vm->callbacksHT == NULL) {
+    vm_free(vm);
     return NULL;
   }
 
   return vm;
 }
 
+/**
+ * Initializes a VM that runs natives from a callbacks table that it shares
+ * with other VMs, such as the bindings of a Program, see program.c. The
+ * table isn't copied and must outlive the VM. No callbacks can be registered
+ * with the VM, and it can't look them up by name, so it can only run code
+ * that has already been compiled.
+ * stackSize: size of the frame stack in bytes.
+ * callbacks: the shared callbacks table.
+ * numCallbacks: the number of callbacks in the table.
+ * allocator: the allocator used for all memory owned by the VM, or NULL for
+ * the default allocator.
+ * memMode: how VMLibData objects are freed, see vm_new().
+ * returns: a new VM instance, or NULL if allocation fails.
+ */
+VM * vm_new_shared(size_t stackSize, VMCallback * callbacks, int numCallbacks,
+		   GSAllocator * allocator, VMMemMode memMode) {
+  VM * vm;
+
+  assert(stackSize > 0);
+  assert(callbacks != NULL || numCallbacks == 0);
+
+  vm = vm_alloc(stackSize, allocator, memMode);
+  if(vm == NULL) {
+    return NULL;
+  }
+
+  /* callbacksSize stays 0, so the table is never registered into or freed */
+  vm->callbacks = callbacks;
+  vm->numCallbacks = numCallbacks;
+  return vm;
+}
+
+/**
+ * Gets the allocator used by this VM. Native libraries should allocate any
+ * memory that lives as long as VM objects with this allocator.
+ * vm: an instance of VM.
+ * returns: the VM's allocator.
+ */
+GSAllocator * vm_allocator(VM * vm) {
+  assert(vm != NULL);
+  return vm->allocator;
+}
+
+/**
+ * Gets the host allocator that this VM's allocator accounts for. Memory
+ * moved between VMs, see vm_mem_disown(), is owned by it in between.
+ * vm: an instance of VM.
+ * returns: the host allocator.
+ */
+GSAllocator * vm_base_allocator(VM * vm) {
+  assert(vm != NULL);
+  return vm->baseAllocator;
+}
+
+/**
+ * Counts memory that was allocated with the VM's base allocator elsewhere,
+ * e.g. by another VM, as this VM's, so that vm_allocator() can free it. It
+ * counts even if it goes over the memory limit, since it exists already.
+ * vm: an instance of VM.
+ * size: the number of bytes.
+ */
+void vm_mem_adopt(VM * vm, size_t size) {
+  assert(vm != NULL);
+
+  vm->memUsed += size;
+  if(vm->memUsed > vm->memPeak) {
+    vm->memPeak = vm->memUsed;
+  }
+}
+
+/**
+ * Stops counting memory allocated with vm_allocator() as this VM's, so that
+ * it can be handed to another VM, or freed with vm_base_allocator().
+ * vm: an instance of VM.
+ * size: the number of bytes.
+ */
+void vm_mem_disown(VM * vm, size_t size) {
+  assert(vm != NULL);
+  assert(size <= vm->memUsed);
+
+  vm->memUsed -= size;
+}
+
+/**
+ * Checks whether an argument of the running native holds the only reference
+ * to its object, e.g. a string made by an expression rather than read from a
+ * variable. The native may then take the object's contents instead of
+ * copying them, since the object is freed when the native returns. Always
+ * false in VMMEM_GC mode, where reference counts aren't trusted.
+ * vm: an instance of VM.
+ * arg: the native's arguments.
+ * index: the index of the argument.
+ * returns: true if the argument's object is unique.
+ */
+bool vm_native_arg_unique(VM * vm, VMArg * arg, int index) {
+  assert(vm != NULL);
+  assert(arg != NULL);
+
+  return vm->memMode == VMMEM_REFCOUNT && vm->native != NULL
+    && index >= 0 && index < vm->native->argc && vm->native->owned[index]
+    && arg[index].type == TYPE_LIBDATA
+    && !vmarg_libdata(arg[index])->frozen
+    && vmarg_libdata(arg[index])->refCount == 1;
+}
+
+/**
+ * Sets a hard limit on the number of bytes that this VM may have allocated at
+ * once. Allocations that would exceed it fail without reaching the host
+ * allocator, and the operation that requested them fails with
+ * VMERR_MEMORY_LIMIT. Lowering the limit below the current usage does not
+ * free anything, it only causes further allocations to fail.
+ * vm: an instance of VM.
+ * limit: the limit in bytes, or 0 for no limit.
+ */
+void vm_set_mem_limit(VM * vm, size_t limit) {
+  assert(vm != NULL);
+  vm->memLimit = limit;
+}
+
+/**
+ * Gets the VM's memory limit.
+ * vm: an instance of VM.
+ * returns: the limit in bytes, or 0 if there is no limit.
+ */
+size_t vm_mem_limit(VM * vm) {
+  assert(vm != NULL);
+  return vm->memLimit;
+}
+
+/**
+ * Sets how much fuel a run gets. A backward jump, i.e. a loop iteration, or
+ * a call uses one unit. When a coroutine runs out, it is preempted:
+ * vm_resume() returns true with the coroutine in the VMCORO_PREEMPTED state,
+ * and resuming it goes on from where it stopped, so a scheduler can round
+ * robin many coroutines fairly. Any other run that runs out fails with
+ * VMERR_OUT_OF_FUEL. Each vm_exec(), vm_call(), or vm_resume() by the host
+ * gets the full amount, and coroutines resumed by natives share what is left
+ * of it.
+ * vm: an instance of VM.
+ * fuel: the fuel per run, or 0 for no limit.
+ */
+void vm_set_fuel(VM * vm, int fuel) {
+  assert(vm != NULL);
+  assert(fuel >= 0);
+  vm->fuelLimit = fuel;
+}
+
+/**
+ * Gets the VM's fuel per run.
+ * vm: an instance of VM.
+ * returns: the fuel, or 0 if there is no limit.
+ */
+int vm_fuel(VM * vm) {
+  assert(vm != NULL);
+  return vm->fuelLimit;
+}
+
+/**
+ * Sets a time limit for each run. A run by the host, with vm_exec(),
+ * vm_call(), or vm_resume(), that takes longer fails with VMERR_TIMED_OUT,
+ * and coroutines resumed by natives share its deadline. The clock is read
+ * every few hundred backward jumps and calls, so a run may go on slightly
+ * past its deadline, and a native that blocks must check
+ * vm_poll_interrupt() itself.
+ * vm: an instance of VM.
+ * seconds: the limit in seconds, or 0 for no limit.
+ */
+void vm_set_timeout(VM * vm, double seconds) {
+  assert(vm != NULL);
+  assert(seconds >= 0);
+  vm->timeout = seconds;
+}
+
+/**
+ * Gets the VM's time limit for each run.
+ * vm: an instance of VM.
+ * returns: the limit in seconds, or 0 if there is no limit.
+ */
+double vm_timeout(VM * vm) {
+  assert(vm != NULL);
+  return vm->timeout;
+}
+
+/**
+ * Asks the VM to stop the run in progress, or the next one if it isn't
+ * running. The run fails with VMERR_INTERRUPTED at its next backward jump or
+ * call, or when a native checks vm_poll_interrupt(), and can be reset with
+ * vm_reset(), which also clears a request that wasn't seen. Unlike the rest
+ * of the VM's functions, this may be called from any thread.
+ * vm: an instance of VM.
+ */
+void vm_interrupt(VM * vm) {
+  assert(vm != NULL);
+  __atomic_store_n(&vm->interrupted, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Gets the time from a clock that isn't changed by setting the date.
+ * returns: the time in seconds.
+ */
+static double vm_clock() {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Checks if the run should stop because vm_interrupt() was called or its
+ * time limit passed. Natives that loop or block for a long time should call
+ * this every so often, and return false if it returns true.
+ * vm: an instance of VM.
+ * returns: true if the run should stop, in which case the VM's error is set
+ * to VMERR_INTERRUPTED or VMERR_TIMED_OUT, and the interrupt is cleared.
+ */
+bool vm_poll_interrupt(VM * vm) {
+  assert(vm != NULL);
+
+  if(__atomic_load_n(&vm->interrupted, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&vm->interrupted, 0, __ATOMIC_RELAXED);
+    vm_set_err(vm, VMERR_INTERRUPTED);
+    return true;
+  }
+
+  if(vm->timeout > 0 && vm_clock() >= vm->deadline) {
+    vm_set_err(vm, VMERR_TIMED_OUT);
+    return true;
+  }
+
+  return false;
+}
+
+/**
+ * Loads fuel into the counter that vm_loop() decrements. With a time limit,
+ * at most deadlineCheckInterval is loaded at a time, and the rest is kept in
+ * reserve, so that vm_refuel() gets to check the clock.
+ * vm: an instance of VM.
+ * fuel: the fuel.
+ */
+static void vm_load_fuel(VM * vm, int fuel) {
+  vm->fuel = fuel;
+  if(vm->timeout > 0 && fuel > deadlineCheckInterval) {
+    vm->fuel = deadlineCheckInterval;
+  }
+  vm->fuelReserve = fuel - vm->fuel;
+}
+
+/**
+ * Gives the VM the full fuel, and starts the clock, for a run by the host.
+ * See vm_set_fuel() and vm_set_timeout().
+ * vm: an instance of VM.
+ */
+static void vm_fill_fuel(VM * vm) {
+  if(vm->timeout > 0) {
+    vm->deadline = vm_clock() + vm->timeout;
+  }
+  vm_load_fuel(vm, vm->fuelLimit > 0 ? vm->fuelLimit : INT_MAX);
+}
+
+/**
+ * Handles the VM's fuel counter running out. Checks the time limit, then
+ * loads more fuel from the reserve, or refills it if there is no limit.
+ * vm: an instance of VM.
+ * canPreempt: true if the loop is running a coroutine's own frames, so it
+ * can stop and be resumed later.
+ * returns: true if the run may go on, false if the coroutine was preempted,
+ * in which case vm->preempted is set, or if the run must stop, in which case
+ * the VM's error is set.
+ */
+static bool vm_refuel(VM * vm, bool canPreempt) {
+  if(vm->timeout > 0 && vm_clock() >= vm->deadline) {
+    vm_set_err(vm, VMERR_TIMED_OUT);
+    return false;
+  }
+
+  if(vm->fuelReserve > 0) {
+    vm_load_fuel(vm, vm->fuelReserve);
+    return true;
+  }
+  if(vm->fuelLimit == 0) {
+    vm_load_fuel(vm, INT_MAX);
+    return true;
+  }
+
+  if(canPreempt) {
+    vm->preempted = true;
+  } else {
+    vm_set_err(vm, VMERR_OUT_OF_FUEL);
+  }
+  return false;
+}
+
+/**
+ * Gets the number of bytes currently allocated by this VM's stacks, callback
+ * table, and VMLibData objects, not including the VM struct itself.
+ * vm: an instance of VM.
+ * returns: the live byte count.
+ */
+size_t vm_mem_used(VM * vm) {
+  assert(vm != NULL);
+  return vm->memUsed;
+}
+
+/**
+ * Gets the highest value that vm_mem_used() has reached since vm_new().
+ * vm: an instance of VM.
+ * returns: the peak byte count.
+ */
+size_t vm_mem_peak(VM * vm) {
+  assert(vm != NULL);
+  return vm->memPeak;
+}
+
 /**
  * Registers a callback function to this VM instance.
  * vm: an instance of a VM.
@@ -150,105 +607,494 @@ bool vm_reg_callback(VM * vm, char * name, size_t nameLen, VMCallback callback)
     vm_set_err(vm, VMERR_CALLBACK_EXISTS);
     return false;
   }
-
-  vm->numCallbacks++;
-  return true;
+
+  vm->numCallbacks++;
+  return true;
+}
+
+/**
+ * Gets a callback function's function pointer from its array index.
+ * vm: an instance of VM.
+ * index: the index of the function to call. You can find out a function's
+ * index using the vm_callback_index() function.
+ * returns: the function's function pointer, or NULL if the specified index does
+ * not exist.
+ */
+VMCallback vm_callback_from_index(VM * vm, int index) {
+  assert(vm != NULL);
+  assert(index >= 0);
+
+  /* handle index is out of range error case */
+  if(index >= vm->numCallbacks) {
+    vm_set_err(vm, VMERR_CALLBACK_NOT_EXIST);
+    return NULL;
+  }
+
+  return vm->callbacks[index];
+}
+
+/**
+ * Gets the index of a VM callback function from its name.
+ * vm: an instance of VM.
+ * name: the name of the function.
+ * nameLen: the length of name, in chars.
+ * returns: the index of the callback, > 0, or -1 if the operation
+ * fails because the function does not exist.
+ */
+int vm_callback_index(VM * vm, char * name, size_t nameLen) {
+  int index = vm_callback_lookup(vm, name, nameLen);
+
+  vm_set_err(vm, index == -1 ? VMERR_CALLBACK_NOT_EXIST : VMERR_SUCCESS);
+  return index;
+}
+
+/**
+ * Gets the index of a VM callback function from its name, like
+ * vm_callback_index(), but without setting the VM's error. It doesn't modify
+ * the VM, so compilation units on several threads may call it at once, as
+ * long as no callbacks are being registered.
+ * vm: an instance of VM.
+ * name: the name of the function.
+ * nameLen: the length of name, in chars.
+ * returns: the index of the callback, or -1 if the function does not exist.
+ */
+int vm_callback_lookup(VM * vm, char * name, size_t nameLen) {
+  assert(vm != NULL);
+  assert(name != NULL);
+  assert(nameLen > 0);
+  
+  DSValue value;
+
+  if(vm->callbacksHT == NULL
+     || !ht_get_raw_key(vm->callbacksHT, name, nameLen, &value)) {
+    return -1;
+  }
+
+  return value.intVal;
+}
+
+/**
+ * Gets the name that a VM callback function was registered with. This is the
+ * reverse of vm_callback_index() and walks the callbacks table, so it is
+ * intended for tools such as the bytecode writer, not for hot paths.
+ * vm: an instance of VM.
+ * index: the index of the callback.
+ * nameBuf: a buffer that receives the name. It is not NULL terminated.
+ * nameBufLen: the size of nameBuf in chars. At most this many chars are copied.
+ * returns: the length of the name, which may be larger than nameBufLen, or 0
+ * if no callback has this index.
+ */
+size_t vm_callback_name(VM * vm, int index, char * nameBuf, size_t nameBufLen) {
+  HTIter iter;
+  DSValue value;
+  size_t nameLen;
+
+  assert(vm != NULL);
+  assert(nameBuf != NULL);
+
+  vm_set_err(vm, VMERR_SUCCESS);
+
+  if(vm->callbacksHT == NULL) {
+    vm_set_err(vm, VMERR_CALLBACK_NOT_EXIST);
+    return 0;
+  }
+
+  ht_iter_get(vm->callbacksHT, &iter);
+  while(ht_iter_has_next(&iter)) {
+    ht_iter_next(&iter, nameBuf, nameBufLen, &value, &nameLen, false);
+    if(value.intVal == index) {
+      return nameLen;
+    }
+  }
+
+  vm_set_err(vm, VMERR_CALLBACK_NOT_EXIST);
+  return 0;
+}
+
+/**
+ * Gets the number of callbacks registered with the VM.
+ * vm: an instance of VM.
+ * returns: the number of callbacks registered.
+ */
+int vm_num_callbacks(VM * vm) {
+  assert(vm != NULL);
+
+  vm_set_err(vm, VMERR_SUCCESS);
+
+  return vm->numCallbacks;
+}
+
+/**
+ * Sets the function that compiles a function when the OP_STUB that stands in
+ * for it runs for the first time. The compiler writes stubs in lazy mode.
+ * See compiler_set_lazy().
+ * vm: an instance of VM.
+ * handler: the stub handler, or NULL for none, in which case OP_STUB fails
+ * with VMERR_STUB_FAILED.
+ * context: a pointer passed to handler.
+ */
+void vm_set_stub_handler(VM * vm, VMStubHandler handler, void * context) {
+  assert(vm != NULL);
+
+  vm->stubHandler = handler;
+  vm->stubContext = context;
+}
+
+/**
+ * Tells the VM that the code it is running was changed by a native function
+ * and moved, e.g. by compiler_rebuild(). When the native returns, the VM
+ * continues at the same index in the new code. Has no effect if no script is
+ * running.
+ * vm: an instance of VM.
+ * byteCode: the new location of the code.
+ * byteCodeLen: the new length of the code.
+ */
+void vm_code_moved(VM * vm, char * byteCode, size_t byteCodeLen) {
+  assert(vm != NULL);
+  assert(byteCode != NULL);
+
+  vm->movedCode = byteCode;
+  vm->movedCodeLen = byteCodeLen;
+}
+
+/**
+ * Sets the pool that the spawn() and join() natives run tasks with. The
+ * VM must be running code of the pool's program, see libtask.c.
+ * vm: an instance of VM.
+ * pool: the pool, or NULL to stop the natives from working. It must outlive
+ * the VM, or be unset first.
+ */
+void vm_set_task_pool(VM * vm, TaskPool * pool) {
+  assert(vm != NULL);
+  vm->taskPool = pool;
+}
+
+/**
+ * Gets the VM's task pool.
+ * vm: an instance of VM.
+ * returns: the pool, or NULL if there is none.
+ */
+TaskPool * vm_task_pool(VM * vm) {
+  assert(vm != NULL);
+  return vm->taskPool;
+}
+
+#ifdef VM_CHECK_REFCOUNTS
+/**
+ * Zeroes the checker counts of the object in a stack slot.
+ * context: unused.
+ * type: the type of the slot.
+ * value: pointer to the slot's possibly unaligned data.
+ */
+static void check_clear_slot(void * context, VarType type, void * value) {
+  VMLibData * data;
+
+  if(type == TYPE_LIBDATA) {
+    memcpy(&data, value, sizeof(VMLibData*));
+    if(!data->frozen) {
+      data->checkRefs = 0;
+      data->checkVarRefs = 0;
+    }
+  }
+}
+
+/**
+ * Counts the reference held by a variable slot.
+ * context: unused.
+ * type: the type of the slot.
+ * value: pointer to the slot's possibly unaligned data.
+ */
+static void check_count_var(void * context, VarType type, void * value) {
+  VMLibData * data;
+
+  if(type == TYPE_LIBDATA) {
+    memcpy(&data, value, sizeof(VMLibData*));
+    if(!data->frozen) {
+      data->checkRefs++;
+      data->checkVarRefs++;
+    }
+  }
+}
+
+/**
+ * Asserts that an object's reference count matches the references counted.
+ * context: unused.
+ * type: the type of the slot.
+ * value: pointer to the slot's possibly unaligned data.
+ */
+static void check_verify_slot(void * context, VarType type, void * value) {
+  VMLibData * data;
+
+  if(type == TYPE_LIBDATA) {
+    memcpy(&data, value, sizeof(VMLibData*));
+    assert(data->frozen || data->refCount == data->checkRefs);
+  }
+}
+
+/**
+ * Clears or counts the references held by a coroutine's stacks, which are
+ * the resumer's while the coroutine runs.
+ * coro: the coroutine.
+ * count: false to zero the checker counts, true to count the references.
+ */
+static void check_coro(VMCoro * coro, bool count) {
+  TypeStkData * entry;
+  VMLibData * data;
+  int i;
+
+  for(i = 0; i < coro->opStk->size; i++) {
+    entry = &coro->opStk->stack[i];
+    if(!count) {
+      check_clear_slot(NULL, entry->type, entry->data);
+    } else if(entry->type == TYPE_LIBDATA && !entry->borrowed) {
+      memcpy(&data, entry->data, sizeof(VMLibData*));
+      if(!data->frozen) {
+	data->checkRefs++;
+      }
+    }
+  }
+  frmstk_visit_vars(coro->frmStk, count ? check_count_var
+		    : check_clear_slot, NULL);
 }
 
 /**
- * Gets a callback function's function pointer from its array index.
+ * Verifies the operand stack ownership invariant described in ophandlers.c:
+ * every object's refCount equals the number of variable slots, owned operand
+ * stack entries, and host roots that hold it, and every borrowed operand
+ * is also held by a variable slot. Frozen objects are skipped, since other
+ * threads change their counts. Only valid in VMMEM_REFCOUNT mode, and
+ * only compiled in when VM_CHECK_REFCOUNTS is defined.
  * vm: an instance of VM.
- * index: the index of the function to call. You can find out a function's
- * index using the vm_callback_index() function.
- * returns: the function's function pointer, or NULL if the specified index does
- * not exist.
  */
-VMCallback vm_callback_from_index(VM * vm, int index) {
-  assert(vm != NULL);
-  assert(index >= 0);
+static void vm_check_refcounts(VM * vm) {
+  TypeStkData * entry;
+  VMNative * native;
+  VMCoro * coro;
+  int i;
+
+  if(vm->memMode != VMMEM_REFCOUNT) {
+    return;
+  }
 
-  /* handle index is out of range error case */
-  if(index >= vm->numCallbacks) {
-    vm_set_err(vm, VMERR_CALLBACK_NOT_EXIST);
-    return NULL;
+  /* clear counts on every reachable object */
+  for(i = 0; i < vm->opStk->size; i++) {
+    entry = &vm->opStk->stack[i];
+    check_clear_slot(vm, entry->type, entry->data);
+  }
+  frmstk_visit_vars(vm->frmStk, check_clear_slot, vm);
+  for(i = 0; i < vm->gcNumRoots; i++) {
+    if(!vm->gcRoots[i]->frozen) {
+      vm->gcRoots[i]->checkRefs = 0;
+      vm->gcRoots[i]->checkVarRefs = 0;
+    }
+  }
+  for(coro = vm->coros; coro != NULL; coro = coro->next) {
+    check_coro(coro, false);
+  }
+  for(native = vm->native; native != NULL; native = native->caller) {
+    for(i = 0; i < native->argc; i++) {
+      check_clear_slot(vm, native->args[i].type, native->args[i].data);
+    }
   }
 
-  return vm->callbacks[index];
+  /* count every reference holder */
+  frmstk_visit_vars(vm->frmStk, check_count_var, vm);
+  for(i = 0; i < vm->opStk->size; i++) {
+    entry = &vm->opStk->stack[i];
+    if(entry->type == TYPE_LIBDATA && !entry->borrowed) {
+      VMLibData * data;
+
+      memcpy(&data, entry->data, sizeof(VMLibData*));
+      if(!data->frozen) {
+	data->checkRefs++;
+      }
+    }
+  }
+  for(i = 0; i < vm->gcNumRoots; i++) {
+    if(!vm->gcRoots[i]->frozen) {
+      vm->gcRoots[i]->checkRefs++;
+    }
+  }
+  for(coro = vm->coros; coro != NULL; coro = coro->next) {
+    check_coro(coro, true);
+  }
+
+  /* arguments of running natives that call back into the VM */
+  for(native = vm->native; native != NULL; native = native->caller) {
+    for(i = 0; i < native->argc; i++) {
+      if(native->args[i].type == TYPE_LIBDATA && native->owned[i]
+	 && !vmarg_libdata(native->args[i])->frozen) {
+	vmarg_libdata(native->args[i])->checkRefs++;
+      }
+    }
+  }
+
+  /* verify counts, and that borrowed operands are kept alive by a variable */
+  for(i = 0; i < vm->opStk->size; i++) {
+    entry = &vm->opStk->stack[i];
+    check_verify_slot(vm, entry->type, entry->data);
+
+    if(entry->type == TYPE_LIBDATA && entry->borrowed) {
+      VMLibData * data;
+
+      memcpy(&data, entry->data, sizeof(VMLibData*));
+      assert(data->frozen || data->checkVarRefs > 0);
+    }
+  }
+  frmstk_visit_vars(vm->frmStk, check_verify_slot, vm);
+  for(i = 0; i < vm->gcNumRoots; i++) {
+    assert(vm->gcRoots[i]->frozen
+	   || vm->gcRoots[i]->refCount == vm->gcRoots[i]->checkRefs);
+  }
 }
+#endif /* VM_CHECK_REFCOUNTS */
 
 /**
- * Gets the index of a VM callback function from its name.
+ * Gives a value that holds a reference to the host, e.g. a return value, or
+ * releases it.
  * vm: an instance of VM.
- * name: the name of the function.
- * nameLen: the length of name, in chars.
- * returns: the index of the callback, > 0, or -1 if the operation
- * fails because the function does not exist.
+ * value: the value.
+ * result: receives the value and its reference, or NULL to release it.
+ * returns: true if success, false if an object couldn't be made a root.
  */
-int vm_callback_index(VM * vm, char * name, size_t nameLen) {
-  assert(vm != NULL);
-  assert(name != NULL);
-  assert(nameLen > 0);
-  
-  DSValue value;
+static bool vm_give_value(VM * vm, VMArg value, VMArg * result) {
 
-  vm_set_err(vm, VMERR_SUCCESS);
+  if(result == NULL) {
+    if(value.type == TYPE_LIBDATA) {
+      vmlibdata_release(vm, vmarg_libdata(value));
+    }
+    return true;
+  }
 
-  if(!ht_get_raw_key(vm->callbacksHT, name, nameLen, &value)) {
-    vm_set_err(vm, VMERR_CALLBACK_NOT_EXIST);
-    return -1;
+  /* the reference passes to the host. the collector doesn't count
+   * references, so the object must be a root to survive later runs
+   */
+  *result = value;
+  if(value.type == TYPE_LIBDATA && vm->memMode == VMMEM_GC
+     && !vmgc_add_root(vm, vmarg_libdata(value))) {
+    *result = vmarg_make_null();
+    return false;
   }
 
-  return value.intVal;
+  return true;
 }
 
 /**
- * Gets the number of callbacks registered with the VM.
+ * Pops the entry point's return value when it returns.
  * vm: an instance of VM.
- * returns: the number of callbacks registered.
+ * stackBase: the operand stack size when the entry point was called.
+ * result: receives the value and its reference, or NULL to release it.
+ * returns: true if success, false if an object couldn't be made a root.
  */
-int vm_num_callbacks(VM * vm) {
-  assert(vm != NULL);
+static bool vm_entry_return(VM * vm, int stackBase, VMArg * result) {
+  VMArg value;
 
-  vm_set_err(vm, VMERR_SUCCESS);
+  assert(typestk_size(vm->opStk) == stackBase + 1);
 
-  return vm->numCallbacks;
+  /* the entry frame's variables are released next, so the value can't be
+   * borrowed from them
+   */
+  assert(!typestk_top_borrowed(vm->opStk));
+  typestk_pop(vm->opStk, value.data, VM_VAR_SIZE, &value.type);
+
+  return vm_give_value(vm, value, result);
 }
 
 /**
- * Executes a VM bytecode. For more info on the bytecode format, see
- * ophandlers.c where the opcodes are described and implemented.
+ * Pushes a function's frame and copies arguments from the host into it.
  * vm: an instance of VM.
- * byteCode: an array of chars that contain VM byte code.
- * byteCodeLen: the number of bytes to read from byteCode array.
- * startIndex: the index to start executing from. The entry point.
- * numArgs: the number of items to pop off of stack to use as arguments.
+ * frmStk: the frame stack, the VM's or a new coroutine's.
+ * numVarArgs: the number of args and vars in the function's frame.
+ * args: values for the first argc variables, or NULL.
+ * argc: the number of values in args.
+ * returns: true if success, false if the frame doesn't fit, or argc is more
+ * than numVarArgs, in which case the VM's error is set.
  */
-bool vm_exec(VM * vm, char * byteCode, 
-	     size_t byteCodeLen, int startIndex, int numVarArgs) {
+static bool vm_push_entry(VM * vm, FrmStk * frmStk, int numVarArgs,
+			  VMArg * args, int argc) {
+  int i;
 
-  assert(vm != NULL);
-  assert(startIndex >= 0);
-  assert(startIndex < byteCodeLen);
   assert(numVarArgs >= 0);
+  assert(argc >= 0);
+  assert(args != NULL || argc == 0);
 
-  vm->index = startIndex;
+  /* there are more arguments than there is memory allocated in the frame */
+  if(argc > numVarArgs) {
+    vm_set_err(vm, VMERR_INVALID_PARAM);
+    return false;
+  }
 
   /* push new frame with selected number of arguments and vars. */
-  if(!frmstk_push(vm->frmStk, -1, numVarArgs)) {
+  if(!frmstk_push(frmStk, -1, numVarArgs)) {
      vm_set_err(vm, VMERR_STACK_OVERFLOW);
      return false;
   }
 
+  /* copy the host's arguments into the frame, variables hold a reference */
+  for(i = 0; i < argc; i++) {
+    if(args[i].type == TYPE_LIBDATA) {
+      vmlibdata_inc_refcount(vmarg_libdata(args[i]));
+    }
+    frmstk_var_write(frmStk, FRMSTK_TOP, i, args[i].data,
+		     VM_VAR_SIZE, args[i].type);
+  }
+
+  return true;
+}
+
+/**
+ * Runs code from vm->index until the frame at entryDepth returns, or the
+ * running coroutine yields, in which case vm->yielding is set, or runs out
+ * of fuel, in which case vm->preempted is set.
+ * vm: an instance of VM.
+ * code: the bytecode. Receives the new code if running the function moved
+ * it, so that the next run uses it.
+ * codeLen: the length of the code. Receives the new length.
+ * entryDepth: the frame stack depth of the entry point's frame.
+ * stackBase: the operand stack size when the entry point was called. Not 0
+ * when a native calls back into the VM, on top of its caller's operands.
+ * keepEntry: if true, the entry point's return leaves its frame in place,
+ * for vm_run() to reuse.
+ * result: receives the entry point's return value, or NULL to release it.
+ * returns: true if success, false if a VM error occurred.
+ */
+static bool vm_loop(VM * vm, char ** code, size_t * codeLen, int entryDepth,
+		    int stackBase, bool keepEntry, VMArg * result) {
+  char * byteCode = *code;
+  size_t byteCodeLen = *codeLen;
+  bool burned = false;
+  int from;
+
+  vm->movedCode = NULL;
+
+  if(result != NULL) {
+    *result = vmarg_make_null();
+  }
+
   while(vm->index < byteCodeLen) {
 
     vm_set_err(vm, VMERR_SUCCESS);
 
+    /* safe point: every object is on a stack, so the collector may run */
+    if(vm->gcPending) {
+      vmgc_step(vm);
+    }
+
+#ifdef VM_CHECK_REFCOUNTS
+    vm_check_refcounts(vm);
+#endif /* VM_CHECK_REFCOUNTS */
+
     switch(byteCode[vm->index]) {
     case OP_VAR_PUSH:
       if(!op_var_push(vm, byteCode, byteCodeLen, &vm->index)) {
 	return false;
       }
       break;
+    case OP_VAR_PUSH_B:
+      if(!op_var_push_b(vm, byteCode, byteCodeLen, &vm->index)) {
+	return false;
+      }
+      break;
     case OP_VAR_STOR:
       if(!op_var_stor(vm, byteCode, byteCodeLen, &vm->index)) {
 	return false;
@@ -260,9 +1106,31 @@ bool vm_exec(VM * vm, char * byteCode,
       }
       break;
     case OP_FRM_POP:
+      if(keepEntry && frmstk_size(vm->frmStk) == entryDepth) {
+	*code = byteCode;
+	*codeLen = byteCodeLen;
+	if(!vm_entry_return(vm, stackBase, result)) {
+	  vm_set_err(vm, VMERR_ALLOC_FAILED);
+	  return false;
+	}
+	return true;
+      }
       if(!op_frame_pop(vm, byteCode, byteCodeLen, &vm->index)) {
 	return false;
       }
+
+      /* the entry point returned. stop here instead of running into the
+       * code that follows it, which may be another function
+       */
+      if(frmstk_size(vm->frmStk) < entryDepth) {
+	*code = byteCode;
+	*codeLen = byteCodeLen;
+	if(!vm_entry_return(vm, stackBase, result)) {
+	  vm_set_err(vm, VMERR_ALLOC_FAILED);
+	  return false;
+	}
+	return true;
+      }
       break;
     case OP_ADD:
       if(!op_add(vm, byteCode, byteCodeLen, &vm->index)) {
@@ -297,10 +1165,12 @@ bool vm_exec(VM * vm, char * byteCode,
       }
       break;
     case OP_GOTO:
+      from = vm->index;
       if(!op_goto(vm, byteCode, byteCodeLen,
 			     &vm->index)) {
 	return false;
       }
+      burned = vm->index <= from;
       break;
     case OP_BOOL_PUSH:
       if(!op_bool_push(vm, byteCode, byteCodeLen, &vm->index)) {
@@ -328,11 +1198,27 @@ bool vm_exec(VM * vm, char * byteCode,
       if(!op_call_ptr_n(vm, byteCode, byteCodeLen, &vm->index)) {
 	return false;
       }
+
+      /* the native may have rebuilt the code */
+      if(vm->movedCode != NULL) {
+	byteCode = vm->movedCode;
+	byteCodeLen = vm->movedCodeLen;
+	vm->movedCode = NULL;
+      }
+
+      /* the native yielded, vm_resume() continues after the call */
+      if(vm->yielding) {
+	*code = byteCode;
+	*codeLen = byteCodeLen;
+	return true;
+      }
+      burned = true;
       break;
     case OP_CALL_B:
       if(!op_frame_push(vm, byteCode, byteCodeLen, &vm->index, true)) {
 	return false;
       }
+      burned = true;
       break;
     case OP_NOT:
       if(!op_not(vm, byteCode, byteCodeLen, &vm->index)) {
@@ -340,14 +1226,18 @@ bool vm_exec(VM * vm, char * byteCode,
       }
       break;
     case OP_TCOND_GOTO:
+      from = vm->index;
       if(!op_cond_goto(vm, byteCode, byteCodeLen, &vm->index, false)) {
 	return false;
       }
+      burned = vm->index <= from;
       break;
     case OP_FCOND_GOTO:
+      from = vm->index;
       if(!op_cond_goto(vm, byteCode, byteCodeLen, &vm->index, true)) {
 	return false;
       }
+      burned = vm->index <= from;
       break;
     case OP_POP:
       if(!op_pop(vm, byteCode, byteCodeLen, &vm->index)) {
@@ -359,88 +1249,734 @@ bool vm_exec(VM * vm, char * byteCode,
 	return false;
       }
       break;
+    case OP_STUB:
+      /* compiling the function may move the code */
+      if(!op_stub(vm, &byteCode, &byteCodeLen, &vm->index)) {
+	return false;
+      }
+      break;
     default:
       printf("Invalid OpCode at Index: %i\n", vm->index);
       vm_set_err(vm, VMERR_INVALID_OPCODE);
       return false;
     }
+
+    /* backward jumps and calls check for an interrupt, and use fuel, see
+     * vm_set_fuel(). the time limit is checked when the fuel counter runs out
+     */
+    if(burned) {
+      burned = false;
+      if(__atomic_load_n(&vm->interrupted, __ATOMIC_RELAXED)
+	 && vm_poll_interrupt(vm)) {
+	return false;
+      }
+      if(--vm->fuel <= 0
+	 && !vm_refuel(vm, vm->coro != NULL && entryDepth == 1)) {
+	*code = byteCode;
+	*codeLen = byteCodeLen;
+	return vm->preempted;
+      }
+    }
+  }
+
+  /* make sure that the stack is being cleared after each line. There should
+   * be only 1 item...the entry point return value
+   */
+  assert(typestk_size(vm->opStk) == stackBase + 1);
+  *code = byteCode;
+  *codeLen = byteCodeLen;
+  return true;
+}
+
+/**
+ * Sets the variables of the entry frame that vm_run() keeps between the calls
+ * of a batch, and releases the objects that the last call left in them.
+ * vm: an instance of VM.
+ * numVarArgs: the number of args and vars in the frame.
+ * args: values for the first argc variables, or NULL.
+ * argc: the number of values in args. The other variables are set to null.
+ */
+static void vm_reuse_entry(VM * vm, int numVarArgs, VMArg * args, int argc) {
+  VMArg null = vmarg_make_null();
+  VMArg old;
+  int i;
+
+  for(i = 0; i < numVarArgs; i++) {
+    frmstk_var_read(vm->frmStk, FRMSTK_TOP, i, old.data, VM_VAR_SIZE,
+		    &old.type);
+
+    /* reference the new value before the old one is released, they may be
+     * the same object
+     */
+    if(i < argc) {
+      if(args[i].type == TYPE_LIBDATA) {
+	vmlibdata_inc_refcount(vmarg_libdata(args[i]));
+      }
+      frmstk_var_write(vm->frmStk, FRMSTK_TOP, i, args[i].data,
+		       VM_VAR_SIZE, args[i].type);
+    } else {
+      frmstk_var_write(vm->frmStk, FRMSTK_TOP, i, null.data,
+		       VM_VAR_SIZE, null.type);
+    }
+
+    if(old.type == TYPE_LIBDATA) {
+      vmlibdata_release(vm, vmarg_libdata(old));
+    }
+  }
+}
+
+/**
+ * Runs a function once for each of an array of argument tuples. Shared by
+ * vm_exec(), vm_call(), and vm_call_batch(). The entry frame is pushed once:
+ * the entry point's return leaves it in place until the last call, and each
+ * later call only overwrites its variables and starts over at startIndex.
+ * vm: an instance of VM.
+ * code: the bytecode. Receives the new code if running the function moved
+ * it, so that the next run uses it.
+ * codeLen: the length of the code. Receives the new length.
+ * startIndex: the index of the function.
+ * numVarArgs: the number of args and vars in the function's frame.
+ * args: numCalls tuples of argc values for the first variables, or NULL.
+ * argc: the number of values in each tuple.
+ * results: receives numCalls return values, or NULL to release them.
+ * numCalls: the number of calls, at least 1.
+ * returns: the number of calls that succeeded. If less than numCalls, the
+ * VM's error is set.
+ */
+static int vm_run(VM * vm, char ** code, size_t * codeLen,
+		  int startIndex, int numVarArgs, VMArg * args, int argc,
+		  VMArg * results, int numCalls) {
+  char * callerCode = *code;
+  char * movedCode = vm->movedCode;
+  size_t movedCodeLen = vm->movedCodeLen;
+  int index = vm->index;
+  int entryDepth;
+  int stackBase;
+  bool hostRun;
+  int i;
+
+  assert(vm != NULL);
+  assert(startIndex >= 0);
+  assert(startIndex < *codeLen);
+  assert(numCalls > 0);
+
+  if(results != NULL) {
+    for(i = 0; i < numCalls; i++) {
+      results[i] = vmarg_make_null();
+    }
+  }
+
+  /* a run by the host gets the full fuel for each call, a native's shares
+   * its caller's
+   */
+  hostRun = vm->coro == NULL && frmstk_size(vm->frmStk) == 0;
+  if(hostRun) {
+    vm_fill_fuel(vm);
+  }
+
+  if(!vm_push_entry(vm, vm->frmStk, numVarArgs, args, argc)) {
+    return 0;
+  }
+  entryDepth = frmstk_size(vm->frmStk);
+  stackBase = typestk_size(vm->opStk);
+
+  for(i = 0; i < numCalls; i++) {
+    if(i > 0) {
+
+      /* calls without loops might not check for an interrupt themselves */
+      if(__atomic_load_n(&vm->interrupted, __ATOMIC_RELAXED)
+	 && vm_poll_interrupt(vm)) {
+	vm_reuse_entry(vm, numVarArgs, NULL, 0);
+	frmstk_pop(vm->frmStk);
+	break;
+      }
+
+      if(hostRun) {
+	vm_fill_fuel(vm);
+      }
+      vm_reuse_entry(vm, numVarArgs, args + (i * argc), argc);
+    }
+
+    /* the last call pops the entry frame, like a single call does. a failed
+     * call leaves its frames behind, for vm_reset()
+     */
+    vm->index = startIndex;
+    if(!vm_loop(vm, code, codeLen, entryDepth, stackBase, i < numCalls - 1,
+		results != NULL ? &results[i] : NULL)) {
+      break;
+    }
+  }
+
+  /* a native called back into the VM. its caller goes on after the call,
+   * in the code that this run moved to, if it moved
+   */
+  if(vm->native != NULL) {
+    vm->index = index;
+    if(*code != callerCode) {
+      vm->movedCode = *code;
+      vm->movedCodeLen = *codeLen;
+    } else {
+      vm->movedCode = movedCode;
+      vm->movedCodeLen = movedCodeLen;
+    }
+  }
+
+  return i;
+}
+
+/**
+ * Executes a VM bytecode. For more info on the bytecode format, see
+ * ophandlers.c where the opcodes are described and implemented.
+ * vm: an instance of VM.
+ * byteCode: an array of chars that contain VM byte code.
+ * byteCodeLen: the number of bytes to read from byteCode array.
+ * startIndex: the index to start executing from. The entry point.
+ * numArgs: the number of items to pop off of stack to use as arguments.
+ */
+bool vm_exec(VM * vm, char * byteCode, 
+	     size_t byteCodeLen, int startIndex, int numVarArgs) {
+  return vm_run(vm, &byteCode, &byteCodeLen, startIndex, numVarArgs,
+		NULL, 0, NULL, 1) == 1;
+}
+
+/**
+ * Calls a function with arguments from the host and gets its return value.
+ * Unlike vm_exec(), which leaves the arguments null, the first argc variables
+ * of the function's frame are set to args.
+ * vm: an instance of VM.
+ * byteCode: an array of chars that contain VM byte code.
+ * byteCodeLen: the number of bytes to read from byteCode array.
+ * startIndex: the index of the function.
+ * numVarArgs: the number of args and vars in the function's frame.
+ * args: the arguments. Objects are referenced by the frame while the
+ * function runs, so one that the host holds no reference to, e.g. a new
+ * string from vmarg_new_string(), is freed when the function returns.
+ * argc: the number of arguments, no more than numVarArgs.
+ * result: receives the return value, or NULL to discard it. If it is an
+ * object, the host holds it like a root added with vmgc_add_root(), and must
+ * vmarg_release() it.
+ * returns: true if success, false if a VM error occurred.
+ */
+bool vm_call(VM * vm, char * byteCode, size_t byteCodeLen, int startIndex,
+	     int numVarArgs, VMArg * args, int argc, VMArg * result) {
+  return vm_run(vm, &byteCode, &byteCodeLen, startIndex, numVarArgs,
+		args, argc, result, 1) == 1;
+}
+
+/**
+ * Calls a function once for each of an array of argument tuples, e.g. to
+ * score many records. Equivalent to a vm_call() per tuple, except that the
+ * entry frame is pushed once for the batch and reused by each call, and the
+ * code is followed if a call moves it.
+ * vm: an instance of VM. Its frame stack must be empty, unless a native is
+ * calling back into it.
+ * byteCode: an array of chars that contain VM byte code.
+ * byteCodeLen: the number of bytes to read from byteCode array.
+ * startIndex: the index of the function.
+ * numVarArgs: the number of args and vars in the function's frame.
+ * args: numCalls tuples of argc arguments each, one after another. See
+ * vm_call() for how objects are referenced.
+ * argc: the number of arguments in each tuple, no more than numVarArgs.
+ * results: receives numCalls return values, or NULL to discard them. Values
+ * that are objects must be released with vmarg_release().
+ * numCalls: the number of calls.
+ * returns: the number of calls that succeeded. If less than numCalls, the
+ * call after them failed, and the VM's error is set.
+ */
+int vm_call_batch(VM * vm, char * byteCode, size_t byteCodeLen,
+		  int startIndex, int numVarArgs, VMArg * args, int argc,
+		  VMArg * results, int numCalls) {
+  assert(vm != NULL);
+  assert(args != NULL || argc == 0);
+  assert(numCalls >= 0);
+  assert(vm->native != NULL || frmstk_size(vm->frmStk) == 0);
+
+  /* vm_run() checks again before each of the later calls */
+  if(numCalls == 0
+     || (__atomic_load_n(&vm->interrupted, __ATOMIC_RELAXED)
+	 && vm_poll_interrupt(vm))) {
+    return 0;
+  }
+
+  return vm_run(vm, &byteCode, &byteCodeLen, startIndex, numVarArgs,
+		args, argc, results, numCalls);
+}
+
+/**
+ * Gets the size of the instruction at index, including its operands. For
+ * walking through bytecode one instruction at a time. See ophandlers.c for
+ * the format of each instruction.
+ * byteCode: an array of chars that contain VM byte code.
+ * byteCodeLen: the number of bytes in byteCode.
+ * index: the index of the instruction.
+ * returns: the size in bytes, or -1 if the byte at index isn't an opcode, or
+ * if the instruction runs past the end of byteCode.
+ */
+int vm_op_size(char * byteCode, size_t byteCodeLen, int index) {
+  int size;
+
+  assert(byteCode != NULL);
+  assert(index >= 0);
+
+  if(index >= byteCodeLen) {
+    return -1;
+  }
+
+  switch(byteCode[index]) {
+  case OP_FRM_POP:
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_LT:
+  case OP_GT:
+  case OP_LTE:
+  case OP_GTE:
+  case OP_EQUALS:
+  case OP_NOT_EQUALS:
+  case OP_AND:
+  case OP_OR:
+  case OP_NOT:
+  case OP_POP:
+  case OP_NULL_PUSH:
+    size = 1;
+    break;
+  case OP_FRM_PUSH:
+  case OP_BOOL_PUSH:
+    size = 2;
+    break;
+  case OP_VAR_PUSH:
+  case OP_VAR_PUSH_B:
+  case OP_VAR_STOR:
+    size = 3;
+    break;
+  case OP_GOTO:
+  case OP_TCOND_GOTO:
+  case OP_FCOND_GOTO:
+  case OP_STUB:
+    size = 1 + sizeof(int);
+    break;
+  case OP_NUM_PUSH:
+    size = 1 + sizeof(double);
+    break;
+  case OP_CALL_PTR_N:
+    size = 2 + sizeof(int);
+    break;
+  case OP_CALL_B:
+    size = 3 + sizeof(int);
+    break;
+  case OP_STR_PUSH:
+    if(index + 1 >= byteCodeLen) {
+      return -1;
+    }
+    size = 2 + (unsigned char)byteCode[index + 1];
+    break;
+  default:
+    return -1;
+  }
+
+  return index + size <= byteCodeLen ? size : -1;
+}
+
+/**
+ * Sets the current error code in the VM.
+ * vm: an instance of vm.
+ * err: the error code.
+ */
+void vm_set_err(VM * vm, VMErr err) {
+  assert(vm != NULL);
+
+  /* report allocations refused by the memory limit as such */
+  if(err == VMERR_ALLOC_FAILED && vm->memLimitHit) {
+    err = VMERR_MEMORY_LIMIT;
+  }
+  vm->memLimitHit = false;
+
+  vm->err = err;
+}
+
+/**
+ * Gets the current error status of the VM. Call this after calling any public
+ * VM function to get a diagnostic error code.
+ * vm: the VM instance.
+ * returns: the last error triggered. This will be VMERR_SUCCESS (0) if no error
+ * occurred last call.
+ */
+VMErr vm_get_err(VM * vm) {
+  assert(vm != NULL);
+
+  return vm->err;
+}
+
+/**
+ * Gets a string representation of the vm error. NOTE: these strings are
+ * not dynamically allocated, but are constants that cannot be freed, and die
+ * when this module terminates.
+ * lexer: an instance of lexer.
+ * err: the error to translate to text.
+ * returns: the text form of this error.
+ */
+const char * vm_err_to_string(VMErr err) {
+  return vmErrorMessages[err];
+}
+
+/**
+ * Frees a VM instance
+ * vm: a VM instance.
+ */
+void vm_free(VM * vm) {
+
+  assert(vm != NULL);
+
+  /* release everything on the stacks, e.g. after an error */
+  vm_reset(vm);
+  typestk_free(vm->opStk);
+  frmstk_free(vm->frmStk);
+  while(vm->coros != NULL) {
+    vmcoro_free(vm, vm->coros);
+  }
+
+  /* the collector owns every object in GC mode, free them all */
+  if(vm->memMode == VMMEM_GC) {
+    vmgc_free_all(vm);
+  }
+
+  if(vm->callbacksHT != NULL) {
+    ht_free(vm->callbacksHT);
+  }
+
+  /* shared tables have no size and belong to someone else */
+  if(vm->callbacks != NULL && vm->callbacksSize > 0) {
+    gsalloc_free(vm->allocator, vm->callbacks,
+		 vm->callbacksSize * sizeof(VMCallback));
+  }
+
+  gsalloc_free(vm->baseAllocator, vm, sizeof(VM));
+}
+
+/**
+ * Releases the object in a frame variable slot. For vm_clear_stacks().
+ * context: the VM.
+ * type: the slot's type.
+ * value: the slot's possibly unaligned data.
+ */
+static void reset_release_var(void * context, VarType type, void * value) {
+  VMLibData * data;
+
+  if(type == TYPE_LIBDATA) {
+    memcpy(&data, value, sizeof(VMLibData*));
+    vmlibdata_release(context, data);
+  }
+}
+
+/**
+ * Releases the objects referenced by an operand stack and by variables in
+ * every frame of a frame stack, and empties both without freeing them.
+ * vm: the VM that the stacks belong to.
+ * opStk: the operand stack, the VM's or a coroutine's.
+ * frmStk: the frame stack.
+ */
+static void vm_clear_stacks(VM * vm, TypeStk * opStk, FrmStk * frmStk) {
+  VMLibData * data;
+  VarType type;
+
+  /* release operands first, borrowed ones are kept alive by variables */
+  while(typestk_size(opStk) > 0) {
+    bool borrowed = typestk_top_borrowed(opStk);
+
+    typestk_pop(opStk, &data, sizeof(VMLibData*), &type);
+    if(type == TYPE_LIBDATA && !borrowed) {
+      vmlibdata_release(vm, data);
+    }
   }
 
-  /* make sure that the stack is being cleared after each line. There should
-   * be only 1 item...the entry point return value
-   */
-  assert(typestk_size(vm->opStk) == 1);
-  return true;
+  frmstk_visit_vars(frmStk, reset_release_var, vm);
+  frmstk_clear(frmStk);
 }
 
 /**
- * Sets the current error code in the VM.
- * vm: an instance of vm.
- * err: the error code.
+ * Returns a VM to the state it was in before it first ran, so that it can be
+ * reused, e.g. after vm_exec() fails part way through a script. The objects
+ * referenced by the operand stack and by variables in every frame are
+ * released, both stacks are emptied without freeing their buffers, and the
+ * error is cleared. Registered callbacks, collector roots, coroutines, and
+ * the memory limit are kept. In VMMEM_GC mode, the released objects are
+ * freed by the collector.
+ * vm: an instance of VM that is not running.
  */
-void vm_set_err(VM * vm, VMErr err) {
+void vm_reset(VM * vm) {
   assert(vm != NULL);
+  assert(vm->coro == NULL);
 
-  vm->err = err;
+  vm_clear_stacks(vm, vm->opStk, vm->frmStk);
+
+  vm->movedCode = NULL;
+  vm->memLimitHit = false;
+  vm->yielding = false;
+  vm->preempted = false;
+  __atomic_store_n(&vm->interrupted, 0, __ATOMIC_RELAXED);
+  vm_set_err(vm, VMERR_SUCCESS);
 }
 
 /**
- * Gets the current error status of the VM. Call this after calling any public
- * VM function to get a diagnostic error code.
- * vm: the VM instance.
- * returns: the last error triggered. This will be VMERR_SUCCESS (0) if no error
- * occurred last call.
+ * Resets a VM with vm_reset() if its last run by the host failed, leaving its
+ * frames behind. Called before each run by the host. A native that calls
+ * back into its own VM runs on top of its caller's frames, so nothing is
+ * reset while a native is running.
+ * vm: an instance of VM.
  */
-VMErr vm_get_err(VM * vm) {
+void vm_reset_failed(VM * vm) {
   assert(vm != NULL);
 
-  return vm->err;
+  if(vm->native == NULL && frmstk_size(vm->frmStk) > 0) {
+    vm_reset(vm);
+  }
 }
 
 /**
- * Gets a string representation of the vm error. NOTE: these strings are
- * not dynamically allocated, but are constants that cannot be freed, and die
- * when this module terminates.
- * lexer: an instance of lexer.
- * err: the error to translate to text.
- * returns: the text form of this error.
+ * Creates a coroutine: a run of a function that can stop part way through
+ * with vm_yield(), and go on from there when vm_resume() is called. Each
+ * coroutine has its own operand and frame stacks, so thousands of them, e.g.
+ * one per connection, can be suspended at once, and switching between them
+ * only swaps the VM's stack pointers.
+ * vm: the VM to run the coroutine in. It owns the coroutine.
+ * stackSize: the size of the coroutine's frame stack in bytes.
+ * startIndex: the index of the function.
+ * numVarArgs: the number of args and vars in the function's frame.
+ * args: the function's arguments, or NULL. See vm_call().
+ * argc: the number of arguments.
+ * returns: a new coroutine that starts running the function on its first
+ * vm_resume(), or NULL if allocation fails, or argc is more than
+ * numVarArgs, in which case the VM's error is set.
  */
-const char * vm_err_to_string(VMErr err) {
-  return vmErrorMessages[err];
+VMCoro * vmcoro_new(VM * vm, size_t stackSize, int startIndex,
+		    int numVarArgs, VMArg * args, int argc) {
+  VMCoro * coro;
+
+  assert(vm != NULL);
+  assert(stackSize > 0);
+  assert(startIndex >= 0);
+
+  coro = gsalloc_calloc(vm->allocator, 1, sizeof(VMCoro));
+  if(coro == NULL) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return NULL;
+  }
+
+  coro->frmStk = frmstk_new(stackSize, vm->allocator);
+  coro->opStk = typestk_new(coroOpStkInitSize, opStkBlockSize, vm->allocator);
+  if(coro->frmStk == NULL || coro->opStk == NULL) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+  }
+  if(coro->frmStk == NULL || coro->opStk == NULL
+     || !vm_push_entry(vm, coro->frmStk, numVarArgs, args, argc)) {
+    if(coro->frmStk != NULL) {
+      frmstk_free(coro->frmStk);
+    }
+    if(coro->opStk != NULL) {
+      typestk_free(coro->opStk);
+    }
+    gsalloc_free(vm->allocator, coro, sizeof(VMCoro));
+    return NULL;
+  }
+
+  coro->index = startIndex;
+  coro->state = VMCORO_NEW;
+  coro->yielded = vmarg_make_null();
+
+  /* link into the VM's list, where the collector finds its stacks */
+  coro->next = vm->coros;
+  if(vm->coros != NULL) {
+    vm->coros->prev = coro;
+  }
+  vm->coros = coro;
+
+  return coro;
 }
 
 /**
- * Frees a VM instance
- * vm: a VM instance.
+ * Gets the state of a coroutine.
+ * coro: the coroutine.
+ * returns: its state.
  */
-void vm_free(VM * vm) {
+VMCoroState vmcoro_state(VMCoro * coro) {
+  assert(coro != NULL);
+  return coro->state;
+}
 
+/**
+ * Frees a coroutine, releasing the objects on its stacks, whether or not its
+ * function returned.
+ * vm: the VM that owns the coroutine.
+ * coro: the coroutine. It must not be running.
+ */
+void vmcoro_free(VM * vm, VMCoro * coro) {
   assert(vm != NULL);
+  assert(coro != NULL);
+  assert(coro->state != VMCORO_RUNNING);
+
+  vm_clear_stacks(vm, coro->opStk, coro->frmStk);
+  typestk_free(coro->opStk);
+  frmstk_free(coro->frmStk);
+
+  if(coro->prev != NULL) {
+    coro->prev->next = coro->next;
+  } else {
+    vm->coros = coro->next;
+  }
+  if(coro->next != NULL) {
+    coro->next->prev = coro->prev;
+  }
+
+  gsalloc_free(vm->allocator, coro, sizeof(VMCoro));
+}
+
+/**
+ * Swaps the stacks and instruction index of the VM with those of a
+ * coroutine. Swapping once switches to the coroutine, and leaves the
+ * resumer's in the coroutine, and swapping again switches back.
+ * vm: an instance of VM.
+ * coro: the coroutine.
+ */
+static void vm_swap_coro(VM * vm, VMCoro * coro) {
+  TypeStk * opStk = vm->opStk;
+  FrmStk * frmStk = vm->frmStk;
+  int index = vm->index;
+
+  vm->opStk = coro->opStk;
+  vm->frmStk = coro->frmStk;
+  vm->index = coro->index;
+  coro->opStk = opStk;
+  coro->frmStk = frmStk;
+  coro->index = index;
+}
 
-  if(vm->opStk != NULL) {
-    void * value;
-    VarType type;
+/**
+ * Runs a coroutine until it yields, runs out of fuel, or its function
+ * returns. May be called by the host, or by a native, e.g. a scheduler, in
+ * which case the coroutine runs inside of the native's call.
+ * vm: the VM that owns the coroutine.
+ * coro: a new, suspended, or preempted coroutine.
+ * byteCode: the code, which may have moved since the coroutine was last run.
+ * byteCodeLen: the length of the code.
+ * value: the value that the yield returns in the coroutine, or NULL for
+ * null. Only used if the coroutine is suspended. Objects are referenced as
+ * by vmarg_push_libdata().
+ * result: receives the value given to the yield, or the function's return
+ * value if it returned, or null if it was preempted, or NULL to discard it.
+ * Objects are held as by vm_call(), and must be released with
+ * vmarg_release().
+ * returns: true if the coroutine yielded, was preempted, or returned, see
+ * vmcoro_state(), false if a VM error occurred, or the coroutine wasn't new,
+ * suspended, or preempted.
+ */
+bool vm_resume(VM * vm, VMCoro * coro, char * byteCode, size_t byteCodeLen,
+	       VMArg * value, VMArg * result) {
+  VMCoro * resumer;
+  char * code = byteCode;
+  char * movedCode = vm->movedCode;
+  size_t movedCodeLen = vm->movedCodeLen;
+  bool success;
 
-    /* pop all items off and free strings */
-    while(typestk_pop(vm->opStk, &value, sizeof(void*), &type));
+  assert(vm != NULL);
+  assert(coro != NULL);
+  assert(byteCode != NULL);
 
-    typestk_free(vm->opStk);
+  if(result != NULL) {
+    *result = vmarg_make_null();
   }
 
-  if(vm->frmStk != NULL) {
-    /* TODO: Free strings in frmstk */
-    frmstk_free(vm->frmStk);
+  if(coro->state != VMCORO_NEW && coro->state != VMCORO_SUSPENDED
+     && coro->state != VMCORO_PREEMPTED) {
+    vm_set_err(vm, VMERR_COROUTINE_NOT_SUSPENDED);
+    return false;
   }
 
-  if(vm->callbacksHT != NULL) {
-    ht_free(vm->callbacksHT);
+  /* the value becomes the return value of the native that yielded */
+  if(coro->state == VMCORO_SUSPENDED) {
+    VMArg pushed = value != NULL ? *value : vmarg_make_null();
+
+    if(pushed.type == TYPE_LIBDATA) {
+      vmlibdata_inc_refcount(vmarg_libdata(pushed));
+    }
+    if(!typestk_push(coro->opStk, pushed.data, VM_VAR_SIZE, pushed.type)) {
+      vm_set_err(vm, VMERR_ALLOC_FAILED);
+      return false;
+    }
+  }
+
+  /* a resume by the host gets the full fuel, a native's shares its caller's */
+  resumer = vm->coro;
+  if(resumer == NULL && frmstk_size(vm->frmStk) == 0) {
+    vm_fill_fuel(vm);
   }
+  vm->coro = coro;
+  coro->state = VMCORO_RUNNING;
+  vm_swap_coro(vm, coro);
 
-  if(vm->callbacks) {
-    free(vm->callbacks);
+  success = vm_loop(vm, &code, &byteCodeLen, 1, 0, false, result);
+
+  vm_swap_coro(vm, coro);
+  vm->coro = resumer;
+
+  /* if a native resumed the coroutine, its caller must follow moved code */
+  if(code != byteCode) {
+    vm_code_moved(vm, code, byteCodeLen);
+  } else {
+    vm->movedCode = movedCode;
+    vm->movedCodeLen = movedCodeLen;
+  }
+
+  if(!success) {
+    coro->state = VMCORO_FAILED;
+    return false;
+  }
+  if(vm->preempted) {
+    vm->preempted = false;
+    coro->state = VMCORO_PREEMPTED;
+    return true;
+  }
+  if(!vm->yielding) {
+    coro->state = VMCORO_DONE;
+    return true;
+  }
+
+  vm->yielding = false;
+  coro->state = VMCORO_SUSPENDED;
+  if(!vm_give_value(vm, coro->yielded, result)) {
+    vm_set_err(vm, VMERR_ALLOC_FAILED);
+    return false;
+  }
+  coro->yielded = vmarg_make_null();
+  return true;
+}
+
+/**
+ * Suspends the running coroutine. Called by natives, such as yield(), that
+ * must return true without pushing a value. vm_resume() returns to the host
+ * right after the native returns, and when the coroutine is resumed the
+ * value passed to vm_resume() becomes the native's return value.
+ * vm: an instance of VM.
+ * value: the value for vm_resume() to give to the host.
+ * returns: true if success, false if no coroutine is running, in which case
+ * the VM's error is set, and the native should return false.
+ */
+bool vm_yield(VM * vm, VMArg value) {
+  assert(vm != NULL);
+
+  if(vm->coro == NULL) {
+    vm_set_err(vm, VMERR_NOT_IN_COROUTINE);
+    return false;
   }
 
-  free(vm);
+  /* hold a reference until vm_resume() gives it to the host */
+  if(value.type == TYPE_LIBDATA) {
+    vmlibdata_inc_refcount(vmarg_libdata(value));
+  }
+  vm->coro->yielded = value;
+  vm->yielding = true;
+  return true;
 }
 
 /**
@@ -560,15 +2096,16 @@ char * vmarg_string(VMArg arg) {
 /**
  * Creates a new string encased in a VMLibData struct, ready to be
  * pushed to the stack as a native function return value.
+ * vm: the VM instance whose allocator will own the string.
  * string: the text for the string.
  * stringLen: the length of the new string.
  * returns: a new VMLibData struct, or NULL if the malloc fails.
  */
-VMLibData * vmarg_new_string(char * string, size_t stringLen) {
+VMLibData * vmarg_new_string(VM * vm, char * string, size_t stringLen) {
   VMLibData * result;
 
   /* allocate new string buffer */
-  result = libstr_string_new(stringLen);
+  result = libstr_string_new(vm, stringLen);
   if(result == NULL) {
     return NULL;
   }
@@ -578,6 +2115,79 @@ VMLibData * vmarg_new_string(char * string, size_t stringLen) {
   return result;
 }
 
+/**
+ * Makes a number argument, for passing to vm_call().
+ * value: the number.
+ * returns: the argument.
+ */
+VMArg vmarg_make_number(double value) {
+  VMArg arg;
+
+  arg.type = TYPE_NUMBER;
+  memset(arg.data, 0, VM_VAR_SIZE);
+  memcpy(arg.data, &value, sizeof(double));
+  return arg;
+}
+
+/**
+ * Makes a boolean argument, for passing to vm_call().
+ * value: the boolean.
+ * returns: the argument.
+ */
+VMArg vmarg_make_boolean(bool value) {
+  VMArg arg;
+
+  arg.type = TYPE_BOOLEAN;
+  memset(arg.data, 0, VM_VAR_SIZE);
+  memcpy(arg.data, &value, sizeof(bool));
+  return arg;
+}
+
+/**
+ * Makes a null argument, for passing to vm_call().
+ * returns: the argument.
+ */
+VMArg vmarg_make_null() {
+  VMArg arg;
+
+  arg.type = TYPE_NULL;
+  memset(arg.data, 0, VM_VAR_SIZE);
+  return arg;
+}
+
+/**
+ * Makes an object argument, e.g. a string from vmarg_new_string(), for
+ * passing to vm_call(). No reference is taken.
+ * data: the object.
+ * returns: the argument.
+ */
+VMArg vmarg_make_libdata(VMLibData * data) {
+  VMArg arg;
+
+  assert(data != NULL);
+
+  arg.type = TYPE_LIBDATA;
+  memset(arg.data, 0, VM_VAR_SIZE);
+  memcpy(arg.data, &data, sizeof(VMLibData*));
+  return arg;
+}
+
+/**
+ * Releases a value that vm_call() returned, freeing the object if nothing
+ * else holds it. Does nothing for values that aren't objects.
+ * vm: the VM that returned the value.
+ * arg: the value.
+ */
+void vmarg_release(VM * vm, VMArg arg) {
+  VMLibData * data = vmarg_libdata(arg);
+
+  assert(vm != NULL);
+
+  if(data != NULL) {
+    vmgc_remove_root(vm, data);
+  }
+}
+
 /**
  * Checks to see if the current vmarg is a string.
  * arg: a vm arg.
@@ -585,8 +2195,7 @@ VMLibData * vmarg_new_string(char * string, size_t stringLen) {
  */
 bool vmarg_is_string(VMArg arg) {
   if(arg.type == TYPE_LIBDATA
-     && vmlibdata_is_type(vmarg_libdata(arg), LIBSTR_STRING_TYPE, 
-			  LIBSTR_STRING_TYPE_LEN)) {
+     && vmlibdata_is_typeid(vmarg_libdata(arg), LIBSTR_STRING_TYPEID)) {
     return true;
   }
 
@@ -600,7 +2209,8 @@ bool vmarg_is_string(VMArg arg) {
  * returns: true if success, false if fails.
  */
 bool vmarg_push_libdata(VM * vm, VMLibData * data) {
-  vmlibdata_inc_refcount(data);
+
+  /* operand stack entries own a reference, see ophandlers.c */
   vmlibdata_inc_refcount(data);
   return typestk_push(vm->opStk, &data, sizeof(VMLibData*), TYPE_LIBDATA);
 }
@@ -639,7 +2249,73 @@ bool vmarg_push_boolean(VM * vm, bool value) {
 
 
 /**
- * Creates a new VMLibData structure instance.
+ * Registers a LIBDATA type name and gets the integer type ID that identifies
+ * it. Registering a name that already exists returns the existing ID, so
+ * libraries can safely call this from their install function every time they
+ * are installed. Type IDs are shared by all VM instances. Safe to call from
+ * any thread.
+ * type: a string that names the type. Limited to VM_LIBDATA_TYPELEN chars.
+ * typeLen: the length of the type string.
+ * returns: the ID of the type, or VM_LIBDATA_TYPE_INVALID if the type table
+ * is full.
+ */
+VMLibDataType vmlibdata_type_register(char * type, size_t typeLen) {
+  VMLibDataType typeId;
+  int numTypes;
+  int i;
+
+  assert(type != NULL);
+  assert(!(typeLen > VM_LIBDATA_TYPELEN));
+
+  /* check if this type was already registered, without the lock */
+  numTypes = __atomic_load_n(&numLibDataTypes, __ATOMIC_ACQUIRE);
+  for(i = 0; i < numTypes; i++) {
+    if(strlen(libDataTypes[i]) == typeLen
+       && strncmp(libDataTypes[i], type, typeLen) == 0) {
+      return i;
+    }
+  }
+
+  /* check again for a type that another thread just registered */
+  pthread_mutex_lock(&libDataTypesLock);
+  for(; i < numLibDataTypes; i++) {
+    if(strlen(libDataTypes[i]) == typeLen
+       && strncmp(libDataTypes[i], type, typeLen) == 0) {
+      pthread_mutex_unlock(&libDataTypesLock);
+      return i;
+    }
+  }
+
+  /* handle type table full error case */
+  if(numLibDataTypes >= VM_LIBDATA_MAXTYPES) {
+    pthread_mutex_unlock(&libDataTypesLock);
+    return VM_LIBDATA_TYPE_INVALID;
+  }
+
+  /* fill in the name before publishing its ID */
+  typeId = numLibDataTypes;
+  strncpy(libDataTypes[typeId], type, typeLen);
+  __atomic_store_n(&numLibDataTypes, typeId + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&libDataTypesLock);
+  return typeId;
+}
+
+/**
+ * Gets the name that the type of a VMLibData was registered with.
+ * data: an instance of VMLibData.
+ * returns: the NULL terminated type name. This string must not be freed.
+ */
+const char * vmlibdata_type_name(VMLibData * data) {
+  assert(data != NULL);
+  return libDataTypes[data->type];
+}
+
+/**
+ * Creates a new VMLibData structure instance from a type string. The type is
+ * registered with vmlibdata_type_register() if it was not already. Libraries
+ * that create objects often should register their type once and use
+ * vmlibdata_new_typed() instead.
+ * vm: the VM instance whose allocator will own the object.
  * type: a string that specifies the type of this VMLibData struct. This string
  * is limited to VM_LIBDATA_TYPELEN in length.
  * typeLen: the length of the type string. Cannot be more than 
@@ -648,26 +2324,56 @@ bool vmarg_push_boolean(VM * vm, bool value) {
  * implementing this type when the object goes out of scope.
  * libData: a pointer allocated by the library implementor. This pointer can be
  * used to store data required to implement the desired functionality.
- * return: a new instance, or NULL if the malloc fails. NOTE: assert failure if
- * type is longer than VM_LIBDATA_TYPELEN.
+ * return: a new instance, or NULL if the malloc fails or the type table is
+ * full. NOTE: assert failure if type is longer than VM_LIBDATA_TYPELEN.
  */
-
-VMLibData * vmlibdata_new(char * type, size_t typeLen,
+VMLibData * vmlibdata_new(VM * vm, char * type, size_t typeLen,
 			  VMLibDataCleanupCallback cleanupCallback, void * libData) {
+  VMLibDataType typeId;
+
   assert(!(typeLen > VM_LIBDATA_TYPELEN));
   assert(type != NULL);
 
-  VMLibData * data = calloc(1, sizeof(VMLibData));
+  typeId = vmlibdata_type_register(type, typeLen);
+  if(typeId == VM_LIBDATA_TYPE_INVALID) {
+    return NULL;
+  }
+
+  return vmlibdata_new_typed(vm, typeId, cleanupCallback, libData);
+}
+
+/**
+ * Creates a new VMLibData structure instance.
+ * vm: the VM instance whose allocator will own the object.
+ * type: a type ID returned by vmlibdata_type_register().
+ * cleanupCallback: a function that will free any memory allocated by the lib
+ * implementing this type when the object goes out of scope.
+ * libData: a pointer allocated by the library implementor. This pointer can be
+ * used to store data required to implement the desired functionality.
+ * return: a new instance, or NULL if the malloc fails.
+ */
+VMLibData * vmlibdata_new_typed(VM * vm, VMLibDataType type,
+				VMLibDataCleanupCallback cleanupCallback,
+				void * libData) {
+  assert(vm != NULL);
+  assert(type >= 0
+	 && type < __atomic_load_n(&numLibDataTypes, __ATOMIC_ACQUIRE));
+
+  VMLibData * data = gsalloc_calloc(vm->allocator, 1, sizeof(VMLibData));
 
   if(data == NULL) {
     return NULL;
   }
 
-  strncpy(data->type, type, typeLen);
+  data->type = type;
   data->libData = libData;
   data->cleanupCallback = cleanupCallback;
   data->refCount = 0;
 
+  if(vm->memMode == VMMEM_GC) {
+    vmgc_track(vm, data);
+  }
+
   return data;
 }
 
@@ -697,34 +2403,137 @@ void vmlibdata_set_data(VMLibData * data, void * setData) {
  */
 void vmlibdata_inc_refcount(VMLibData * data) {
   assert(data != NULL);
-  data->refCount++;
+
+  /* only frozen objects pay for an atomic */
+  if(data->frozen) {
+    __sync_add_and_fetch(&data->refCount, 1);
+  } else {
+    data->refCount++;
+  }
 }
 
 /**
  * Used by the VM to track usage of an object, this decrements the internal
- * reference counter for this VMLibData.
+ * reference counter for this VMLibData. Use vmlibdata_release() instead for
+ * an object that may be frozen, since another thread can drop the count to 0
+ * between this and vmlibdata_check_cleanup().
  * data: an instance.
  */
 void vmlibdata_dec_refcount(VMLibData * data) {
   assert(data != NULL);
   /*assert(data-> refCount > 0);*/
-  data->refCount--;
+
+  if(data->frozen) {
+    __sync_sub_and_fetch(&data->refCount, 1);
+  } else {
+    data->refCount--;
+  }
 }
 
 /**
  * Used by the VM to track usage of an object, checks the reference counter
  * for the specified object. If the reference count is 0, the VM automatically
- * destroys this object.
+ * destroys this object. Does nothing in VMMEM_GC mode, or for a frozen object,
+ * see vmlibdata_release().
+ * vm: the VM instance.
  * data: an instance.
  */
 void vmlibdata_check_cleanup(VM * vm, VMLibData * data) {
   assert(vm != NULL);
   assert(data != NULL);
+
+  /* the collector frees objects in GC mode, and frozen objects are freed
+   * by whichever thread drops their last reference
+   */
+  if(vm->memMode == VMMEM_GC || data->frozen) {
+    return;
+  }
+
   if(data->refCount <= 0) {
     vmlibdata_free(vm, data);
   }
 }
 
+/**
+ * Drops a reference to an object, and frees it if that was the last one.
+ * Does not free thread local objects in VMMEM_GC mode, where the collector
+ * does. Frozen objects are freed by the thread that drops the last reference,
+ * whichever VM it's running.
+ * vm: the VM that held the reference. May be NULL only for a frozen object
+ * that is held outside of any VM, e.g. by a channel.
+ * data: an instance.
+ */
+void vmlibdata_release(VM * vm, VMLibData * data) {
+  assert(data != NULL);
+
+  if(data->frozen) {
+    if(__sync_sub_and_fetch(&data->refCount, 1) == 0) {
+      vmlibdata_free(vm, data);
+    }
+    return;
+  }
+
+  assert(vm != NULL);
+  data->refCount--;
+  vmlibdata_check_cleanup(vm, data);
+}
+
+/**
+ * Freezes an object so that VMs on other threads can hold references to it:
+ * its reference count becomes atomic, and it stops counting against this
+ * VM's memory. Freezing can't be undone. The library that implements the
+ * type must then hand the object's data to vm_base_allocator(), make sure
+ * that the object can't change, and make sure that its cleanup callback
+ * doesn't use the VM, which can be any VM, or NULL. See
+ * libstr_string_freeze().
+ * vm: the VM that owns the object.
+ * data: an instance.
+ * returns: true if the object is frozen, or false if the VM uses VMMEM_GC,
+ * since the collector can't see references from other VMs.
+ */
+bool vmlibdata_freeze(VM * vm, VMLibData * data) {
+  assert(vm != NULL);
+  assert(data != NULL);
+
+  if(data->frozen) {
+    return true;
+  }
+  if(vm->memMode != VMMEM_REFCOUNT) {
+    return false;
+  }
+
+  vm_mem_disown(vm, sizeof(VMLibData));
+  data->frozenAllocator = vm->baseAllocator;
+  data->frozen = true;
+  return true;
+}
+
+/**
+ * Checks whether an object is frozen.
+ * data: an instance.
+ * returns: true if frozen, see vmlibdata_freeze().
+ */
+bool vmlibdata_is_frozen(VMLibData * data) {
+  assert(data != NULL);
+  return data->frozen;
+}
+
+/**
+ * Checks whether a VM can hold references to an object from another VM,
+ * rather than needing a copy of it. It can if the object is frozen, and the
+ * VM counts references, and can free the object's memory.
+ * vm: the VM that would hold the references.
+ * data: an instance.
+ * returns: true if the VM can share the object.
+ */
+bool vmlibdata_can_share(VM * vm, VMLibData * data) {
+  assert(vm != NULL);
+  assert(data != NULL);
+
+  return data->frozen && vm->memMode == VMMEM_REFCOUNT
+    && vm->baseAllocator == data->frozenAllocator;
+}
+
 /**
  * Checks if data is the specified type.
  * data: an instance.
@@ -739,21 +2548,39 @@ bool vmlibdata_is_type(VMLibData * data, char * type, size_t typeLen) {
     return false;
   }
 
-  return strncmp(data->type, type, typeLen) == 0;
+  return strncmp(libDataTypes[data->type], type, typeLen) == 0;
+}
+
+/**
+ * Checks if data is the specified type. This is the fast alternative to
+ * vmlibdata_is_type() for types registered with vmlibdata_type_register().
+ * data: an instance.
+ * type: the type ID to check against.
+ * returns: true if data is of type, type and false if not.
+ */
+bool vmlibdata_is_typeid(VMLibData * data, VMLibDataType type) {
+  assert(data != NULL);
+  return data->type == type;
 }
 
 
 /**
  * Frees a VMLibData structure and calls its cleanup method.
- * vm: the VM instance.
+ * vm: the VM instance. May be NULL for a frozen object.
  * data: an instance of VMLibData.
  */
 void vmlibdata_free(VM * vm, VMLibData * data) {
-  assert(vm != NULL);
   assert(data != NULL);
+  assert(vm != NULL || data->frozen);
 
   if(data->cleanupCallback != NULL) {
     ((*data->cleanupCallback)(vm, data));
   }
-  free(data);
+
+  /* a frozen object no longer counts against any VM */
+  if(data->frozen) {
+    gsalloc_free(data->frozenAllocator, data, sizeof(VMLibData));
+  } else {
+    gsalloc_free(vm->allocator, data, sizeof(VMLibData));
+  }
 }
@@ -0,0 +1,394 @@
+/**
+ * vmgc.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * Non-moving incremental mark-sweep garbage collector for VMLibData objects,
+ * used instead of reference counting when a VM is created with VMMEM_GC.
+ *
+ * Every object created by a GC mode VM is linked into the VM's object list.
+ * When the list grows past a threshold, or the VM has allocated enough bytes
+ * since the last cycle, a cycle begins at the next safe point, which is the
+ * top of the vm_exec() loop, between instructions, when no object is held
+ * only by C locals. A cycle flips the VM's mark epoch and marks every object
+ * referenced from the operand stack, the frame stack, the stacks of
+ * coroutines, the arguments of natives that are running script code, such as
+ * join(), and the host registered roots. VMLibData objects
+ * never reference each other, so marking is a single bounded pass over the
+ * stacks. The sweep, which is proportional to the size of the heap, is then
+ * done VMGC_SWEEP_STEP objects per instruction. Objects created mid-sweep
+ * receive the current epoch's mark so the sweep can never free them.
+ *
+ * With a memory limit, the byte trigger also fires once the bytes allocated
+ * since the last cycle could fill what is left under the limit. If an
+ * allocation is refused anyway, the sweep in progress is finished right away
+ * and the allocation retried. That is safe even in the middle of an
+ * instruction, since the sweep only frees objects that were unreachable when
+ * the cycle marked, and nothing can reach them again. Marking must wait for
+ * a safe point, so if the retry fails too, the next safe point runs a full
+ * cycle, and the error is reported.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "vmgc.h"
+
+/* number of root slots added each time the roots array fills up */
+static const int rootsBlockSize = 16;
+
+/**
+ * Marks the object referenced by a stack slot, if it holds one.
+ * vm: the VM instance.
+ * type: the type of the slot.
+ * value: pointer to the slot's possibly unaligned data.
+ */
+static void mark_slot(void * vm, VarType type, void * value) {
+  VMLibData * data;
+
+  if(type == TYPE_LIBDATA) {
+    memcpy(&data, value, sizeof(VMLibData*));
+    data->gcMark = ((VM*)vm)->gcEpoch;
+  }
+}
+
+/**
+ * Begins a cycle by flipping the epoch, which unmarks every object, and then
+ * marking every object reachable from the roots.
+ * vm: the VM instance.
+ */
+static void mark_roots(VM * vm) {
+  VMNative * native;
+  VMCoro * coro;
+  int i;
+
+  vm->gcEpoch = !vm->gcEpoch;
+
+  /* operand stack */
+  for(i = 0; i < vm->opStk->size; i++) {
+    mark_slot(vm, vm->opStk->stack[i].type, vm->opStk->stack[i].data);
+  }
+
+  /* frame stack variables */
+  frmstk_visit_vars(vm->frmStk, mark_slot, vm);
+
+  /* coroutines' stacks, or their resumers' while they run */
+  for(coro = vm->coros; coro != NULL; coro = coro->next) {
+    for(i = 0; i < coro->opStk->size; i++) {
+      mark_slot(vm, coro->opStk->stack[i].type, coro->opStk->stack[i].data);
+    }
+    frmstk_visit_vars(coro->frmStk, mark_slot, vm);
+  }
+
+  /* arguments of running natives, popped from the operand stack */
+  for(native = vm->native; native != NULL; native = native->caller) {
+    for(i = 0; i < native->argc; i++) {
+      mark_slot(vm, native->args[i].type, native->args[i].data);
+    }
+  }
+
+  /* host registered roots */
+  for(i = 0; i < vm->gcNumRoots; i++) {
+    vm->gcRoots[i]->gcMark = vm->gcEpoch;
+  }
+
+  vm->gcSweep = &vm->gcObjects;
+}
+
+/**
+ * Sweeps up to count objects, freeing those that were not marked this cycle.
+ * vm: the VM instance.
+ * count: the maximum number of objects to visit.
+ * returns: true if the sweep finished the object list.
+ */
+static bool sweep(VM * vm, size_t count) {
+  size_t i;
+
+  for(i = 0; i < count && *vm->gcSweep != NULL; i++) {
+    VMLibData * data = *vm->gcSweep;
+
+    if(data->gcMark != vm->gcEpoch) {
+      /* unlink and free, cursor now points at the next object */
+      *vm->gcSweep = data->gcNext;
+      vm->gcStats.objects--;
+      vm->gcStats.freed++;
+      vmlibdata_free(vm, data);
+    } else {
+      vm->gcSweep = &data->gcNext;
+    }
+  }
+
+  if(*vm->gcSweep != NULL) {
+    return false;
+  }
+
+  /* cycle complete, next one starts when the live set has doubled, by
+   * objects or by bytes
+   */
+  vm->gcSweep = NULL;
+  vm->gcPending = false;
+  vm->gcThreshold = vm->gcStats.objects * 2;
+  if(vm->gcThreshold < VMGC_INITIAL_THRESHOLD) {
+    vm->gcThreshold = VMGC_INITIAL_THRESHOLD;
+  }
+  vm->gcAllocBytes = 0;
+  vm->gcByteThreshold = vm->memUsed;
+  if(vm->gcByteThreshold < VMGC_INITIAL_BYTES) {
+    vm->gcByteThreshold = VMGC_INITIAL_BYTES;
+  }
+  vm->gcStats.cycles++;
+  return true;
+}
+
+/**
+ * Records the duration of a collector pause.
+ * vm: the VM instance.
+ * start: the clock() value when the pause began.
+ */
+static void record_pause(VM * vm, clock_t start) {
+  double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  vm->gcStats.steps++;
+  vm->gcStats.totalPause += pause;
+  if(pause > vm->gcStats.maxPause) {
+    vm->gcStats.maxPause = pause;
+  }
+}
+
+/**
+ * Adds a newly created object to the VM's collector. Called by
+ * vmlibdata_new_typed() for GC mode VMs.
+ * vm: the VM instance.
+ * data: the new object.
+ */
+void vmgc_track(VM * vm, VMLibData * data) {
+  assert(vm != NULL);
+  assert(data != NULL);
+
+  data->gcMark = vm->gcEpoch;
+  data->gcNext = vm->gcObjects;
+  vm->gcObjects = data;
+  vm->gcStats.objects++;
+
+  if(vm->gcStats.objects > vm->gcThreshold) {
+    vm->gcPending = true;
+  }
+}
+
+/**
+ * Counts bytes allocated by a GC mode VM, and starts a cycle at the next
+ * safe point once they pass the byte threshold, or, with a memory limit,
+ * could fill the rest of it. Called by the VM's accounting allocator.
+ * vm: the VM instance.
+ * size: the number of bytes allocated.
+ */
+void vmgc_account(VM * vm, size_t size) {
+  assert(vm != NULL);
+
+  vm->gcAllocBytes += size;
+  if(vm->gcAllocBytes > vm->gcByteThreshold
+     || (vm->memLimit != 0 && (vm->memUsed >= vm->memLimit
+			       || vm->gcAllocBytes
+			       > vm->memLimit - vm->memUsed))) {
+    vm->gcPending = true;
+  }
+}
+
+/**
+ * Frees garbage for an allocation that the memory limit refused, by finishing
+ * the sweep in progress, if any. Safe to call anywhere, see the top of this
+ * file. If that doesn't make room, a full cycle runs at the next safe point.
+ * Called by the VM's accounting allocator.
+ * vm: the VM instance.
+ * size: the number of bytes that were refused.
+ * returns: true if the allocation fits under the limit now.
+ */
+bool vmgc_reclaim(VM * vm, size_t size) {
+  assert(vm != NULL);
+  assert(vm->memMode == VMMEM_GC);
+
+  if(vm->gcSweep != NULL) {
+    clock_t start = clock();
+
+    sweep(vm, (size_t)-1);
+    record_pause(vm, start);
+  }
+
+  if(vm->memUsed < vm->memLimit && size <= vm->memLimit - vm->memUsed) {
+    return true;
+  }
+
+  vm->gcPending = true;
+  vm->gcFull = true;
+  return false;
+}
+
+/**
+ * Performs one increment of collector work. Either starts a cycle by marking
+ * the roots, or sweeps the next VMGC_SWEEP_STEP objects, or, after an
+ * allocation was refused, runs a full cycle. Called by vm_exec() between
+ * instructions while vm->gcPending is set.
+ * vm: the VM instance.
+ */
+void vmgc_step(VM * vm) {
+  clock_t start = clock();
+
+  assert(vm != NULL);
+  assert(vm->memMode == VMMEM_GC);
+
+  if(vm->gcFull) {
+    vmgc_collect(vm);
+    return;
+  }
+
+  if(vm->gcSweep == NULL) {
+    mark_roots(vm);
+  } else {
+    sweep(vm, VMGC_SWEEP_STEP);
+  }
+
+  record_pause(vm, start);
+}
+
+/**
+ * Runs a complete collection cycle immediately, finishing any cycle that is
+ * in progress first. Does nothing for reference counting VMs. Must not be
+ * called from within a native callback, since the callback's arguments have
+ * already been popped from the operand stack and are not roots.
+ * vm: the VM instance.
+ */
+void vmgc_collect(VM * vm) {
+  clock_t start = clock();
+
+  assert(vm != NULL);
+
+  if(vm->memMode != VMMEM_GC) {
+    return;
+  }
+
+  /* finish the current cycle, its marks may be stale */
+  if(vm->gcSweep != NULL) {
+    sweep(vm, (size_t)-1);
+  }
+
+  mark_roots(vm);
+  sweep(vm, (size_t)-1);
+  vm->gcFull = false;
+
+  record_pause(vm, start);
+}
+
+/**
+ * Registers an object that the host holds outside of the VM's stacks so that
+ * it stays alive. For reference counting VMs this holds a reference instead,
+ * so host code can be written the same way for both modes.
+ * vm: the VM instance.
+ * data: the object to keep alive until vmgc_remove_root().
+ * returns: true if success, false if the roots array could not grow.
+ */
+bool vmgc_add_root(VM * vm, VMLibData * data) {
+  assert(vm != NULL);
+  assert(data != NULL);
+
+  if(vm->memMode != VMMEM_GC) {
+    vmlibdata_inc_refcount(data);
+    return true;
+  }
+
+  /* expand roots array if full */
+  if(vm->gcNumRoots == vm->gcRootsSize) {
+    VMLibData ** newRoots = gsalloc_realloc(vm->allocator, vm->gcRoots,
+					    vm->gcRootsSize * sizeof(VMLibData*),
+					    (vm->gcRootsSize + rootsBlockSize)
+					    * sizeof(VMLibData*));
+    if(newRoots == NULL) {
+      vm_set_err(vm, VMERR_ALLOC_FAILED);
+      return false;
+    }
+    vm->gcRoots = newRoots;
+    vm->gcRootsSize += rootsBlockSize;
+  }
+
+  vm->gcRoots[vm->gcNumRoots++] = data;
+  return true;
+}
+
+/**
+ * Unregisters one registration of a root added by vmgc_add_root(). The object
+ * is freed by a later cycle, or right away for reference counting VMs, if
+ * nothing else references it.
+ * vm: the VM instance.
+ * data: the root object.
+ * returns: true if data was a root, and false if not.
+ */
+bool vmgc_remove_root(VM * vm, VMLibData * data) {
+  int i;
+
+  assert(vm != NULL);
+  assert(data != NULL);
+
+  if(vm->memMode != VMMEM_GC) {
+    vmlibdata_release(vm, data);
+    return true;
+  }
+
+  /* order of roots doesn't matter, so fill the hole with the last root */
+  for(i = 0; i < vm->gcNumRoots; i++) {
+    if(vm->gcRoots[i] == data) {
+      vm->gcRoots[i] = vm->gcRoots[--vm->gcNumRoots];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Gets the collector's statistics.
+ * vm: the VM instance.
+ * stats: pointer to a struct that receives the statistics.
+ */
+void vmgc_stats(VM * vm, VMGCStats * stats) {
+  assert(vm != NULL);
+  assert(stats != NULL);
+
+  *stats = vm->gcStats;
+}
+
+/**
+ * Frees every object owned by the collector and the roots array, reachable
+ * or not. Called by vm_free().
+ * vm: the VM instance.
+ */
+void vmgc_free_all(VM * vm) {
+  assert(vm != NULL);
+
+  while(vm->gcObjects != NULL) {
+    VMLibData * data = vm->gcObjects;
+    vm->gcObjects = data->gcNext;
+    vmlibdata_free(vm, data);
+  }
+  vm->gcStats.objects = 0;
+  vm->gcSweep = NULL;
+
+  gsalloc_free(vm->allocator, vm->gcRoots,
+	       vm->gcRootsSize * sizeof(VMLibData*));
+  vm->gcRoots = NULL;
+  vm->gcNumRoots = 0;
+  vm->gcRootsSize = 0;
+}
@@ -0,0 +1,333 @@
+/**
+ * vmpool.c
+ * (C) 2014 Christian Gunderman
+ * Modified by:
+ * Author Email: gundermanc@gmail.com
+ * Modifier Email:
+ *
+ * Description:
+ * A thread safe pool of VMs, in the form of ExecContexts for one Program,
+ * for servers that run a script per request. Creating a VM allocates its
+ * frame stack and operand stack, so instead of creating and freeing one per
+ * request, a worker checks a context out of the pool, runs the program, and
+ * checks it back in. Checking in resets the context with vm_reset(), which
+ * releases whatever the run left on its stacks, even if it failed, and keeps
+ * the stacks' buffers, so the next checkout is a pop from the idle list.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include "vmpool.h"
+
+/* number of calls that a batch thread takes from the batch at a time */
+static const int batchChunkSize = 256;
+
+/* state shared by the threads of vmpool_call_batch() */
+typedef struct VMPoolBatch {
+  VMPool * pool;
+  CompilerFunc * function;        /* function to call */
+  VMArg * args;                   /* argc arguments per call */
+  int argc;
+  VMArg * results;                /* a result per call, or NULL */
+  int numCalls;
+  int next;                       /* first call of the next chunk */
+  int failed;                     /* lowest failed call, or numCalls */
+  VMErr err;                      /* error of the call at failed */
+  pthread_mutex_t lock;           /* protects next, failed, and err */
+} VMPoolBatch;
+
+/**
+ * Creates a pool of contexts for a program. Contexts are created when the
+ * pool has none idle, and kept for reuse when checked in, up to maxIdle.
+ * program: the program. The pool holds a reference to it until
+ * vmpool_free().
+ * maxIdle: the most contexts to keep while they aren't checked out.
+ * stackSize: the frame stack size of each context, in bytes.
+ * allocator: the allocator for the pool and its contexts, or NULL for the
+ * default allocator. It must be thread safe.
+ * memMode: the memory mode of each context, see vm_new().
+ * returns: the pool, or NULL if allocation fails.
+ */
+VMPool * vmpool_new(Program * program, int maxIdle, size_t stackSize,
+		    GSAllocator * allocator, VMMemMode memMode) {
+  VMPool * pool;
+
+  assert(program != NULL);
+  assert(maxIdle > 0);
+  assert(stackSize > 0);
+
+  if(allocator == NULL) {
+    allocator = gsalloc_default();
+  }
+
+  pool = gsalloc_calloc(allocator, 1, sizeof(VMPool));
+  if(pool == NULL) {
+    return NULL;
+  }
+
+  pool->idle = gsalloc_calloc(allocator, maxIdle, sizeof(ExecContext*));
+  if(pool->idle == NULL) {
+    gsalloc_free(allocator, pool, sizeof(VMPool));
+    return NULL;
+  }
+
+  if(pthread_mutex_init(&pool->lock, NULL) != 0) {
+    gsalloc_free(allocator, pool->idle, maxIdle * sizeof(ExecContext*));
+    gsalloc_free(allocator, pool, sizeof(VMPool));
+    return NULL;
+  }
+
+  pool->program = program_retain(program);
+  pool->maxIdle = maxIdle;
+  pool->stackSize = stackSize;
+  pool->memMode = memMode;
+  pool->allocator = allocator;
+  return pool;
+}
+
+/**
+ * Takes a context out of the pool, creating one if none are idle. May be
+ * called from any thread.
+ * pool: the pool.
+ * returns: a context with empty stacks and no error, for use by one thread
+ * until it is checked in, or NULL if allocation fails.
+ */
+ExecContext * vmpool_checkout(VMPool * pool) {
+  ExecContext * context = NULL;
+
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  if(pool->numIdle > 0) {
+    context = pool->idle[--pool->numIdle];
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if(context == NULL) {
+    context = execcontext_new(pool->program, pool->stackSize,
+			      pool->allocator, pool->memMode);
+  }
+  return context;
+}
+
+/**
+ * Resets a context and returns it to the pool, or frees it if the pool
+ * already has maxIdle contexts. May be called from any thread. Settings made
+ * on the context's VM, such as a memory limit, are kept.
+ * pool: the pool.
+ * context: a context checked out of pool, whether or not its last run
+ * succeeded.
+ */
+void vmpool_checkin(VMPool * pool, ExecContext * context) {
+  bool kept = false;
+
+  assert(pool != NULL);
+  assert(context != NULL);
+  assert(context->program == pool->program);
+
+  /* reset outside of the lock, it may free objects */
+  vm_reset(execcontext_vm(context));
+
+  pthread_mutex_lock(&pool->lock);
+  if(pool->numIdle < pool->maxIdle) {
+    pool->idle[pool->numIdle++] = context;
+    kept = true;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if(!kept) {
+    execcontext_free(context);
+  }
+}
+
+/**
+ * Records a failed call of a batch, if it's the lowest so far.
+ * batch: the batch.
+ * call: the call that failed.
+ * err: the error.
+ */
+static void batch_fail(VMPoolBatch * batch, int call, VMErr err) {
+  pthread_mutex_lock(&batch->lock);
+  if(call < batch->failed) {
+    batch->failed = call;
+    batch->err = err;
+  }
+  pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * Batch thread: runs chunks of a VMPoolBatch with a context from its pool
+ * until none are left or a call fails.
+ * arg: the VMPoolBatch.
+ * returns: NULL.
+ */
+static void * batch_worker(void * arg) {
+  VMPoolBatch * batch = arg;
+  ExecContext * context = vmpool_checkout(batch->pool);
+  int start, count, done, i;
+
+  while(true) {
+    pthread_mutex_lock(&batch->lock);
+    start = batch->next;
+    if(batch->failed < batch->numCalls) {
+      start = batch->numCalls;
+    }
+    batch->next += batchChunkSize;
+    pthread_mutex_unlock(&batch->lock);
+
+    if(start >= batch->numCalls) {
+      break;
+    }
+    count = batch->numCalls - start;
+    if(count > batchChunkSize) {
+      count = batchChunkSize;
+    }
+
+    if(context == NULL) {
+      batch_fail(batch, start, VMERR_ALLOC_FAILED);
+      return NULL;
+    }
+
+    done = execcontext_call_batch(context, batch->function,
+				  batch->args + (start * batch->argc),
+				  batch->argc, batch->results != NULL
+				  ? batch->results + start : NULL, count);
+
+    /* objects belong to this thread's context, they can't be returned */
+    if(batch->results != NULL) {
+      for(i = start; i < start + done; i++) {
+	if(vmarg_type(batch->results[i]) == TYPE_LIBDATA) {
+	  vmarg_release(execcontext_vm(context), batch->results[i]);
+	  batch->results[i] = vmarg_make_null();
+	}
+      }
+    }
+
+    if(done < count) {
+      batch_fail(batch, start + done, execcontext_err(context));
+      break;
+    }
+  }
+
+  if(context != NULL) {
+    vmpool_checkin(batch->pool, context);
+  }
+  return NULL;
+}
+
+/**
+ * Calls a function of the pool's program once for each of an array of
+ * argument tuples, split across up to numThreads threads, each with a
+ * context from the pool. Chunks of the batch are handed out in order, so
+ * every call before the first one that fails has run.
+ * pool: the pool.
+ * function: a function of the pool's program, see program_function().
+ * args: numCalls tuples of argc arguments each, one after another. They
+ * must not be objects, since objects can't be shared between contexts.
+ * argc: the number of arguments in each tuple, which must match the
+ * function's.
+ * results: receives numCalls return values, or NULL to discard them.
+ * Objects are released by the thread that made them, and returned as null.
+ * numCalls: the number of calls.
+ * numThreads: the most threads to run on, including the calling thread.
+ * err: if not NULL, receives the error of the first call that failed.
+ * returns: the number of calls before the first one that failed, which is
+ * numCalls if all of them succeeded.
+ */
+int vmpool_call_batch(VMPool * pool, CompilerFunc * function, VMArg * args,
+		      int argc, VMArg * results, int numCalls,
+		      int numThreads, VMErr * err) {
+  VMPoolBatch batch;
+  pthread_t * threads;
+  int numStarted = 0;
+  int i;
+
+  assert(pool != NULL);
+  assert(function != NULL);
+  assert(args != NULL || argc == 0);
+  assert(numCalls >= 0);
+
+  /* no thread needs less than a chunk */
+  if(numThreads > (numCalls + batchChunkSize - 1) / batchChunkSize) {
+    numThreads = (numCalls + batchChunkSize - 1) / batchChunkSize;
+  }
+  if(numThreads < 1) {
+    numThreads = 1;
+  }
+
+  batch.pool = pool;
+  batch.function = function;
+  batch.args = args;
+  batch.argc = argc;
+  batch.results = results;
+  batch.numCalls = numCalls;
+  batch.next = 0;
+  batch.failed = numCalls;
+  batch.err = VMERR_SUCCESS;
+
+  threads = gsalloc_calloc(pool->allocator, numThreads, sizeof(pthread_t));
+  if(threads == NULL || pthread_mutex_init(&batch.lock, NULL) != 0) {
+    if(threads != NULL) {
+      gsalloc_free(pool->allocator, threads, numThreads * sizeof(pthread_t));
+    }
+    if(err != NULL) {
+      *err = VMERR_ALLOC_FAILED;
+    }
+    return 0;
+  }
+
+  /* run on the other threads and this one. if a thread can't be started
+   * the remaining threads take its share
+   */
+  for(numStarted = 0; numStarted < numThreads - 1; numStarted++) {
+    if(pthread_create(&threads[numStarted], NULL,
+		      batch_worker, &batch) != 0) {
+      break;
+    }
+  }
+  batch_worker(&batch);
+
+  for(i = 0; i < numStarted; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&batch.lock);
+  gsalloc_free(pool->allocator, threads, numThreads * sizeof(pthread_t));
+
+  if(err != NULL) {
+    *err = batch.err;
+  }
+  return batch.failed;
+}
+
+/**
+ * Frees a pool and its idle contexts, and drops its reference to its
+ * program. Contexts that are checked out must be checked in first.
+ * pool: the pool.
+ */
+void vmpool_free(VMPool * pool) {
+  int i;
+
+  assert(pool != NULL);
+
+  for(i = 0; i < pool->numIdle; i++) {
+    execcontext_free(pool->idle[i]);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  program_release(pool->program);
+  gsalloc_free(pool->allocator, pool->idle,
+	       pool->maxIdle * sizeof(ExecContext*));
+  gsalloc_free(pool->allocator, pool, sizeof(VMPool));
+}